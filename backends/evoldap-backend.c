@@ -176,16 +176,21 @@ resolve_address (const char  *address,
   return (GConfSource *) esource;
 }
 
+/* Serializes use of the LDAP connections */
+static GRecMutex evoldap_lock;
+
 static void
 lock (GConfSource  *source,
       GError      **err)
 {
+  g_rec_mutex_lock (&evoldap_lock);
 }
 
 static void
 unlock (GConfSource  *source,
         GError      **err)
 {
+  g_rec_mutex_unlock (&evoldap_lock);
 }
 
 
@@ -24,6 +24,7 @@
 #include <locale.h>
 
 #include "markup-tree.c"
+#include "markup-snapshot.h"
 
 guint
 _gconf_mode_t_to_mode (mode_t orig)
@@ -40,30 +41,41 @@ _gconf_mode_t_to_mode (mode_t orig)
 }
 
 static gboolean
-merge_tree (const char *root_dir)
+get_modes (const char *root_dir,
+           guint      *dir_mode,
+           guint      *file_mode)
 {
   struct stat statbuf;
-  guint dir_mode;
-  guint file_mode;
-  MarkupTree *tree;
-  GError *error;
 
   if (g_stat (root_dir, &statbuf) == 0)
     {
-      dir_mode = _gconf_mode_t_to_mode (statbuf.st_mode);
+      *dir_mode = _gconf_mode_t_to_mode (statbuf.st_mode);
       /* dir_mode without search bits */
-      file_mode = dir_mode & (~0111);
+      *file_mode = *dir_mode & (~0111);
+      return TRUE;
     }
   else
     {
       fprintf (stderr, _("Cannot find directory %s\n"), root_dir);
       return FALSE;
-
     }
+}
+
+static gboolean
+merge_tree (const char *root_dir)
+{
+  guint dir_mode;
+  guint file_mode;
+  MarkupTree *tree;
+  GError *error;
+
+  if (!get_modes (root_dir, &dir_mode, &file_mode))
+    return FALSE;
 
   tree = markup_tree_get (root_dir, dir_mode, file_mode, TRUE);
 
   recursively_load_subtree (tree->root);
+  tree->root->all_local_descs_dirty = TRUE;
 
   error = NULL;
   save_tree (tree->root, TRUE, file_mode, &error);
@@ -89,6 +101,35 @@ merge_tree (const char *root_dir)
   return TRUE;
 }
 
+static gboolean
+snapshot_tree (const char *root_dir)
+{
+  guint dir_mode;
+  guint file_mode;
+  MarkupTree *tree;
+  GError *error;
+  gboolean retval;
+
+  if (!get_modes (root_dir, &dir_mode, &file_mode))
+    return FALSE;
+
+  tree = markup_tree_get (root_dir, dir_mode, file_mode, FALSE);
+
+  error = NULL;
+  retval = markup_snapshot_write (tree, root_dir, &error);
+  if (!retval)
+    {
+      fprintf (stderr, _("Error saving GConf snapshot of '%s': %s\n"),
+	       root_dir,
+	       error->message);
+      g_error_free (error);
+    }
+
+  markup_tree_unref (tree);
+
+  return retval;
+}
+
 int
 main (int argc, char **argv)
 {
@@ -96,21 +137,29 @@ main (int argc, char **argv)
   _gconf_init_i18n ();
   textdomain (GETTEXT_PACKAGE);
 
+  if (argc == 3 && !strcmp (argv [1], "--snapshot"))
+    return !snapshot_tree (argv [2]);
+
   if (argc != 2)
     {
-      fprintf (stderr, _("Usage: %s <dir>\n"), argv [0]);
+      fprintf (stderr, _("Usage: %s [--snapshot] <dir>\n"), argv [0]);
       return 1;
     }
 
   if (!strcmp (argv [1], "--help"))
     {
-      printf (_("Usage: %s <dir>\n"
+      printf (_("Usage: %s [--snapshot] <dir>\n"
 		"  Merges a markup backend filesystem hierarchy like:\n"
 		"    dir/%%gconf.xml\n"
 		"        subdir1/%%gconf.xml\n"
 		"        subdir2/%%gconf.xml\n"
 		"  to:\n"
-		"    dir/%%gconf-tree.xml\n"), argv [0]);
+		"    dir/%%gconf-tree.xml\n"
+		"\n"
+		"  With --snapshot, compiles the tree under dir to\n"
+		"    dir/%%gconf-tree.snapshot\n"
+		"  which read-only sources load instead of the XML\n"
+		"  files for as long as those don't change.\n"), argv [0]);
       return 0;
     }
 
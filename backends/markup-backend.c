@@ -34,6 +34,7 @@
 #include <limits.h>
 
 #include "markup-tree.h"
+#include "markup-snapshot.h"
 
 /*
  * Overview
@@ -53,6 +54,10 @@
  *   gnumeric/
  *     %gconf.xml
  *
+ * Sources that can't be written may instead be served from
+ * %gconf-tree.snapshot, a compiled image of the whole tree made
+ * by "gconf-merge-tree --snapshot", as long as it is newer than
+ * the XML files. See markup-snapshot.h.
  */
 
 typedef struct
@@ -61,6 +66,7 @@ typedef struct
   char *root_dir;
   GConfLock* lock;
   MarkupTree *tree;
+  MarkupSnapshot *snapshot;
   guint dir_mode;
   guint file_mode;
   guint merged : 1;
@@ -72,6 +78,10 @@ static MarkupSource* ms_new     (const char   *root_dir,
                                  gboolean      merged,
                                  GConfLock    *lock);
 static void          ms_destroy (MarkupSource *source);
+static void          ms_load_snapshot (MarkupSource *ms);
+static gboolean      ms_check_writable (MarkupSource *ms,
+                                        const char   *key,
+                                        GError      **err);
 
 /*
  * VTable functions
@@ -129,6 +139,11 @@ static gboolean       sync_all        (GConfSource       *source,
 static void           destroy_source  (GConfSource       *source);
 static void           clear_cache     (GConfSource       *source);
 static void           blow_away_locks (const char        *address);
+static gpointer       prepare_sync    (GConfSource       *source);
+static gboolean       run_sync_job    (gpointer           job,
+                                       GError           **err);
+static void           finish_sync     (GConfSource       *source,
+                                       gpointer           job);
 
 
 static GConfBackendVTable markup_vtable = {
@@ -154,7 +169,10 @@ static GConfBackendVTable markup_vtable = {
   blow_away_locks,
   NULL, /* set_notify_func */
   NULL, /* add_listener    */
-  NULL  /* remove_listener */
+  NULL, /* remove_listener */
+  prepare_sync,
+  run_sync_job,
+  finish_sync
 };
 
 static void          
@@ -167,16 +185,18 @@ static void
 lock (GConfSource *source,
       GError **err)
 {
-  
+  MarkupSource *ms = (MarkupSource *) source;
 
+  markup_tree_lock (ms->tree);
 }
 
 static void
 unlock (GConfSource *source,
         GError **err)
 {
+  MarkupSource *ms = (MarkupSource *) source;
 
-
+  markup_tree_unlock (ms->tree);
 }
 
 static gboolean
@@ -406,32 +426,50 @@ resolve_address (const char *address,
   source = (GConfSource*)xsource;
 
   source->flags = flags;
+
+  if (!(flags & GCONF_SOURCE_ALL_WRITEABLE))
+    ms_load_snapshot (xsource);
   
   g_free (root_dir);
   
   return source;
 }
 
+/* Keys shorter than this are split on the stack */
+#define KEY_BUFFER_SIZE 256
+
 static MarkupEntry*
 tree_lookup_entry (MarkupTree *tree,
                    const char *key,
                    gboolean    create_if_not_found,
                    GError    **err)
 {
-  char* parent;
+  char buf[KEY_BUFFER_SIZE];
+  char *parent;
+  const char *slash;
+  gsize len;
   MarkupDir *dir;
   GError* error = NULL;
 
-  parent = gconf_key_directory (key);
-  
-  g_assert (parent != NULL);
+  /* Split off the parent without a heap copy for the usual case */
+  slash = strrchr (key, '/');
+  g_assert (slash != NULL);
+
+  len = slash - key;
+  if (len == 0)
+    len = 1; /* the parent of "/foo" is "/" */
+
+  parent = len < sizeof (buf) ? buf : g_malloc (len + 1);
+  memcpy (parent, key, len);
+  parent[len] = '\0';
 
   if (create_if_not_found)
     dir = markup_tree_ensure_dir (tree, parent, &error);
   else
     dir = markup_tree_lookup_dir (tree, parent, &error);
 
-  g_free (parent);
+  if (parent != buf)
+    g_free (parent);
   parent = NULL;
   
   if (error != NULL)
@@ -477,6 +515,9 @@ query_value (GConfSource *source,
   MarkupEntry *entry;
   GConfValue *retval;
 
+  if (ms->snapshot != NULL)
+    return markup_snapshot_query_value (ms->snapshot, key, locales, schema_name);
+
   retval = NULL;
   
   error = NULL;
@@ -512,6 +553,9 @@ query_metainfo (GConfSource *source,
   GError* error = NULL;
   MarkupEntry *entry;
 
+  if (ms->snapshot != NULL)
+    return markup_snapshot_query_metainfo (ms->snapshot, key);
+
   error = NULL;
   entry = tree_lookup_entry (ms->tree, key, FALSE, &error);
   if (error != NULL)
@@ -562,6 +606,9 @@ set_value (GConfSource      *source,
   g_return_if_fail (value != NULL);
   g_return_if_fail (source != NULL);
 
+  if (!ms_check_writable (ms, key, err))
+    return;
+
   tmp_err = NULL;
   entry = tree_lookup_entry (ms->tree,
                              key, TRUE, &tmp_err);
@@ -609,6 +656,9 @@ all_entries (GConfSource *source,
   GSList *retval;
   GSList *tmp;
   
+  if (ms->snapshot != NULL)
+    return markup_snapshot_all_entries (ms->snapshot, key, locales);
+
   retval = NULL;
 
   error = NULL;
@@ -653,6 +703,9 @@ all_subdirs (GConfSource *source,
   GSList *retval;
   GSList *tmp;
   
+  if (ms->snapshot != NULL)
+    return markup_snapshot_all_subdirs (ms->snapshot, key);
+
   retval = NULL;
 
   error = NULL;
@@ -698,6 +751,9 @@ unset_value (GConfSource *source,
   g_return_if_fail (key != NULL);
   g_return_if_fail (source != NULL);
 
+  if (!ms_check_writable (ms, key, err))
+    return;
+
   tmp_err = NULL;
   entry = tree_lookup_entry (ms->tree,
                              key, TRUE, &tmp_err);
@@ -721,6 +777,9 @@ dir_exists (GConfSource *source,
   MarkupDir *dir;
   GError* error;
 
+  if (ms->snapshot != NULL)
+    return markup_snapshot_dir_exists (ms->snapshot, key);
+
   error = NULL;
   dir = markup_tree_lookup_dir (ms->tree, key, &error);
   if (error != NULL)
@@ -755,6 +814,9 @@ set_schema (GConfSource *source,
   g_return_if_fail (key != NULL);
   g_return_if_fail (source != NULL);
   /* schema_name can be NULL to unset */
+
+  if (!ms_check_writable (ms, key, err))
+    return;
   
   tmp_err = NULL;
   entry = tree_lookup_entry (ms->tree,
@@ -779,6 +841,28 @@ sync_all (GConfSource *source,
   return markup_tree_sync (ms->tree, err);
 }
 
+static gpointer
+prepare_sync (GConfSource *source)
+{
+  MarkupSource* ms = (MarkupSource*)source;
+
+  return markup_tree_prepare_sync (ms->tree);
+}
+
+static gboolean
+run_sync_job (gpointer job,
+              GError **err)
+{
+  return markup_sync_job_run (job, err);
+}
+
+static void
+finish_sync (GConfSource *source,
+             gpointer     job)
+{
+  markup_sync_job_finish (job);
+}
+
 static void          
 destroy_source (GConfSource *source)
 {
@@ -790,6 +874,10 @@ clear_cache (GConfSource *source)
 {
   MarkupSource* ms = (MarkupSource*)source;
 
+  /* Pick up a regenerated snapshot, or drop a stale one */
+  if (!(source->flags & GCONF_SOURCE_ALL_WRITEABLE))
+    ms_load_snapshot (ms);
+
   /* To blow the entire cache we just rebuild the tree */
   if (!markup_tree_sync (ms->tree, NULL))
     {
@@ -905,6 +993,51 @@ ms_new (const char* root_dir,
   return ms;
 }
 
+static void
+ms_load_snapshot (MarkupSource *ms)
+{
+  GError *error;
+
+  if (ms->snapshot != NULL)
+    {
+      if (markup_snapshot_is_current (ms->snapshot))
+        return;
+
+      markup_snapshot_free (ms->snapshot);
+      ms->snapshot = NULL;
+    }
+
+  error = NULL;
+  ms->snapshot = markup_snapshot_open (ms->root_dir, &error);
+  if (ms->snapshot != NULL)
+    {
+      gconf_log (GCL_DEBUG, "Using snapshot for XML source at root %s",
+                 ms->root_dir);
+    }
+  else
+    {
+      /* debug-only, most sources simply don't have a snapshot */
+      gconf_log (GCL_DEBUG, "Not using a snapshot for XML source at root %s: %s",
+                 ms->root_dir, error->message);
+      g_error_free (error);
+    }
+}
+
+static gboolean
+ms_check_writable (MarkupSource *ms,
+                   const char   *key,
+                   GError      **err)
+{
+  if (ms->snapshot == NULL)
+    return TRUE;
+
+  gconf_set_error (err, GCONF_ERROR_NO_WRITABLE_DATABASE,
+                   _("Can't write to \"%s\", the XML source at root %s is read-only"),
+                   key, ms->root_dir);
+
+  return FALSE;
+}
+
 static void
 ms_destroy (MarkupSource* ms)
 {
@@ -927,6 +1060,9 @@ ms_destroy (MarkupSource* ms)
     }
 #endif
 
+  if (ms->snapshot != NULL)
+    markup_snapshot_free (ms->snapshot);
+
   markup_tree_unref (ms->tree);
 
   g_free (ms->root_dir);
@@ -0,0 +1,1009 @@
+/* GConf
+ * Copyright (C) 2002 Red Hat Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <config.h>
+#include <glib.h>
+#include "gconf/gconf-internals.h"
+#include "gconf/gconf-schema.h"
+#include "markup-snapshot.h"
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <string.h>
+#include <errno.h>
+
+/*
+ * File format
+ *
+ * Everything is a guint32 in host byte order; the file is meant to
+ * be generated on the machine that uses it, and is simply ignored
+ * if the byte order mark doesn't match. All strings live NUL
+ * terminated in a single deduplicated string table and are referred
+ * to by offset. Values are stored as gconf_value_encode() strings.
+ *
+ *   SnapshotHeader
+ *   SnapshotSource[n_sources]   files/dirs the snapshot was built from
+ *   SnapshotDir[n_dirs]         sorted by full path
+ *   guint32[n_children]         dir indexes, referenced by SnapshotDir
+ *   SnapshotEntry[n_entries]    grouped by dir, sorted by name
+ *   SnapshotVariant[n_variants] localized schemas, referenced by entries
+ *   char[strings_size]          string table
+ */
+
+#define SNAPSHOT_MAGIC      "GConfSnp"
+#define SNAPSHOT_VERSION    1
+#define SNAPSHOT_BYTE_ORDER 0x01020304
+#define SNAPSHOT_NONE       0xffffffff
+
+typedef struct
+{
+  char    magic[8];
+  guint32 version;
+  guint32 byte_order;
+  guint32 n_sources;
+  guint32 n_dirs;
+  guint32 n_children;
+  guint32 n_entries;
+  guint32 n_variants;
+  guint32 strings_size;
+} SnapshotHeader;
+
+typedef struct
+{
+  guint32 path;      /* relative to the root dir, "" for the root */
+  guint32 is_dir;
+  guint32 mtime;
+  guint32 size;
+} SnapshotSource;
+
+typedef struct
+{
+  guint32 name;      /* full path */
+  guint32 first_entry;
+  guint32 n_entries;
+  guint32 first_child;
+  guint32 n_children;
+} SnapshotDir;
+
+typedef struct
+{
+  guint32 name;      /* relative to the dir */
+  guint32 value;     /* encoded value, C locale for schemas */
+  guint32 schema_name;
+  guint32 mod_user;
+  guint32 mod_time;
+  guint32 owner;     /* schema owner, not kept by gconf_value_encode() */
+  guint32 first_variant;
+  guint32 n_variants;
+} SnapshotEntry;
+
+typedef struct
+{
+  guint32 locale;
+  guint32 value;
+} SnapshotVariant;
+
+struct _MarkupSnapshot
+{
+  char *root_dir;
+  char *filename;
+
+  GMappedFile *mapped;
+
+  const SnapshotHeader  *header;
+  const SnapshotSource  *sources;
+  const SnapshotDir     *dirs;
+  const guint32         *children;
+  const SnapshotEntry   *entries;
+  const SnapshotVariant *variants;
+  const char            *strings;
+
+  time_t mtime;
+  off_t  size;
+};
+
+static const char*
+snapshot_string (MarkupSnapshot *snapshot,
+                 guint32         offset)
+{
+  if (offset == SNAPSHOT_NONE || offset >= snapshot->header->strings_size)
+    return NULL;
+
+  return snapshot->strings + offset;
+}
+
+/*
+ * Reading
+ */
+
+static gboolean
+snapshot_sources_unchanged (MarkupSnapshot *snapshot)
+{
+  guint32 i;
+
+  for (i = 0; i < snapshot->header->n_sources; i++)
+    {
+      const SnapshotSource *source = &snapshot->sources[i];
+      const char *path;
+      struct stat statbuf;
+      char *fullpath;
+      gboolean unchanged;
+
+      path = snapshot_string (snapshot, source->path);
+      if (path == NULL)
+        return FALSE;
+
+      fullpath = g_build_filename (snapshot->root_dir, path, NULL);
+
+      if (g_stat (fullpath, &statbuf) < 0)
+        unchanged = FALSE;
+      else if (source->is_dir)
+        /* Adding or removing files touches the directory; the
+         * snapshot is touched after it's written so it is never
+         * older than its own directory.
+         */
+        unchanged = statbuf.st_mtime <= snapshot->mtime;
+      else
+        unchanged = (guint32) statbuf.st_mtime == source->mtime &&
+                    (guint32) statbuf.st_size == source->size;
+
+      if (!unchanged)
+        gconf_log (GCL_DEBUG, "Snapshot \"%s\" is out of date, \"%s\" changed",
+                   snapshot->filename, fullpath);
+
+      g_free (fullpath);
+
+      if (!unchanged)
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+static gboolean
+snapshot_section_fits (gsize *offset,
+                       gsize  length,
+                       gsize  n_items,
+                       gsize  item_size)
+{
+  if (n_items > (length - *offset) / item_size)
+    return FALSE;
+
+  *offset += n_items * item_size;
+
+  return TRUE;
+}
+
+static gboolean
+snapshot_validate (MarkupSnapshot *snapshot,
+                   gsize           length)
+{
+  const SnapshotHeader *header;
+  const char *data;
+  gsize offset;
+  guint32 i;
+
+  data = g_mapped_file_get_contents (snapshot->mapped);
+
+  if (length < sizeof (SnapshotHeader))
+    return FALSE;
+
+  header = (const SnapshotHeader *) data;
+
+  if (memcmp (header->magic, SNAPSHOT_MAGIC, sizeof (header->magic)) != 0 ||
+      header->version != SNAPSHOT_VERSION ||
+      header->byte_order != SNAPSHOT_BYTE_ORDER)
+    return FALSE;
+
+  offset = sizeof (SnapshotHeader);
+
+  snapshot->header = header;
+
+  snapshot->sources = (const SnapshotSource *) (data + offset);
+  if (!snapshot_section_fits (&offset, length, header->n_sources, sizeof (SnapshotSource)))
+    return FALSE;
+
+  snapshot->dirs = (const SnapshotDir *) (data + offset);
+  if (!snapshot_section_fits (&offset, length, header->n_dirs, sizeof (SnapshotDir)))
+    return FALSE;
+
+  snapshot->children = (const guint32 *) (data + offset);
+  if (!snapshot_section_fits (&offset, length, header->n_children, sizeof (guint32)))
+    return FALSE;
+
+  snapshot->entries = (const SnapshotEntry *) (data + offset);
+  if (!snapshot_section_fits (&offset, length, header->n_entries, sizeof (SnapshotEntry)))
+    return FALSE;
+
+  snapshot->variants = (const SnapshotVariant *) (data + offset);
+  if (!snapshot_section_fits (&offset, length, header->n_variants, sizeof (SnapshotVariant)))
+    return FALSE;
+
+  snapshot->strings = data + offset;
+  if (header->strings_size == 0 ||
+      header->strings_size != length - offset ||
+      snapshot->strings[header->strings_size - 1] != '\0')
+    return FALSE;
+
+  /* Check every cross reference once here so lookups don't have to */
+  for (i = 0; i < header->n_dirs; i++)
+    {
+      const SnapshotDir *dir = &snapshot->dirs[i];
+
+      if (snapshot_string (snapshot, dir->name) == NULL ||
+          dir->first_entry > header->n_entries ||
+          dir->n_entries > header->n_entries - dir->first_entry ||
+          dir->first_child > header->n_children ||
+          dir->n_children > header->n_children - dir->first_child)
+        return FALSE;
+    }
+
+  for (i = 0; i < header->n_children; i++)
+    {
+      if (snapshot->children[i] >= header->n_dirs)
+        return FALSE;
+    }
+
+  for (i = 0; i < header->n_entries; i++)
+    {
+      const SnapshotEntry *entry = &snapshot->entries[i];
+
+      if (snapshot_string (snapshot, entry->name) == NULL ||
+          entry->first_variant > header->n_variants ||
+          entry->n_variants > header->n_variants - entry->first_variant)
+        return FALSE;
+    }
+
+  for (i = 0; i < header->n_variants; i++)
+    {
+      if (snapshot_string (snapshot, snapshot->variants[i].locale) == NULL ||
+          snapshot_string (snapshot, snapshot->variants[i].value) == NULL)
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+MarkupSnapshot*
+markup_snapshot_open (const char  *root_dir,
+                      GError     **err)
+{
+  MarkupSnapshot *snapshot;
+  struct stat statbuf;
+  GError *error;
+
+  snapshot = g_new0 (MarkupSnapshot, 1);
+
+  snapshot->root_dir = g_strdup (root_dir);
+  snapshot->filename = g_build_filename (root_dir, MARKUP_SNAPSHOT_FILE, NULL);
+
+  if (g_stat (snapshot->filename, &statbuf) < 0)
+    {
+      gconf_set_error (err, GCONF_ERROR_FAILED,
+                       _("Failed to open \"%s\": %s\n"),
+                       snapshot->filename, g_strerror (errno));
+      goto failed;
+    }
+
+  snapshot->mtime = statbuf.st_mtime;
+  snapshot->size = statbuf.st_size;
+
+  error = NULL;
+  snapshot->mapped = g_mapped_file_new (snapshot->filename, FALSE, &error);
+  if (snapshot->mapped == NULL)
+    {
+      gconf_set_error (err, GCONF_ERROR_FAILED,
+                       _("Failed to open \"%s\": %s\n"),
+                       snapshot->filename, error->message);
+      g_error_free (error);
+      goto failed;
+    }
+
+  if (!snapshot_validate (snapshot, g_mapped_file_get_length (snapshot->mapped)))
+    {
+      gconf_set_error (err, GCONF_ERROR_CORRUPT,
+                       _("\"%s\" is not a valid configuration snapshot"),
+                       snapshot->filename);
+      goto failed;
+    }
+
+  if (!snapshot_sources_unchanged (snapshot))
+    {
+      gconf_set_error (err, GCONF_ERROR_FAILED,
+                       _("\"%s\" is older than the configuration it was built from"),
+                       snapshot->filename);
+      goto failed;
+    }
+
+  return snapshot;
+
+ failed:
+  markup_snapshot_free (snapshot);
+
+  return NULL;
+}
+
+void
+markup_snapshot_free (MarkupSnapshot *snapshot)
+{
+  g_return_if_fail (snapshot != NULL);
+
+  if (snapshot->mapped != NULL)
+    g_mapped_file_unref (snapshot->mapped);
+
+  g_free (snapshot->root_dir);
+  g_free (snapshot->filename);
+  g_free (snapshot);
+}
+
+gboolean
+markup_snapshot_is_current (MarkupSnapshot *snapshot)
+{
+  struct stat statbuf;
+
+  /* A regenerated snapshot has to be remapped too */
+  if (g_stat (snapshot->filename, &statbuf) < 0 ||
+      statbuf.st_mtime != snapshot->mtime ||
+      statbuf.st_size != snapshot->size)
+    return FALSE;
+
+  return snapshot_sources_unchanged (snapshot);
+}
+
+/* Compare @name against the first @len bytes of @key */
+static int
+compare_with_prefix (const char *name,
+                     const char *key,
+                     gsize       len)
+{
+  int result;
+
+  result = strncmp (name, key, len);
+  if (result != 0)
+    return result;
+
+  return name[len] == '\0' ? 0 : 1;
+}
+
+static const SnapshotDir*
+snapshot_lookup_dir (MarkupSnapshot *snapshot,
+                     const char     *dir,
+                     gsize           len)
+{
+  guint32 lo, hi;
+
+  lo = 0;
+  hi = snapshot->header->n_dirs;
+  while (lo < hi)
+    {
+      guint32 mid;
+      int result;
+
+      mid = lo + (hi - lo) / 2;
+      result = compare_with_prefix (snapshot_string (snapshot, snapshot->dirs[mid].name),
+                                    dir, len);
+      if (result == 0)
+        return &snapshot->dirs[mid];
+      else if (result < 0)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+
+  return NULL;
+}
+
+static const SnapshotEntry*
+snapshot_lookup_entry (MarkupSnapshot *snapshot,
+                       const char     *key)
+{
+  const SnapshotDir *dir;
+  const char *name;
+  guint32 lo, hi;
+
+  name = strrchr (key, '/');
+  if (name == NULL)
+    return NULL;
+
+  if (name == key)
+    dir = snapshot_lookup_dir (snapshot, "/", 1);
+  else
+    dir = snapshot_lookup_dir (snapshot, key, name - key);
+
+  if (dir == NULL)
+    return NULL;
+
+  name++;
+
+  lo = dir->first_entry;
+  hi = dir->first_entry + dir->n_entries;
+  while (lo < hi)
+    {
+      guint32 mid;
+      int result;
+
+      mid = lo + (hi - lo) / 2;
+      result = strcmp (snapshot_string (snapshot, snapshot->entries[mid].name), name);
+      if (result == 0)
+        return &snapshot->entries[mid];
+      else if (result < 0)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+
+  return NULL;
+}
+
+static GConfValue*
+snapshot_entry_get_value (MarkupSnapshot      *snapshot,
+                          const SnapshotEntry *entry,
+                          const char         **locales)
+{
+  const char *encoded;
+  const char *owner;
+  GConfValue *value;
+
+  encoded = snapshot_string (snapshot, entry->value);
+  if (encoded == NULL)
+    return NULL;
+
+  /* Same choice as markup_entry_get_value(): the first requested
+   * locale we have descriptions for, otherwise C. Each variant was
+   * already merged with the C fallbacks when it was compiled.
+   */
+  if (entry->n_variants > 0 && locales != NULL)
+    {
+      int i;
+
+      for (i = 0; locales[i] != NULL; i++)
+        {
+          guint32 j;
+
+          for (j = 0; j < entry->n_variants; j++)
+            {
+              const SnapshotVariant *variant;
+
+              variant = &snapshot->variants[entry->first_variant + j];
+
+              if (strcmp (snapshot_string (snapshot, variant->locale), locales[i]) == 0)
+                {
+                  encoded = snapshot_string (snapshot, variant->value);
+                  goto found;
+                }
+            }
+        }
+    }
+
+ found:
+  value = gconf_value_decode (encoded);
+
+  owner = snapshot_string (snapshot, entry->owner);
+  if (value != NULL && value->type == GCONF_VALUE_SCHEMA && owner != NULL)
+    gconf_schema_set_owner (gconf_value_get_schema (value), owner);
+
+  return value;
+}
+
+GConfValue*
+markup_snapshot_query_value (MarkupSnapshot  *snapshot,
+                             const char      *key,
+                             const char     **locales,
+                             char           **schema_name)
+{
+  const SnapshotEntry *entry;
+
+  entry = snapshot_lookup_entry (snapshot, key);
+
+  if (schema_name)
+    *schema_name = entry ? g_strdup (snapshot_string (snapshot, entry->schema_name)) : NULL;
+
+  if (entry == NULL)
+    return NULL;
+
+  return snapshot_entry_get_value (snapshot, entry, locales);
+}
+
+GConfMetaInfo*
+markup_snapshot_query_metainfo (MarkupSnapshot *snapshot,
+                                const char     *key)
+{
+  const SnapshotEntry *entry;
+  GConfMetaInfo *gcmi;
+  const char *schema_name;
+  const char *mod_user;
+
+  entry = snapshot_lookup_entry (snapshot, key);
+  if (entry == NULL)
+    return NULL;
+
+  gcmi = gconf_meta_info_new ();
+
+  schema_name = snapshot_string (snapshot, entry->schema_name);
+  mod_user = snapshot_string (snapshot, entry->mod_user);
+
+  if (schema_name)
+    gconf_meta_info_set_schema (gcmi, schema_name);
+
+  gconf_meta_info_set_mod_time (gcmi, entry->mod_time);
+
+  if (mod_user)
+    gconf_meta_info_set_mod_user (gcmi, mod_user);
+
+  return gcmi;
+}
+
+GSList*
+markup_snapshot_all_entries (MarkupSnapshot  *snapshot,
+                             const char      *dir,
+                             const char     **locales)
+{
+  const SnapshotDir *sdir;
+  GSList *retval;
+  guint32 i;
+
+  sdir = snapshot_lookup_dir (snapshot, dir, strlen (dir));
+  if (sdir == NULL)
+    return NULL;
+
+  retval = NULL;
+  for (i = 0; i < sdir->n_entries; i++)
+    {
+      const SnapshotEntry *entry;
+      GConfEntry *gconf_entry;
+
+      entry = &snapshot->entries[sdir->first_entry + i];
+
+      /* Relative names, like the markup backend's all_entries */
+      gconf_entry = gconf_entry_new_nocopy (g_strdup (snapshot_string (snapshot, entry->name)),
+                                            snapshot_entry_get_value (snapshot, entry, locales));
+      gconf_entry_set_schema_name (gconf_entry,
+                                   snapshot_string (snapshot, entry->schema_name));
+
+      retval = g_slist_prepend (retval, gconf_entry);
+    }
+
+  return retval;
+}
+
+GSList*
+markup_snapshot_all_subdirs (MarkupSnapshot *snapshot,
+                             const char     *dir)
+{
+  const SnapshotDir *sdir;
+  GSList *retval;
+  guint32 i;
+
+  sdir = snapshot_lookup_dir (snapshot, dir, strlen (dir));
+  if (sdir == NULL)
+    return NULL;
+
+  retval = NULL;
+  for (i = 0; i < sdir->n_children; i++)
+    {
+      const SnapshotDir *child;
+      const char *name;
+
+      child = &snapshot->dirs[snapshot->children[sdir->first_child + i]];
+      name = strrchr (snapshot_string (snapshot, child->name), '/');
+
+      retval = g_slist_prepend (retval, g_strdup (name ? name + 1 : ""));
+    }
+
+  return retval;
+}
+
+gboolean
+markup_snapshot_dir_exists (MarkupSnapshot *snapshot,
+                            const char     *dir)
+{
+  return snapshot_lookup_dir (snapshot, dir, strlen (dir)) != NULL;
+}
+
+/*
+ * Writing
+ */
+
+typedef struct
+{
+  const char *root_dir;
+
+  GArray *sources;
+  GArray *dirs;
+  GArray *children;
+  GArray *entries;
+  GArray *variants;
+
+  GString    *strings;
+  GHashTable *string_offsets;
+} SnapshotBuilder;
+
+typedef struct
+{
+  char      *path;
+  MarkupDir *dir;
+} BuilderDir;
+
+static guint32
+builder_add_string (SnapshotBuilder *builder,
+                    const char      *str)
+{
+  gpointer offset;
+
+  if (str == NULL)
+    return SNAPSHOT_NONE;
+
+  if (g_hash_table_lookup_extended (builder->string_offsets, str, NULL, &offset))
+    return GPOINTER_TO_UINT (offset);
+
+  offset = GUINT_TO_POINTER (builder->strings->len);
+  g_string_append_len (builder->strings, str, strlen (str) + 1);
+  g_hash_table_insert (builder->string_offsets, g_strdup (str), offset);
+
+  return GPOINTER_TO_UINT (offset);
+}
+
+static guint32
+builder_add_value (SnapshotBuilder *builder,
+                   GConfValue      *value)
+{
+  guint32 offset;
+  char *encoded;
+
+  if (value == NULL)
+    return SNAPSHOT_NONE;
+
+  encoded = gconf_value_encode (value);
+  offset = builder_add_string (builder, encoded);
+  g_free (encoded);
+
+  return offset;
+}
+
+/* Record every directory and XML file under the root, so we can
+ * tell later whether the snapshot still describes them.
+ */
+static void
+builder_add_sources (SnapshotBuilder *builder,
+                     const char      *relative_dir)
+{
+  SnapshotSource source;
+  struct stat statbuf;
+  const char *dent;
+  char *fullpath;
+  GDir *dp;
+
+  fullpath = g_build_filename (builder->root_dir, relative_dir, NULL);
+
+  if (g_stat (fullpath, &statbuf) < 0)
+    {
+      g_free (fullpath);
+      return;
+    }
+
+  source.path = builder_add_string (builder, relative_dir);
+  source.is_dir = TRUE;
+  source.mtime = statbuf.st_mtime;
+  source.size = 0;
+  g_array_append_val (builder->sources, source);
+
+  dp = g_dir_open (fullpath, 0, NULL);
+  if (dp == NULL)
+    {
+      g_free (fullpath);
+      return;
+    }
+
+  while ((dent = g_dir_read_name (dp)) != NULL)
+    {
+      char *child_relative;
+      char *child_path;
+
+      if (dent[0] == '.')
+        continue;
+
+      child_relative = g_build_filename (relative_dir, dent, NULL);
+      child_path = g_build_filename (builder->root_dir, child_relative, NULL);
+
+      if (g_stat (child_path, &statbuf) == 0)
+        {
+          if (S_ISDIR (statbuf.st_mode))
+            {
+              /* skip lock dirs and the like */
+              if (dent[0] != '%')
+                builder_add_sources (builder, child_relative);
+            }
+          else if (g_str_has_prefix (dent, "%gconf") &&
+                   g_str_has_suffix (dent, ".xml"))
+            {
+              source.path = builder_add_string (builder, child_relative);
+              source.is_dir = FALSE;
+              source.mtime = statbuf.st_mtime;
+              source.size = statbuf.st_size;
+              g_array_append_val (builder->sources, source);
+            }
+        }
+
+      g_free (child_path);
+      g_free (child_relative);
+    }
+
+  g_dir_close (dp);
+  g_free (fullpath);
+}
+
+static void
+builder_collect_dirs (MarkupDir  *dir,
+                      const char *path,
+                      GArray     *dirs)
+{
+  BuilderDir bdir;
+  GSList *tmp;
+
+  bdir.path = g_strdup (path);
+  bdir.dir = dir;
+  g_array_append_val (dirs, bdir);
+
+  tmp = markup_dir_list_subdirs (dir, NULL);
+  while (tmp != NULL)
+    {
+      MarkupDir *subdir = tmp->data;
+      char *subpath;
+
+      subpath = gconf_concat_dir_and_key (path, markup_dir_get_name (subdir));
+      builder_collect_dirs (subdir, subpath, dirs);
+      g_free (subpath);
+
+      tmp = tmp->next;
+    }
+}
+
+static int
+builder_dir_compare (gconstpointer a,
+                     gconstpointer b)
+{
+  return strcmp (((const BuilderDir *) a)->path, ((const BuilderDir *) b)->path);
+}
+
+static int
+markup_entry_compare (gconstpointer a,
+                      gconstpointer b)
+{
+  return strcmp (markup_entry_get_name ((MarkupEntry *) a),
+                 markup_entry_get_name ((MarkupEntry *) b));
+}
+
+static void
+builder_add_entry (SnapshotBuilder *builder,
+                   MarkupEntry     *entry)
+{
+  SnapshotEntry sentry;
+  GConfValue *value;
+
+  /* With no locales this gives the C locale descriptions, which is
+   * the fallback when no variant matches.
+   */
+  value = markup_entry_get_value (entry, NULL);
+
+  sentry.name = builder_add_string (builder, markup_entry_get_name (entry));
+  sentry.value = builder_add_value (builder, value);
+  sentry.schema_name = builder_add_string (builder, markup_entry_get_schema_name (entry));
+  sentry.mod_user = builder_add_string (builder, markup_entry_get_mod_user (entry));
+  sentry.mod_time = markup_entry_get_mod_time (entry);
+  sentry.owner = SNAPSHOT_NONE;
+  sentry.first_variant = builder->variants->len;
+  sentry.n_variants = 0;
+
+  if (value != NULL && value->type == GCONF_VALUE_SCHEMA)
+    {
+      GSList *locales;
+      GSList *tmp;
+
+      sentry.owner = builder_add_string (builder,
+                                         gconf_schema_get_owner (gconf_value_get_schema (value)));
+
+      locales = markup_entry_list_schema_locales (entry);
+      for (tmp = locales; tmp != NULL; tmp = tmp->next)
+        {
+          const char *locale[2] = { tmp->data, NULL };
+          SnapshotVariant variant;
+          GConfValue *localized;
+
+          if (strcmp (locale[0], "C") == 0)
+            continue;
+
+          localized = markup_entry_get_value (entry, locale);
+
+          variant.locale = builder_add_string (builder, locale[0]);
+          variant.value = builder_add_value (builder, localized);
+          g_array_append_val (builder->variants, variant);
+          sentry.n_variants += 1;
+
+          gconf_value_free (localized);
+        }
+      g_slist_free (locales);
+    }
+
+  if (value != NULL)
+    gconf_value_free (value);
+
+  g_array_append_val (builder->entries, sentry);
+}
+
+static void
+builder_add_tree (SnapshotBuilder *builder,
+                  MarkupTree      *tree,
+                  GError         **err)
+{
+  GHashTable *dir_indexes;
+  MarkupDir *root;
+  GArray *dirs;
+  guint i;
+
+  root = markup_tree_lookup_dir (tree, "/", err);
+  if (root == NULL)
+    return;
+
+  dirs = g_array_new (FALSE, FALSE, sizeof (BuilderDir));
+  builder_collect_dirs (root, "/", dirs);
+  g_array_sort (dirs, builder_dir_compare);
+
+  dir_indexes = g_hash_table_new (g_direct_hash, g_direct_equal);
+  for (i = 0; i < dirs->len; i++)
+    g_hash_table_insert (dir_indexes,
+                         g_array_index (dirs, BuilderDir, i).dir,
+                         GUINT_TO_POINTER (i));
+
+  for (i = 0; i < dirs->len; i++)
+    {
+      BuilderDir *bdir = &g_array_index (dirs, BuilderDir, i);
+      SnapshotDir sdir;
+      GSList *entries;
+      GSList *tmp;
+
+      sdir.name = builder_add_string (builder, bdir->path);
+      sdir.first_entry = builder->entries->len;
+      sdir.first_child = builder->children->len;
+      sdir.n_children = 0;
+
+      entries = g_slist_copy (markup_dir_list_entries (bdir->dir, NULL));
+      entries = g_slist_sort (entries, markup_entry_compare);
+      for (tmp = entries; tmp != NULL; tmp = tmp->next)
+        builder_add_entry (builder, tmp->data);
+      g_slist_free (entries);
+
+      sdir.n_entries = builder->entries->len - sdir.first_entry;
+
+      for (tmp = markup_dir_list_subdirs (bdir->dir, NULL); tmp != NULL; tmp = tmp->next)
+        {
+          guint32 child;
+
+          child = GPOINTER_TO_UINT (g_hash_table_lookup (dir_indexes, tmp->data));
+          g_array_append_val (builder->children, child);
+          sdir.n_children += 1;
+        }
+
+      g_array_append_val (builder->dirs, sdir);
+    }
+
+  for (i = 0; i < dirs->len; i++)
+    g_free (g_array_index (dirs, BuilderDir, i).path);
+  g_array_free (dirs, TRUE);
+  g_hash_table_destroy (dir_indexes);
+}
+
+gboolean
+markup_snapshot_write (MarkupTree  *tree,
+                       const char  *root_dir,
+                       GError     **err)
+{
+  SnapshotBuilder builder;
+  SnapshotHeader header;
+  GString *contents;
+  GError *error;
+  char *filename;
+  gboolean retval;
+
+  builder.root_dir = root_dir;
+  builder.sources = g_array_new (FALSE, FALSE, sizeof (SnapshotSource));
+  builder.dirs = g_array_new (FALSE, FALSE, sizeof (SnapshotDir));
+  builder.children = g_array_new (FALSE, FALSE, sizeof (guint32));
+  builder.entries = g_array_new (FALSE, FALSE, sizeof (SnapshotEntry));
+  builder.variants = g_array_new (FALSE, FALSE, sizeof (SnapshotVariant));
+  builder.strings = g_string_new (NULL);
+  builder.string_offsets = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                  g_free, NULL);
+
+  retval = FALSE;
+  contents = NULL;
+  filename = g_build_filename (root_dir, MARKUP_SNAPSHOT_FILE, NULL);
+
+  /* Sources first, so a file changing while we load the tree makes
+   * the snapshot look stale rather than silently out of date.
+   */
+  builder_add_sources (&builder, "");
+
+  error = NULL;
+  builder_add_tree (&builder, tree, &error);
+  if (error != NULL)
+    {
+      g_propagate_error (err, error);
+      goto out;
+    }
+
+  /* Never leave an empty string table, so validation is simple */
+  builder_add_string (&builder, "");
+
+  memset (&header, 0, sizeof (header));
+  memcpy (header.magic, SNAPSHOT_MAGIC, sizeof (header.magic));
+  header.version = SNAPSHOT_VERSION;
+  header.byte_order = SNAPSHOT_BYTE_ORDER;
+  header.n_sources = builder.sources->len;
+  header.n_dirs = builder.dirs->len;
+  header.n_children = builder.children->len;
+  header.n_entries = builder.entries->len;
+  header.n_variants = builder.variants->len;
+  header.strings_size = builder.strings->len;
+
+  contents = g_string_sized_new (sizeof (header) + builder.strings->len);
+  g_string_append_len (contents, (const char *) &header, sizeof (header));
+  g_string_append_len (contents, builder.sources->data,
+                       builder.sources->len * sizeof (SnapshotSource));
+  g_string_append_len (contents, builder.dirs->data,
+                       builder.dirs->len * sizeof (SnapshotDir));
+  g_string_append_len (contents, builder.children->data,
+                       builder.children->len * sizeof (guint32));
+  g_string_append_len (contents, builder.entries->data,
+                       builder.entries->len * sizeof (SnapshotEntry));
+  g_string_append_len (contents, builder.variants->data,
+                       builder.variants->len * sizeof (SnapshotVariant));
+  g_string_append_len (contents, builder.strings->str, builder.strings->len);
+
+  error = NULL;
+  if (!g_file_set_contents (filename, contents->str, contents->len, &error))
+    {
+      gconf_set_error (err, GCONF_ERROR_FAILED,
+                       _("Error writing file \"%s\": %s"),
+                       filename, error->message);
+      g_error_free (error);
+      goto out;
+    }
+
+  /* Renaming the snapshot into place touched the root directory;
+   * make sure the snapshot doesn't look older than it.
+   */
+  g_utime (filename, NULL);
+
+  retval = TRUE;
+
+ out:
+  if (contents != NULL)
+    g_string_free (contents, TRUE);
+
+  g_free (filename);
+
+  g_array_free (builder.sources, TRUE);
+  g_array_free (builder.dirs, TRUE);
+  g_array_free (builder.children, TRUE);
+  g_array_free (builder.entries, TRUE);
+  g_array_free (builder.variants, TRUE);
+  g_string_free (builder.strings, TRUE);
+  g_hash_table_destroy (builder.string_offsets);
+
+  return retval;
+}
@@ -0,0 +1,63 @@
+/* GConf
+ * Copyright (C) 2002 Red Hat Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef MARKUP_SNAPSHOT_H
+#define MARKUP_SNAPSHOT_H
+
+#include <glib.h>
+#include "gconf/gconf-value.h"
+#include "markup-tree.h"
+
+/* A compiled, read-only image of a whole markup tree, stored as
+ * %gconf-tree.snapshot in the root directory. It is only used for
+ * sources that can't be written, and only while none of the XML
+ * files it was compiled from have changed.
+ */
+
+#define MARKUP_SNAPSHOT_FILE "%gconf-tree.snapshot"
+
+typedef struct _MarkupSnapshot MarkupSnapshot;
+
+MarkupSnapshot* markup_snapshot_open       (const char      *root_dir,
+                                            GError         **err);
+void            markup_snapshot_free       (MarkupSnapshot  *snapshot);
+gboolean        markup_snapshot_is_current (MarkupSnapshot  *snapshot);
+
+gboolean        markup_snapshot_write      (MarkupTree      *tree,
+                                            const char      *root_dir,
+                                            GError         **err);
+
+/* These mirror the backend vtable; values and lists are newly
+ * allocated and owned by the caller.
+ */
+GConfValue*     markup_snapshot_query_value    (MarkupSnapshot  *snapshot,
+                                                const char      *key,
+                                                const char     **locales,
+                                                char           **schema_name);
+GConfMetaInfo*  markup_snapshot_query_metainfo (MarkupSnapshot  *snapshot,
+                                                const char      *key);
+GSList*         markup_snapshot_all_entries    (MarkupSnapshot  *snapshot,
+                                                const char      *dir,
+                                                const char     **locales);
+GSList*         markup_snapshot_all_subdirs    (MarkupSnapshot  *snapshot,
+                                                const char      *dir);
+gboolean        markup_snapshot_dir_exists     (MarkupSnapshot  *snapshot,
+                                                const char      *dir);
+
+#endif
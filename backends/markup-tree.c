@@ -71,9 +71,15 @@ fsync (int fd)
 }
 #endif
 
+/* @locale and MarkupEntry::mod_user come from a small set of values
+ * repeated across every entry in a tree, so they are interned with
+ * g_intern_string() rather than copied per entry. Dir and entry names
+ * and schema names repeat too but come and go with the tree, so they
+ * are held with gconf_key_intern() instead.
+ */
 typedef struct
 {
-  char       *locale;
+  const char *locale;
   char       *short_desc;
   char       *long_desc;
   GConfValue *default_value;
@@ -87,7 +93,7 @@ struct _MarkupEntry
   /* list of LocalSchemaInfo */
   GSList     *local_schemas;
   char       *schema_name;
-  char       *mod_user;
+  const char *mod_user;
   GTime       mod_time;
 };
 
@@ -121,6 +127,12 @@ static void save_tree  (MarkupDir   *root,
 			guint        file_mode,
 			GError     **err);
 
+static gboolean create_filesystem_dir (const char *name,
+                                       guint       dir_mode);
+static void     remove_filesystem_dir (const char *fs_filename,
+                                       const char *fs_dirname);
+static void     markup_dir_mark_all_dirty (MarkupDir *dir);
+
 
 struct _MarkupTree
 {
@@ -130,9 +142,55 @@ struct _MarkupTree
 
   MarkupDir *root;
 
+  /* Reused output buffer for saving files */
+  char *write_buffer;
+
+  /* What the sync in progress has written, for logging */
+  guint  files_written;
+  gsize  bytes_written;
+
+  /* File operations are queued here instead of being done
+   * while preparing a sync job
+   */
+  MarkupSyncJob *preparing_job;
+
+  GRecMutex lock;
+
   guint refcount;
 
   guint merged : 1;
+
+  /* A sync job failed part way, so save everything next time */
+  guint resave_all : 1;
+};
+
+typedef enum
+{
+  MARKUP_SYNC_MKDIR,
+  MARKUP_SYNC_WRITE,
+  MARKUP_SYNC_REMOVE_DIR
+} MarkupSyncOpType;
+
+typedef struct
+{
+  MarkupSyncOpType type;
+  char    *path;
+  /* MARKUP_SYNC_WRITE */
+  GString *contents;
+  guint    mode;
+  /* MARKUP_SYNC_REMOVE_DIR: data file to delete first */
+  char    *data_file;
+} MarkupSyncOp;
+
+struct _MarkupSyncJob
+{
+  MarkupTree *tree;
+  GSList     *ops;
+
+  /* Filled in by markup_sync_job_run() */
+  guint       files_written;
+  gsize       bytes_written;
+  guint       succeeded : 1;
 };
 
 static GHashTable *trees_by_root_dir = NULL;
@@ -167,6 +225,8 @@ markup_tree_get (const char *root_dir,
 
   tree->root = markup_dir_new (tree, NULL, "/");  
 
+  g_rec_mutex_init (&tree->lock);
+
   tree->refcount = 1;
 
   g_hash_table_insert (trees_by_root_dir, tree->dirname, tree);
@@ -196,11 +256,26 @@ markup_tree_unref (MarkupTree *tree)
   markup_dir_free (tree->root);
   tree->root = NULL;
 
+  g_free (tree->write_buffer);
   g_free (tree->dirname);
 
+  g_rec_mutex_clear (&tree->lock);
+
   g_free (tree);
 }
 
+void
+markup_tree_lock (MarkupTree *tree)
+{
+  g_rec_mutex_lock (&tree->lock);
+}
+
+void
+markup_tree_unlock (MarkupTree *tree)
+{
+  g_rec_mutex_unlock (&tree->lock);
+}
+
 void
 markup_tree_rebuild (MarkupTree *tree)
 {
@@ -220,9 +295,22 @@ struct _MarkupDir
   GSList *entries;
   GSList *subdirs;
 
+  /* Name -> MarkupEntry/MarkupDir indexes over @entries and
+   * @subdirs, so lookups don't have to walk the lists. If a file
+   * contains the same name twice, the first one in the list is
+   * the one indexed, matching what a linear walk would find.
+   */
+  GHashTable *entries_by_name;
+  GHashTable *subdirs_by_name;
+
   /* Available %gconf-tree-$(locale).xml files */
   GHashTable *available_local_descs;
 
+  /* Locales whose %gconf-tree-$(locale).xml is out of date, as
+   * interned strings. Only used on subtree roots.
+   */
+  GHashTable *dirty_local_descs;
+
   /* Have read the existing XML file */
   guint entries_loaded : 1;
   /* Need to rewrite the XML file since we changed
@@ -248,6 +336,11 @@ struct _MarkupDir
   /* We've loaded all locales in @available_local_descs */
   guint all_local_descs_loaded : 1;
 
+  /* Every %gconf-tree-$(locale).xml must be rewritten, not
+   * just those in @dirty_local_descs
+   */
+  guint all_local_descs_dirty : 1;
+
   /* This is a temporary directory used only during parsing */
   guint is_parser_dummy : 1;
 
@@ -264,14 +357,20 @@ markup_dir_new (MarkupTree *tree,
 
   dir = g_new0 (MarkupDir, 1);
 
-  dir->name = g_strdup (name);
+  dir->name = (char *) gconf_key_intern (name);
   dir->tree = tree;
   dir->parent = parent;
 
+  dir->entries_by_name = g_hash_table_new (g_str_hash, g_str_equal);
+  dir->subdirs_by_name = g_hash_table_new (g_str_hash, g_str_equal);
+
   if (parent)
     {
       dir->subtree_root = parent->subtree_root;
       parent->subdirs = g_slist_prepend (parent->subdirs, dir);
+
+      if (g_hash_table_lookup (parent->subdirs_by_name, dir->name) == NULL)
+        g_hash_table_insert (parent->subdirs_by_name, dir->name, dir);
     }
   else
     {
@@ -292,6 +391,9 @@ markup_dir_free (MarkupDir *dir)
       dir->available_local_descs = NULL;
     }
 
+  if (dir->dirty_local_descs != NULL)
+    g_hash_table_destroy (dir->dirty_local_descs);
+
   tmp = dir->entries;
   while (tmp)
     {
@@ -314,11 +416,56 @@ markup_dir_free (MarkupDir *dir)
     }
   g_slist_free (dir->subdirs);
 
-  g_free (dir->name);
+  g_hash_table_destroy (dir->entries_by_name);
+  g_hash_table_destroy (dir->subdirs_by_name);
+
+  gconf_key_unintern (dir->name);
 
   g_free (dir);
 }
 
+/* Rebuild the name indexes from the lists, after the lists have been
+ * pruned or reordered. Walks in list order so the first of any
+ * duplicate names wins, as with a linear lookup.
+ */
+static void
+markup_dir_reindex_entries (MarkupDir *dir)
+{
+  GSList *tmp;
+
+  g_hash_table_remove_all (dir->entries_by_name);
+
+  tmp = dir->entries;
+  while (tmp != NULL)
+    {
+      MarkupEntry *entry = tmp->data;
+
+      if (g_hash_table_lookup (dir->entries_by_name, entry->name) == NULL)
+        g_hash_table_insert (dir->entries_by_name, entry->name, entry);
+
+      tmp = tmp->next;
+    }
+}
+
+static void
+markup_dir_reindex_subdirs (MarkupDir *dir)
+{
+  GSList *tmp;
+
+  g_hash_table_remove_all (dir->subdirs_by_name);
+
+  tmp = dir->subdirs;
+  while (tmp != NULL)
+    {
+      MarkupDir *subdir = tmp->data;
+
+      if (g_hash_table_lookup (dir->subdirs_by_name, subdir->name) == NULL)
+        g_hash_table_insert (dir->subdirs_by_name, subdir->name, subdir);
+
+      tmp = tmp->next;
+    }
+}
+
 static void
 markup_dir_queue_sync (MarkupDir *dir)
 {
@@ -424,13 +571,39 @@ markup_tree_ensure_dir (MarkupTree *tree,
   return markup_tree_get_dir_internal (tree, full_key, TRUE, err);  
 }
 
+static void
+markup_tree_check_resave (MarkupTree *tree)
+{
+  if (tree->resave_all)
+    {
+      gconf_log (GCL_DEBUG, "Saving all of \"%s\" after a failed sync",
+                 tree->dirname);
+
+      markup_dir_mark_all_dirty (tree->root);
+      tree->resave_all = FALSE;
+    }
+}
+
 gboolean
 markup_tree_sync (MarkupTree *tree,
                   GError    **err)
 {
+  markup_tree_check_resave (tree);
+
   if (markup_dir_needs_sync (tree->root))
     {
-      if (!markup_dir_sync (tree->root))
+      gboolean synced;
+
+      tree->files_written = 0;
+      tree->bytes_written = 0;
+
+      synced = markup_dir_sync (tree->root);
+
+      gconf_log (GCL_DEBUG, "Synced \"%s\": wrote %u files, %lu bytes",
+                 tree->dirname, tree->files_written,
+                 (gulong) tree->bytes_written);
+
+      if (!synced)
         {
           g_set_error (err, GCONF_ERROR,
                        GCONF_ERROR_FAILED,
@@ -442,6 +615,128 @@ markup_tree_sync (MarkupTree *tree,
   return TRUE;
 }
 
+/*
+ * Sync jobs
+ *
+ * Preparing a job does everything markup_tree_sync() would, except
+ * that file operations are queued on the job rather than done, with
+ * files serialized into memory. Running the job - the part that
+ * waits on the disk - only touches the job, so it can happen in
+ * another thread while the tree is used and changed.
+ */
+
+static MarkupSyncOp*
+markup_sync_job_add_op (MarkupSyncJob    *job,
+                        MarkupSyncOpType  type,
+                        char             *path)
+{
+  MarkupSyncOp *op;
+
+  op = g_new0 (MarkupSyncOp, 1);
+  op->type = type;
+  op->path = path;
+
+  job->ops = g_slist_prepend (job->ops, op);
+
+  return op;
+}
+
+static void
+markup_sync_op_free (MarkupSyncOp *op)
+{
+  g_free (op->path);
+  g_free (op->data_file);
+  if (op->contents)
+    g_string_free (op->contents, TRUE);
+  g_free (op);
+}
+
+static gboolean
+markup_tree_mkdir (MarkupTree *tree,
+                   const char *path)
+{
+  if (tree->preparing_job != NULL)
+    {
+      MarkupSyncOp *op;
+
+      op = markup_sync_job_add_op (tree->preparing_job, MARKUP_SYNC_MKDIR,
+                                   g_strdup (path));
+      op->mode = tree->dir_mode;
+
+      return TRUE;
+    }
+
+  return create_filesystem_dir (path, tree->dir_mode);
+}
+
+static void
+markup_tree_remove_dir (MarkupTree *tree,
+                        const char *fs_filename,
+                        const char *fs_dirname)
+{
+  if (tree->preparing_job != NULL)
+    {
+      MarkupSyncOp *op;
+
+      op = markup_sync_job_add_op (tree->preparing_job, MARKUP_SYNC_REMOVE_DIR,
+                                   g_strdup (fs_dirname));
+      op->data_file = g_strdup (fs_filename);
+
+      return;
+    }
+
+  remove_filesystem_dir (fs_filename, fs_dirname);
+}
+
+MarkupSyncJob*
+markup_tree_prepare_sync (MarkupTree *tree)
+{
+  MarkupSyncJob *job;
+
+  g_return_val_if_fail (tree->preparing_job == NULL, NULL);
+
+  markup_tree_check_resave (tree);
+
+  if (!markup_dir_needs_sync (tree->root))
+    return NULL;
+
+  job = g_new0 (MarkupSyncJob, 1);
+  job->tree = tree;
+  tree->refcount += 1;
+
+  tree->preparing_job = job;
+  markup_dir_sync (tree->root);
+  tree->preparing_job = NULL;
+
+  job->ops = g_slist_reverse (job->ops);
+
+  return job;
+}
+
+void
+markup_sync_job_finish (MarkupSyncJob *job)
+{
+  MarkupTree *tree;
+
+  tree = job->tree;
+
+  gconf_log (GCL_DEBUG, "Synced \"%s\": wrote %u files, %lu bytes",
+             tree->dirname, job->files_written,
+             (gulong) job->bytes_written);
+
+  /* We don't know which of the files were written, and the
+   * dirty flags were cleared when the job was prepared
+   */
+  if (!job->succeeded)
+    tree->resave_all = TRUE;
+
+  g_slist_foreach (job->ops, (GFunc) markup_sync_op_free, NULL);
+  g_slist_free (job->ops);
+  g_free (job);
+
+  markup_tree_unref (tree);
+}
+
 static void
 markup_dir_setup_as_subtree_root (MarkupDir *dir)
 {
@@ -724,22 +1019,9 @@ markup_dir_lookup_entry (MarkupDir   *dir,
                          const char  *relative_key,
                          GError     **err)
 {
-  GSList *tmp;
-
   load_entries (dir);
-  
-  tmp = dir->entries;
-  while (tmp != NULL)
-    {
-      MarkupEntry *entry = tmp->data;
-
-      if (strcmp (relative_key, entry->name) == 0)
-        return entry;
-      
-      tmp = tmp->next;
-    }
 
-  return NULL;
+  return g_hash_table_lookup (dir->entries_by_name, relative_key);
 }
 
 MarkupEntry*
@@ -778,22 +1060,9 @@ markup_dir_lookup_subdir (MarkupDir   *dir,
                           const char  *relative_key,
                           GError     **err)
 {
-  GSList *tmp;
-  
   load_subdirs (dir);
 
-  tmp = dir->subdirs;
-  while (tmp != NULL)
-    {
-      MarkupDir *subdir = tmp->data;
-
-      if (strcmp (subdir->name, relative_key) == 0)
-        return subdir;
-
-      tmp = tmp->next;
-    }
-
-  return NULL;
+  return g_hash_table_lookup (dir->subdirs_by_name, relative_key);
 }
 
 MarkupDir*
@@ -871,6 +1140,67 @@ markup_dir_set_entries_need_save (MarkupDir *dir)
     }
 }
 
+static void
+markup_dir_mark_all_dirty (MarkupDir *dir)
+{
+  GSList *tmp;
+
+  if (dir->entries_loaded)
+    {
+      markup_dir_set_entries_need_save (dir);
+      markup_dir_queue_sync (dir);
+    }
+
+  /* The mkdir may have been what failed */
+  if (!dir->not_in_filesystem)
+    dir->filesystem_dir_probably_exists = FALSE;
+
+  if (dir->subtree_root == dir)
+    dir->all_local_descs_dirty = TRUE;
+
+  for (tmp = dir->subdirs; tmp != NULL; tmp = tmp->next)
+    markup_dir_mark_all_dirty (tmp->data);
+}
+
+/* Note that the descriptions for @locale under @dir changed, so
+ * its %gconf-tree-$(locale).xml needs rewriting.
+ */
+static void
+markup_dir_queue_local_desc_save (MarkupDir  *dir,
+                                  const char *locale)
+{
+  MarkupDir *subtree_root;
+
+  subtree_root = dir->subtree_root;
+
+  /* Descriptions are inline in %gconf.xml files, and C
+   * descriptions are in %gconf-tree.xml
+   */
+  if (!subtree_root->save_as_subtree || strcmp (locale, "C") == 0)
+    return;
+
+  if (subtree_root->dirty_local_descs == NULL)
+    subtree_root->dirty_local_descs = g_hash_table_new (g_direct_hash,
+                                                        g_direct_equal);
+
+  locale = g_intern_string (locale);
+  g_hash_table_replace (subtree_root->dirty_local_descs,
+                        (char *) locale, (char *) locale);
+}
+
+static void
+markup_entry_queue_local_descs_save (MarkupEntry *entry)
+{
+  GSList *tmp;
+
+  for (tmp = entry->local_schemas; tmp != NULL; tmp = tmp->next)
+    {
+      LocalSchemaInfo *local_schema = tmp->data;
+
+      markup_dir_queue_local_desc_save (entry->dir, local_schema->locale);
+    }
+}
+
 /* Get rid of any local_schema that no longer apply */
 static void
 clean_old_local_schemas (MarkupEntry *entry)
@@ -902,6 +1232,7 @@ clean_old_local_schemas (MarkupEntry *entry)
           
       if (dead)
         {
+          markup_dir_queue_local_desc_save (entry->dir, local_schema->locale);
           local_schema_info_free (local_schema);
         }
       else
@@ -966,6 +1297,25 @@ create_filesystem_dir (const char *name,
   return TRUE;
 }
 
+static void
+remove_filesystem_dir (const char *fs_filename,
+                       const char *fs_dirname)
+{
+  if (g_unlink (fs_filename) < 0)
+    {
+      gconf_log (GCL_WARNING,
+                 _("Could not remove \"%s\": %s\n"),
+                 fs_filename, g_strerror (errno));
+    }
+
+  if (g_rmdir (fs_dirname) < 0)
+    {
+      gconf_log (GCL_WARNING,
+                 _("Could not remove \"%s\": %s\n"),
+                 fs_dirname, g_strerror (errno));
+    }
+}
+
 static gboolean
 delete_useless_subdirs (MarkupDir *dir)
 {
@@ -994,19 +1344,7 @@ delete_useless_subdirs (MarkupDir *dir)
 							subdir->save_as_subtree,
 							NULL);
 
-	      if (g_unlink (fs_filename) < 0)
-		{
-		  gconf_log (GCL_WARNING,
-			     _("Could not remove \"%s\": %s\n"),
-			     fs_filename, g_strerror (errno));
-		}
-
-	      if (g_rmdir (fs_dirname) < 0)
-		{
-		  gconf_log (GCL_WARNING,
-			     _("Could not remove \"%s\": %s\n"),
-			     fs_dirname, g_strerror (errno));
-		}
+	      markup_tree_remove_dir (dir->tree, fs_filename, fs_dirname);
           
 	      g_free (fs_dirname);
 	      g_free (fs_filename);
@@ -1027,6 +1365,9 @@ delete_useless_subdirs (MarkupDir *dir)
   g_slist_free (dir->subdirs);
   dir->subdirs = g_slist_reverse (kept_subdirs);
 
+  if (some_deleted)
+    markup_dir_reindex_subdirs (dir);
+
   return some_deleted;
 }
 
@@ -1089,6 +1430,9 @@ delete_useless_entries (MarkupDir *dir)
   g_slist_free (dir->entries);
   dir->entries = g_slist_reverse (kept_entries);
 
+  if (some_deleted)
+    markup_dir_reindex_entries (dir);
+
   return some_deleted;
 }
 
@@ -1161,6 +1505,7 @@ markup_dir_sync (MarkupDir *dir)
   if (!dir->save_as_subtree && dir->tree->merged)
     {
       dir->save_as_subtree = TRUE;
+      dir->all_local_descs_dirty = TRUE;
       recursively_load_subtree (dir);
     }
   
@@ -1195,7 +1540,7 @@ markup_dir_sync (MarkupDir *dir)
       /* Be sure the directory exists */
       if (!dir->filesystem_dir_probably_exists)
         {
-          if (create_filesystem_dir (fs_dirname, dir->tree->dir_mode))
+          if (markup_tree_mkdir (dir->tree, fs_dirname))
             dir->filesystem_dir_probably_exists = TRUE;
         }
       
@@ -1240,7 +1585,7 @@ markup_dir_sync (MarkupDir *dir)
                */
               if (!dir->filesystem_dir_probably_exists)
                 {
-                  if (create_filesystem_dir (fs_dirname, dir->tree->dir_mode))
+                  if (markup_tree_mkdir (dir->tree, fs_dirname))
                     dir->filesystem_dir_probably_exists = TRUE;
                 }
               
@@ -1372,22 +1717,24 @@ markup_entry_new (MarkupDir  *dir,
 
   entry = g_new0 (MarkupEntry, 1);
 
-  entry->name = g_strdup (name);
+  entry->name = (char *) gconf_key_intern (name);
 
   entry->dir = dir;
   dir->entries = g_slist_prepend (dir->entries, entry);
 
+  if (g_hash_table_lookup (dir->entries_by_name, entry->name) == NULL)
+    g_hash_table_insert (dir->entries_by_name, entry->name, entry);
+
   return entry;
 }
 
 static void
 markup_entry_free (MarkupEntry *entry)
 {
-  g_free (entry->name);
+  gconf_key_unintern (entry->name);
   if (entry->value)
     gconf_value_free (entry->value);
-  g_free (entry->schema_name);
-  g_free (entry->mod_user);
+  gconf_key_unintern (entry->schema_name);
 
   g_slist_foreach (entry->local_schemas,
                    (GFunc) local_schema_info_free,
@@ -1523,6 +1870,7 @@ markup_entry_set_value (MarkupEntry       *entry,
       /* Dump these if they exist, we aren't a schema anymore */
       if (entry->local_schemas)
         {
+          markup_entry_queue_local_descs_save (entry);
           g_slist_foreach (entry->local_schemas,
                            (GFunc) local_schema_info_free,
                            NULL);
@@ -1573,7 +1921,7 @@ markup_entry_set_value (MarkupEntry       *entry,
         {
           /* Didn't find a value for locale, make a new entry in the list */
           local_schema = local_schema_info_new ();
-          local_schema->locale = g_strdup (locale);
+          local_schema->locale = g_intern_string (locale);
           entry->local_schemas =
             g_slist_prepend (entry->local_schemas, local_schema);
         }
@@ -1583,6 +1931,8 @@ markup_entry_set_value (MarkupEntry       *entry,
       if (local_schema->default_value)
         gconf_value_free (local_schema->default_value);
 
+      markup_dir_queue_local_desc_save (entry->dir, locale);
+
       local_schema->short_desc = g_strdup (gconf_schema_get_short_desc (schema));
       local_schema->long_desc = g_strdup (gconf_schema_get_long_desc (schema));
       def_value = gconf_schema_get_default_value (schema);
@@ -1665,6 +2015,7 @@ markup_entry_unset_value (MarkupEntry *entry,
           entry->value = NULL;
 
           ensure_schema_descs_loaded (entry, NULL);
+          markup_entry_queue_local_descs_save (entry);
 
           g_slist_foreach (entry->local_schemas,
                            (GFunc) local_schema_info_free,
@@ -1688,6 +2039,8 @@ markup_entry_unset_value (MarkupEntry *entry,
 
               if (strcmp (local_schema->locale, locale) == 0)
                 {
+                  markup_dir_queue_local_desc_save (entry->dir, locale);
+
                   entry->local_schemas =
                     g_slist_remove (entry->local_schemas,
                                     local_schema);
@@ -1727,8 +2080,8 @@ markup_entry_set_schema_name (MarkupEntry *entry,
 
   /* schema_name may be NULL to unset it */
   
-  g_free (entry->schema_name);
-  entry->schema_name = g_strdup (schema_name);
+  gconf_key_unintern (entry->schema_name);
+  entry->schema_name = (char *) gconf_key_intern (schema_name);
   
   /* Update mod time */
   entry->mod_time = time (NULL);
@@ -1755,7 +2108,10 @@ markup_entry_get_value (MarkupEntry *entry,
     }
   else if (entry->value->type != GCONF_VALUE_SCHEMA)
     {
-      return gconf_value_copy (entry->value);
+      /* Setting the entry replaces its value rather than changing
+       * it, so the caller can share this one
+       */
+      return gconf_value_ref (entry->value);
     }
   else
     {
@@ -1882,15 +2238,36 @@ markup_entry_get_mod_time (MarkupEntry *entry)
   return entry->mod_time;
 }
 
+GSList*
+markup_entry_list_schema_locales (MarkupEntry *entry)
+{
+  GSList *retval;
+  GSList *tmp;
+
+  g_return_val_if_fail (entry->dir != NULL, NULL);
+  g_return_val_if_fail (entry->dir->entries_loaded, NULL);
+
+  ensure_schema_descs_loaded (entry, NULL);
+
+  retval = NULL;
+  tmp = entry->local_schemas;
+  while (tmp != NULL)
+    {
+      LocalSchemaInfo *lsi = tmp->data;
+
+      retval = g_slist_prepend (retval, (char *) lsi->locale);
+
+      tmp = tmp->next;
+    }
+
+  return g_slist_reverse (retval);
+}
+
 static void
 markup_entry_set_mod_user (MarkupEntry *entry,
                            const char  *muser)
 {
-  if (muser == entry->mod_user)
-    return;
-
-  g_free (entry->mod_user);
-  entry->mod_user = g_strdup (muser);
+  entry->mod_user = g_intern_string (muser);
 }
 
 static void
@@ -2793,12 +3170,11 @@ parse_entry_element (GMarkupParseContext  *context,
        * mess up the modtime
        */
       if (schema)
-        entry->schema_name = g_strdup (schema);
+        entry->schema_name = (char *) gconf_key_intern (schema);
     }
   else
     {
       MarkupDir  *dir;
-      GSList     *tmp;
       const char *name;
   
       name = NULL;
@@ -2819,20 +3195,7 @@ parse_entry_element (GMarkupParseContext  *context,
 
       dir = dir_stack_peek (info);
 
-      entry = NULL;
-
-      tmp = dir->entries;
-      while (tmp != NULL)
-        {
-          entry = tmp->data;
-
-          if (strcmp (entry->name, name) == 0)
-            break;
-          else
-            entry = NULL;
-
-          tmp = tmp->next;
-        }
+      entry = g_hash_table_lookup (dir->entries_by_name, name);
 
       /* Note: entry can be NULL here, in which case we'll discard
        * the LocalSchemaInfo once we've finished parsing this entry
@@ -2888,20 +3251,7 @@ parse_dir_element (GMarkupParseContext  *context,
     }
   else
     {
-      GSList *tmp;
-
-      tmp = parent->subdirs;
-      while (tmp != NULL)
-        {
-          dir = tmp->data;
-
-          if (strcmp (dir->name, name) == 0)
-            break;
-          else
-            dir = NULL;
-
-          tmp = tmp->next;
-        }
+      dir = g_hash_table_lookup (parent->subdirs_by_name, name);
 
       if (dir == NULL)
         {
@@ -3037,7 +3387,7 @@ parse_local_schema_element (GMarkupParseContext  *context,
     }
 
   local_schema = local_schema_info_new ();
-  local_schema->locale = g_strdup (locale);
+  local_schema->locale = g_intern_string (locale);
   local_schema->short_desc = g_strdup (short_desc);
 
   info->local_schemas = g_slist_prepend (info->local_schemas,
@@ -3490,6 +3840,7 @@ end_element_handler (GMarkupParseContext *context,
         else if (dir->is_parser_dummy)
           {
             dir->parent->subdirs = g_slist_remove (dir->parent->subdirs, dir);
+            g_hash_table_remove (dir->parent->subdirs_by_name, dir->name);
             markup_dir_free (dir);
           }
 
@@ -3605,7 +3956,9 @@ parse_tree (MarkupDir   *root,
   GError *error;
   ParseInfo info;
   char *filename;
-  FILE *f;
+  GMappedFile *mapped;
+  const char *contents;
+  gsize length;
 
   if (!parse_subtree)
     g_assert (locale == NULL);
@@ -3616,13 +3969,19 @@ parse_tree (MarkupDir   *root,
 
   error = NULL;
 
-  f = g_fopen (filename, "rb");
-  if (f == NULL)
+  /* Map the whole file and hand it to GMarkup in one go, rather
+   * than copying it through a stdio buffer a few KB at a time;
+   * merged %gconf-tree.xml files for the defaults can be several
+   * megabytes.
+   */
+  mapped = g_mapped_file_new (filename, FALSE, &error);
+  if (mapped == NULL)
     {
       char *str;
 
       str = g_strdup_printf (_("Failed to open \"%s\": %s\n"),
-			     filename, g_strerror (errno));
+			     filename, error->message);
+      g_error_free (error);
       error = g_error_new_literal (GCONF_ERROR,
 				   GCONF_ERROR_FAILED,
 				   str);
@@ -3634,32 +3993,17 @@ parse_tree (MarkupDir   *root,
   context = g_markup_parse_context_new (&gconf_parser,
                                         0, &info, NULL);
 
-  while (!feof (f))
+  contents = g_mapped_file_get_contents (mapped);
+  length = g_mapped_file_get_length (mapped);
+
+  /* Empty files are written on purpose for directories without
+   * entries; end_parse() below reports them like it always has.
+   */
+  if (length > 0)
     {
-      char  text[4096];
-      gsize n_bytes;
-      
-      n_bytes = fread (text, 1, sizeof (text), f);
-      if (n_bytes > 0)
-	{
-	  error = NULL;
-	  if (!g_markup_parse_context_parse (context, text, n_bytes, &error))
-	    goto out;
-	}
-
-      if (ferror (f))
-	{
-	  char *str;
-
-	  str = g_strdup_printf (_("Error reading \"%s\": %s\n"),
-                                 filename, g_strerror (errno));
-	  error = g_error_new_literal (GCONF_ERROR,
-				       GCONF_ERROR_FAILED,
-				       str);
-	  g_free (str);
-
-	  goto out;
-	}
+      error = NULL;
+      if (!g_markup_parse_context_parse (context, contents, length, &error))
+        goto out;
     }
 
   error = NULL;
@@ -3672,8 +4016,8 @@ parse_tree (MarkupDir   *root,
     g_markup_parse_context_free (context);
   g_free (filename);
 
-  if (f != NULL)
-    fclose (f);
+  if (mapped != NULL)
+    g_mapped_file_unref (mapped);
 
   parse_info_free (&info);
 
@@ -3687,17 +4031,229 @@ parse_tree (MarkupDir   *root,
 
 #define INDENT_SPACES 1
 
-static gboolean write_list_children   (GConfValue  *value,
-                                       FILE        *f,
-                                       int          indent);
-static gboolean write_pair_children   (GConfValue  *value,
-                                       FILE        *f,
-                                       int          indent);
-static gboolean write_schema_children (GConfValue  *value,
-                                       FILE        *f,
-                                       int          indent,
-                                       GSList      *local_schemas,
-                                       gboolean     save_as_subtree);
+/* Output is escaped and formatted straight into a buffer that is
+ * handed to write() in large chunks, rather than going through
+ * stdio and g_markup_escape_text() copies a few bytes at a time.
+ * Once a write fails, all further appends fail too. When preparing
+ * a sync job, output is collected in a string instead.
+ */
+
+#define WRITE_BUFFER_SIZE (64 * 1024)
+
+typedef struct
+{
+  int      fd;
+  char    *buf;
+  gsize    len;
+  gsize    bytes_written;
+  gboolean failed;
+  GString *out;
+} MarkupWriter;
+
+static void
+markup_writer_init (MarkupWriter *w,
+                    int           fd,
+                    char         *buf)
+{
+  w->fd = fd;
+  w->buf = buf;
+  w->len = 0;
+  w->bytes_written = 0;
+  w->failed = FALSE;
+  w->out = NULL;
+}
+
+static void
+markup_writer_init_string (MarkupWriter *w,
+                           GString      *out)
+{
+  markup_writer_init (w, -1, NULL);
+  w->out = out;
+}
+
+static gboolean
+markup_writer_write_all (MarkupWriter *w,
+                         const char   *data,
+                         gsize         len)
+{
+  while (len > 0 && !w->failed)
+    {
+      gssize written;
+
+      written = write (w->fd, data, len);
+      if (written < 0)
+        {
+          if (errno != EINTR)
+            w->failed = TRUE;
+          continue;
+        }
+
+      data += written;
+      len -= written;
+      w->bytes_written += written;
+    }
+
+  return !w->failed;
+}
+
+static gboolean
+markup_writer_flush (MarkupWriter *w)
+{
+  gsize len;
+
+  if (w->out != NULL)
+    return TRUE;
+
+  len = w->len;
+  w->len = 0;
+
+  return markup_writer_write_all (w, w->buf, len);
+}
+
+static gboolean
+markup_writer_append_len (MarkupWriter *w,
+                          const char   *str,
+                          gsize         len)
+{
+  if (w->failed)
+    return FALSE;
+
+  if (w->out != NULL)
+    {
+      g_string_append_len (w->out, str, len);
+      return TRUE;
+    }
+
+  if (w->len + len > WRITE_BUFFER_SIZE)
+    {
+      if (!markup_writer_flush (w))
+        return FALSE;
+
+      if (len >= WRITE_BUFFER_SIZE)
+        return markup_writer_write_all (w, str, len);
+    }
+
+  memcpy (w->buf + w->len, str, len);
+  w->len += len;
+
+  return TRUE;
+}
+
+static inline gboolean
+markup_writer_append (MarkupWriter *w,
+                      const char   *str)
+{
+  return markup_writer_append_len (w, str, strlen (str));
+}
+
+static gboolean
+markup_writer_append_printf (MarkupWriter *w,
+                             const char   *format,
+                             ...) G_GNUC_PRINTF (2, 3);
+
+static gboolean
+markup_writer_append_printf (MarkupWriter *w,
+                             const char   *format,
+                             ...)
+{
+  char buf[128];
+  va_list args;
+  int len;
+
+  va_start (args, format);
+  len = g_vsnprintf (buf, sizeof (buf), format, args);
+  va_end (args);
+
+  g_assert (len >= 0 && len < (int) sizeof (buf));
+
+  return markup_writer_append_len (w, buf, len);
+}
+
+/* Produces the same output as g_markup_escape_text() */
+static gboolean
+markup_writer_append_escaped (MarkupWriter *w,
+                              const char   *text)
+{
+  const char *p;
+  const char *run;
+
+  run = p = text;
+  while (*p != '\0')
+    {
+      const char *entity;
+      guchar c = *p;
+      gsize len = 1;
+      char charref[8];
+
+      entity = NULL;
+
+      switch (c)
+        {
+        case '&':
+          entity = "&amp;";
+          break;
+        case '<':
+          entity = "&lt;";
+          break;
+        case '>':
+          entity = "&gt;";
+          break;
+        case '\'':
+          entity = "&apos;";
+          break;
+        case '"':
+          entity = "&quot;";
+          break;
+        default:
+          if ((c >= 0x1 && c <= 0x8) ||
+              (c >= 0xb && c <= 0xc) ||
+              (c >= 0xe && c <= 0x1f) ||
+              c == 0x7f)
+            {
+              g_snprintf (charref, sizeof (charref), "&#x%x;", c);
+              entity = charref;
+            }
+          else if (c == 0xc2 &&
+                   (guchar) p[1] >= 0x80 && (guchar) p[1] <= 0x9f &&
+                   (guchar) p[1] != 0x85)
+            {
+              /* C1 control characters */
+              g_snprintf (charref, sizeof (charref), "&#x%x;", (guchar) p[1]);
+              entity = charref;
+              len = 2;
+            }
+          break;
+        }
+
+      if (entity != NULL)
+        {
+          if (!markup_writer_append_len (w, run, p - run) ||
+              !markup_writer_append (w, entity))
+            return FALSE;
+
+          p += len;
+          run = p;
+        }
+      else
+        {
+          p++;
+        }
+    }
+
+  return markup_writer_append_len (w, run, p - run);
+}
+
+static gboolean write_list_children   (GConfValue   *value,
+                                       MarkupWriter *w,
+                                       int           indent);
+static gboolean write_pair_children   (GConfValue   *value,
+                                       MarkupWriter *w,
+                                       int           indent);
+static gboolean write_schema_children (GConfValue   *value,
+                                       MarkupWriter *w,
+                                       int           indent,
+                                       GSList       *local_schemas,
+                                       gboolean      save_as_subtree);
 
 /* the common case - before we start interning */
 static const char write_indents_static[] = 
@@ -3711,27 +4267,29 @@ static const char *make_whitespace (int indent)
 }
 
 static gboolean
-write_value_element (GConfValue *value,
-                     const char *closing_element,
-                     FILE       *f,
-                     int         indent,
-                     GSList     *local_schemas,
-                     gboolean    save_as_subtree)
+write_value_element (GConfValue   *value,
+                     const char   *closing_element,
+                     MarkupWriter *w,
+                     int           indent,
+                     GSList       *local_schemas,
+                     gboolean      save_as_subtree)
 {
   gboolean single_element = FALSE;
   /* We are at the "<foo bar="whatever"" stage here,
    * <foo> still missing the closing >
    */
   
-  if (fprintf (f, " type=\"%s\"",
-               gconf_value_type_to_string (value->type)) < 0)
+  if (!markup_writer_append (w, " type=\"") ||
+      !markup_writer_append (w, gconf_value_type_to_string (value->type)) ||
+      !markup_writer_append (w, "\""))
     return FALSE;
   
   switch (value->type)
     {          
     case GCONF_VALUE_LIST:
-      if (fprintf (f, " ltype=\"%s\"",
-                   gconf_value_type_to_string (gconf_value_get_list_type (value))) < 0)
+      if (!markup_writer_append (w, " ltype=\"") ||
+          !markup_writer_append (w, gconf_value_type_to_string (gconf_value_get_list_type (value))) ||
+          !markup_writer_append (w, "\""))
         return FALSE;
       break;
       
@@ -3745,25 +4303,19 @@ write_value_element (GConfValue *value,
 
         stype = gconf_schema_get_type (schema);
         
-        if (fprintf (f, " stype=\"%s\"",
-                     gconf_value_type_to_string (stype)) < 0)
+        if (!markup_writer_append (w, " stype=\"") ||
+            !markup_writer_append (w, gconf_value_type_to_string (stype)) ||
+            !markup_writer_append (w, "\""))
           return FALSE;
 
         owner = gconf_schema_get_owner (schema);
 
         if (owner)
           {
-            char *s;
-
-            s = g_markup_escape_text (owner, -1);
-            
-            if (fprintf (f, " owner=\"%s\"", s) < 0)
-              {
-                g_free (s);
-                return FALSE;
-              }
-            
-            g_free (s);
+            if (!markup_writer_append (w, " owner=\"") ||
+                !markup_writer_append_escaped (w, owner) ||
+                !markup_writer_append (w, "\""))
+              return FALSE;
           }
         
         if (stype == GCONF_VALUE_LIST)
@@ -3772,8 +4324,9 @@ write_value_element (GConfValue *value,
 
             if (list_type != GCONF_VALUE_INVALID)
               {
-                if (fprintf (f, " list_type=\"%s\"",
-                             gconf_value_type_to_string (list_type)) < 0)
+                if (!markup_writer_append (w, " list_type=\"") ||
+                    !markup_writer_append (w, gconf_value_type_to_string (list_type)) ||
+                    !markup_writer_append (w, "\""))
                   return FALSE;
               }
           }
@@ -3788,15 +4341,17 @@ write_value_element (GConfValue *value,
 
             if (car_type != GCONF_VALUE_INVALID)
               {
-                if (fprintf (f, " car_type=\"%s\"",
-                             gconf_value_type_to_string (car_type)) < 0)
+                if (!markup_writer_append (w, " car_type=\"") ||
+                    !markup_writer_append (w, gconf_value_type_to_string (car_type)) ||
+                    !markup_writer_append (w, "\""))
                   return FALSE;
               }
 
             if (cdr_type != GCONF_VALUE_INVALID)
               {
-                if (fprintf (f, " cdr_type=\"%s\"",
-                             gconf_value_type_to_string (cdr_type)) < 0)
+                if (!markup_writer_append (w, " cdr_type=\"") ||
+                    !markup_writer_append (w, gconf_value_type_to_string (cdr_type)) ||
+                    !markup_writer_append (w, "\""))
                   return FALSE;
               }
           }
@@ -3804,28 +4359,30 @@ write_value_element (GConfValue *value,
       break;
 
     case GCONF_VALUE_INT:
-      if (fprintf (f, " value=\"%d\"",
-                   gconf_value_get_int (value)) < 0)
+      if (!markup_writer_append_printf (w, " value=\"%d\"",
+                                        gconf_value_get_int (value)))
         return FALSE;
       break;
 
     case GCONF_VALUE_BOOL:
-      if (fprintf (f, " value=\"%s\"",
-                   gconf_value_get_bool (value) ? "true" : "false") < 0)
+      if (!markup_writer_append (w, gconf_value_get_bool (value) ?
+                                 " value=\"true\"" : " value=\"false\""))
         return FALSE;
       break;
 
     case GCONF_VALUE_FLOAT:
       {
         char *s;
+        gboolean retval;
 
         s = gconf_double_to_string (gconf_value_get_float (value));
-        if (fprintf (f, " value=\"%s\"", s) < 0)
-          {
-            g_free (s);
-            return FALSE;
-          }
+        retval = markup_writer_append (w, " value=\"") &&
+          markup_writer_append (w, s) &&
+          markup_writer_append (w, "\"");
         g_free (s);
+
+        if (!retval)
+          return FALSE;
       }
       break;
 
@@ -3838,41 +4395,33 @@ write_value_element (GConfValue *value,
   switch (value->type)
     {
     case GCONF_VALUE_STRING:
-      {
-        char *s;
-        
-        s = g_markup_escape_text (gconf_value_get_string (value),
-                                  -1);
-        if (fprintf (f, ">\n%s<stringvalue>%s</stringvalue>\n",
-                     make_whitespace (indent + INDENT_SPACES), s) < 0)
-          {
-            g_free (s);
-            return FALSE;
-          }
-        
-        g_free (s);
-      }
+      if (!markup_writer_append (w, ">\n") ||
+          !markup_writer_append (w, make_whitespace (indent + INDENT_SPACES)) ||
+          !markup_writer_append (w, "<stringvalue>") ||
+          !markup_writer_append_escaped (w, gconf_value_get_string (value)) ||
+          !markup_writer_append (w, "</stringvalue>\n"))
+        return FALSE;
       break;
       
     case GCONF_VALUE_LIST:
-      if (fputs (">\n", f) < 0)
+      if (!markup_writer_append (w, ">\n"))
 	return FALSE;
-      if (!write_list_children (value, f, indent + INDENT_SPACES))
+      if (!write_list_children (value, w, indent + INDENT_SPACES))
         return FALSE;
       break;
       
     case GCONF_VALUE_PAIR:
-      if (fputs (">\n", f) < 0)
+      if (!markup_writer_append (w, ">\n"))
 	return FALSE;
-      if (!write_pair_children (value, f, indent + INDENT_SPACES))
+      if (!write_pair_children (value, w, indent + INDENT_SPACES))
         return FALSE;
       break;
       
     case GCONF_VALUE_SCHEMA:
-      if (fputs (">\n", f) < 0)
+      if (!markup_writer_append (w, ">\n"))
 	return FALSE;
       if (!write_schema_children (value,
-                                  f,
+                                  w,
                                   indent + INDENT_SPACES,
                                   local_schemas,
                                   save_as_subtree))
@@ -3883,23 +4432,28 @@ write_value_element (GConfValue *value,
     case GCONF_VALUE_BOOL:
     case GCONF_VALUE_FLOAT:
     case GCONF_VALUE_INVALID:
-      if (fputs ("/>\n", f) < 0)
+      if (!markup_writer_append (w, "/>\n"))
 	return FALSE;
       single_element = TRUE;
       break;
     }
 
   if (!single_element)
-    if (fprintf (f, "%s</%s>\n", make_whitespace (indent), closing_element) < 0)
-      return FALSE;
+    {
+      if (!markup_writer_append (w, make_whitespace (indent)) ||
+          !markup_writer_append (w, "</") ||
+          !markup_writer_append (w, closing_element) ||
+          !markup_writer_append (w, ">\n"))
+        return FALSE;
+    }
 
   return TRUE;
 }    
 
 static gboolean
-write_list_children (GConfValue  *value,
-                     FILE        *f,
-                     int          indent)
+write_list_children (GConfValue   *value,
+                     MarkupWriter *w,
+                     int           indent)
 {
   GSList *tmp;
   gboolean retval = FALSE;
@@ -3909,13 +4463,13 @@ write_list_children (GConfValue  *value,
     {
       GConfValue *li = tmp->data;
 
-      if (fputs (make_whitespace (indent), f) < 0)
+      if (!markup_writer_append (w, make_whitespace (indent)))
 	goto out;
       
-      if (fputs ("<li", f) < 0)
+      if (!markup_writer_append (w, "<li"))
 	goto out;
 
-      if (!write_value_element (li, "li", f, indent, NULL, FALSE))
+      if (!write_value_element (li, "li", w, indent, NULL, FALSE))
 	goto out;
 
       tmp = tmp->next;
@@ -3929,9 +4483,9 @@ write_list_children (GConfValue  *value,
 }
 
 static gboolean
-write_pair_children (GConfValue  *value,
-                     FILE        *f,
-                     int          indent)
+write_pair_children (GConfValue   *value,
+                     MarkupWriter *w,
+                     int           indent)
 {
   GConfValue *child;
   gboolean retval = FALSE;
@@ -3940,13 +4494,13 @@ write_pair_children (GConfValue  *value,
 
   if (child != NULL)
     {
-      if (fputs (make_whitespace (indent), f) < 0)
+      if (!markup_writer_append (w, make_whitespace (indent)))
 	goto out;
 
-      if (fputs ("<car", f) < 0)
+      if (!markup_writer_append (w, "<car"))
 	goto out;
 
-      if (!write_value_element (child, "car", f, indent, NULL, FALSE))
+      if (!write_value_element (child, "car", w, indent, NULL, FALSE))
 	goto out;
     }
 
@@ -3954,13 +4508,13 @@ write_pair_children (GConfValue  *value,
 
   if (child != NULL)
     {
-      if (fputs (make_whitespace (indent), f) < 0)
+      if (!markup_writer_append (w, make_whitespace (indent)))
 	goto out;
       
-      if (fputs ("<cdr", f) < 0)
+      if (!markup_writer_append (w, "<cdr"))
 	goto out;
 
-      if (!write_value_element (child, "cdr", f, indent, NULL, FALSE))
+      if (!write_value_element (child, "cdr", w, indent, NULL, FALSE))
 	goto out;
     }
 
@@ -3973,14 +4527,13 @@ write_pair_children (GConfValue  *value,
 
 static gboolean
 write_local_schema_info (LocalSchemaInfo *local_schema,
-                         FILE            *f,
+                         MarkupWriter    *w,
                          int              indent,
                          gboolean         is_locale_file,
                          gboolean         write_descs)
 {
   gboolean retval;
   const char *whitespace1, *whitespace2;
-  char *s;
 
   if (!write_descs && local_schema->default_value == NULL)
     return TRUE;
@@ -3990,54 +4543,44 @@ write_local_schema_info (LocalSchemaInfo *local_schema,
   whitespace1 = make_whitespace (indent);
   whitespace2 = make_whitespace (indent + INDENT_SPACES);
 
-  if (fputs (whitespace1, f) < 0)
+  if (!markup_writer_append (w, whitespace1))
     goto out;
 
-  if (fputs ("<local_schema", f) < 0)
+  if (!markup_writer_append (w, "<local_schema"))
     goto out;
 
   if (!is_locale_file)
     {
       g_assert (local_schema->locale);
       
-      s = g_markup_escape_text (local_schema->locale, -1);
-
-      if (fprintf (f, " locale=\"%s\"", s) < 0)
-        {
-          g_free (s);
-          goto out;
-        }
-      
-      g_free (s);
+      if (!markup_writer_append (w, " locale=\"") ||
+          !markup_writer_append_escaped (w, local_schema->locale) ||
+          !markup_writer_append (w, "\""))
+        goto out;
     }
 
   if (write_descs && local_schema->short_desc)
     {
-      s = g_markup_escape_text (local_schema->short_desc, -1);
-
-      if (fprintf (f, " short_desc=\"%s\"", s) < 0)
-        {
-          g_free (s);
-          goto out;
-        }
-          
-      g_free (s);
+      if (!markup_writer_append (w, " short_desc=\"") ||
+          !markup_writer_append_escaped (w, local_schema->short_desc) ||
+          !markup_writer_append (w, "\""))
+        goto out;
     }
 
-  if (fputs (">\n", f) < 0)
+  if (!markup_writer_append (w, ">\n"))
     goto out;
 
   if (!is_locale_file && local_schema->default_value)
     {
-      if (fputs (whitespace2, f) < 0)
+      if (!markup_writer_append (w, whitespace2))
         goto out;
 
-      if (fputs ("<default", f) < 0)
+      if (!markup_writer_append (w, "<default"))
         goto out;
 
       if (!write_value_element (local_schema->default_value,
                                 "default",
-                                f,
+                                w,
                                 indent + INDENT_SPACES,
                                 NULL,
                                 FALSE))
@@ -4046,27 +4589,21 @@ write_local_schema_info (LocalSchemaInfo *local_schema,
 
   if (write_descs && local_schema->long_desc)
     {
-      if (fprintf (f, "%s<longdesc>", whitespace2) < 0)
+      if (!markup_writer_append (w, whitespace2) ||
+          !markup_writer_append (w, "<longdesc>"))
         goto out;
 
-      s = g_markup_escape_text (local_schema->long_desc, -1);
-          
-      if (fputs (s, f) < 0)
-        {
-          g_free (s);
-          goto out;
-        }
-          
-      g_free (s);
+      if (!markup_writer_append_escaped (w, local_schema->long_desc))
+        goto out;
 
-      if (fputs ("</longdesc>\n", f) < 0)
+      if (!markup_writer_append (w, "</longdesc>\n"))
         goto out;
     }
 
-  if (fputs (whitespace1, f) < 0)
+  if (!markup_writer_append (w, whitespace1))
     goto out;
 
-  if (fputs ("</local_schema>\n", f) < 0)
+  if (!markup_writer_append (w, "</local_schema>\n"))
     goto out;
 
   retval = TRUE;
@@ -4077,11 +4614,11 @@ write_local_schema_info (LocalSchemaInfo *local_schema,
 }
 
 static gboolean
-write_schema_children (GConfValue *value,
-                       FILE       *f,
-                       int         indent,
-                       GSList     *local_schemas,
-		       gboolean    save_as_subtree)
+write_schema_children (GConfValue   *value,
+                       MarkupWriter *w,
+                       int           indent,
+                       GSList       *local_schemas,
+		       gboolean      save_as_subtree)
 {
   /* Here we write each local_schema, in turn a local_schema can
    * contain <default> and <longdesc> and have locale and short_desc
@@ -4102,7 +4639,7 @@ write_schema_children (GConfValue *value,
 	write_descs = FALSE;
 
       if (!write_local_schema_info (local_schema,
-				    f,
+				    w,
 				    indent,
 				    FALSE,
 				    write_descs))
@@ -4161,9 +4698,9 @@ get_local_schema_info (MarkupEntry *entry,
 }
 
 static gboolean
-write_entry (MarkupEntry *entry,
-             FILE        *f,
-	     int          indent,
+write_entry (MarkupEntry  *entry,
+             MarkupWriter *w,
+	     int           indent,
 	     gboolean     save_as_subtree,
 	     const char  *locale,
 	     GHashTable  *other_locales)
@@ -4178,8 +4715,8 @@ write_entry (MarkupEntry *entry,
     {
       if (locale == NULL)
 	{
-	  g_assert (other_locales != NULL);
-	  get_non_c_desc_locales (entry, other_locales);
+	  if (other_locales != NULL)
+	    get_non_c_desc_locales (entry, other_locales);
 	}
       else
 	{
@@ -4190,23 +4727,31 @@ write_entry (MarkupEntry *entry,
 
   g_assert (entry->name != NULL);
   
-  if (fprintf (f, "%s<entry name=\"%s\"", make_whitespace (indent), entry->name) < 0)
+  if (!markup_writer_append (w, make_whitespace (indent)) ||
+      !markup_writer_append (w, "<entry name=\"") ||
+      !markup_writer_append (w, entry->name) ||
+      !markup_writer_append (w, "\""))
     goto out;
 
   if (local_schema_info == NULL)
     {
-      if (fprintf (f, " mtime=\"%lu\"", (unsigned long) entry->mod_time) < 0)
+      if (!markup_writer_append_printf (w, " mtime=\"%lu\"",
+                                        (unsigned long) entry->mod_time))
 	goto out;
   
       if (entry->schema_name)
 	{
-	  if (fprintf (f, " schema=\"%s\"", entry->schema_name) < 0)
+	  if (!markup_writer_append (w, " schema=\"") ||
+	      !markup_writer_append (w, entry->schema_name) ||
+	      !markup_writer_append (w, "\""))
 	    goto out;
 	}
 
       if (entry->mod_user)
 	{
-	  if (fprintf (f, " muser=\"%s\"", entry->mod_user) < 0)
+	  if (!markup_writer_append (w, " muser=\"") ||
+	      !markup_writer_append (w, entry->mod_user) ||
+	      !markup_writer_append (w, "\""))
 	    goto out;
 	}
 
@@ -4214,7 +4759,7 @@ write_entry (MarkupEntry *entry,
         {
           if (!write_value_element (entry->value,
                                     "entry",
-                                    f,
+                                    w,
                                     indent,
                                     entry->local_schemas,
                                     save_as_subtree))
@@ -4222,23 +4767,24 @@ write_entry (MarkupEntry *entry,
         }
       else
         {
-          if (fputs ("/>\n", f) < 0)
+          if (!markup_writer_append (w, "/>\n"))
             goto out;
         }
     }
   else
     {
-      if (fputs (">\n", f) < 0)
+      if (!markup_writer_append (w, ">\n"))
         goto out;
 
       if (!write_local_schema_info (local_schema_info,
-                                    f,
+                                    w,
                                     indent + INDENT_SPACES,
                                     TRUE,
                                     TRUE))
         goto out;
                                     
-      if (fprintf (f, "%s</entry>\n", make_whitespace (indent)) < 0)
+      if (!markup_writer_append (w, make_whitespace (indent)) ||
+          !markup_writer_append (w, "</entry>\n"))
         goto out;
     }
 
@@ -4250,12 +4796,12 @@ write_entry (MarkupEntry *entry,
 }
 
 static gboolean
-write_dir (MarkupDir  *dir,
-	   FILE       *f,
-	   int         indent,
-	   gboolean    save_as_subtree,
-	   const char *locale,
-	   GHashTable *other_locales)
+write_dir (MarkupDir    *dir,
+	   MarkupWriter *w,
+	   int           indent,
+	   gboolean      save_as_subtree,
+	   const char   *locale,
+	   GHashTable   *other_locales)
 {
   GSList *tmp;
   gboolean retval = FALSE;
@@ -4267,8 +4813,10 @@ write_dir (MarkupDir  *dir,
 
   g_assert (dir->name != NULL);
   
-  if (fprintf (f, "%s<dir name=\"%s\">\n",
-	       make_whitespace (indent), dir->name) < 0)
+  if (!markup_writer_append (w, make_whitespace (indent)) ||
+      !markup_writer_append (w, "<dir name=\"") ||
+      !markup_writer_append (w, dir->name) ||
+      !markup_writer_append (w, "\">\n"))
     goto out;
 
   tmp = dir->entries;
@@ -4277,7 +4825,7 @@ write_dir (MarkupDir  *dir,
       MarkupEntry *entry = tmp->data;
       
       if (!write_entry (entry,
-			f,
+			w,
 			indent + INDENT_SPACES,
 			save_as_subtree,
 			locale,
@@ -4293,7 +4841,7 @@ write_dir (MarkupDir  *dir,
       MarkupDir *subdir = tmp->data;
       
       if (!write_dir (subdir,
-		      f,
+		      w,
 		      indent + INDENT_SPACES,
 		      save_as_subtree,
 		      locale,
@@ -4303,8 +4851,9 @@ write_dir (MarkupDir  *dir,
       tmp = tmp->next;
     }
 
-  if (fprintf (f, "%s</dir>\n", make_whitespace (indent)) < 0)
-    return FALSE;
+  if (!markup_writer_append (w, make_whitespace (indent)) ||
+      !markup_writer_append (w, "</dir>\n"))
+    goto out;
 
   retval = TRUE;
 
@@ -4349,20 +4898,27 @@ init_is_dir_empty_flags (MarkupDir  *dir,
   return dir->is_dir_empty;
 }
 
-static void
-save_tree_with_locale (MarkupDir  *dir,
-		       gboolean    save_as_subtree,
-		       const char *locale,
-		       GHashTable *other_locales,
-		       guint       file_mode,
-		       GError    **err)
+typedef gboolean (* MarkupContentsFunc) (MarkupWriter *w,
+                                         gpointer      data);
+
+/* Writes @filename by way of a temporary file; the contents come
+ * from @contents_func, or the file is left empty if that is NULL.
+ * Doesn't touch the tree, so it can run in a sync job's thread.
+ */
+static gboolean
+write_new_file (const char         *filename,
+                guint               file_mode,
+                char               *buffer,
+                MarkupContentsFunc  contents_func,
+                gpointer            contents_data,
+                gsize              *bytes_written,
+                GError            **err)
 {
   /* We save to a secondary file then copy over, to handle
    * out-of-disk-space robustly
    */
-  FILE *f;
+  MarkupWriter w;
   int new_fd;
-  char *filename;
   char *new_filename;
 #ifdef G_OS_WIN32
   char *tmp_filename;
@@ -4370,21 +4926,17 @@ save_tree_with_locale (MarkupDir  *dir,
 #endif
   char *err_str;
   gboolean write_failed;
-  GSList *tmp;
   struct stat st;
 
   write_failed = FALSE;
   err_str = NULL;
   new_fd = -1;
-  f = NULL;
 
-  filename = markup_dir_build_file_path (dir, save_as_subtree, locale);
-  
   new_filename = g_strconcat (filename, ".new", NULL);
 #ifdef G_OS_WIN32
   tmp_filename = g_strconcat (filename, ".tmp", NULL);
 #endif
-  new_fd = g_open (new_filename, O_WRONLY | O_CREAT, file_mode);
+  new_fd = g_open (new_filename, O_WRONLY | O_CREAT | O_TRUNC, file_mode);
   if (new_fd < 0)
     {
       err_str = g_strdup_printf (_("Failed to open \"%s\": %s\n"),
@@ -4392,109 +4944,36 @@ save_tree_with_locale (MarkupDir  *dir,
       goto out;
     }
 
-  /* Leave the file empty to avoid parsing it later
-   * if there are no entries in it.
-   */
-  if (dir->entries == NULL && (!save_as_subtree || dir->subdirs == NULL))
-    {
-      fsync (new_fd);
-      close (new_fd);
-      new_fd = -1;
-      goto done_writing;
-    }
-  
-  f = fdopen (new_fd, "w");
-  if (f == NULL)
-    {
-      err_str = g_strdup_printf (_("Failed to open \"%s\": %s\n"),
-                                 new_filename, g_strerror (errno));
-      goto out;
-    }
+  markup_writer_init (&w, new_fd, buffer);
 
-  new_fd = -1; /* owned by the FILE* now */
-
-  write_failed = FALSE;
-
-  if (fputs ("<?xml version=\"1.0\"?>\n", f) < 0)
-    {
-      write_failed = TRUE;
-      goto done_writing;
-    }
-  
-  if (fputs ("<gconf>\n", f) < 0)
-    {
-      write_failed = TRUE;
-      goto done_writing;
-    }
-
-    
-  tmp = dir->entries;
-  while (tmp != NULL)
-    {
-      MarkupEntry *entry = tmp->data;
-      
-      if (!write_entry (entry,
-			f,
-			INDENT_SPACES,
-			save_as_subtree,
-			locale,
-			other_locales))
-	{
-	  write_failed = TRUE;
-	  goto done_writing;
-	}
-        
-      tmp = tmp->next;
-    }
-
-  if (save_as_subtree)
-    {
-      if (locale != NULL)
-        init_is_dir_empty_flags (dir, locale);
-
-      tmp = dir->subdirs;
-      while (tmp != NULL)
-	{
-	  MarkupDir *dir = tmp->data;
-
-	  if (!write_dir (dir,
-			  f,
-			  INDENT_SPACES,
-			  save_as_subtree,
-			  locale,
-			  other_locales))
-	    {
-	      write_failed = TRUE;
-	      goto done_writing;
-	    }
-
-	  tmp = tmp->next;
-	}
-    }
-
-  if (fputs ("</gconf>\n", f) < 0)
+  if (contents_func != NULL)
     {
-      write_failed = TRUE;
-      goto done_writing;
+      if (!(* contents_func) (&w, contents_data) ||
+          !markup_writer_flush (&w))
+        {
+          write_failed = TRUE;
+          goto done_writing;
+        }
     }
 
-  if (fflush (f) != 0 || fsync (fileno (f)) < 0)
+  if (fsync (new_fd) < 0)
     {
       gconf_log (GCL_WARNING,
                  _("Could not flush file '%s' to disk: %s"),
                  new_filename, g_strerror (errno));
     }
 
-  if (fclose (f) < 0)
+  if (bytes_written)
+    *bytes_written = w.bytes_written;
+
+  if (close (new_fd) < 0)
     {
-      f = NULL; /* f is still freed even if fclose fails according to the
-                 * linux man page
-                 */
+      new_fd = -1;
       write_failed = TRUE;
       goto done_writing;
     }
 
-  f = NULL;
+  new_fd = -1;
   
  done_writing:
   
@@ -4548,7 +5027,6 @@ save_tree_with_locale (MarkupDir  *dir,
   g_free (tmp_filename);
 #endif
   g_free (new_filename);
-  g_free (filename);
   
   if (err_str)
     {
@@ -4563,8 +5041,206 @@ save_tree_with_locale (MarkupDir  *dir,
   if (new_fd >= 0)
     close (new_fd);
 
-  if (f != NULL)
-    fclose (f);
+  return err_str == NULL;
+}
+
+typedef struct
+{
+  MarkupDir  *dir;
+  gboolean    save_as_subtree;
+  const char *locale;
+  GHashTable *other_locales;
+} SaveContentsData;
+
+static gboolean
+write_tree_contents (MarkupWriter     *w,
+                     SaveContentsData *data)
+{
+  MarkupDir *dir;
+  GSList *tmp;
+
+  dir = data->dir;
+
+  if (!markup_writer_append (w, "<?xml version=\"1.0\"?>\n<gconf>\n"))
+    return FALSE;
+    
+  tmp = dir->entries;
+  while (tmp != NULL)
+    {
+      MarkupEntry *entry = tmp->data;
+      
+      if (!write_entry (entry,
+			w,
+			INDENT_SPACES,
+			data->save_as_subtree,
+			data->locale,
+			data->other_locales))
+	return FALSE;
+        
+      tmp = tmp->next;
+    }
+
+  if (data->save_as_subtree)
+    {
+      if (data->locale != NULL)
+        init_is_dir_empty_flags (dir, data->locale);
+
+      tmp = dir->subdirs;
+      while (tmp != NULL)
+	{
+	  MarkupDir *subdir = tmp->data;
+
+	  if (!write_dir (subdir,
+			  w,
+			  INDENT_SPACES,
+			  data->save_as_subtree,
+			  data->locale,
+			  data->other_locales))
+	    return FALSE;
+
+	  tmp = tmp->next;
+	}
+    }
+
+  return markup_writer_append (w, "</gconf>\n");
+}
+
+static gboolean
+write_string_contents (MarkupWriter *w,
+                       GString      *contents)
+{
+  return markup_writer_append_len (w, contents->str, contents->len);
+}
+
+static void
+save_tree_with_locale (MarkupDir  *dir,
+		       gboolean    save_as_subtree,
+		       const char *locale,
+		       GHashTable *other_locales,
+		       guint       file_mode,
+		       GError    **err)
+{
+  SaveContentsData data;
+  MarkupTree *tree;
+  char *filename;
+  gsize bytes_written;
+  gboolean empty;
+
+  tree = dir->tree;
+
+  filename = markup_dir_build_file_path (dir, save_as_subtree, locale);
+
+  data.dir = dir;
+  data.save_as_subtree = save_as_subtree;
+  data.locale = locale;
+  data.other_locales = other_locales;
+
+  /* Leave the file empty to avoid parsing it later
+   * if there are no entries in it.
+   */
+  empty = dir->entries == NULL && (!save_as_subtree || dir->subdirs == NULL);
+
+  if (tree->preparing_job != NULL)
+    {
+      MarkupSyncOp *op;
+      MarkupWriter w;
+      GString *contents;
+
+      contents = g_string_new (NULL);
+      if (!empty)
+        {
+          markup_writer_init_string (&w, contents);
+          write_tree_contents (&w, &data);
+        }
+
+      op = markup_sync_job_add_op (tree->preparing_job, MARKUP_SYNC_WRITE,
+                                   filename);
+      op->contents = contents;
+      op->mode = file_mode;
+
+      return;
+    }
+
+  /* The buffer is kept around for the next file */
+  if (tree->write_buffer == NULL)
+    tree->write_buffer = g_malloc (WRITE_BUFFER_SIZE);
+
+  bytes_written = 0;
+  if (write_new_file (filename, file_mode, tree->write_buffer,
+                      empty ? NULL : (MarkupContentsFunc) write_tree_contents,
+                      &data, &bytes_written, err))
+    {
+      tree->files_written += 1;
+      tree->bytes_written += bytes_written;
+    }
+
+  g_free (filename);
+}
+
+gboolean
+markup_sync_job_run (MarkupSyncJob *job,
+                     GError       **err)
+{
+  GSList *tmp;
+  char *buffer;
+  gboolean failed;
+
+  failed = FALSE;
+  buffer = g_malloc (WRITE_BUFFER_SIZE);
+
+  for (tmp = job->ops; tmp != NULL; tmp = tmp->next)
+    {
+      MarkupSyncOp *op = tmp->data;
+      GError *error;
+      gsize bytes_written;
+
+      switch (op->type)
+        {
+        case MARKUP_SYNC_MKDIR:
+          /* failure shows up when writing into the dir */
+          create_filesystem_dir (op->path, op->mode);
+          break;
+
+        case MARKUP_SYNC_WRITE:
+          error = NULL;
+          bytes_written = 0;
+          if (write_new_file (op->path, op->mode, buffer,
+                              op->contents->len > 0 ?
+                              (MarkupContentsFunc) write_string_contents : NULL,
+                              op->contents, &bytes_written, &error))
+            {
+              job->files_written += 1;
+              job->bytes_written += bytes_written;
+            }
+          else
+            {
+              gconf_log (GCL_WARNING,
+                         _("Failed to write \"%s\": %s\n"),
+                         op->path, error->message);
+              g_error_free (error);
+              failed = TRUE;
+            }
+          break;
+
+        case MARKUP_SYNC_REMOVE_DIR:
+          remove_filesystem_dir (op->data_file, op->path);
+          break;
+        }
+    }
+
+  g_free (buffer);
+
+  job->succeeded = !failed;
+
+  if (failed)
+    {
+      g_set_error (err, GCONF_ERROR,
+                   GCONF_ERROR_FAILED,
+                   _("Failed to write some configuration data to disk\n"));
+      return FALSE;
+    }
+
+  return TRUE;
 }
 
 typedef struct
@@ -4590,13 +5266,21 @@ other_locales_foreach (const char *locale,
                          &error);
   if (error != NULL)
     {
-      if (data->first_error != NULL)
+      if (data->first_error == NULL)
         data->first_error = error;
       else
         g_error_free (error);
     }
 }
 
+static void
+add_locale_foreach (const char *locale,
+                    gpointer    dummy,
+                    GHashTable *locales)
+{
+  g_hash_table_replace (locales, (char *) locale, GINT_TO_POINTER (TRUE));
+}
+
 static void
 save_tree (MarkupDir  *dir,
 	   gboolean    save_as_subtree,
@@ -4612,12 +5296,18 @@ save_tree (MarkupDir  *dir,
       OtherLocalesForeachData other_locales_foreach_data;
       GHashTable *other_locales;
 
+      g_assert (dir->subtree_root == dir);
+
       /* First save %gconf-tree.xml with all values and C locale
        * schema descriptions; then save schema descriptions for
-       * all other locales in %gconf-tree-$(locale).xml
+       * the other locales in %gconf-tree-$(locale).xml. Only the
+       * locales whose descriptions changed are rewritten, unless
+       * the subtree is being written out for the first time.
        */
 
-      other_locales = g_hash_table_new (g_str_hash, g_str_equal);
+      other_locales = NULL;
+      if (dir->all_local_descs_dirty)
+        other_locales = g_hash_table_new (g_str_hash, g_str_equal);
 
       save_tree_with_locale (dir,
                              TRUE,
@@ -4630,9 +5320,22 @@ save_tree (MarkupDir  *dir,
       other_locales_foreach_data.file_mode   = file_mode;
       other_locales_foreach_data.first_error = NULL;
 
-      g_hash_table_foreach (other_locales,
-                            (GHFunc) other_locales_foreach,
-                            &other_locales_foreach_data);
+      if (other_locales != NULL)
+        {
+          /* Also empty out locales that lost their last description */
+          if (dir->dirty_local_descs != NULL)
+            g_hash_table_foreach (dir->dirty_local_descs,
+                                  (GHFunc) add_locale_foreach,
+                                  other_locales);
+
+          g_hash_table_foreach (other_locales,
+                                (GHFunc) other_locales_foreach,
+                                &other_locales_foreach_data);
+        }
+      else if (dir->dirty_local_descs != NULL)
+        g_hash_table_foreach (dir->dirty_local_descs,
+                              (GHFunc) other_locales_foreach,
+                              &other_locales_foreach_data);
 
       if (other_locales_foreach_data.first_error != NULL)
         {
@@ -4641,8 +5344,19 @@ save_tree (MarkupDir  *dir,
           else
             g_error_free (other_locales_foreach_data.first_error);
         }
+      else
+        {
+          dir->all_local_descs_dirty = FALSE;
+
+          if (dir->dirty_local_descs != NULL)
+            {
+              g_hash_table_destroy (dir->dirty_local_descs);
+              dir->dirty_local_descs = NULL;
+            }
+        }
 
-      g_hash_table_destroy (other_locales);
+      if (other_locales != NULL)
+        g_hash_table_destroy (other_locales);
     }
 }
 
@@ -4663,7 +5377,6 @@ local_schema_info_new (void)
 static void
 local_schema_info_free (LocalSchemaInfo *info)
 {
-  g_free (info->locale);
   g_free (info->short_desc);
   g_free (info->long_desc);
   if (info->default_value)
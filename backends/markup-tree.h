@@ -45,6 +45,24 @@ MarkupDir*  markup_tree_ensure_dir (MarkupTree *tree,
 gboolean    markup_tree_sync       (MarkupTree *tree,
                                     GError    **err);
 
+/* Trees are shared by every source with the same root dir, so
+ * threads serialize access to a tree with these. They nest.
+ */
+void        markup_tree_lock       (MarkupTree *tree);
+void        markup_tree_unlock     (MarkupTree *tree);
+
+/* Syncing in two steps: preparing a job (NULL if there is nothing
+ * to save) serializes the changes, running it writes them out and
+ * may be done in any thread, and finishing it frees it and takes
+ * note of any failure. Prepare and finish jobs in the same order.
+ */
+typedef struct _MarkupSyncJob MarkupSyncJob;
+
+MarkupSyncJob* markup_tree_prepare_sync (MarkupTree    *tree);
+gboolean       markup_sync_job_run      (MarkupSyncJob *job,
+                                         GError       **err);
+void           markup_sync_job_finish   (MarkupSyncJob *job);
+
 /* Directories in the tree */
 
 MarkupEntry* markup_dir_lookup_entry  (MarkupDir   *dir,
@@ -79,5 +97,9 @@ const char* markup_entry_get_name        (MarkupEntry       *entry);
 const char* markup_entry_get_schema_name (MarkupEntry       *entry);
 const char* markup_entry_get_mod_user    (MarkupEntry       *entry);
 GTime       markup_entry_get_mod_time    (MarkupEntry       *entry);
+/* Locales with schema descriptions; list of interned strings,
+ * free the list but not the data
+ */
+GSList*     markup_entry_list_schema_locales (MarkupEntry  *entry);
 
 #endif
@@ -239,20 +239,21 @@ x_shutdown (GError** err)
   gconf_log(GCL_DEBUG, _("Unloading XML backend module."));
 }
 
+/* Caches are shared between sources, so lock the whole backend */
+static GRecMutex xml_lock;
+
 static void
 lock (GConfSource* source,
       GError** err)
 {
-  
-
+  g_rec_mutex_lock (&xml_lock);
 }
 
 static void
 unlock (GConfSource* source,
         GError** err)
 {
-
-
+  g_rec_mutex_unlock (&xml_lock);
 }
 
 static gboolean
@@ -838,7 +839,9 @@ cleanup_timeout(gpointer data)
 {
   XMLSource* xs = (XMLSource*)data;
 
+  g_rec_mutex_lock (&xml_lock);
   cache_clean(xs->cache, 60*5 /* 5 minutes */);
+  g_rec_mutex_unlock (&xml_lock);
 
   return TRUE;
 }
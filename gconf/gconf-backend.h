@@ -144,6 +144,20 @@ struct _GConfBackendVTable {
 
   void                (* remove_listener) (GConfSource           *source,
 					   guint                  id);
+
+  /* Optional; lets sync_all happen in the background. prepare_sync
+   * returns a job, or NULL if nothing needs saving. run_sync_job may
+   * be called in another thread and must not touch the source;
+   * finish_sync is called back in the main thread. Jobs are run and
+   * finished in the order they were prepared.
+   */
+  gpointer            (* prepare_sync)    (GConfSource           *source);
+
+  gboolean            (* run_sync_job)    (gpointer               job,
+                                           GError               **err);
+
+  void                (* finish_sync)     (GConfSource           *source,
+                                           gpointer               job);
 };
 
 struct _GConfBackend {
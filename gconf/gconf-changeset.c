@@ -533,6 +533,47 @@ commit_foreach (GConfChangeSet* cs,
     }
 }
 
+/* Hands the whole set to the engine at once, so gconfd makes all the
+ * changes in one request. Returns FALSE if the engine can't, after
+ * checking the set so that an invalid key or value fails the commit
+ * before commit_foreach() changes anything.
+ */
+static gboolean
+commit_entries (GConfChangeSet* cs,
+                struct CommitData* cd)
+{
+  GSList* entries;
+  GSList* committed;
+  GSList* tmp;
+  gboolean handled;
+
+  entries = gconf_change_set_get_entries (cs);
+
+  handled = gconf_engine_commit_entries (cd->conf, entries, &committed,
+                                         &cd->error);
+
+  if (!handled)
+    gconf_entries_validate (entries, &cd->error);
+
+  if (handled && cd->remove_committed)
+    {
+      for (tmp = committed; tmp != NULL; tmp = tmp->next)
+        {
+          GConfEntry* entry = tmp->data;
+
+          gconf_change_set_remove (cs, entry->key);
+        }
+    }
+
+  g_slist_free (committed);
+
+  for (tmp = entries; tmp != NULL; tmp = tmp->next)
+    gconf_entry_free (tmp->data);
+  g_slist_free (entries);
+
+  return handled;
+}
+
 gboolean
 gconf_engine_commit_change_set   (GConfEngine* conf,
                            GConfChangeSet* cs,
@@ -556,7 +597,8 @@ gconf_engine_commit_change_set   (GConfEngine* conf,
   gconf_change_set_ref(cs);
   gconf_engine_ref(conf);
   
-  gconf_change_set_foreach(cs, commit_foreach, &cd);
+  if (!commit_entries (cs, &cd))
+    gconf_change_set_foreach(cs, commit_foreach, &cd);
 
   tmp = cd.remove_list;
   while (tmp != NULL)
@@ -29,6 +29,7 @@
 #include "gconfmarshal.c"
 
 static gboolean do_trace = FALSE;
+static gsize default_cache_budget = 0;
 
 static void
 trace (const char *format, ...)
@@ -103,6 +104,59 @@ static Listener* listener_new(GConfClientNotifyFunc func,
 
 static void listener_destroy(Listener* l);
 
+/*
+ * CacheDir object (the cache, indexed by directory)
+ */
+
+typedef struct _CacheDir CacheDir;
+
+struct _CacheDir {
+  gchar* name;
+  CacheDir* parent;
+  /* cached entries directly in this dir, by key; the CacheEntry
+   * structs belong to cache_hash */
+  GHashTable* entries;
+  /* child CacheDirs, by name */
+  GHashTable* subdirs;
+  /* every entry in the dir is cached, so a key that isn't is unset */
+  guint complete : 1;
+};
+
+static CacheDir* cache_dir_ensure   (GConfClient *client,
+                                     const gchar *name);
+static CacheDir* cache_dir_for_key  (GConfClient *client,
+                                     const gchar *key,
+                                     gboolean     create);
+static void      cache_dir_clear    (GConfClient *client,
+                                     CacheDir    *cd);
+static void      cache_dir_prune    (GConfClient *client,
+                                     CacheDir    *cd);
+static void      cache_dir_free     (CacheDir    *cd);
+
+/*
+ * CacheEntry (a cached entry, with its memory accounting)
+ */
+
+typedef struct _CacheEntry CacheEntry;
+
+struct _CacheEntry {
+  GConfEntry* entry;
+  /* our link in client->cache_lru, or NULL if the key is monitored,
+   * in which case notifications keep it current and it isn't evicted */
+  GList* lru_link;
+  /* approximate bytes held for this entry */
+  gsize size;
+};
+
+static void      cache_entry_set    (GConfClient *client,
+                                     CacheEntry  *ce,
+                                     GConfEntry  *entry);
+static void      cache_entry_touch  (GConfClient *client,
+                                     CacheEntry  *ce);
+static void      cache_entry_free   (GConfClient *client,
+                                     CacheEntry  *ce);
+static void      cache_enforce_budget (GConfClient *client);
+
 /*
  * GConfClient proper
  */
@@ -228,6 +282,10 @@ gconf_client_class_init (GConfClientClass *class)
 
   if (g_getenv ("GCONF_DEBUG_TRACE_CLIENT") != NULL)
     do_trace = TRUE;
+
+  if (g_getenv ("GCONF_CLIENT_CACHE_BUDGET") != NULL)
+    default_cache_budget = g_ascii_strtoull (g_getenv ("GCONF_CLIENT_CACHE_BUDGET"),
+                                             NULL, 10);
 }
 
 static void
@@ -237,10 +295,16 @@ gconf_client_init (GConfClient *client)
   client->error_mode = GCONF_CLIENT_HANDLE_UNRETURNED;
   client->dir_hash = g_hash_table_new (g_str_hash, g_str_equal);
   client->cache_hash = g_hash_table_new (g_str_hash, g_str_equal);
-  client->cache_dirs = g_hash_table_new_full (g_str_hash, g_str_equal,
-					      g_free, NULL);
+  client->cache_dirs = g_hash_table_new (g_str_hash, g_str_equal);
   client->cache_recursive_dirs = g_hash_table_new_full (g_str_hash, g_str_equal,
                                                         g_free, NULL);
+  client->cache_lru = g_queue_new ();
+  client->cache_size = 0;
+  client->cache_budget = default_cache_budget;
+  client->cache_hits = 0;
+  client->cache_negative_hits = 0;
+  client->cache_misses = 0;
+  client->cache_evictions = 0;
   /* We create the listeners only if they're actually used */
   client->listeners = NULL;
   client->notify_list = NULL;
@@ -324,6 +388,9 @@ gconf_client_finalize (GObject* object)
   g_hash_table_destroy (client->cache_dirs);
   client->cache_dirs = NULL;
 
+  g_queue_free (client->cache_lru);
+  client->cache_lru = NULL;
+
   unregister_client (client);
 
   set_engine (client, NULL);
@@ -683,24 +750,12 @@ foreach_add_notifies(gpointer key, gpointer value, gpointer user_data)
 }
 
 static gboolean
-clear_dir_cache_foreach (char* key, GConfEntry* entry, char *dir)
-{
-  if (gconf_key_is_below (dir, key))
-    {
-      gconf_entry_free (entry);
-      return TRUE;
-    }
-  else
-    return FALSE;
-}
-
-static gboolean
-clear_cache_dirs_foreach (char *key, gpointer value, char *dir)
+clear_recursive_dirs_foreach (char *key, gpointer value, char *dir)
 {
   if (strcmp (dir, key) == 0 ||
       gconf_key_is_below (dir, key))
     {
-      trace ("'%s' no longer fully cached", dir);
+      trace ("'%s' no longer recursively cached", key);
       return TRUE;
     }
 
@@ -713,6 +768,7 @@ gconf_client_real_remove_dir    (GConfClient* client,
                                  GError** err)
 {
   AddNotifiesData ad;
+  CacheDir *cd;
 
   g_return_if_fail(d != NULL);
   g_return_if_fail(d->add_count == 0);
@@ -730,11 +786,14 @@ gconf_client_real_remove_dir    (GConfClient* client,
       d->notify_id = 0;
     }
   
-  g_hash_table_foreach_remove (client->cache_hash,
-                               (GHRFunc)clear_dir_cache_foreach,
-                               d->name);
-  g_hash_table_foreach_remove (client->cache_dirs,
-                               (GHRFunc)clear_cache_dirs_foreach,
+  cd = g_hash_table_lookup (client->cache_dirs, d->name);
+  if (cd != NULL)
+    {
+      cache_dir_clear (client, cd);
+      cache_dir_prune (client, cd);
+    }
+  g_hash_table_foreach_remove (client->cache_recursive_dirs,
+                               (GHRFunc)clear_recursive_dirs_foreach,
                                d->name);
   dir_destroy(d);
 
@@ -852,9 +911,17 @@ gconf_client_set_error_handling(GConfClient* client,
 }
 
 static gboolean
-clear_cache_foreach (char* key, GConfEntry* entry, GConfClient* client)
+clear_cache_foreach (char* key, CacheEntry* ce, GConfClient* client)
 {
-  gconf_entry_free (entry);
+  cache_entry_free (client, ce);
+
+  return TRUE;
+}
+
+static gboolean
+clear_cache_dirs_foreach (char* name, CacheDir* cd, GConfClient* client)
+{
+  cache_dir_free (cd);
 
   return TRUE;
 }
@@ -870,39 +937,81 @@ gconf_client_clear_cache(GConfClient* client)
   g_hash_table_foreach_remove (client->cache_hash, (GHRFunc)clear_cache_foreach,
                                client);
 
-  g_hash_table_remove_all (client->cache_dirs);
+  g_hash_table_foreach_remove (client->cache_dirs,
+                               (GHRFunc)clear_cache_dirs_foreach, client);
+  g_hash_table_remove_all (client->cache_recursive_dirs);
+
+  g_assert (client->cache_size == 0);
+  g_assert (g_queue_is_empty (client->cache_lru));
 }
 
-static void
-cache_pairs_in_dir(GConfClient* client, const gchar* path, gboolean recursive);
+/**
+ * gconf_client_set_cache_budget:
+ * @client: a #GConfClient.
+ * @max_bytes: approximate number of bytes the cache may hold, or 0 for no limit.
+ *
+ * Bounds the memory held by the client-side cache. Once the cache goes
+ * over @max_bytes, the least recently used entries outside the directories
+ * added with gconf_client_add_dir() are dropped until it fits again.
+ * Entries in added directories are never dropped, since notifications
+ * rely on them, but they still count against the budget.
+ */
+void
+gconf_client_set_cache_budget (GConfClient *client,
+                               gsize        max_bytes)
+{
+  g_return_if_fail (GCONF_IS_CLIENT (client));
 
-static void 
-recurse_subdir_list(GConfClient* client, GSList* subdirs)
+  trace ("Setting cache budget to %lu bytes", (gulong) max_bytes);
+
+  client->cache_budget = max_bytes;
+  cache_enforce_budget (client);
+}
+
+/**
+ * gconf_client_get_cache_budget:
+ * @client: a #GConfClient.
+ *
+ * Return value: the budget set with gconf_client_set_cache_budget(), or 0 if
+ * the cache is unbounded.
+ */
+gsize
+gconf_client_get_cache_budget (GConfClient *client)
 {
-  GSList* tmp;
+  g_return_val_if_fail (GCONF_IS_CLIENT (client), 0);
 
-  tmp = subdirs;
-  
-  while (tmp != NULL)
-    {
-      gchar* s = tmp->data;
-      
-      cache_pairs_in_dir(client, s, TRUE);
+  return client->cache_budget;
+}
 
-      trace ("REMOTE: All dirs at '%s'", s);
-      PUSH_USE_ENGINE (client);
-      recurse_subdir_list(client,
-                          gconf_engine_all_dirs (client->engine, s, NULL));
-      POP_USE_ENGINE (client);
+/**
+ * gconf_client_get_cache_stats:
+ * @client: a #GConfClient.
+ * @stats: (out caller-allocates): location to store the statistics.
+ *
+ * Fills in @stats with the hit, miss and eviction counts of the client-side
+ * cache since @client was created, along with its current size.
+ */
+void
+gconf_client_get_cache_stats (GConfClient           *client,
+                              GConfClientCacheStats *stats)
+{
+  g_return_if_fail (GCONF_IS_CLIENT (client));
+  g_return_if_fail (stats != NULL);
 
-      g_free(s);
-      
-      tmp = g_slist_next(tmp);
-    }
-  
-  g_slist_free(subdirs);
+  stats->hits = client->cache_hits;
+  stats->negative_hits = client->cache_negative_hits;
+  stats->misses = client->cache_misses;
+  stats->evictions = client->cache_evictions;
+  stats->n_entries = g_hash_table_size (client->cache_hash);
+  stats->size = client->cache_size;
+  stats->budget = client->cache_budget;
 }
 
+static void
+cache_pairs_in_dir(GConfClient* client, const gchar* path);
+static void
+cache_subtree (GConfClient* client, const gchar* dir);
+
 static gboolean
 key_being_monitored (GConfClient *client,
                      const char  *key)
@@ -958,7 +1067,7 @@ cache_entry_list_destructively (GConfClient *client,
 }
 
 static void 
-cache_pairs_in_dir(GConfClient* client, const gchar* dir, gboolean recursive)
+cache_pairs_in_dir(GConfClient* client, const gchar* dir)
 {
   GSList* pairs;
   GError* error = NULL;
@@ -977,12 +1086,50 @@ cache_pairs_in_dir(GConfClient* client, const gchar* dir, gboolean recursive)
       error = NULL;
     }
 
-  cache_entry_list_destructively (client, pairs);
+  /* Marked first, so that evicting one of its entries while the rest
+   * are cached leaves it incomplete */
   trace ("Mark '%s' as fully cached", dir);
-  g_hash_table_insert (client->cache_dirs, g_strdup (dir), GINT_TO_POINTER (1));
-  
-  if (recursive)
-    g_hash_table_insert (client->cache_recursive_dirs, g_strdup (dir), GINT_TO_POINTER (1));
+  cache_dir_ensure (client, dir)->complete = TRUE;
+  cache_entry_list_destructively (client, pairs);
+}
+
+/* Caches the whole tree below @dir, fetched in one request */
+static void
+cache_subtree (GConfClient* client, const gchar* dir)
+{
+  GSList* entries;
+  GSList* subdirs;
+  GSList* tmp;
+  GError* error = NULL;
+
+  trace ("REMOTE: Caching everything below '%s'", dir);
+
+  PUSH_USE_ENGINE (client);
+  entries = gconf_engine_all_entries_recursive (client->engine, dir,
+                                                &subdirs, &error);
+  POP_USE_ENGINE (client);
+
+  if (error != NULL)
+    {
+      g_printerr (_("GConf warning: failure listing pairs below `%s': %s"),
+                  dir, error->message);
+      g_error_free (error);
+      return;
+    }
+
+  /* Every dir in the tree is complete, including empty ones. As in
+   * cache_pairs_in_dir(), they are marked before the entries go in. */
+  subdirs = g_slist_prepend (subdirs, g_strdup (dir));
+  for (tmp = subdirs; tmp != NULL; tmp = tmp->next)
+    {
+      trace ("Mark '%s' as fully cached", (char *) tmp->data);
+      cache_dir_ensure (client, tmp->data)->complete = TRUE;
+      g_hash_table_insert (client->cache_recursive_dirs, tmp->data,
+                           GINT_TO_POINTER (1));
+    }
+  g_slist_free (subdirs);
+
+  cache_entry_list_destructively (client, entries);
 }
 
 void
@@ -1015,24 +1162,15 @@ gconf_client_preload    (GConfClient* client,
       {
         trace ("Onelevel preload of '%s'", dirname);
         
-        cache_pairs_in_dir (client, dirname, FALSE);
+        cache_pairs_in_dir (client, dirname);
       }
       break;
 
     case GCONF_CLIENT_PRELOAD_RECURSIVE:
       {
-        GSList* subdirs;
-
         trace ("Recursive preload of '%s'", dirname);
-        
-	trace ("REMOTE: All dirs at '%s'", dirname);
-        PUSH_USE_ENGINE (client);
-        subdirs = gconf_engine_all_dirs(client->engine, dirname, NULL);
-        POP_USE_ENGINE (client);
-        
-        cache_pairs_in_dir(client, dirname, TRUE);
-          
-        recurse_subdir_list(client, subdirs);
+
+        cache_subtree (client, dirname);
       }
       break;
 
@@ -1049,90 +1187,51 @@ gconf_client_preload    (GConfClient* client,
  * D-BUS environment we update the internal cache when changes happen to
  * ensure a consistent state
  */
-static gboolean
-remove_key_from_cache_foreach (const gchar *cached_key,
-                               GConfEntry  *entry,
-                               const gchar *key)
-{
-  if (strcmp (cached_key, key) == 0)
-    {
-      gconf_entry_free (entry);
-      return TRUE;
-    }
-
-  return FALSE;
-}
-
-static gboolean
-remove_key_from_cache_recursively_foreach (const gchar *cached_key,
-                                           GConfEntry  *entry,
-                                           const gchar *key)
-{
-  if (gconf_key_is_below (cached_key, key) == 0 || strcmp (cached_key, key) == 0)
-    {
-      /* Not sure why a null entry would be in the cache, but it happens
-       * sometimes, workaround for now to avoid crashing.
-       */
-      if (entry)
-        gconf_entry_free (entry);
-      return TRUE;
-    }
-
-  return FALSE;
-}
-
-static gboolean
-remove_dir_from_cache_foreach (char     *cached_dir,
-                               gpointer  value,
-                               char     *dir)
-{
-  if (strcmp (dir, cached_dir) == 0)
-    {
-      trace ("'%s' no longer fully cached", dir);
-      return TRUE;
-    }
-
-  return FALSE;
-}
-
 /* The dbus version cleans the cache after modifying a value. So we will
- * remove current dir (where the key is in) from the cache_dirs
- * when removing the key from the cache_hash.
+ * also mark the dir the key is in as no longer fully cached.
  * This is a workaround. It will degrade the performance of querying negative keys in the same dir. 
  */
-static void remove_dir_from_cache (GConfClient *client,
-                                   const gchar *key)
-{
-  char *dir, *last_slash;
-  dir = g_strdup (key);
-  last_slash = strrchr (dir, '/');
-  g_assert (last_slash != NULL);
-  *last_slash = 0;
-  trace ("Remove dir '%s' from cache since one of keys is changed", dir);
-  g_hash_table_foreach_remove (client->cache_dirs,
-                               (GHRFunc) remove_dir_from_cache_foreach,
-                               dir);
-  g_free (dir);
-}
-
 static void
 remove_key_from_cache (GConfClient *client,
                        const gchar *key)
 {
-  g_hash_table_foreach_remove (client->cache_hash,
-                               (GHRFunc) remove_key_from_cache_foreach,
-                               (char *) key);
-  remove_dir_from_cache (client, key);
+  CacheDir *cd;
+  CacheEntry *ce;
+
+  cd = cache_dir_for_key (client, key, FALSE);
+  if (cd == NULL)
+    return;
+
+  ce = g_hash_table_lookup (cd->entries, key);
+  if (ce != NULL)
+    {
+      g_hash_table_remove (cd->entries, key);
+      g_hash_table_remove (client->cache_hash, key);
+      cache_entry_free (client, ce);
+    }
+
+  if (cd->complete)
+    trace ("Remove dir '%s' from cache since one of keys is changed", cd->name);
+  cd->complete = FALSE;
+
+  cache_dir_prune (client, cd);
 }
 
 static void
 remove_key_from_cache_recursively (GConfClient *client,
                                    const gchar *key)
 {
-  g_hash_table_foreach_remove (client->cache_hash,
-                               (GHRFunc) remove_key_from_cache_recursively_foreach,
-                               (char *) key);
-  remove_dir_from_cache (client, key);
+  CacheDir *cd;
+
+  remove_key_from_cache (client, key);
+
+  /* And everything below it, if it's a dir */
+  cd = g_hash_table_lookup (client->cache_dirs, key);
+  if (cd != NULL)
+    {
+      cache_dir_clear (client, cd);
+      cache_dir_prune (client, cd);
+    }
 }
 
 static gboolean
@@ -1283,26 +1382,21 @@ gconf_client_all_entries    (GConfClient* client,
 {
   GError *error = NULL;
   GSList *retval;
-  int dirlen;
+  CacheDir *cd;
 
-  if (g_hash_table_lookup (client->cache_dirs, dir))
+  cd = g_hash_table_lookup (client->cache_dirs, dir);
+  if (cd != NULL && cd->complete)
     {
       GHashTableIter iter;
-      gpointer key, value;
+      gpointer value;
 
       trace ("CACHED: Getting all values in '%s'", dir);
 
-      dirlen = strlen (dir);
       retval = NULL;
-      g_hash_table_iter_init (&iter, client->cache_hash);
-      while (g_hash_table_iter_next (&iter, &key, &value))
-        {
-          const gchar *id = key;
-          GConfEntry *entry = value;
-          if (g_str_has_prefix (id, dir) &&
-              id + dirlen == strrchr (id, '/'))
-            retval = g_slist_prepend (retval, gconf_entry_copy (entry));
-        }
+      g_hash_table_iter_init (&iter, cd->entries);
+      while (g_hash_table_iter_next (&iter, NULL, &value))
+        retval = g_slist_prepend (retval,
+                                  gconf_entry_copy (((CacheEntry *) value)->entry));
 
       return retval;
     }
@@ -1320,9 +1414,9 @@ gconf_client_all_entries    (GConfClient* client,
 
   if (key_being_monitored (client, dir))
     {
-      cache_entry_list_destructively (client, copy_entry_list (retval));
       trace ("Mark '%s' as fully cached", dir);
-      g_hash_table_insert (client->cache_dirs, g_strdup (dir), GINT_TO_POINTER (1));
+      cache_dir_ensure (client, dir)->complete = TRUE;
+      cache_entry_list_destructively (client, copy_entry_list (retval));
     }
 
   return retval;
@@ -1583,6 +1677,97 @@ gconf_client_get_entry (GConfClient* client,
   return entry;
 }
 
+GSList*
+gconf_client_get_many (GConfClient* client,
+                       GSList* keys,
+                       GError** err)
+{
+  GError* error = NULL;
+  GSList *missing;
+  GSList *fetched;
+  GSList *entries;
+  GSList *tmp;
+
+  g_return_val_if_fail (GCONF_IS_CLIENT (client), NULL);
+  g_return_val_if_fail (err == NULL || *err == NULL, NULL);
+
+  /* Cached keys are filled in straight away, the others are left
+   * NULL until they've been fetched
+   */
+  entries = NULL;
+  missing = NULL;
+  for (tmp = keys; tmp != NULL; tmp = tmp->next)
+    {
+      GConfEntry *entry = NULL;
+
+      if (gconf_client_lookup (client, tmp->data, &entry))
+        {
+          trace ("CACHED: Query for '%s'", (const gchar *) tmp->data);
+
+          if (entry != NULL)
+            entry = gconf_entry_copy (entry);
+          else
+            entry = gconf_entry_new (tmp->data, NULL);
+        }
+      else
+        missing = g_slist_prepend (missing, tmp->data);
+
+      entries = g_slist_prepend (entries, entry);
+    }
+  entries = g_slist_reverse (entries);
+  missing = g_slist_reverse (missing);
+
+  if (missing == NULL)
+    return entries;
+
+  trace ("REMOTE: Query for %u keys", g_slist_length (missing));
+
+  PUSH_USE_ENGINE (client);
+  fetched = gconf_engine_get_many (client->engine, missing,
+                                   gconf_current_locale (),
+                                   TRUE /* always use default here */,
+                                   &error);
+  POP_USE_ENGINE (client);
+
+  g_slist_free (missing);
+
+  if (error != NULL)
+    {
+      for (tmp = entries; tmp != NULL; tmp = tmp->next)
+        {
+          if (tmp->data)
+            gconf_entry_free (tmp->data);
+        }
+      g_slist_free (entries);
+
+      handle_error (client, error, err);
+      return NULL;
+    }
+
+  for (tmp = entries; tmp != NULL; tmp = tmp->next)
+    {
+      GConfEntry *entry;
+
+      if (tmp->data != NULL)
+        continue;
+
+      g_assert (fetched != NULL);
+
+      entry = fetched->data;
+      fetched = g_slist_delete_link (fetched, fetched);
+
+      /* Cache this value, if it's in our directory list. */
+      if (key_being_monitored (client, entry->key))
+        gconf_client_cache (client, FALSE, entry, FALSE);
+
+      tmp->data = entry;
+    }
+
+  g_assert (fetched == NULL);
+
+  return entries;
+}
+
 GConfValue*
 gconf_client_get             (GConfClient* client,
                               const gchar* key,
@@ -2288,12 +2473,13 @@ gconf_client_cache (GConfClient *client,
                     GConfEntry  *new_entry,
                     gboolean     preserve_schema_name)
 {
-  gpointer oldkey = NULL, oldval = NULL;
+  CacheEntry *ce;
 
-  if (g_hash_table_lookup_extended (client->cache_hash, new_entry->key, &oldkey, &oldval))
+  ce = g_hash_table_lookup (client->cache_hash, new_entry->key);
+  if (ce != NULL)
     {
       /* Already have a value, update it */
-      GConfEntry *entry = oldval;
+      GConfEntry *entry = ce->entry;
       gboolean changed;
       
       g_assert (entry != NULL);
@@ -2312,9 +2498,14 @@ gconf_client_cache (GConfClient *client,
             gconf_entry_set_schema_name (new_entry, 
                                          gconf_entry_get_schema_name (entry));
 
+          cache_entry_set (client, ce, new_entry);
+
           g_hash_table_replace (client->cache_hash,
                                 new_entry->key,
-                                new_entry);
+                                ce);
+          g_hash_table_replace (cache_dir_for_key (client, new_entry->key, TRUE)->entries,
+                                new_entry->key,
+                                ce);
 
           /* oldkey is inside entry */
           gconf_entry_free (entry);
@@ -2328,6 +2519,9 @@ gconf_client_cache (GConfClient *client,
             gconf_entry_free (new_entry);
         }
 
+      cache_entry_touch (client, ce);
+      cache_enforce_budget (client);
+
       return changed;
     }
   else
@@ -2335,11 +2529,25 @@ gconf_client_cache (GConfClient *client,
       /* Create a new entry */
       if (!take_ownership)
         new_entry = gconf_entry_copy (new_entry);
+
+      ce = g_new0 (CacheEntry, 1);
+      cache_entry_set (client, ce, new_entry);
+
+      /* Only keys nobody is watching may be evicted */
+      if (!key_being_monitored (client, new_entry->key))
+        {
+          g_queue_push_head (client->cache_lru, ce);
+          ce->lru_link = client->cache_lru->head;
+        }
       
-      g_hash_table_insert (client->cache_hash, new_entry->key, new_entry);
+      g_hash_table_insert (client->cache_hash, new_entry->key, ce);
+      g_hash_table_insert (cache_dir_for_key (client, new_entry->key, TRUE)->entries,
+                           new_entry->key, ce);
       trace ("Added value of '%s' to the cache",
              new_entry->key);
 
+      cache_enforce_budget (client);
+
       return TRUE; /* changed */
     }
 }
@@ -2349,33 +2557,41 @@ gconf_client_lookup (GConfClient *client,
                      const char  *key,
                      GConfEntry **entryp)
 {
-  GConfEntry *entry;
+  CacheEntry *ce;
 
   g_return_val_if_fail (entryp != NULL, FALSE);
   g_return_val_if_fail (*entryp == NULL, FALSE);
   
-  entry = g_hash_table_lookup (client->cache_hash, key);
-
-  *entryp = entry;
+  ce = g_hash_table_lookup (client->cache_hash, key);
 
-  if (!entry)
+  if (ce != NULL)
+    {
+      client->cache_hits += 1;
+      cache_entry_touch (client, ce);
+      *entryp = ce->entry;
+      return TRUE;
+    }
+  else
   {
     char *dir, *last_slash;
+    CacheDir *cd;
 
-    dir = g_strdup (key);
-    last_slash = strrchr (dir, '/');
-    g_assert (last_slash != NULL);
-    *last_slash = 0;
-
-    if (g_hash_table_lookup (client->cache_dirs, dir))
+    cd = cache_dir_for_key (client, key, FALSE);
+    if (cd != NULL && cd->complete)
       {
-        g_free (dir);
         trace ("Negative cache hit on %s", key);
+        client->cache_negative_hits += 1;
         return TRUE;
       }
     else 
       {
         gboolean not_cached = FALSE;
+
+        dir = g_strdup (key);
+        last_slash = strrchr (dir, '/');
+        g_assert (last_slash != NULL);
+        *last_slash = 0;
+
         while(not_cached || (!g_hash_table_lookup (client->cache_recursive_dirs, dir)))
           {
             last_slash = strrchr (dir, '/');
@@ -2387,15 +2603,19 @@ gconf_client_lookup (GConfClient *client,
               {
                 g_free (dir);
                 trace ("Non-existing dir for %s", key);
+                client->cache_negative_hits += 1;
                 return TRUE;
               }
             not_cached = TRUE;
           }
+
+        g_free (dir);
       }
-    g_free (dir);
   }
 
-  return entry != NULL;
+  client->cache_misses += 1;
+
+  return FALSE;
 }
 
 /*
@@ -2426,6 +2646,291 @@ dir_destroy(Dir* d)
   g_free(d);
 }
 
+/*
+ * CacheDir
+ */
+
+/* The dir @key is in, or NULL if it has no slash */
+static gchar*
+cache_key_dir (const gchar *key)
+{
+  const gchar *last_slash;
+
+  last_slash = strrchr (key, '/');
+  if (last_slash == NULL)
+    return NULL;
+  else if (last_slash == key)
+    return g_strdup ("/");
+  else
+    return g_strndup (key, last_slash - key);
+}
+
+static CacheDir*
+cache_dir_ensure (GConfClient *client,
+                  const gchar *name)
+{
+  CacheDir *cd;
+  gchar *parent_name;
+
+  cd = g_hash_table_lookup (client->cache_dirs, name);
+  if (cd != NULL)
+    return cd;
+
+  cd = g_new0 (CacheDir, 1);
+  cd->name = g_strdup (name);
+  cd->entries = g_hash_table_new (g_str_hash, g_str_equal);
+  cd->subdirs = g_hash_table_new (g_str_hash, g_str_equal);
+
+  g_hash_table_insert (client->cache_dirs, cd->name, cd);
+
+  /* Link it to its parent, so recursive invalidation can find it */
+  parent_name = NULL;
+  if (strcmp (name, "/") != 0)
+    parent_name = cache_key_dir (name);
+
+  if (parent_name != NULL)
+    {
+      cd->parent = cache_dir_ensure (client, parent_name);
+      g_hash_table_insert (cd->parent->subdirs, cd->name, cd);
+      g_free (parent_name);
+    }
+
+  return cd;
+}
+
+static CacheDir*
+cache_dir_for_key (GConfClient *client,
+                   const gchar *key,
+                   gboolean     create)
+{
+  CacheDir *cd;
+  gchar *dir;
+
+  dir = cache_key_dir (key);
+  if (dir == NULL)
+    return NULL;
+
+  if (create)
+    cd = cache_dir_ensure (client, dir);
+  else
+    cd = g_hash_table_lookup (client->cache_dirs, dir);
+
+  g_free (dir);
+
+  return cd;
+}
+
+/* Drops every cached entry in @cd and below it, and the dirs below it */
+static void
+cache_dir_clear (GConfClient *client,
+                 CacheDir    *cd)
+{
+  GHashTableIter iter;
+  gpointer key, value;
+
+  g_hash_table_iter_init (&iter, cd->entries);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+      g_hash_table_iter_remove (&iter);
+      g_hash_table_remove (client->cache_hash, key);
+      cache_entry_free (client, value);
+    }
+
+  if (cd->complete)
+    trace ("'%s' no longer fully cached", cd->name);
+  cd->complete = FALSE;
+
+  g_hash_table_iter_init (&iter, cd->subdirs);
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    {
+      CacheDir *sub = value;
+
+      cache_dir_clear (client, sub);
+
+      g_hash_table_iter_remove (&iter);
+      g_hash_table_remove (client->cache_dirs, sub->name);
+      cache_dir_free (sub);
+    }
+}
+
+/* Frees @cd and its ancestors for as long as they hold nothing */
+static void
+cache_dir_prune (GConfClient *client,
+                 CacheDir    *cd)
+{
+  while (cd != NULL &&
+         !cd->complete &&
+         g_hash_table_size (cd->entries) == 0 &&
+         g_hash_table_size (cd->subdirs) == 0)
+    {
+      CacheDir *parent = cd->parent;
+
+      if (parent != NULL)
+        g_hash_table_remove (parent->subdirs, cd->name);
+      g_hash_table_remove (client->cache_dirs, cd->name);
+      cache_dir_free (cd);
+
+      cd = parent;
+    }
+}
+
+static void
+cache_dir_free (CacheDir *cd)
+{
+  g_hash_table_destroy (cd->entries);
+  g_hash_table_destroy (cd->subdirs);
+  g_free (cd->name);
+  g_free (cd);
+}
+
+/*
+ * CacheEntry
+ */
+
+/* Rough heap footprint of a value: the struct plus what it points to */
+static gsize
+cache_value_size (const GConfValue *value)
+{
+  gsize size;
+  GSList *tmp;
+
+  if (value == NULL)
+    return 0;
+
+  size = sizeof (GConfValue) + 2 * sizeof (gpointer);
+
+  switch (value->type)
+    {
+    case GCONF_VALUE_STRING:
+      size += strlen (gconf_value_get_string (value)) + 1;
+      break;
+
+    case GCONF_VALUE_LIST:
+      for (tmp = gconf_value_get_list (value); tmp != NULL; tmp = tmp->next)
+        size += sizeof (GSList) + cache_value_size (tmp->data);
+      break;
+
+    case GCONF_VALUE_PAIR:
+      size += cache_value_size (gconf_value_get_car (value));
+      size += cache_value_size (gconf_value_get_cdr (value));
+      break;
+
+    case GCONF_VALUE_SCHEMA:
+      {
+        GConfSchema *schema = gconf_value_get_schema (value);
+        const char *strs[4];
+        int i;
+
+        strs[0] = gconf_schema_get_locale (schema);
+        strs[1] = gconf_schema_get_short_desc (schema);
+        strs[2] = gconf_schema_get_long_desc (schema);
+        strs[3] = gconf_schema_get_owner (schema);
+
+        size += 8 * sizeof (gpointer);
+        for (i = 0; i < 4; i++)
+          if (strs[i] != NULL)
+            size += strlen (strs[i]) + 1;
+        size += cache_value_size (gconf_schema_get_default_value (schema));
+      }
+      break;
+
+    default:
+      break;
+    }
+
+  return size;
+}
+
+/* Points @ce at @entry, which it then owns, and re-accounts its size.
+ * The entry struct and the two hash table nodes that point at it are
+ * counted with the key.
+ */
+static void
+cache_entry_set (GConfClient *client,
+                 CacheEntry  *ce,
+                 GConfEntry  *entry)
+{
+  const char *schema_name;
+
+  client->cache_size -= ce->size;
+
+  ce->entry = entry;
+  ce->size = sizeof (CacheEntry) + 12 * sizeof (gpointer);
+  ce->size += strlen (entry->key) + 1;
+  ce->size += cache_value_size (gconf_entry_get_value (entry));
+  schema_name = gconf_entry_get_schema_name (entry);
+  if (schema_name != NULL)
+    ce->size += strlen (schema_name) + 1;
+
+  client->cache_size += ce->size;
+}
+
+/* Marks @ce as the most recently used */
+static void
+cache_entry_touch (GConfClient *client,
+                   CacheEntry  *ce)
+{
+  if (ce->lru_link == NULL || ce->lru_link == client->cache_lru->head)
+    return;
+
+  g_queue_unlink (client->cache_lru, ce->lru_link);
+  g_queue_push_head_link (client->cache_lru, ce->lru_link);
+}
+
+/* Frees @ce and its entry; the caller removes it from the tables */
+static void
+cache_entry_free (GConfClient *client,
+                  CacheEntry  *ce)
+{
+  if (ce->lru_link != NULL)
+    g_queue_delete_link (client->cache_lru, ce->lru_link);
+
+  g_assert (client->cache_size >= ce->size);
+  client->cache_size -= ce->size;
+
+  gconf_entry_free (ce->entry);
+  g_free (ce);
+}
+
+/* Drops least recently used entries until the cache fits its budget */
+static void
+cache_enforce_budget (GConfClient *client)
+{
+  if (client->cache_budget == 0)
+    return;
+
+  while (client->cache_size > client->cache_budget &&
+         client->cache_lru->tail != NULL)
+    {
+      CacheEntry *ce = client->cache_lru->tail->data;
+      const char *key = ce->entry->key;
+      CacheDir *cd;
+
+      /* Its dir may have been added since it was cached */
+      if (key_being_monitored (client, key))
+        {
+          g_queue_delete_link (client->cache_lru, ce->lru_link);
+          ce->lru_link = NULL;
+          continue;
+        }
+
+      trace ("Evicting '%s' from the cache", key);
+
+      cd = cache_dir_for_key (client, key, FALSE);
+      g_assert (cd != NULL);
+
+      g_hash_table_remove (cd->entries, key);
+      g_hash_table_remove (client->cache_hash, key);
+      cache_entry_free (client, ce);
+
+      /* The dir is no longer all there, so don't answer unset for it */
+      cd->complete = FALSE;
+      cache_dir_prune (client, cd);
+
+      client->cache_evictions += 1;
+    }
+}
+
 /*
  * Listener
  */
@@ -2495,6 +3000,61 @@ commit_foreach (GConfChangeSet* cs,
     }
 }
 
+/* Commits the whole set in one request where the engine can, and
+ * updates the cache for the keys that changed. Returns FALSE if the
+ * engine can't, after checking the set so that an invalid key or
+ * value fails the commit before commit_foreach() changes anything.
+ */
+static gboolean
+commit_entries (GConfChangeSet* cs,
+                struct CommitData* cd)
+{
+  GSList* entries;
+  GSList* committed;
+  GSList* tmp;
+  GError* error = NULL;
+  gboolean handled;
+
+  entries = gconf_change_set_get_entries (cs);
+
+  trace ("REMOTE: Committing %u changes", g_slist_length (entries));
+  PUSH_USE_ENGINE (cd->client);
+  handled = gconf_engine_commit_entries (cd->client->engine, entries,
+                                         &committed, &error);
+  POP_USE_ENGINE (cd->client);
+
+  if (handled)
+    {
+      for (tmp = committed; tmp != NULL; tmp = tmp->next)
+        {
+          GConfEntry* entry = tmp->data;
+
+#ifdef HAVE_DBUS
+          if (entry->value)
+            cache_key_value_and_notify (cd->client, entry->key,
+                                        entry->value, FALSE);
+          else
+            remove_key_from_cache (cd->client, entry->key);
+#endif
+
+          if (cd->remove_committed)
+            gconf_change_set_remove (cs, entry->key);
+        }
+
+      handle_error (cd->client, error, &cd->error);
+    }
+  else if (!gconf_entries_validate (entries, &error))
+    handle_error (cd->client, error, &cd->error);
+
+  g_slist_free (committed);
+
+  for (tmp = entries; tmp != NULL; tmp = tmp->next)
+    gconf_entry_free (tmp->data);
+  g_slist_free (entries);
+
+  return handled;
+}
+
 gboolean
 gconf_client_commit_change_set   (GConfClient* client,
                                   GConfChangeSet* cs,
@@ -2519,7 +3079,8 @@ gconf_client_commit_change_set   (GConfClient* client,
   gconf_change_set_ref(cs);
   g_object_ref(G_OBJECT(client));
   
-  gconf_change_set_foreach(cs, commit_foreach, &cd);
+  if (!commit_entries (cs, &cd))
+    gconf_change_set_foreach(cs, commit_foreach, &cd);
 
   tmp = cd.remove_list;
   while (tmp != NULL)
@@ -69,6 +69,7 @@ typedef enum { /*< prefix=GCONF_CLIENT >*/
 
 typedef struct _GConfClient       GConfClient;
 typedef struct _GConfClientClass  GConfClientClass;
+typedef struct _GConfClientCacheStats GConfClientCacheStats;
 
 
 typedef void (*GConfClientNotifyFunc)(GConfClient* client,
@@ -102,6 +103,24 @@ struct _GConfClient
   int pending_notify_count;
   GHashTable *cache_dirs;
   GHashTable *cache_recursive_dirs;
+  GQueue *cache_lru;
+  gsize cache_size;
+  gsize cache_budget;
+  gulong cache_hits;
+  gulong cache_negative_hits;
+  gulong cache_misses;
+  gulong cache_evictions;
+};
+
+struct _GConfClientCacheStats
+{
+  gulong hits;           /* lookups answered with a cached value */
+  gulong negative_hits;  /* lookups answered "unset" from the cache */
+  gulong misses;         /* lookups that had to ask the engine */
+  gulong evictions;      /* entries dropped to stay within the budget */
+  guint  n_entries;      /* entries currently cached */
+  gsize  size;           /* approximate bytes they hold */
+  gsize  budget;         /* the budget, or 0 if unbounded */
 };
 
 struct _GConfClientClass
@@ -214,6 +233,20 @@ void              gconf_client_set_global_default_error_handler(GConfClientError
  */
 void              gconf_client_clear_cache(GConfClient* client);
 
+/*
+ * Bound the memory the cache may hold, in bytes (0, the default, means
+ * no bound). Past the budget, the least recently used entries outside
+ * the directories you've added are dropped; entries in added directories
+ * are kept up to date by notification and are never dropped, though
+ * they count against the budget. The default can also be set with the
+ * GCONF_CLIENT_CACHE_BUDGET environment variable.
+ */
+void              gconf_client_set_cache_budget (GConfClient           *client,
+                                                 gsize                  max_bytes);
+gsize             gconf_client_get_cache_budget (GConfClient           *client);
+void              gconf_client_get_cache_stats  (GConfClient           *client,
+                                                 GConfClientCacheStats *stats);
+
 /*
  * Preload a directory; the directory must have been added already.
  * This is only useful as an optimization if you clear the cache,
@@ -250,6 +283,13 @@ GConfEntry*       gconf_client_get_entry        (GConfClient* client,
                                                  gboolean use_schema_default,
                                                  GError** err);
 
+/* Returns a list of GConfEntry, one for each key in the same order;
+ * all the keys that aren't cached are fetched in one request.
+ */
+GSList*           gconf_client_get_many         (GConfClient* client,
+                                                 GSList* keys,
+                                                 GError** err);
+
 GConfValue*       gconf_client_get_default_from_schema (GConfClient* client,
                                                         const gchar* key,
                                                         GError** err);
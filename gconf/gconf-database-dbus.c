@@ -30,15 +30,44 @@
 static gint object_nr = 0;
 
 typedef struct {
-  char  *namespace_section;
-  GList *clients;
+  char       *namespace_section;
+
+  /* ListeningClientData -> how many times it added the section */
+  GHashTable *clients;
 } NotificationData;
 
 typedef struct {
   gchar *service;
   gint nr_of_notifications;
+
+  /* The NotificationData it listens on, each once */
+  GSList *sections;
+
+  /* Sections that matched the change being delivered */
+  GSList *matched;
+
+  /* Notifications waiting for the next NotifyMany, newest first */
+  GSList *pending;
+  guint   n_pending;
 } ListeningClientData;
 
+/* A change waiting to be sent, shared by all the clients it goes to */
+typedef struct {
+  gint        refcount;
+  GConfEntry *entry;
+} PendingChange;
+
+typedef struct {
+  gchar         *namespace_section;
+  PendingChange *change;
+} PendingNotify;
+
+/* How long changes wait for others to be sent with, and how many a
+ * client can have waiting before they are sent anyway.
+ */
+#define NOTIFY_BATCH_TIMEOUT_MSEC 50
+#define NOTIFY_BATCH_MAX          1000
+
 static void              database_unregistered_func         (DBusConnection   *connection,
 							     GConfDatabase    *db);
 static DBusHandlerResult database_message_func              (DBusConnection   *connection,
@@ -57,6 +86,9 @@ static void     database_handle_lookup            (DBusConnection   *conn,
 static void     database_handle_lookup_ext        (DBusConnection   *conn,
 						   DBusMessage      *message,
 						   GConfDatabase    *db);
+static void     database_handle_lookup_many       (DBusConnection   *conn,
+						   DBusMessage      *message,
+						   GConfDatabase    *db);
 static void     database_handle_lookup_default    (DBusConnection   *conn,
 						   DBusMessage      *message,
 						   GConfDatabase    *db);
@@ -78,18 +110,34 @@ static void     database_handle_get_all_entries   (DBusConnection   *conn,
 static void     database_handle_get_all_dirs      (DBusConnection   *conn,
 						   DBusMessage      *message,
 						   GConfDatabase    *db);
+static void     database_handle_get_subtree       (DBusConnection   *conn,
+						   DBusMessage      *message,
+						   GConfDatabase    *db);
 static void     database_handle_set_schema        (DBusConnection   *conn,
 						   DBusMessage      *message,
 						   GConfDatabase    *db);
 static void     database_handle_suggest_sync      (DBusConnection   *conn,
 						   DBusMessage      *message,
 						   GConfDatabase    *db);
+static void     database_handle_get_sync_stats    (DBusConnection   *conn,
+						   DBusMessage      *message,
+						   GConfDatabase    *db);
+static void     database_handle_get_statistics    (DBusConnection   *conn,
+						   DBusMessage      *message,
+						   GConfDatabase    *db);
+static void     database_handle_get_cache_stats   (DBusConnection   *conn,
+						   DBusMessage      *message,
+						   GConfDatabase    *db);
+static void     database_handle_commit_change_set (DBusConnection   *conn,
+						   DBusMessage      *message,
+						   GConfDatabase    *db);
 static void     database_handle_add_notify        (DBusConnection   *conn,
 						   DBusMessage      *message,
 						   GConfDatabase    *db);
-static gboolean database_remove_notification_data (GConfDatabase    *db,
-						   NotificationData *notification,
-						   const char       *client);
+static gboolean database_remove_notification_data (GConfDatabase       *db,
+						   NotificationData    *notification,
+						   ListeningClientData *client,
+						   gboolean             all);
 static void     database_handle_remove_notify     (DBusConnection   *conn,
 						   DBusMessage      *message,
 						   GConfDatabase    *db);
@@ -111,14 +159,206 @@ database_unregistered_func (DBusConnection *connection, GConfDatabase *db)
 {
 }
 
+/*
+ * Per-method call counts and latencies, for GetStatistics. Calls are
+ * counted into buckets of one decade of microseconds each.
+ */
+
+static const struct {
+  guint64     limit;
+  const char *name;
+} latency_buckets[] = {
+  { 10,          "under-10us" },
+  { 100,         "under-100us" },
+  { 1000,        "under-1ms" },
+  { 10000,       "under-10ms" },
+  { 100000,      "under-100ms" },
+  { 1000000,     "under-1s" },
+  { G_MAXUINT64, "over-1s" }
+};
+
+#define N_LATENCY_BUCKETS G_N_ELEMENTS (latency_buckets)
+
+typedef struct {
+  guint64 n_calls;
+  guint64 total_time;
+  guint64 max_time;
+  guint64 buckets[N_LATENCY_BUCKETS];
+} MethodStats;
+
+/* Worker threads record their calls too */
+static GMutex method_stats_lock;
+
+static void
+database_record_call (GConfDatabase *db,
+		      DBusMessage   *message,
+		      gint64         start_time)
+{
+  const char *method;
+  MethodStats *stats;
+  guint64 elapsed;
+  guint i;
+
+  method = dbus_message_get_member (message);
+  if (method == NULL)
+    return;
+
+  elapsed = g_get_monotonic_time () - start_time;
+
+  g_mutex_lock (&method_stats_lock);
+
+  stats = g_hash_table_lookup (db->method_stats, method);
+  if (stats == NULL)
+    {
+      stats = g_new0 (MethodStats, 1);
+      g_hash_table_insert (db->method_stats, g_strdup (method), stats);
+    }
+
+  stats->n_calls++;
+  stats->total_time += elapsed;
+  stats->max_time = MAX (stats->max_time, elapsed);
+
+  for (i = 0; elapsed >= latency_buckets[i].limit; i++)
+    ;
+  stats->buckets[i]++;
+
+  g_mutex_unlock (&method_stats_lock);
+}
+
+/*
+ * Worker pool. With GCONF_WORKER_THREADS set, read-only queries are
+ * answered by a pool of threads, each holding its database's lock
+ * for reading; everything else is handled in the main loop, holding
+ * it for writing.
+ */
+
+typedef void (* QueryHandler) (DBusConnection *conn,
+			       DBusMessage    *message,
+			       GConfDatabase  *db);
+
+static const struct {
+  const char   *method;
+  QueryHandler  handler;
+} query_methods[] = {
+  { GCONF_DBUS_DATABASE_LOOKUP,           database_handle_lookup },
+  { GCONF_DBUS_DATABASE_LOOKUP_EXTENDED,  database_handle_lookup_ext },
+  { GCONF_DBUS_DATABASE_LOOKUP_MANY,      database_handle_lookup_many },
+  { GCONF_DBUS_DATABASE_LOOKUP_DEFAULT,   database_handle_lookup_default },
+  { GCONF_DBUS_DATABASE_DIR_EXISTS,       database_handle_dir_exists },
+  { GCONF_DBUS_DATABASE_GET_ALL_ENTRIES,  database_handle_get_all_entries },
+  { GCONF_DBUS_DATABASE_GET_ALL_DIRS,     database_handle_get_all_dirs },
+  { GCONF_DBUS_DATABASE_GET_SUBTREE,      database_handle_get_subtree }
+};
+
+typedef struct {
+  GConfDatabase  *db;
+  DBusConnection *conn;
+  DBusMessage    *message;
+  QueryHandler    handler;
+  gint64          queued_time;
+} QueryJob;
+
+static GThreadPool *query_pool = NULL;
+
+/* Protects each database's n_queries */
+static GMutex queries_lock;
+static GCond  queries_cond;
+
+static void
+query_thread_func (QueryJob *job,
+		   gpointer  user_data)
+{
+  GConfDatabase *db = job->db;
+
+  g_rw_lock_reader_lock (&db->lock);
+  (* job->handler) (job->conn, job->message, db);
+  g_rw_lock_reader_unlock (&db->lock);
+
+  /* Time spent queued counts, the client waited for it */
+  database_record_call (db, job->message, job->queued_time);
+
+  dbus_message_unref (job->message);
+  dbus_connection_unref (job->conn);
+  g_free (job);
+
+  g_mutex_lock (&queries_lock);
+  db->n_queries--;
+  g_cond_broadcast (&queries_cond);
+  g_mutex_unlock (&queries_lock);
+}
+
+static gboolean
+database_queue_query (DBusConnection *conn,
+		      DBusMessage    *message,
+		      GConfDatabase  *db)
+{
+  QueryJob *job;
+  guint i;
+
+  if (query_pool == NULL ||
+      dbus_message_get_type (message) != DBUS_MESSAGE_TYPE_METHOD_CALL)
+    return FALSE;
+
+  for (i = 0; i < G_N_ELEMENTS (query_methods); i++)
+    {
+      if (dbus_message_is_method_call (message,
+				       GCONF_DBUS_DATABASE_INTERFACE,
+				       query_methods[i].method))
+	break;
+    }
+
+  if (i == G_N_ELEMENTS (query_methods))
+    return FALSE;
+
+  job = g_new (QueryJob, 1);
+  job->db = db;
+  job->conn = dbus_connection_ref (conn);
+  job->message = dbus_message_ref (message);
+  job->handler = query_methods[i].handler;
+  job->queued_time = g_get_monotonic_time ();
+
+  g_mutex_lock (&queries_lock);
+  db->n_queries++;
+  g_mutex_unlock (&queries_lock);
+
+  g_thread_pool_push (query_pool, job, NULL);
+
+  return TRUE;
+}
+
+/* Called before a write is handled and before the database goes away */
+static void
+database_wait_for_queries (GConfDatabase *db)
+{
+  g_mutex_lock (&queries_lock);
+  while (db->n_queries > 0)
+    g_cond_wait (&queries_cond, &queries_lock);
+  g_mutex_unlock (&queries_lock);
+}
+
 static DBusHandlerResult
 database_message_func (DBusConnection *connection,
                        DBusMessage    *message,
                        GConfDatabase  *db)
 {
+  gint64 start_time;
+
   if (gconfd_dbus_check_in_shutdown (connection, message))
     return DBUS_HANDLER_RESULT_HANDLED;
 
+  if (database_queue_query (connection, message, db))
+    return DBUS_HANDLER_RESULT_HANDLED;
+
+  /* Timed from here, like a queued query from when it was queued */
+  start_time = g_get_monotonic_time ();
+
+  /* Reads queued before this request have to see the database as it
+   * was when they arrived, so answer them all first.
+   */
+  database_wait_for_queries (db);
+
+  g_rw_lock_writer_lock (&db->lock);
+
   if (dbus_message_is_method_call (message,
 				   GCONF_DBUS_DATABASE_INTERFACE,
 				   GCONF_DBUS_DATABASE_LOOKUP)) {
@@ -129,6 +369,11 @@ database_message_func (DBusConnection *connection,
 					GCONF_DBUS_DATABASE_LOOKUP_EXTENDED)) {
     database_handle_lookup_ext (connection, message, db);
   }
+  else if (dbus_message_is_method_call (message,
+					GCONF_DBUS_DATABASE_INTERFACE,
+					GCONF_DBUS_DATABASE_LOOKUP_MANY)) {
+    database_handle_lookup_many (connection, message, db);
+  }
   else if (dbus_message_is_method_call (message,
 					GCONF_DBUS_DATABASE_INTERFACE,
 					GCONF_DBUS_DATABASE_LOOKUP_DEFAULT)) {
@@ -164,6 +409,11 @@ database_message_func (DBusConnection *connection,
 					GCONF_DBUS_DATABASE_GET_ALL_DIRS)) {
     database_handle_get_all_dirs (connection, message, db);
   }
+  else if (dbus_message_is_method_call (message,
+					GCONF_DBUS_DATABASE_INTERFACE,
+					GCONF_DBUS_DATABASE_GET_SUBTREE)) {
+    database_handle_get_subtree (connection, message, db);
+  }
   else if (dbus_message_is_method_call (message,
 					GCONF_DBUS_DATABASE_INTERFACE,
 					GCONF_DBUS_DATABASE_SET_SCHEMA)) {
@@ -174,6 +424,26 @@ database_message_func (DBusConnection *connection,
 					GCONF_DBUS_DATABASE_SUGGEST_SYNC)) {
     database_handle_suggest_sync (connection, message, db);
   }
+  else if (dbus_message_is_method_call (message,
+					GCONF_DBUS_DATABASE_INTERFACE,
+					GCONF_DBUS_DATABASE_GET_SYNC_STATS)) {
+    database_handle_get_sync_stats (connection, message, db);
+  }
+  else if (dbus_message_is_method_call (message,
+					GCONF_DBUS_DATABASE_INTERFACE,
+					GCONF_DBUS_DATABASE_GET_CACHE_STATS)) {
+    database_handle_get_cache_stats (connection, message, db);
+  }
+  else if (dbus_message_is_method_call (message,
+					GCONF_DBUS_DATABASE_INTERFACE,
+					GCONF_DBUS_DATABASE_GET_STATISTICS)) {
+    database_handle_get_statistics (connection, message, db);
+  }
+  else if (dbus_message_is_method_call (message,
+					GCONF_DBUS_DATABASE_INTERFACE,
+					GCONF_DBUS_DATABASE_COMMIT_CHANGE_SET)) {
+    database_handle_commit_change_set (connection, message, db);
+  }
   else if (dbus_message_is_method_call (message,
 					GCONF_DBUS_DATABASE_INTERFACE,
 					GCONF_DBUS_DATABASE_ADD_NOTIFY)) {
@@ -184,20 +454,15 @@ database_message_func (DBusConnection *connection,
 					GCONF_DBUS_DATABASE_REMOVE_NOTIFY)) {
 	  database_handle_remove_notify (connection, message, db);
   } else {
+    g_rw_lock_writer_unlock (&db->lock);
     return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
   }
 
-  return DBUS_HANDLER_RESULT_HANDLED;
-}
+  g_rw_lock_writer_unlock (&db->lock);
 
-static void
-get_all_notifications_func (gpointer key,
-			    gpointer value,
-			    gpointer user_data)
-{
-  GList **list = user_data;
-  
-  *list = g_list_prepend (*list, value);
+  database_record_call (db, message, start_time);
+
+  return DBUS_HANDLER_RESULT_HANDLED;
 }
 
 static DBusHandlerResult
@@ -228,8 +493,6 @@ database_handle_name_owner_changed (DBusConnection *connection,
   gchar               *service;
   gchar               *old_owner;
   gchar               *new_owner;
-  GList               *notifications = NULL, *l;
-  NotificationData    *notification;
   ListeningClientData *client;
   
   dbus_message_get_args (message,
@@ -245,26 +508,10 @@ database_handle_name_owner_changed (DBusConnection *connection,
       return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
     }
 
-  g_hash_table_foreach (db->notifications, get_all_notifications_func,
-			&notifications);
-  
-  /* Note: This might be a bit too slow to do like this. We could add a hash
-   * table that maps client base service names to notification data, instead of
-   * going through the entire list of notifications and clients.
-   */
-  for (l = notifications; l; l = l->next)
-    {
-      notification = l->data;
-      
-      database_remove_notification_data (db, notification, service);
-    }
- 
   client = g_hash_table_lookup (db->listening_clients, service);
   if (client)
     database_remove_listening_client (db, client);
 
-  g_list_free (notifications);
-
   return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
 }
     
@@ -301,7 +548,8 @@ database_handle_lookup (DBusConnection *conn,
   reply = dbus_message_new_method_return (message);
 
   dbus_message_iter_init_append (reply, &iter);
-  gconf_dbus_utils_append_value (&iter, value);
+  gconf_dbus_utils_append_value (&iter, value,
+				 gconfd_dbus_get_wire_format (message));
 
   dbus_connection_send (conn, reply, NULL);
   dbus_message_unref (reply);
@@ -354,7 +602,8 @@ database_handle_lookup_ext (DBusConnection *conn,
 					  value,
 					  value_is_default,
 					  value_is_writable,
-					  schema_name);
+					  schema_name,
+					  gconfd_dbus_get_wire_format (message));
   
   dbus_connection_send (conn, reply, NULL);
   dbus_message_unref (reply);
@@ -366,6 +615,83 @@ database_handle_lookup_ext (DBusConnection *conn,
     gconf_value_free (value);
 }
 
+/* Like LookupExtended for each key, replying with the entries in
+ * the same order; the first error fails the whole lookup.
+ */
+static void 
+database_handle_lookup_many (DBusConnection *conn,
+			     DBusMessage    *message,
+			     GConfDatabase  *db)
+{
+  GSList *entries, *l;
+  DBusMessage *reply;
+  gchar **keys;
+  int n_keys;
+  gchar *locale;
+  GConfLocaleList *locales;
+  gboolean use_schema_default;
+  GError *gerror = NULL;
+  DBusMessageIter iter;
+  int i;
+  
+  if (!gconfd_dbus_get_message_args (conn, message,
+				     DBUS_TYPE_ARRAY, DBUS_TYPE_STRING,
+				     &keys, &n_keys,
+				     DBUS_TYPE_STRING, &locale,
+				     DBUS_TYPE_BOOLEAN, &use_schema_default,
+				     DBUS_TYPE_INVALID))
+    return;
+  
+  locales = gconfd_locale_cache_lookup (locale);
+
+  entries = NULL;
+  for (i = 0; i < n_keys; i++)
+    {
+      GConfEntry *entry;
+      GConfValue *value;
+      gchar *schema_name = NULL;
+      gboolean value_is_default;
+      gboolean value_is_writable;
+
+      value = gconf_database_query_value (db, keys[i], locales->list,
+					  use_schema_default,
+					  &schema_name, &value_is_default, 
+					  &value_is_writable, &gerror);
+      if (gerror != NULL)
+	break;
+
+      entry = gconf_entry_new_nocopy (g_strdup (keys[i]), value);
+      gconf_entry_set_is_default (entry, value_is_default);
+      gconf_entry_set_is_writable (entry, value_is_writable);
+      gconf_entry_set_schema_name (entry, schema_name);
+      g_free (schema_name);
+
+      entries = g_slist_prepend (entries, entry);
+    }
+
+  entries = g_slist_reverse (entries);
+
+  if (!gconfd_dbus_set_exception (conn, message, &gerror))
+    {
+      reply = dbus_message_new_method_return (message);
+
+      dbus_message_iter_init_append (reply, &iter);
+      gconf_dbus_utils_append_entries (&iter, entries,
+				       gconfd_dbus_get_wire_format (message));
+
+      dbus_connection_send (conn, reply, NULL);
+      dbus_message_unref (reply);
+    }
+  else
+    g_error_free (gerror);
+
+  for (l = entries; l; l = l->next)
+    gconf_entry_free (l->data);
+  g_slist_free (entries);
+
+  dbus_free_string_array (keys);
+}
+
 static void 
 database_handle_lookup_default (DBusConnection *conn,
 				DBusMessage    *message,
@@ -399,7 +725,8 @@ database_handle_lookup_default (DBusConnection *conn,
   dbus_message_iter_init_append (reply, &iter);
 
   if (value)
-    gconf_dbus_utils_append_value (&iter, value);
+    gconf_dbus_utils_append_value (&iter, value,
+				   gconfd_dbus_get_wire_format (message));
   
   dbus_connection_send (conn, reply, NULL);
   dbus_message_unref (reply);
@@ -471,6 +798,96 @@ database_handle_unset (DBusConnection *conn,
 
 }
                                                                                
+/* Makes every change in the message, then replies with whether the
+ * changes were made at all and the key, error code and message of
+ * each change that failed.
+ */
+static void
+database_handle_commit_change_set (DBusConnection *conn,
+				   DBusMessage    *message,
+				   GConfDatabase  *db)
+{
+  GSList *entries;
+  GSList *errors;
+  GSList *l;
+  gchar *locale;
+  dbus_bool_t applied;
+  DBusMessage *reply;
+  DBusMessageIter iter;
+  DBusMessageIter array_iter;
+
+  if (!dbus_message_has_signature (message, "a(svbsbb)s") &&
+      !dbus_message_has_signature (message, "a(ssbsbb)s"))
+    {
+      reply = dbus_message_new_error (message, GCONF_DBUS_ERROR_FAILED,
+				      _("Got a malformed message."));
+      dbus_connection_send (conn, reply, NULL);
+      dbus_message_unref (reply);
+      return;
+    }
+
+  /* Keys are read as sent, so gconf_database_commit_changes() rejects
+   * relative ones instead of rooting them.
+   */
+  dbus_message_iter_init (message, &iter);
+  entries = g_slist_reverse (gconf_dbus_utils_get_entries (&iter, NULL));
+
+  dbus_message_iter_next (&iter);
+  dbus_message_iter_get_basic (&iter, &locale);
+
+  if (locale[0] == '\0')
+    locale = NULL;
+
+  errors = NULL;
+  applied = gconf_database_commit_changes (db, entries, locale, &errors);
+
+  reply = dbus_message_new_method_return (message);
+
+  dbus_message_iter_init_append (reply, &iter);
+  dbus_message_iter_append_basic (&iter, DBUS_TYPE_BOOLEAN, &applied);
+  dbus_message_iter_open_container (&iter,
+				    DBUS_TYPE_ARRAY,
+				    DBUS_STRUCT_BEGIN_CHAR_AS_STRING
+				    DBUS_TYPE_STRING_AS_STRING
+				    DBUS_TYPE_INT32_AS_STRING
+				    DBUS_TYPE_STRING_AS_STRING
+				    DBUS_STRUCT_END_CHAR_AS_STRING,
+				    &array_iter);
+
+  for (l = errors; l; l = l->next)
+    {
+      GConfDatabaseCommitError *commit_error = l->data;
+      DBusMessageIter struct_iter;
+      gint32 code;
+
+      code = commit_error->error->code;
+
+      dbus_message_iter_open_container (&array_iter,
+					DBUS_TYPE_STRUCT,
+					NULL,
+					&struct_iter);
+      dbus_message_iter_append_basic (&struct_iter, DBUS_TYPE_STRING,
+				      &commit_error->key);
+      dbus_message_iter_append_basic (&struct_iter, DBUS_TYPE_INT32,
+				      &code);
+      dbus_message_iter_append_basic (&struct_iter, DBUS_TYPE_STRING,
+				      &commit_error->error->message);
+      dbus_message_iter_close_container (&array_iter, &struct_iter);
+    }
+
+  if (!dbus_message_iter_close_container (&iter, &array_iter))
+    g_error ("Out of memory");
+
+  dbus_connection_send (conn, reply, NULL);
+  dbus_message_unref (reply);
+
+  gconf_database_commit_errors_free (errors);
+
+  for (l = entries; l; l = l->next)
+    gconf_entry_free (l->data);
+  g_slist_free (entries);
+}
+
 static void
 database_handle_recursive_unset  (DBusConnection *conn,
                                   DBusMessage    *message,
@@ -565,7 +982,8 @@ database_handle_get_all_entries (DBusConnection *conn,
 
   dbus_message_iter_init_append (reply, &iter);
 
-  gconf_dbus_utils_append_entries (&iter, entries);
+  gconf_dbus_utils_append_entries (&iter, entries,
+				   gconfd_dbus_get_wire_format (message));
 
   for (l = entries; l; l = l->next)
     {
@@ -629,6 +1047,111 @@ database_handle_get_all_dirs (DBusConnection *conn,
   dbus_connection_send (conn, reply, NULL);
   dbus_message_unref (reply);
 }
+
+/* Collects the entries in @dir and everything below it, with absolute
+ * keys, and the absolute names of the dirs below it.
+ */
+static gboolean
+database_collect_subtree (GConfDatabase   *db,
+			  const gchar     *dir,
+			  const gchar    **locales,
+			  GSList         **entries,
+			  GSList         **dirs,
+			  GError         **gerror)
+{
+  GSList *dir_entries, *subdirs, *l;
+
+  dir_entries = gconf_database_all_entries (db, dir, locales, gerror);
+  if (*gerror != NULL)
+    return FALSE;
+
+  for (l = dir_entries; l; l = l->next)
+    {
+      GConfEntry *entry = l->data;
+      gchar *full;
+
+      full = gconf_concat_dir_and_key (dir, entry->key);
+      g_free (entry->key);
+      entry->key = full;
+    }
+  *entries = g_slist_concat (dir_entries, *entries);
+
+  subdirs = gconf_database_all_dirs (db, dir, gerror);
+  if (*gerror != NULL)
+    return FALSE;
+
+  for (l = subdirs; l; l = l->next)
+    {
+      gchar *full;
+
+      full = gconf_concat_dir_and_key (dir, l->data);
+      g_free (l->data);
+
+      *dirs = g_slist_prepend (*dirs, full);
+
+      if (*gerror == NULL)
+	database_collect_subtree (db, full, locales, entries, dirs, gerror);
+    }
+  g_slist_free (subdirs);
+
+  return *gerror == NULL;
+}
+
+static void
+database_handle_get_subtree (DBusConnection *conn,
+			     DBusMessage    *message,
+			     GConfDatabase  *db)
+{
+  GSList          *entries, *dirs, *l;
+  gchar           *dir;
+  gchar           *locale;
+  GError          *gerror = NULL;
+  GConfLocaleList *locales;
+  DBusMessage     *reply;
+  DBusMessageIter  iter;
+  DBusMessageIter  array_iter;
+
+  if (!gconfd_dbus_get_message_args (conn, message,
+				     DBUS_TYPE_STRING, &dir,
+				     DBUS_TYPE_STRING, &locale,
+				     DBUS_TYPE_INVALID))
+    return;
+
+  locales = gconfd_locale_cache_lookup (locale);
+
+  entries = NULL;
+  dirs = NULL;
+  database_collect_subtree (db, dir, locales->list, &entries, &dirs, &gerror);
+
+  if (!gconfd_dbus_set_exception (conn, message, &gerror))
+    {
+      /* The dirs first, so the client knows which ones are empty */
+      reply = dbus_message_new_method_return (message);
+
+      dbus_message_iter_init_append (reply, &iter);
+
+      dbus_message_iter_open_container (&iter,
+					DBUS_TYPE_ARRAY,
+					DBUS_TYPE_STRING_AS_STRING,
+					&array_iter);
+      for (l = dirs; l; l = l->next)
+	dbus_message_iter_append_basic (&array_iter, DBUS_TYPE_STRING, &l->data);
+      dbus_message_iter_close_container (&iter, &array_iter);
+
+      gconf_dbus_utils_append_entries (&iter, entries,
+				       gconfd_dbus_get_wire_format (message));
+
+      dbus_connection_send (conn, reply, NULL);
+      dbus_message_unref (reply);
+    }
+
+  for (l = entries; l; l = l->next)
+    gconf_entry_free (l->data);
+  g_slist_free (entries);
+
+  g_slist_foreach (dirs, (GFunc) g_free, NULL);
+  g_slist_free (dirs);
+}
                                                                                 
 static void
 database_handle_set_schema (DBusConnection *conn,
@@ -660,6 +1183,39 @@ database_handle_set_schema (DBusConnection *conn,
   dbus_message_unref (reply);
 }
 
+typedef struct
+{
+  DBusConnection *conn;
+  DBusMessage    *message;
+} FlushReply;
+
+static void
+database_flushed (GConfDatabase *db,
+                  const GError  *error,
+                  FlushReply    *fr)
+{
+  DBusMessage *reply;
+
+  if (error != NULL)
+    {
+      GError *gerror;
+
+      gerror = g_error_copy (error);
+      gconfd_dbus_set_exception (fr->conn, fr->message, &gerror);
+      g_error_free (gerror);
+    }
+  else
+    {
+      reply = dbus_message_new_method_return (fr->message);
+      dbus_connection_send (fr->conn, reply, NULL);
+      dbus_message_unref (reply);
+    }
+
+  dbus_message_unref (fr->message);
+  dbus_connection_unref (fr->conn);
+  g_free (fr);
+}
+
 static void
 database_handle_suggest_sync (DBusConnection *conn,
 		              DBusMessage    *message,
@@ -667,6 +1223,22 @@ database_handle_suggest_sync (DBusConnection *conn,
 {
   GError *gerror = NULL;
   DBusMessage *reply;
+  dbus_bool_t wait = FALSE;
+
+  /* With a TRUE argument, reply once the data is on disk */
+  if (dbus_message_get_args (message, NULL,
+                             DBUS_TYPE_BOOLEAN, &wait,
+                             DBUS_TYPE_INVALID) && wait)
+    {
+      FlushReply *fr;
+
+      fr = g_new (FlushReply, 1);
+      fr->conn = dbus_connection_ref (conn);
+      fr->message = dbus_message_ref (message);
+
+      gconf_database_flush (db, (GConfDatabaseFlushFunc) database_flushed, fr);
+      return;
+    }
   
   gconf_database_sync (db, &gerror);
   
@@ -678,6 +1250,211 @@ database_handle_suggest_sync (DBusConnection *conn,
   dbus_message_unref (reply);
 }
 
+static void
+append_stat (DBusMessageIter *dict,
+             const char      *name,
+             guint64          value)
+{
+  DBusMessageIter entry;
+  dbus_uint64_t v = value;
+
+  dbus_message_iter_open_container (dict, DBUS_TYPE_DICT_ENTRY, NULL, &entry);
+  dbus_message_iter_append_basic (&entry, DBUS_TYPE_STRING, &name);
+  dbus_message_iter_append_basic (&entry, DBUS_TYPE_UINT64, &v);
+  dbus_message_iter_close_container (dict, &entry);
+}
+
+/* The write-back policy, the current dirty state and the counters
+ * since gconfd started. Times are in microseconds.
+ */
+static void
+append_sync_stats (DBusMessageIter *dict,
+                   GConfDatabase   *db)
+{
+  GConfDatabaseSyncStats *stats = &db->sync_stats;
+  guint coalesce_msec;
+  guint max_dirty_age;
+  gsize max_dirty_bytes;
+  guint64 dirty_age;
+
+  gconf_database_get_sync_policy (&coalesce_msec,
+                                  &max_dirty_age,
+                                  &max_dirty_bytes);
+
+  dirty_age = 0;
+  if (db->dirty_since != 0)
+    dirty_age = g_get_monotonic_time () - db->dirty_since;
+
+  append_stat (dict, "coalesce-msec", coalesce_msec);
+  append_stat (dict, "max-dirty-age", max_dirty_age);
+  append_stat (dict, "max-dirty-bytes", max_dirty_bytes);
+
+  append_stat (dict, "dirty-bytes", db->dirty_bytes);
+  append_stat (dict, "dirty-age", dirty_age);
+
+  append_stat (dict, "writes", stats->n_writes);
+  append_stat (dict, "syncs", stats->n_syncs);
+  append_stat (dict, "sync-failures", stats->n_sync_failures);
+  append_stat (dict, "syncs-by-age", stats->n_syncs_by_age);
+  append_stat (dict, "syncs-by-bytes", stats->n_syncs_by_bytes);
+  append_stat (dict, "syncs-suggested", stats->n_syncs_suggested);
+  append_stat (dict, "suggests-coalesced", stats->n_suggests_coalesced);
+  append_stat (dict, "bytes-synced", stats->bytes_synced);
+  append_stat (dict, "sync-time", stats->sync_time);
+  append_stat (dict, "max-sync-time", stats->max_sync_time);
+  append_stat (dict, "background-syncs", stats->n_background_syncs);
+  append_stat (dict, "blocked-time", stats->blocked_time);
+  append_stat (dict, "max-blocked-time", stats->max_blocked_time);
+}
+
+/* Replies to @message with the counters as a{st} */
+static void
+database_reply_stats (DBusConnection *conn,
+                      DBusMessage    *message,
+                      GConfDatabase  *db,
+                      void          (*append_func) (DBusMessageIter *dict,
+                                                    GConfDatabase   *db))
+{
+  DBusMessage *reply;
+  DBusMessageIter iter;
+  DBusMessageIter dict;
+
+  reply = dbus_message_new_method_return (message);
+  dbus_message_iter_init_append (reply, &iter);
+  dbus_message_iter_open_container (&iter, DBUS_TYPE_ARRAY,
+                                    DBUS_DICT_ENTRY_BEGIN_CHAR_AS_STRING
+                                    DBUS_TYPE_STRING_AS_STRING
+                                    DBUS_TYPE_UINT64_AS_STRING
+                                    DBUS_DICT_ENTRY_END_CHAR_AS_STRING,
+                                    &dict);
+
+  (* append_func) (&dict, db);
+
+  dbus_message_iter_close_container (&iter, &dict);
+
+  dbus_connection_send (conn, reply, NULL);
+  dbus_message_unref (reply);
+}
+
+static void
+database_handle_get_sync_stats (DBusConnection *conn,
+                                DBusMessage    *message,
+                                GConfDatabase  *db)
+{
+  database_reply_stats (conn, message, db, append_sync_stats);
+}
+
+static void
+append_cache_stats (DBusMessageIter *dict,
+                    GConfDatabase   *db)
+{
+  GConfDatabaseValueCacheStats stats;
+  guint n_keys;
+  GConfSourceMissingStats missing;
+
+  g_mutex_lock (&db->value_cache_lock);
+  stats = db->value_cache_stats;
+  n_keys = g_hash_table_size (db->value_cache);
+  g_mutex_unlock (&db->value_cache_lock);
+
+  gconf_sources_get_missing_stats (db->sources, &missing);
+
+  append_stat (dict, "value-cache-keys", n_keys);
+  append_stat (dict, "value-cache-lookups", stats.n_lookups);
+  append_stat (dict, "value-cache-hits", stats.n_hits);
+  append_stat (dict, "value-cache-invalidations", stats.n_invalidations);
+  append_stat (dict, "value-cache-flushes", stats.n_flushes);
+
+  append_stat (dict, "missing-lookups", missing.n_lookups);
+  append_stat (dict, "missing-hits", missing.n_hits);
+  append_stat (dict, "missing-invalidations", missing.n_invalidations);
+}
+
+static void
+database_handle_get_cache_stats (DBusConnection *conn,
+                                 DBusMessage    *message,
+                                 GConfDatabase  *db)
+{
+  database_reply_stats (conn, message, db, append_cache_stats);
+}
+
+/* Method stats are reported as method-<Method>-calls, -time and
+ * -max-time in microseconds, and one counter per latency bucket.
+ */
+static void
+append_method_stats (DBusMessageIter *dict,
+                     GConfDatabase   *db)
+{
+  GHashTableIter iter;
+  gpointer key, value;
+
+  g_mutex_lock (&method_stats_lock);
+
+  g_hash_table_iter_init (&iter, db->method_stats);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+      MethodStats *stats = value;
+      gchar *name;
+      guint i;
+
+      name = g_strdup_printf ("method-%s-calls", (gchar *) key);
+      append_stat (dict, name, stats->n_calls);
+      g_free (name);
+
+      name = g_strdup_printf ("method-%s-time", (gchar *) key);
+      append_stat (dict, name, stats->total_time);
+      g_free (name);
+
+      name = g_strdup_printf ("method-%s-max-time", (gchar *) key);
+      append_stat (dict, name, stats->max_time);
+      g_free (name);
+
+      for (i = 0; i < N_LATENCY_BUCKETS; i++)
+        {
+          name = g_strdup_printf ("method-%s-%s", (gchar *) key,
+                                  latency_buckets[i].name);
+          append_stat (dict, name, stats->buckets[i]);
+          g_free (name);
+        }
+    }
+
+  g_mutex_unlock (&method_stats_lock);
+}
+
+static void
+append_all_stats (DBusMessageIter *dict,
+                  GConfDatabase   *db)
+{
+  GHashTableIter iter;
+  gpointer value;
+  guint64 n_listeners;
+
+  n_listeners = 0;
+  g_hash_table_iter_init (&iter, db->listening_clients);
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    n_listeners += ((ListeningClientData *) value)->nr_of_notifications;
+
+  append_stat (dict, "listening-clients",
+               g_hash_table_size (db->listening_clients));
+  append_stat (dict, "listeners", n_listeners);
+  append_stat (dict, "listened-dirs", g_hash_table_size (db->notifications));
+  append_stat (dict, "notifications", db->n_notifications);
+  append_stat (dict, "notify-messages", db->n_notify_messages);
+  append_stat (dict, "worker-threads", gconf_database_get_worker_threads ());
+
+  append_cache_stats (dict, db);
+  append_sync_stats (dict, db);
+  append_method_stats (dict, db);
+}
+
+static void
+database_handle_get_statistics (DBusConnection *conn,
+                                DBusMessage    *message,
+                                GConfDatabase  *db)
+{
+  database_reply_stats (conn, message, db, append_all_stats);
+}
+
 static void
 database_handle_add_notify (DBusConnection    *conn,
                             DBusMessage       *message,
@@ -688,6 +1465,7 @@ database_handle_add_notify (DBusConnection    *conn,
   const char *sender;
   NotificationData *notification;
   ListeningClientData *client;
+  gint count;
 
   if (!gconfd_dbus_get_message_args (conn, message,
 				     DBUS_TYPE_STRING, &namespace_section,
@@ -712,43 +1490,61 @@ database_handle_add_notify (DBusConnection    *conn,
     {
       notification = g_new0 (NotificationData, 1);
       notification->namespace_section = g_strdup (namespace_section);
+      notification->clients = g_hash_table_new (NULL, NULL);
 
       g_hash_table_insert (db->notifications,
 			   notification->namespace_section, notification);
     }
-  
-  notification->clients = g_list_prepend (notification->clients,
-					  g_strdup (sender));
+
+  /* A client adding the same section twice still gets each change
+   * once; it dispatches to all its listeners on the section itself.
+   */
+  count = GPOINTER_TO_INT (g_hash_table_lookup (notification->clients, client));
+  if (count == 0)
+    client->sections = g_slist_prepend (client->sections, notification);
+
+  g_hash_table_insert (notification->clients, client,
+		       GINT_TO_POINTER (count + 1));
   
   reply = dbus_message_new_method_return (message);
   dbus_connection_send (conn, reply, NULL);
   dbus_message_unref (reply);
 }
 
+/* Drops one of the client's registrations on the section, or all of
+ * them.
+ */
 static gboolean
-database_remove_notification_data (GConfDatabase *db,
-				   NotificationData *notification,
-				   const char *client)
+database_remove_notification_data (GConfDatabase       *db,
+				   NotificationData    *notification,
+				   ListeningClientData *client,
+				   gboolean             all)
 {
-  GList *element;
-  
-  element = g_list_find_custom (notification->clients, client,
-			     (GCompareFunc)strcmp);
-  if (element == NULL)
+  gint count;
+
+  count = GPOINTER_TO_INT (g_hash_table_lookup (notification->clients, client));
+  if (count == 0)
     return FALSE;
-  
-  notification->clients = g_list_remove_link (notification->clients, element);
-  if (notification->clients == NULL)
+
+  if (count > 1 && !all)
+    {
+      g_hash_table_insert (notification->clients, client,
+			   GINT_TO_POINTER (count - 1));
+      return TRUE;
+    }
+
+  g_hash_table_remove (notification->clients, client);
+  client->sections = g_slist_remove (client->sections, notification);
+
+  if (g_hash_table_size (notification->clients) == 0)
     {
       g_hash_table_remove (db->notifications,
 			   notification->namespace_section);
 
+      g_hash_table_destroy (notification->clients);
       g_free (notification->namespace_section);
       g_free (notification);
     }
-  
-  g_free (element->data);
-  g_list_free_1 (element);
 
   return TRUE;
 }
@@ -774,20 +1570,21 @@ database_handle_remove_notify (DBusConnection    *conn,
   notification = g_hash_table_lookup (db->notifications, namespace_section);
 
   client = g_hash_table_lookup (db->listening_clients, sender);
-  if (client) {
-    client->nr_of_notifications--;
-    
-    if (client->nr_of_notifications == 0) {
-      database_remove_listening_client (db, client);
-    }
-  }
-    
+
   /* Notification can be NULL if the client and server get out of sync. */
-  if (notification == NULL || !database_remove_notification_data (db, notification, sender))
+  if (client == NULL || notification == NULL ||
+      !database_remove_notification_data (db, notification, client, FALSE))
     {
       gconf_log (GCL_DEBUG, _("Notification on %s doesn't exist"),
                  namespace_section);
     }
+  else
+    {
+      client->nr_of_notifications--;
+
+      if (client->nr_of_notifications == 0)
+	database_remove_listening_client (db, client);
+    }
   
   reply = dbus_message_new_method_return (message);
   dbus_connection_send (conn, reply, NULL);
@@ -824,17 +1621,216 @@ database_add_listening_client (GConfDatabase *db,
   return client;
 }
 
+static PendingChange *
+pending_change_new (const gchar      *key,
+		    const GConfValue *value,
+		    gboolean          is_default,
+		    gboolean          is_writable)
+{
+  PendingChange *change;
+
+  change = g_new (PendingChange, 1);
+  change->refcount = 1;
+  change->entry = gconf_entry_new (key, value);
+  gconf_entry_set_is_default (change->entry, is_default);
+  gconf_entry_set_is_writable (change->entry, is_writable);
+
+  return change;
+}
+
+static void
+pending_change_unref (PendingChange *change)
+{
+  if (--change->refcount > 0)
+    return;
+
+  gconf_entry_free (change->entry);
+  g_free (change);
+}
+
+static void
+pending_notify_free (PendingNotify *notify)
+{
+  pending_change_unref (notify->change);
+  g_free (notify->namespace_section);
+  g_free (notify);
+}
+
+static void
+database_free_pending_notifications (ListeningClientData *client)
+{
+  g_slist_foreach (client->pending, (GFunc) pending_notify_free, NULL);
+  g_slist_free (client->pending);
+  client->pending = NULL;
+  client->n_pending = 0;
+}
+
+/* Sends everything queued for the client as one NotifyMany: the
+ * changed entries, each once, followed by (namespace_section, index)
+ * pairs saying which of the client's sections each entry matched.
+ */
+static void
+database_send_pending_notifications (GConfDatabase       *db,
+				     ListeningClientData *client)
+{
+  DBusMessage     *message;
+  DBusMessageIter  iter;
+  DBusMessageIter  array_iter;
+  DBusMessageIter  struct_iter;
+  GHashTable      *indices;
+  GSList          *entries;
+  GSList          *l;
+  guint            n_entries;
+
+  if (client->pending == NULL)
+    return;
+
+  client->pending = g_slist_reverse (client->pending);
+
+  indices = g_hash_table_new (NULL, NULL);
+  entries = NULL;
+  n_entries = 0;
+  for (l = client->pending; l; l = l->next)
+    {
+      PendingNotify *notify = l->data;
+
+      if (g_hash_table_lookup_extended (indices, notify->change, NULL, NULL))
+	continue;
+
+      g_hash_table_insert (indices, notify->change,
+			   GUINT_TO_POINTER (n_entries));
+      entries = g_slist_prepend (entries, notify->change->entry);
+      n_entries++;
+    }
+  entries = g_slist_reverse (entries);
+
+  message = dbus_message_new_method_call (client->service,
+					  GCONF_DBUS_CLIENT_OBJECT,
+					  GCONF_DBUS_CLIENT_INTERFACE,
+					  GCONF_DBUS_LISTENER_NOTIFY_MANY);
+
+  dbus_message_append_args (message,
+			    DBUS_TYPE_OBJECT_PATH, &db->object_path,
+			    DBUS_TYPE_INVALID);
+
+  dbus_message_iter_init_append (message, &iter);
+
+  gconf_dbus_utils_append_entries (&iter, entries, GCONF_DBUS_WIRE_BATCHED);
+
+  dbus_message_iter_open_container (&iter,
+				    DBUS_TYPE_ARRAY,
+				    DBUS_STRUCT_BEGIN_CHAR_AS_STRING
+				    DBUS_TYPE_STRING_AS_STRING
+				    DBUS_TYPE_UINT32_AS_STRING
+				    DBUS_STRUCT_END_CHAR_AS_STRING,
+				    &array_iter);
+
+  for (l = client->pending; l; l = l->next)
+    {
+      PendingNotify *notify = l->data;
+      dbus_uint32_t  index;
+
+      index = GPOINTER_TO_UINT (g_hash_table_lookup (indices, notify->change));
+
+      dbus_message_iter_open_container (&array_iter,
+					DBUS_TYPE_STRUCT,
+					NULL,
+					&struct_iter);
+      dbus_message_iter_append_basic (&struct_iter, DBUS_TYPE_STRING,
+				      &notify->namespace_section);
+      dbus_message_iter_append_basic (&struct_iter, DBUS_TYPE_UINT32, &index);
+      dbus_message_iter_close_container (&array_iter, &struct_iter);
+    }
+
+  dbus_message_iter_close_container (&iter, &array_iter);
+
+  dbus_message_set_no_reply (message, TRUE);
+
+  dbus_connection_send (gconfd_dbus_get_connection (), message, NULL);
+  dbus_message_unref (message);
+
+  db->n_notifications += client->n_pending;
+  db->n_notify_messages++;
+
+  g_hash_table_destroy (indices);
+  g_slist_free (entries);
+
+  database_free_pending_notifications (client);
+}
+
+static void
+send_pending_notifications_func (gpointer key,
+				 gpointer value,
+				 gpointer user_data)
+{
+  database_send_pending_notifications (user_data, value);
+}
+
+void
+gconf_database_dbus_flush_notifications (GConfDatabase *db)
+{
+  if (db->notify_flush_id != 0)
+    {
+      g_source_remove (db->notify_flush_id);
+      db->notify_flush_id = 0;
+    }
+
+  g_hash_table_foreach (db->listening_clients,
+			send_pending_notifications_func,
+			db);
+}
+
+static gboolean
+database_flush_notifications_timeout (gpointer data)
+{
+  GConfDatabase *db = data;
+
+  db->notify_flush_id = 0;
+  gconf_database_dbus_flush_notifications (db);
+
+  return FALSE;
+}
+
+static void
+database_queue_notification (GConfDatabase       *db,
+			     ListeningClientData *client,
+			     const gchar         *namespace_section,
+			     PendingChange       *change)
+{
+  PendingNotify *notify;
+
+  notify = g_new (PendingNotify, 1);
+  notify->namespace_section = g_strdup (namespace_section);
+  notify->change = change;
+  change->refcount++;
+
+  client->pending = g_slist_prepend (client->pending, notify);
+  client->n_pending++;
+
+  if (client->n_pending >= NOTIFY_BATCH_MAX)
+    database_send_pending_notifications (db, client);
+  else if (db->notify_flush_id == 0)
+    db->notify_flush_id = g_timeout_add (NOTIFY_BATCH_TIMEOUT_MSEC,
+					 database_flush_notifications_timeout,
+					 db);
+}
+
 static void
 database_remove_listening_client (GConfDatabase       *db,
 				  ListeningClientData *client)
 {
   gchar *rule;
 
+  while (client->sections != NULL)
+    database_remove_notification_data (db, client->sections->data,
+				       client, TRUE);
+
   rule = get_rule_for_service (client->service);
   dbus_bus_remove_match (gconfd_dbus_get_connection (), rule, NULL);
   g_free (rule);
 
   g_hash_table_remove (db->listening_clients, client->service);
+  database_free_pending_notifications (client);
   g_free (client->service);
   g_free (client);
 }
@@ -859,6 +1855,19 @@ gconf_database_dbus_setup (GConfDatabase *db)
 
   db->notifications = g_hash_table_new (g_str_hash, g_str_equal);
   db->listening_clients = g_hash_table_new (g_str_hash, g_str_equal);
+  db->notify_flush_id = 0;
+  db->n_queries = 0;
+  db->method_stats = g_hash_table_new_full (g_str_hash, g_str_equal,
+					    g_free, g_free);
+
+  if (query_pool == NULL && gconf_database_get_worker_threads () > 0)
+    {
+      query_pool = g_thread_pool_new ((GFunc) query_thread_func, NULL,
+				      gconf_database_get_worker_threads (),
+				      FALSE, NULL);
+      gconf_log (GCL_DEBUG, "Answering queries from %u worker threads",
+		 gconf_database_get_worker_threads ());
+    }
  
   dbus_connection_add_filter (conn,
 			      (DBusHandleMessageFunction)database_filter_func,
@@ -873,6 +1882,10 @@ gconf_database_dbus_teardown (GConfDatabase *db)
 
   conn = gconfd_dbus_get_connection ();
 
+  database_wait_for_queries (db);
+
+  gconf_database_dbus_flush_notifications (db);
+
   gconfd_emit_db_gone (db->object_path);
   dbus_connection_unregister_object_path (conn, db->object_path);
   
@@ -887,6 +1900,9 @@ gconf_database_dbus_teardown (GConfDatabase *db)
 
   g_hash_table_destroy (db->listening_clients);
   db->listening_clients = NULL;
+
+  g_hash_table_destroy (db->method_stats);
+  db->method_stats = NULL;
 }
 
 const char *
@@ -895,6 +1911,72 @@ gconf_database_dbus_get_path (GConfDatabase *db)
   return db->object_path;
 }
 
+static void
+database_send_notification (GConfDatabase       *db,
+			    ListeningClientData *client,
+			    const gchar         *namespace_section,
+			    const gchar         *key,
+			    const GConfValue    *value,
+			    gboolean             is_default,
+			    gboolean             is_writable)
+{
+  DBusMessage     *message;
+  DBusMessageIter  iter;
+
+  message = dbus_message_new_method_call (client->service,
+					  GCONF_DBUS_CLIENT_OBJECT,
+					  GCONF_DBUS_CLIENT_INTERFACE,
+					  GCONF_DBUS_LISTENER_NOTIFY);
+
+  dbus_message_append_args (message,
+			    DBUS_TYPE_OBJECT_PATH, &db->object_path,
+			    DBUS_TYPE_STRING, &namespace_section,
+			    DBUS_TYPE_INVALID);
+
+  dbus_message_iter_init_append (message, &iter);
+
+  gconf_dbus_utils_append_entry_values (&iter,
+					key,
+					value,
+					is_default,
+					is_writable,
+					NULL,
+					gconfd_dbus_get_client_wire_format (client->service));
+
+  dbus_message_set_no_reply (message, TRUE);
+
+  dbus_connection_send (gconfd_dbus_get_connection (), message, NULL);
+  dbus_message_unref (message);
+
+  db->n_notifications++;
+  db->n_notify_messages++;
+}
+
+/* Notes the section as matched for each of its clients, returning
+ * the clients that had nothing matched yet prepended to the list.
+ */
+static GSList *
+database_match_notification (NotificationData *notification,
+			     GSList           *clients)
+{
+  GHashTableIter iter;
+  gpointer       client_p;
+
+  g_hash_table_iter_init (&iter, notification->clients);
+  while (g_hash_table_iter_next (&iter, &client_p, NULL))
+    {
+      ListeningClientData *client = client_p;
+
+      if (client->matched == NULL)
+	clients = g_slist_prepend (clients, client);
+
+      client->matched = g_slist_prepend (client->matched,
+					 notification->namespace_section);
+    }
+
+  return clients;
+}
+
 void
 gconf_database_dbus_notify_listeners (GConfDatabase    *db,
 				      GConfSources     *modified_sources,
@@ -905,17 +1987,18 @@ gconf_database_dbus_notify_listeners (GConfDatabase    *db,
 				      gboolean          notify_others)
 {
   char             *dir, *sep;
-  GList            *l;
+  GSList           *clients, *l, *s;
   NotificationData *notification;
-  DBusMessage      *message;
   gboolean          last;
+  PendingChange    *change;
   
   dir = g_strdup (key);
+  clients = NULL;
 
-  /* Lookup the key in the namespace hierarchy, start with the full key and then
-   * remove the leaf, lookup again, remove the leaf, and so on until a match is
-   * found. Notify the clients (identified by their base service) that
-   * correspond to the found namespace.
+  /* Lookup the key in the namespace hierarchy, start with the full key and
+   * then remove the leaf, lookup again, and so on up to the root, gathering
+   * the distinct clients (identified by their base service) listening on
+   * any of those sections along with the sections each matched.
    */
   last = FALSE;
   while (1)
@@ -923,37 +2006,7 @@ gconf_database_dbus_notify_listeners (GConfDatabase    *db,
       notification = g_hash_table_lookup (db->notifications, dir);
 
       if (notification)
-	{
-	  for (l = notification->clients; l; l = l->next)
-	    {
-	      const char *base_service = l->data;
-	      DBusMessageIter iter;
-	      
-	      message = dbus_message_new_method_call (base_service,
-						      GCONF_DBUS_CLIENT_OBJECT,
-						      GCONF_DBUS_CLIENT_INTERFACE,
-						      "Notify");
-
-	      dbus_message_append_args (message,
-					DBUS_TYPE_OBJECT_PATH, &db->object_path,
-					DBUS_TYPE_STRING, &dir,
-					DBUS_TYPE_INVALID);
-
-	      dbus_message_iter_init_append (message, &iter);
-	      
-	      gconf_dbus_utils_append_entry_values (&iter,
-						    key,
-						    value,
-						    is_default,
-						    is_writable,
-						    NULL);
-	      
-	      dbus_message_set_no_reply (message, TRUE);
-	      
-	      dbus_connection_send (gconfd_dbus_get_connection (), message, NULL);
-	      dbus_message_unref (message);
-	    }
-	}
+	clients = database_match_notification (notification, clients);
 
       if (last)
 	break;
@@ -970,9 +2023,46 @@ gconf_database_dbus_notify_listeners (GConfDatabase    *db,
 	*sep = '\0';
     }
 
-    
+  /* The matched sections now point into the NotificationData, which
+   * stay put while we send.
+   */
   g_free (dir);
 
+  /* Clients that understand NotifyMany get the change queued, sharing
+   * one copy of it; the others get a Notify per matched section.
+   */
+  change = NULL;
+  for (l = clients; l; l = l->next)
+    {
+      ListeningClientData *client = l->data;
+      gboolean             batched;
+
+      batched = gconfd_dbus_get_client_wire_format (client->service) >= GCONF_DBUS_WIRE_BATCHED;
+
+      if (batched && change == NULL)
+	change = pending_change_new (key, value, is_default, is_writable);
+
+      /* Deepest section first, as before */
+      client->matched = g_slist_reverse (client->matched);
+
+      for (s = client->matched; s; s = s->next)
+	{
+	  if (batched)
+	    database_queue_notification (db, client, s->data, change);
+	  else
+	    database_send_notification (db, client, s->data,
+					key, value, is_default, is_writable);
+	}
+
+      g_slist_free (client->matched);
+      client->matched = NULL;
+    }
+
+  g_slist_free (clients);
+
+  if (change != NULL)
+    pending_change_unref (change);
+
   if (modified_sources)
     {
       if (notify_others)
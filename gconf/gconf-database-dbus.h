@@ -33,5 +33,6 @@ void         gconf_database_dbus_notify_listeners (GConfDatabase    *db,
 						   gboolean          is_default,
 						   gboolean          is_writable,
 						   gboolean          notify_others);
+void         gconf_database_dbus_flush_notifications (GConfDatabase *db);
 
 #endif
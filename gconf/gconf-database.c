@@ -787,9 +787,274 @@ static POA_ConfigDatabase3__vepv poa_server_vepv = { &base_epv, &server_epv, &se
 #endif /* HAVE_CORBA */
 
 static void gconf_database_really_sync (GConfDatabase *db);
+static void gconf_database_sync_and_log (GConfDatabase *db);
+static void gconf_database_wait_for_syncs (void);
 static void source_notify_cb           (GConfSource   *source,
 					const gchar   *location,
 					GConfDatabase *db);
+static void load_sync_policy           (void);
+
+/*
+ * Resolved-value cache
+ *
+ * gconf_sources_query_value() walks every source for the value and
+ * the schema name, then walks them again for the schema's default.
+ * Many clients ask for the same keys, so we keep what it returned.
+ * Changing a key drops it, and drops the keys whose default came
+ * from it when it's a schema.
+ */
+
+/* How much schema resolution a query asked for; each gives
+ * different answers, so they're cached separately
+ */
+enum {
+  RESOLVE_VALUE,           /* the value only */
+  RESOLVE_SCHEMA_NAME,     /* and the schema name */
+  RESOLVE_SCHEMA_DEFAULT   /* and fall back to the schema default */
+};
+
+/* Past this many keys we start over rather than grow further */
+#define VALUE_CACHE_MAX_KEYS 8192
+
+typedef struct {
+  gchar      **locales;
+  guint        mode : 2;
+  guint        is_default : 1;
+  guint        is_writable : 1;
+  GConfValue  *value;
+  gchar       *schema_name;
+} ResolvedValue;
+
+static void
+resolved_value_free (ResolvedValue *rv)
+{
+  g_strfreev (rv->locales);
+  if (rv->value)
+    gconf_value_free (rv->value);
+  g_free (rv->schema_name);
+  g_free (rv);
+}
+
+static void
+resolved_value_list_free (GSList *list)
+{
+  g_slist_foreach (list, (GFunc) resolved_value_free, NULL);
+  g_slist_free (list);
+}
+
+static gboolean
+locales_equal (const gchar **a,
+               const gchar **b)
+{
+  if (a == NULL || b == NULL)
+    return a == b;
+
+  while (*a != NULL && *b != NULL)
+    {
+      if (strcmp (*a, *b) != 0)
+        return FALSE;
+      ++a;
+      ++b;
+    }
+
+  return *a == *b;
+}
+
+static void
+value_cache_init (GConfDatabase *db)
+{
+  db->value_cache = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                           (GDestroyNotify) gconf_key_unintern,
+                                           (GDestroyNotify) resolved_value_list_free);
+  db->value_cache_dependents = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                      (GDestroyNotify) gconf_key_unintern,
+                                                      (GDestroyNotify) g_hash_table_destroy);
+}
+
+/* The value cache is shared by the worker threads answering
+ * queries, so it has its own lock; functions named _unlocked expect
+ * it to be held. Every invalidation bumps the generation, so that a
+ * query that raced with a change doesn't cache what it read before.
+ */
+static void
+value_cache_clear_unlocked (GConfDatabase *db)
+{
+  db->value_cache_generation++;
+
+  if (g_hash_table_size (db->value_cache) == 0)
+    return;
+
+  g_hash_table_remove_all (db->value_cache);
+  g_hash_table_remove_all (db->value_cache_dependents);
+  db->value_cache_stats.n_flushes++;
+}
+
+static void
+value_cache_clear (GConfDatabase *db)
+{
+  g_mutex_lock (&db->value_cache_lock);
+  value_cache_clear_unlocked (db);
+  g_mutex_unlock (&db->value_cache_lock);
+}
+
+static ResolvedValue*
+value_cache_lookup_unlocked (GConfDatabase *db,
+                    const gchar   *key,
+                    const gchar  **locales,
+                    guint          mode)
+{
+  GSList *tmp;
+
+  db->value_cache_stats.n_lookups++;
+
+  for (tmp = g_hash_table_lookup (db->value_cache, key); tmp; tmp = tmp->next)
+    {
+      ResolvedValue *rv = tmp->data;
+
+      if (rv->mode == mode &&
+          locales_equal ((const gchar **) rv->locales, locales))
+        {
+          db->value_cache_stats.n_hits++;
+          return rv;
+        }
+    }
+
+  return NULL;
+}
+
+static void
+value_cache_insert_unlocked (GConfDatabase    *db,
+                    const gchar      *key,
+                    const gchar     **locales,
+                    guint             mode,
+                    GConfValue       *value,
+                    const gchar      *schema_name,
+                    gboolean          is_default,
+                    gboolean          is_writable)
+{
+  ResolvedValue *rv;
+  GSList *list;
+
+  if (g_hash_table_size (db->value_cache) >= VALUE_CACHE_MAX_KEYS)
+    value_cache_clear_unlocked (db);
+
+  rv = g_new0 (ResolvedValue, 1);
+  rv->locales = g_strdupv ((gchar **) locales);
+  rv->mode = mode;
+  rv->is_default = is_default != FALSE;
+  rv->is_writable = is_writable != FALSE;
+  rv->value = value ? gconf_value_ref (value) : NULL;
+  rv->schema_name = g_strdup (schema_name);
+
+  /* Appending leaves the head, which the table holds, in place */
+  list = g_hash_table_lookup (db->value_cache, key);
+  if (list != NULL)
+    g_slist_append (list, rv);
+  else
+    g_hash_table_insert (db->value_cache, (gchar *) gconf_key_intern (key),
+                         g_slist_prepend (NULL, rv));
+
+  /* Setting the schema changes this key's default */
+  if (mode == RESOLVE_SCHEMA_DEFAULT && schema_name != NULL)
+    {
+      GHashTable *dependents;
+
+      dependents = g_hash_table_lookup (db->value_cache_dependents, schema_name);
+      if (dependents == NULL)
+        {
+          dependents = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                              (GDestroyNotify) gconf_key_unintern,
+                                              NULL);
+          g_hash_table_insert (db->value_cache_dependents,
+                               (gchar *) gconf_key_intern (schema_name),
+                               dependents);
+        }
+
+      if (g_hash_table_lookup (dependents, key) == NULL)
+        g_hash_table_insert (dependents, (gchar *) gconf_key_intern (key),
+                             GINT_TO_POINTER (1));
+    }
+}
+
+static void
+value_cache_forget_unlocked (GConfDatabase *db,
+                             const gchar   *key)
+{
+  GHashTable *dependents;
+
+  db->value_cache_generation++;
+
+  if (g_hash_table_remove (db->value_cache, key))
+    db->value_cache_stats.n_invalidations++;
+
+  dependents = g_hash_table_lookup (db->value_cache_dependents, key);
+  if (dependents != NULL)
+    {
+      GHashTableIter iter;
+      gpointer dependent;
+
+      g_hash_table_iter_init (&iter, dependents);
+      while (g_hash_table_iter_next (&iter, &dependent, NULL))
+        {
+          if (g_hash_table_remove (db->value_cache, dependent))
+            db->value_cache_stats.n_invalidations++;
+        }
+
+      g_hash_table_remove (db->value_cache_dependents, key);
+    }
+}
+
+static void
+value_cache_forget (GConfDatabase *db,
+                    const gchar   *key)
+{
+  g_mutex_lock (&db->value_cache_lock);
+  value_cache_forget_unlocked (db, key);
+  g_mutex_unlock (&db->value_cache_lock);
+}
+
+static void
+collect_keys_below (GHashTable   *table,
+                    const gchar  *location,
+                    GSList      **keys)
+{
+  GHashTableIter iter;
+  gpointer key;
+
+  g_hash_table_iter_init (&iter, table);
+  while (g_hash_table_iter_next (&iter, &key, NULL))
+    {
+      if (gconf_key_is_below (location, key))
+        *keys = g_slist_prepend (*keys, g_strdup (key));
+    }
+}
+
+/* Forgets @location and every key below it, cached or a schema
+ * that cached keys depend on
+ */
+static void
+value_cache_forget_tree (GConfDatabase *db,
+                         const gchar   *location)
+{
+  GSList *doomed;
+  GSList *tmp;
+
+  g_mutex_lock (&db->value_cache_lock);
+
+  doomed = NULL;
+  collect_keys_below (db->value_cache, location, &doomed);
+  collect_keys_below (db->value_cache_dependents, location, &doomed);
+
+  value_cache_forget_unlocked (db, location);
+  for (tmp = doomed; tmp != NULL; tmp = tmp->next)
+    {
+      value_cache_forget_unlocked (db, tmp->data);
+      g_free (tmp->data);
+    }
+  g_slist_free (doomed);
+
+  g_mutex_unlock (&db->value_cache_lock);
+}
 
 void
 gconf_database_set_sources (GConfDatabase *db,
@@ -804,11 +1069,24 @@ gconf_database_set_sources (GConfDatabase *db,
       g_assert_not_reached ();
 #endif
 
+      gconf_database_wait_for_syncs ();
+
+      /* Worker threads may be reading the old sources */
+      g_rw_lock_writer_lock (&db->lock);
+
       gconf_sources_clear_cache(db->sources);
       gconf_sources_free(db->sources);
-    }
 
-  db->sources = sources;
+      db->sources = sources;
+      value_cache_clear (db);
+
+      g_rw_lock_writer_unlock (&db->lock);
+    }
+  else
+    {
+      db->sources = sources;
+      value_cache_clear (db);
+    }
 
   gconf_sources_set_notify_func (db->sources,
 				 (GConfSourceNotifyFunc) source_notify_cb,
@@ -851,6 +1129,10 @@ gconf_database_new (GConfSources  *sources)
 
   db->listeners = gconf_listeners_new();
 
+  g_rw_lock_init (&db->lock);
+  g_mutex_init (&db->value_cache_lock);
+  value_cache_init (db);
+
   gconf_database_set_sources(db, sources);
 
   db->last_access = time(NULL);
@@ -858,6 +1140,8 @@ gconf_database_new (GConfSources  *sources)
   db->sync_idle = 0;
   db->sync_timeout = 0;
 
+  load_sync_policy ();
+
   db->persistent_name = NULL;
   
   return db;
@@ -901,6 +1185,8 @@ gconf_database_free (GConfDatabase *db)
       
       g_assert(db->sources != NULL);
 
+      gconf_database_wait_for_syncs ();
+
       if (db->sync_idle != 0)
         {
           g_source_remove(db->sync_idle);
@@ -915,13 +1201,18 @@ gconf_database_free (GConfDatabase *db)
           need_sync = TRUE;
         }
 
-      if (need_sync)
-        gconf_database_really_sync(db);
+      if (need_sync || db->flush_waiters != NULL)
+        gconf_database_sync_and_log (db);
       
       gconf_listeners_free(db->listeners);
       gconf_sources_free(db->sources);
     }
 
+  g_hash_table_destroy (db->value_cache);
+  g_hash_table_destroy (db->value_cache_dependents);
+  g_mutex_clear (&db->value_cache_lock);
+  g_rw_lock_clear (&db->lock);
+
   g_free (db->persistent_name);
   
   g_free (db);
@@ -972,6 +1263,155 @@ gconf_database_drop_dead_listeners (GConfDatabase *db)
 #endif
 }
 
+/*
+ * Write-back scheduling
+ *
+ * Changes are written back at the latest sync_max_dirty_age seconds
+ * after the database first became dirty, or once about
+ * sync_max_dirty_bytes have changed. Client sync requests and the
+ * byte threshold sync within sync_coalesce_msec rather than at once,
+ * so a burst of them results in a single sync.
+ *
+ * Unless sync_in_background is off, the sources only serialize the
+ * changes in the main loop; writing them out is left to a thread.
+ */
+
+#define DEFAULT_SYNC_COALESCE_MSEC   500
+#define DEFAULT_SYNC_MAX_DIRTY_AGE   60
+#define DEFAULT_SYNC_MAX_DIRTY_BYTES (256 * 1024)
+
+/* Rough cost of one changed entry in the XML files */
+#define DIRTY_ENTRY_OVERHEAD 64
+
+static gboolean sync_policy_loaded = FALSE;
+static guint sync_coalesce_msec = DEFAULT_SYNC_COALESCE_MSEC;
+static guint sync_max_dirty_age = DEFAULT_SYNC_MAX_DIRTY_AGE;
+static gsize sync_max_dirty_bytes = DEFAULT_SYNC_MAX_DIRTY_BYTES;
+static gboolean sync_in_background = TRUE;
+
+static guint
+get_sync_setting (const gchar *name,
+                  guint        default_value)
+{
+  const gchar *str;
+  gchar *end;
+  gulong val;
+
+  str = g_getenv (name);
+  if (str == NULL || *str == '\0')
+    return default_value;
+
+  val = strtoul (str, &end, 10);
+  if (*end != '\0' || val > G_MAXUINT)
+    {
+      gconf_log (GCL_WARNING, _("Ignoring invalid value \"%s\" for %s"),
+                 str, name);
+      return default_value;
+    }
+
+  return val;
+}
+
+static void
+load_sync_policy (void)
+{
+  if (sync_policy_loaded)
+    return;
+
+  sync_policy_loaded = TRUE;
+
+  /* A max dirty age of 0 syncs after every change, and a max dirty
+   * size of 0 disables the size threshold.
+   */
+  sync_coalesce_msec = get_sync_setting ("GCONF_SYNC_COALESCE_MSEC",
+                                         DEFAULT_SYNC_COALESCE_MSEC);
+  sync_max_dirty_age = get_sync_setting ("GCONF_SYNC_MAX_DIRTY_AGE",
+                                         DEFAULT_SYNC_MAX_DIRTY_AGE);
+  sync_max_dirty_bytes = get_sync_setting ("GCONF_SYNC_MAX_DIRTY_BYTES",
+                                           DEFAULT_SYNC_MAX_DIRTY_BYTES);
+  sync_in_background = get_sync_setting ("GCONF_SYNC_IN_BACKGROUND", 1) != 0;
+
+  gconf_log (GCL_DEBUG,
+             "Sync policy: coalesce %u ms, max dirty age %u s, max dirty bytes %lu%s",
+             sync_coalesce_msec, sync_max_dirty_age,
+             (gulong) sync_max_dirty_bytes,
+             sync_in_background ? ", in background" : "");
+}
+
+void
+gconf_database_get_sync_policy (guint *coalesce_msec,
+                                guint *max_dirty_age,
+                                gsize *max_dirty_bytes)
+{
+  load_sync_policy ();
+
+  if (coalesce_msec)
+    *coalesce_msec = sync_coalesce_msec;
+  if (max_dirty_age)
+    *max_dirty_age = sync_max_dirty_age;
+  if (max_dirty_bytes)
+    *max_dirty_bytes = sync_max_dirty_bytes;
+}
+
+/* How many threads answer read-only D-Bus queries; 0, the default,
+ * answers everything from the main loop.
+ */
+guint
+gconf_database_get_worker_threads (void)
+{
+  static gsize loaded = 0;
+  static guint n_threads;
+
+  if (g_once_init_enter (&loaded))
+    {
+      n_threads = MIN (get_sync_setting ("GCONF_WORKER_THREADS", 0), 64);
+      g_once_init_leave (&loaded, 1);
+    }
+
+  return n_threads;
+}
+
+static gsize
+estimate_value_size (const GConfValue *value)
+{
+  gsize size;
+  GSList *tmp;
+
+  if (value == NULL)
+    return 0;
+
+  switch (value->type)
+    {
+    case GCONF_VALUE_STRING:
+      return strlen (gconf_value_get_string (value));
+
+    case GCONF_VALUE_LIST:
+      size = 0;
+      for (tmp = gconf_value_get_list (value); tmp != NULL; tmp = tmp->next)
+        size += estimate_value_size (tmp->data) + 16;
+      return size;
+
+    case GCONF_VALUE_PAIR:
+      return estimate_value_size (gconf_value_get_car (value)) +
+        estimate_value_size (gconf_value_get_cdr (value));
+
+    case GCONF_VALUE_SCHEMA:
+      {
+        GConfSchema *schema = gconf_value_get_schema (value);
+
+        size = estimate_value_size (gconf_schema_get_default_value (schema));
+        if (gconf_schema_get_short_desc (schema))
+          size += strlen (gconf_schema_get_short_desc (schema));
+        if (gconf_schema_get_long_desc (schema))
+          size += strlen (gconf_schema_get_long_desc (schema));
+        return size;
+      }
+
+    default:
+      return 8;
+    }
+}
+
 static gint
 gconf_database_sync_idle (GConfDatabase* db)
 {
@@ -996,65 +1436,418 @@ static gint
 gconf_database_sync_timeout(GConfDatabase* db)
 {
   db->sync_timeout = 0;
+  db->sync_stats.n_syncs_by_age++;
   
   /* Install the sync idle */
   if (db->sync_idle == 0)
     db->sync_idle = g_idle_add((GSourceFunc)gconf_database_sync_idle, db);
 
-  gconf_log(GCL_DEBUG, "Sync queued one minute after changes occurred");
+  gconf_log(GCL_DEBUG, "Sync queued %u seconds after changes occurred",
+            sync_max_dirty_age);
   
   /* Remove the timeout function by returning FALSE */
   return FALSE;
 }
 
+static gint
+gconf_database_coalesce_timeout (GConfDatabase* db)
+{
+  db->sync_timeout = 0;
+
+  if (db->sync_idle == 0)
+    db->sync_idle = g_idle_add ((GSourceFunc) gconf_database_sync_idle, db);
+
+  return FALSE;
+}
+
 static void
-gconf_database_really_sync(GConfDatabase* db)
+log_sync_result (const GError *error)
+{
+  if (error != NULL)
+    gconf_log (GCL_ERR, _("Failed to sync one or more sources: %s"), 
+               error->message);
+  else
+    gconf_log (GCL_DEBUG, "Sync completed without errors");
+}
+
+static void
+gconf_database_sync_and_log (GConfDatabase* db)
 {
   GError* error = NULL;
   
   if (!gconf_database_synchronous_sync(db, &error))
+    g_return_if_fail(error != NULL);
+
+  log_sync_result (error);
+
+  if (error != NULL)
+    g_error_free (error);
+}
+
+static void
+gconf_database_cancel_sync_timers (GConfDatabase *db)
+{
+  if (db->sync_timeout != 0)
     {
-      g_return_if_fail(error != NULL);
+      g_source_remove(db->sync_timeout);
+      db->sync_timeout = 0;
+    }
 
-      gconf_log(GCL_ERR, _("Failed to sync one or more sources: %s"), 
-                error->message);
-      g_error_free(error);
+  if (db->sync_idle != 0)
+    {
+      g_source_remove(db->sync_idle);
+      db->sync_idle = 0;
     }
-  else
+
+  db->sync_deadline = 0;
+}
+
+static void
+gconf_database_record_sync (GConfDatabase *db,
+                            gboolean       succeeded,
+                            gsize          bytes,
+                            guint64        elapsed,
+                            guint64        blocked)
+{
+  db->sync_stats.n_syncs++;
+  if (!succeeded)
+    db->sync_stats.n_sync_failures++;
+  db->sync_stats.bytes_synced += bytes;
+  db->sync_stats.sync_time += elapsed;
+  db->sync_stats.max_sync_time = MAX (db->sync_stats.max_sync_time, elapsed);
+  db->sync_stats.blocked_time += blocked;
+  db->sync_stats.max_blocked_time = MAX (db->sync_stats.max_blocked_time,
+                                         blocked);
+}
+
+typedef struct
+{
+  GConfDatabaseFlushFunc func;
+  gpointer               user_data;
+} FlushWaiter;
+
+static void
+notify_flush_waiters (GConfDatabase *db,
+                      GSList        *waiters,
+                      const GError  *error)
+{
+  GSList *tmp;
+
+  for (tmp = waiters; tmp != NULL; tmp = tmp->next)
+    {
+      FlushWaiter *waiter = tmp->data;
+
+      (* waiter->func) (db, error, waiter->user_data);
+      g_free (waiter);
+    }
+
+  g_slist_free (waiters);
+}
+
+/*
+ * Background syncs
+ *
+ * One thread, shared by all databases, runs the jobs in the order
+ * they were started, and they are finished in the main loop in the
+ * same order. Anything that needs the sources synced right away
+ * waits for all of them, since databases may share files.
+ */
+
+struct _GConfDatabaseSyncJob
+{
+  GConfDatabase    *db;
+  GConfSourcesSync *sync;
+  GSList           *flush_waiters;
+  gsize             dirty_bytes;
+  gint64            start;
+  guint64           blocked;
+
+  /* Set by the sync thread */
+  GError           *error;
+
+  /* Protected by sync_jobs_lock */
+  gboolean          done;
+  guint             done_idle;
+};
+
+static GThreadPool *sync_pool = NULL;
+static GSList *sync_jobs = NULL;
+static GMutex sync_jobs_lock;
+static GCond sync_jobs_cond;
+
+static gboolean gconf_database_sync_soon (GConfDatabase *db);
+
+static void
+gconf_database_finish_sync_job (GConfDatabaseSyncJob *job)
+{
+  GConfDatabase *db;
+  gint64 start;
+
+  db = job->db;
+
+  sync_jobs = g_slist_remove (sync_jobs, job);
+  db->sync_job = NULL;
+
+  start = g_get_monotonic_time ();
+  gconf_sources_finish_sync (job->sync);
+  job->blocked += g_get_monotonic_time () - start;
+
+  db->sync_stats.n_background_syncs++;
+  gconf_database_record_sync (db, job->error == NULL, job->dirty_bytes,
+                              g_get_monotonic_time () - job->start,
+                              job->blocked);
+
+  log_sync_result (job->error);
+
+  notify_flush_waiters (db, job->flush_waiters, job->error);
+
+  if (job->error != NULL)
+    g_error_free (job->error);
+  g_free (job);
+}
+
+static gboolean
+sync_job_done_idle (GConfDatabaseSyncJob *job)
+{
+  GConfDatabase *db;
+
+  db = job->db;
+
+  /* Be sure the sync thread has let go of the job */
+  g_mutex_lock (&sync_jobs_lock);
+  job->done_idle = 0;
+  g_mutex_unlock (&sync_jobs_lock);
+
+  gconf_database_finish_sync_job (job);
+
+  if (db->sync_again)
     {
-      gconf_log(GCL_DEBUG, "Sync completed without errors");
+      db->sync_again = FALSE;
+      gconf_database_really_sync (db);
     }
+
+  return FALSE;
 }
 
 static void
-gconf_database_sync_nowish(GConfDatabase* db)
+sync_thread_func (GConfDatabaseSyncJob *job,
+                  gpointer              user_data)
+{
+  GError *error = NULL;
+
+  if (!gconf_sources_run_sync (job->sync, &error))
+    {
+      GError *composed;
+
+      composed = gconf_compose_errors (job->error, error);
+      if (job->error != NULL)
+        g_error_free (job->error);
+      g_error_free (error);
+
+      job->error = composed;
+    }
+
+  g_mutex_lock (&sync_jobs_lock);
+  job->done = TRUE;
+  job->done_idle = g_idle_add ((GSourceFunc) sync_job_done_idle, job);
+  g_cond_broadcast (&sync_jobs_cond);
+  g_mutex_unlock (&sync_jobs_lock);
+}
+
+static void
+gconf_database_wait_for_syncs (void)
 {
-  /* Go ahead and sync as soon as the event loop quiets down */
+  while (sync_jobs != NULL)
+    {
+      GConfDatabaseSyncJob *job = sync_jobs->data;
+      GConfDatabase *db = job->db;
+
+      g_mutex_lock (&sync_jobs_lock);
+      while (!job->done)
+        g_cond_wait (&sync_jobs_cond, &sync_jobs_lock);
+      g_source_remove (job->done_idle);
+      job->done_idle = 0;
+      g_mutex_unlock (&sync_jobs_lock);
+
+      gconf_database_finish_sync_job (job);
+
+      if (db->sync_again)
+        {
+          db->sync_again = FALSE;
+          gconf_database_sync_soon (db);
+        }
+    }
+}
+
+static void
+gconf_database_start_sync (GConfDatabase *db)
+{
+  GConfDatabaseSyncJob *job;
+  GConfSourcesSync *sync;
+  GError *error = NULL;
+  gint64 start;
+  guint64 elapsed;
+
+  gconf_database_cancel_sync_timers (db);
+
+  db->last_access = time(NULL);
+
+  start = g_get_monotonic_time ();
+  sync = gconf_sources_prepare_sync (db->sources, &error);
+  elapsed = g_get_monotonic_time () - start;
+
+  if (sync == NULL)
+    {
+      /* Nothing was left for the sync thread */
+      gconf_database_record_sync (db, error == NULL, db->dirty_bytes,
+                                  elapsed, elapsed);
+      db->dirty_since = 0;
+      db->dirty_bytes = 0;
+
+      log_sync_result (error);
+
+      notify_flush_waiters (db, db->flush_waiters, error);
+      db->flush_waiters = NULL;
+
+      if (error != NULL)
+        g_error_free (error);
+      return;
+    }
+
+  job = g_new0 (GConfDatabaseSyncJob, 1);
+  job->db = db;
+  job->sync = sync;
+  job->error = error;
+  job->start = start;
+  job->blocked = elapsed;
+  job->dirty_bytes = db->dirty_bytes;
+  job->flush_waiters = db->flush_waiters;
+  db->flush_waiters = NULL;
+
+  /* Changes from here on are for the next sync */
+  db->dirty_since = 0;
+  db->dirty_bytes = 0;
+
+  db->sync_job = job;
+  sync_jobs = g_slist_append (sync_jobs, job);
+
+  if (sync_pool == NULL)
+    sync_pool = g_thread_pool_new ((GFunc) sync_thread_func, NULL,
+                                   1, FALSE, NULL);
+
+  g_thread_pool_push (sync_pool, job, NULL);
+}
+
+static void
+gconf_database_really_sync(GConfDatabase* db)
+{
+  if (!sync_in_background)
+    {
+      gconf_database_sync_and_log (db);
+      return;
+    }
+
+  /* Only one job per database at a time, so the next one
+   * sees what the last one saved
+   */
+  if (db->sync_job != NULL)
+    db->sync_again = TRUE;
+  else
+    gconf_database_start_sync (db);
+}
+
+static void
+gconf_database_set_sync_timeout (GConfDatabase *db,
+                                 gint64         deadline,
+                                 GSourceFunc    func)
+{
+  gint64 now;
+  guint msec;
 
-  /* remove the scheduled sync */
   if (db->sync_timeout != 0)
+    g_source_remove (db->sync_timeout);
+
+  now = g_get_monotonic_time ();
+  msec = deadline > now ? (deadline - now + 999) / 1000 : 0;
+
+  db->sync_deadline = deadline;
+  db->sync_timeout = g_timeout_add (msec, func, db);
+}
+
+/* Returns FALSE if a sync at least as early was already pending */
+static gboolean
+gconf_database_sync_soon (GConfDatabase *db)
+{
+  gint64 deadline;
+
+  if (db->sync_idle != 0)
+    return FALSE;
+
+  if (sync_coalesce_msec == 0)
     {
-      g_source_remove(db->sync_timeout);
-      db->sync_timeout = 0;
+      if (db->sync_timeout != 0)
+        {
+          g_source_remove (db->sync_timeout);
+          db->sync_timeout = 0;
+        }
+
+      db->sync_idle = g_idle_add ((GSourceFunc) gconf_database_sync_idle, db);
+      return TRUE;
     }
 
-  /* Schedule immediate post-quietdown sync */
-  if (db->sync_idle == 0)
-    db->sync_idle = g_idle_add((GSourceFunc)gconf_database_sync_idle, db);
+  deadline = g_get_monotonic_time () + (gint64) sync_coalesce_msec * 1000;
+
+  if (db->sync_timeout != 0 && db->sync_deadline <= deadline)
+    return FALSE;
+
+  gconf_database_set_sync_timeout (db, deadline,
+                                   (GSourceFunc) gconf_database_coalesce_timeout);
+  return TRUE;
+}
+
+static void
+gconf_database_sync_nowish(GConfDatabase* db)
+{
+  /* Go ahead and sync once the coalescing window has passed
+   * and the event loop quiets down
+   */
+  db->sync_stats.n_syncs_suggested++;
+
+  if (!gconf_database_sync_soon (db))
+    db->sync_stats.n_suggests_coalesced++;
 }
 
 static void
-gconf_database_schedule_sync(GConfDatabase* db)
+gconf_database_schedule_sync (GConfDatabase *db,
+                              gsize          changed_bytes)
 {
-  /* Plan to sync within a minute or so */
+  if (db->dirty_since == 0)
+    db->dirty_since = g_get_monotonic_time ();
+
+  db->dirty_bytes += changed_bytes + DIRTY_ENTRY_OVERHEAD;
+  db->sync_stats.n_writes++;
+
   if (db->sync_idle != 0)
     return;
-  else if (db->sync_timeout != 0)
-    return;
-  else
+
+  if (sync_max_dirty_bytes > 0 && db->dirty_bytes >= sync_max_dirty_bytes)
     {
-      /* 1 minute timeout */
-      db->sync_timeout = g_timeout_add_seconds(60, (GSourceFunc)gconf_database_sync_timeout, db);
+      if (gconf_database_sync_soon (db))
+        {
+          db->sync_stats.n_syncs_by_bytes++;
+          gconf_log (GCL_DEBUG, "%lu bytes changed, syncing soon",
+                     (gulong) db->dirty_bytes);
+        }
+    }
+  else if (db->sync_timeout == 0)
+    {
+      /* Not re-armed by later changes, so nothing stays
+       * unsaved for longer than the max dirty age
+       */
+      gconf_database_set_sync_timeout (db,
+                                       db->dirty_since +
+                                       (gint64) sync_max_dirty_age * G_USEC_PER_SEC,
+                                       (GSourceFunc) gconf_database_sync_timeout);
     }
 }
 
@@ -1067,6 +1860,10 @@ source_notify_cb (GConfSource   *source,
   g_return_if_fail (location != NULL);
   g_return_if_fail (db != NULL);
 
+  /* The backend changed under us, so whatever it lacked may be there now */
+  gconf_source_forget_missing (source, location);
+  value_cache_forget_tree (db, location);
+
   if (gconf_sources_is_affected (db->sources, source, location))
     {
       GConfValue  *value;
@@ -1344,24 +2141,87 @@ gconf_database_query_value (GConfDatabase  *db,
                             GError    **err)
 {
   GConfValue* val;
+  ResolvedValue *rv;
+  guint mode;
+  gchar *found_schema_name;
+  gboolean is_default;
+  gboolean is_writable;
+  GError *error;
+  guint generation;
   
   g_return_val_if_fail(err == NULL || *err == NULL, NULL);
   g_assert(db->listeners != NULL);
   
   db->last_access = time(NULL);
-  
+
+  if (use_schema_default)
+    mode = RESOLVE_SCHEMA_DEFAULT;
+  else if (schema_name != NULL)
+    mode = RESOLVE_SCHEMA_NAME;
+  else
+    mode = RESOLVE_VALUE;
+
+  g_mutex_lock (&db->value_cache_lock);
+
+  rv = value_cache_lookup_unlocked (db, key, locales, mode);
+  if (rv != NULL)
+    {
+      if (schema_name)
+        *schema_name = g_strdup (rv->schema_name);
+      if (value_is_default)
+        *value_is_default = rv->is_default;
+      if (value_is_writable)
+        *value_is_writable = rv->is_writable;
+
+      val = rv->value ? gconf_value_ref (rv->value) : NULL;
+
+      g_mutex_unlock (&db->value_cache_lock);
+
+      return val;
+    }
+
+  generation = db->value_cache_generation;
+
+  g_mutex_unlock (&db->value_cache_lock);
+
+  /* Always ask for everything we cache; when use_schema_default is
+   * set the schema name is looked up anyway
+   */
+  found_schema_name = NULL;
+  is_default = FALSE;
+  is_writable = FALSE;
+  error = NULL;
   val = gconf_sources_query_value(db->sources, key, locales,
                                   use_schema_default,
-                                  value_is_default,
-                                  value_is_writable,
-                                  schema_name,
-                                  err);
+                                  &is_default,
+                                  &is_writable,
+                                  mode != RESOLVE_VALUE ? &found_schema_name : NULL,
+                                  &error);
   
-  if (err && *err != NULL)
+  if (error != NULL)
     {
       gconf_log(GCL_ERR, _("Error getting value for `%s': %s"),
-                key, (*err)->message);
+                key, error->message);
+      g_propagate_error (err, error);
+    }
+  else
+    {
+      g_mutex_lock (&db->value_cache_lock);
+      if (db->value_cache_generation == generation)
+        value_cache_insert_unlocked (db, key, locales, mode, val,
+                                     found_schema_name,
+                                     is_default, is_writable);
+      g_mutex_unlock (&db->value_cache_lock);
     }
+
+  if (value_is_default)
+    *value_is_default = is_default;
+  if (value_is_writable)
+    *value_is_writable = is_writable;
+  if (schema_name)
+    *schema_name = found_schema_name;
+  else
+    g_free (found_schema_name);
   
   return val;
 }
@@ -1407,6 +2267,8 @@ gconf_database_set   (GConfDatabase      *db,
   
   gconf_sources_set_value(db->sources, key, value, &modified_sources, &error);
 
+  value_cache_forget (db, key);
+
   if (error)
     {
       g_assert (modified_sources == NULL);
@@ -1420,7 +2282,7 @@ gconf_database_set   (GConfDatabase      *db,
     }
   else
     {
-      gconf_database_schedule_sync(db);
+      gconf_database_schedule_sync (db, strlen (key) + estimate_value_size (value));
       
       /* Can't possibly be the default, since we just set it,
        * and must be writable since setting it succeeded.
@@ -1468,6 +2330,8 @@ gconf_database_unset (GConfDatabase      *db,
 
   gconf_sources_unset_value(db->sources, key, locale, &modified_sources, &error);
 
+  value_cache_forget (db, key);
+
   if (error != NULL)
     {
       g_assert (modified_sources == NULL);
@@ -1515,7 +2379,7 @@ gconf_database_unset (GConfDatabase      *db,
           val = gconf_invalid_corba_value ();
         }
           
-      gconf_database_schedule_sync(db);
+      gconf_database_schedule_sync (db, strlen (key));
 
       gconf_database_notify_listeners(db,
 				      modified_sources,
@@ -1528,7 +2392,7 @@ gconf_database_unset (GConfDatabase      *db,
 #endif
 
 #ifdef HAVE_DBUS
-      gconf_database_schedule_sync(db);
+      gconf_database_schedule_sync (db, strlen (key));
 
       gconf_database_dbus_notify_listeners(db,
 					   modified_sources,
@@ -1543,6 +2407,195 @@ gconf_database_unset (GConfDatabase      *db,
     }
 }
 
+#ifdef HAVE_DBUS
+typedef struct {
+  const gchar  *key;
+  GConfValue   *value;
+  GConfSources *modified_sources;
+} CommittedChange;
+
+static GSList *
+commit_error_prepend (GSList      *errors,
+                      const gchar *key,
+                      GError      *error)
+{
+  GConfDatabaseCommitError *commit_error;
+
+  commit_error = g_new (GConfDatabaseCommitError, 1);
+  commit_error->key = g_strdup (key);
+  commit_error->error = error;
+
+  return g_slist_prepend (errors, commit_error);
+}
+
+/* Makes each change in @entries, a set for an entry with a value and
+ * an unset for one without, then tells listeners about them all and
+ * schedules one sync. The changes that couldn't be made are returned
+ * in @errors as GConfDatabaseCommitError. If any key or value is
+ * invalid nothing is changed and FALSE is returned.
+ */
+gboolean
+gconf_database_commit_changes (GConfDatabase *db,
+                               GSList        *entries,
+                               const gchar   *locale,
+                               GSList       **errors_p)
+{
+  GSList *errors;
+  GSList *committed;
+  GSList *tmp;
+  gsize changed_bytes;
+  const gchar *locale_list[] = { NULL, NULL };
+
+  g_assert (db->listeners != NULL);
+
+  db->last_access = time (NULL);
+
+  errors = NULL;
+  for (tmp = entries; tmp != NULL; tmp = tmp->next)
+    {
+      GConfEntry *entry = tmp->data;
+      GConfValue *value = gconf_entry_get_value (entry);
+      GError *error = NULL;
+
+      if (!gconf_key_check (entry->key, &error) ||
+          (value != NULL && !gconf_value_validate (value, &error)))
+        errors = commit_error_prepend (errors, entry->key, error);
+    }
+
+  if (errors != NULL)
+    {
+      *errors_p = g_slist_reverse (errors);
+      return FALSE;
+    }
+
+  gconf_log (GCL_DEBUG, "Received request to commit %u changes",
+             g_slist_length (entries));
+
+  committed = NULL;
+  changed_bytes = 0;
+  for (tmp = entries; tmp != NULL; tmp = tmp->next)
+    {
+      GConfEntry *entry = tmp->data;
+      GConfValue *value = gconf_entry_get_value (entry);
+      CommittedChange *change;
+      GConfSources *modified_sources;
+      GError *error;
+
+      modified_sources = NULL;
+      error = NULL;
+
+      if (value != NULL)
+        gconf_sources_set_value (db->sources, entry->key, value,
+                                 &modified_sources, &error);
+      else
+        gconf_sources_unset_value (db->sources, entry->key, locale,
+                                   &modified_sources, &error);
+
+      value_cache_forget (db, entry->key);
+
+      if (error != NULL)
+        {
+          g_assert (modified_sources == NULL);
+
+          gconf_log (GCL_ERR, _("Error committing change to `%s': %s"),
+                     entry->key, error->message);
+
+          errors = commit_error_prepend (errors, entry->key, error);
+          continue;
+        }
+
+      /* schedule_sync counts the overhead of one entry itself */
+      if (committed != NULL)
+        changed_bytes += DIRTY_ENTRY_OVERHEAD;
+      changed_bytes += strlen (entry->key);
+      if (value != NULL)
+        changed_bytes += estimate_value_size (value);
+
+      change = g_new (CommittedChange, 1);
+      change->key = entry->key;
+      change->value = value;
+      change->modified_sources = modified_sources;
+
+      committed = g_slist_prepend (committed, change);
+    }
+
+  *errors_p = g_slist_reverse (errors);
+
+  if (committed == NULL)
+    return TRUE;
+
+  gconf_database_schedule_sync (db, changed_bytes);
+
+  /* Listeners only hear of the changes once they have all been made */
+  committed = g_slist_reverse (committed);
+  locale_list[0] = locale;
+
+  for (tmp = committed; tmp != NULL; tmp = tmp->next)
+    {
+      CommittedChange *change = tmp->data;
+
+      if (change->value != NULL)
+        {
+          gconf_database_dbus_notify_listeners (db,
+                                                change->modified_sources,
+                                                change->key,
+                                                change->value,
+                                                FALSE,
+                                                TRUE,
+                                                TRUE);
+        }
+      else
+        {
+          GConfValue *def_value;
+          gboolean is_writable = TRUE;
+
+          /* As in gconf_database_unset () */
+          def_value = gconf_database_query_default_value (db,
+                                                          change->key,
+                                                          locale_list,
+                                                          &is_writable,
+                                                          NULL);
+
+          gconf_database_dbus_notify_listeners (db,
+                                                change->modified_sources,
+                                                change->key,
+                                                def_value,
+                                                TRUE,
+                                                is_writable,
+                                                TRUE);
+          if (def_value)
+            gconf_value_free (def_value);
+        }
+
+      g_free (change);
+    }
+
+  g_slist_free (committed);
+
+  /* Batching clients get the whole commit in one message */
+  gconf_database_dbus_flush_notifications (db);
+
+  return TRUE;
+}
+
+void
+gconf_database_commit_errors_free (GSList *errors)
+{
+  GSList *tmp;
+
+  for (tmp = errors; tmp != NULL; tmp = tmp->next)
+    {
+      GConfDatabaseCommitError *commit_error = tmp->data;
+
+      g_free (commit_error->key);
+      g_error_free (commit_error->error);
+      g_free (commit_error);
+    }
+
+  g_slist_free (errors);
+}
+#endif
+
 void
 gconf_database_recursive_unset (GConfDatabase      *db,
                                 const gchar        *key,
@@ -1569,6 +2622,8 @@ gconf_database_recursive_unset (GConfDatabase      *db,
   gconf_sources_recursive_unset (db->sources, key, locale,
                                  flags, &notifies, &error);
 
+  value_cache_forget_tree (db, key);
+
   /* We return the error but go ahead and finish the unset.
    * We're just returning the first error seen during the
    * unset process.
@@ -1625,7 +2680,7 @@ gconf_database_recursive_unset (GConfDatabase      *db,
           val = gconf_invalid_corba_value ();
         }
           
-      gconf_database_schedule_sync (db);
+      gconf_database_schedule_sync (db, strlen (notify->key));
 
       gconf_database_notify_listeners (db,
 				       notify->modified_sources,
@@ -1638,7 +2693,7 @@ gconf_database_recursive_unset (GConfDatabase      *db,
       CORBA_free (val);
 #endif
 #ifdef HAVE_DBUS
-      gconf_database_schedule_sync (db);
+      gconf_database_schedule_sync (db, strlen (notify->key));
       
       gconf_database_dbus_notify_listeners (db,
 					    notify->modified_sources,
@@ -1701,6 +2756,8 @@ gconf_database_remove_dir  (GConfDatabase  *db,
   
   gconf_sources_remove_dir(db->sources, dir, err);
 
+  value_cache_forget_tree (db, dir);
+
   if (err && *err != NULL)
     {
       gconf_log (GCL_ERR, _("Error removing directory \"%s\": %s"),
@@ -1708,7 +2765,7 @@ gconf_database_remove_dir  (GConfDatabase  *db,
     }
   else
     {
-      gconf_database_schedule_sync(db);
+      gconf_database_schedule_sync (db, strlen (dir));
     }
 }
 
@@ -1775,6 +2832,8 @@ gconf_database_set_schema (GConfDatabase  *db,
   
   gconf_sources_set_schema (db->sources, key, schema_key, err);
 
+  value_cache_forget (db, key);
+
   if (err && *err != NULL)
     {
       gconf_log (GCL_ERR, _("Error setting schema for `%s': %s"),
@@ -1782,7 +2841,9 @@ gconf_database_set_schema (GConfDatabase  *db,
     }
   else
     {
-      gconf_database_schedule_sync (db);
+      gconf_database_schedule_sync (db,
+                                    strlen (key) +
+                                    (schema_key ? strlen (schema_key) : 0));
     }
 }
 
@@ -1803,22 +2864,69 @@ gboolean
 gconf_database_synchronous_sync (GConfDatabase  *db,
                                  GError    **err)
 {  
+  GError *error = NULL;
+  gboolean retval;
+  gint64 start;
+  guint64 elapsed;
+
+  gconf_database_wait_for_syncs ();
+
   /* remove the scheduled syncs */
-  if (db->sync_timeout != 0)
-    {
-      g_source_remove(db->sync_timeout);
-      db->sync_timeout = 0;
-    }
+  gconf_database_cancel_sync_timers (db);
 
-  if (db->sync_idle != 0)
+  db->last_access = time(NULL);
+
+  start = g_get_monotonic_time ();
+  retval = gconf_sources_sync_all(db->sources, &error);
+  elapsed = g_get_monotonic_time () - start;
+
+  gconf_database_record_sync (db, retval, db->dirty_bytes, elapsed, elapsed);
+
+  /* The sources keep track of what they failed to save, and the
+   * next change schedules another attempt.
+   */
+  db->dirty_since = 0;
+  db->dirty_bytes = 0;
+
+  notify_flush_waiters (db, db->flush_waiters, error);
+  db->flush_waiters = NULL;
+
+  if (error != NULL)
+    g_propagate_error (err, error);
+
+  return retval;
+}
+
+/* Syncs without waiting for the coalescing window, and calls @func
+ * once everything changed so far is on disk; this may happen before
+ * returning.
+ */
+void
+gconf_database_flush (GConfDatabase          *db,
+                      GConfDatabaseFlushFunc  func,
+                      gpointer                user_data)
+{
+  FlushWaiter *waiter;
+
+  g_assert(db->listeners != NULL);
+
+  db->last_access = time(NULL);
+
+  waiter = g_new (FlushWaiter, 1);
+  waiter->func = func;
+  waiter->user_data = user_data;
+
+  /* Nothing changed since the sync in flight was started */
+  if (db->sync_job != NULL && db->dirty_bytes == 0)
     {
-      g_source_remove(db->sync_idle);
-      db->sync_idle = 0;
+      db->sync_job->flush_waiters = g_slist_append (db->sync_job->flush_waiters,
+                                                    waiter);
+      return;
     }
 
-  db->last_access = time(NULL);
-  
-  return gconf_sources_sync_all(db->sources, err);
+  db->flush_waiters = g_slist_append (db->flush_waiters, waiter);
+
+  gconf_database_really_sync (db);
 }
 
 void
@@ -1829,7 +2937,10 @@ gconf_database_clear_cache (GConfDatabase  *db,
 
   db->last_access = time(NULL);
 
+  gconf_database_wait_for_syncs ();
+
   gconf_sources_clear_cache(db->sources);
+  value_cache_clear (db);
 }
 
 void
@@ -1841,7 +2952,19 @@ gconf_database_clear_cache_for_sources (GConfDatabase  *db,
 
   db->last_access = time(NULL);
 
+  gconf_database_wait_for_syncs ();
+
   gconf_sources_clear_cache_for_sources(db->sources, sources);
+  value_cache_clear (db);
+}
+
+void
+gconf_database_forget_key_for_sources (GConfDatabase  *db,
+                                       GConfSources   *sources,
+                                       const gchar    *key)
+{
+  gconf_sources_forget_missing_for_sources (db->sources, sources, key);
+  value_cache_forget (db, key);
 }
 
 const gchar *
@@ -1966,17 +3089,22 @@ gconf_database_log_listeners_to_string (GConfDatabase *db,
  */
 
 static GConfLocaleCache* locale_cache = NULL;
+static GMutex locale_cache_lock;   /* worker threads look up locales too */
 
 GConfLocaleList*
 gconfd_locale_cache_lookup (const gchar *locale)
 {
   GConfLocaleList* locale_list;
   
+  g_mutex_lock (&locale_cache_lock);
+
   if (locale_cache == NULL)
     locale_cache = gconf_locale_cache_new();
 
   locale_list = gconf_locale_cache_get_list(locale_cache, locale);
 
+  g_mutex_unlock (&locale_cache_lock);
+
   g_assert(locale_list != NULL);
   g_assert(locale_list->list != NULL);
   
@@ -1986,18 +3114,22 @@ gconfd_locale_cache_lookup (const gchar *locale)
 void
 gconfd_locale_cache_expire(void)
 {
+  g_mutex_lock (&locale_cache_lock);
   if (locale_cache != NULL)
     gconf_locale_cache_expire(locale_cache, 60 * 30); /* 60 sec * 30 min */
+  g_mutex_unlock (&locale_cache_lock);
 }
 
 void
 gconfd_locale_cache_drop(void)
 {
+  g_mutex_lock (&locale_cache_lock);
   if (locale_cache != NULL)
     {
       gconf_locale_cache_free(locale_cache);
       locale_cache = NULL;
     }
+  g_mutex_unlock (&locale_cache_lock);
 }
 
 #ifdef HAVE_CORBA
@@ -39,6 +39,45 @@ G_BEGIN_DECLS
 #include "gconf-locale.h"
 
 typedef struct _GConfDatabase GConfDatabase;
+typedef struct _GConfDatabaseSyncStats GConfDatabaseSyncStats;
+
+/* Write-back bookkeeping; times are in microseconds */
+struct _GConfDatabaseSyncStats
+{
+  guint64 n_writes;            /* changes that dirtied the database */
+  guint64 n_syncs;             /* syncs actually performed */
+  guint64 n_sync_failures;
+  guint64 n_syncs_by_age;      /* forced by the max dirty age */
+  guint64 n_syncs_by_bytes;    /* forced by the max dirty bytes */
+  guint64 n_syncs_suggested;   /* requested by clients */
+  guint64 n_suggests_coalesced; /* requests folded into a pending sync */
+  guint64 bytes_synced;        /* estimated bytes written back */
+  guint64 sync_time;           /* total time spent syncing */
+  guint64 max_sync_time;
+  guint64 n_background_syncs;  /* written by the sync thread */
+  guint64 blocked_time;        /* main loop time spent on syncs */
+  guint64 max_blocked_time;
+};
+
+typedef struct _GConfDatabaseValueCacheStats GConfDatabaseValueCacheStats;
+
+/* Resolved-value cache bookkeeping */
+struct _GConfDatabaseValueCacheStats
+{
+  guint64 n_lookups;
+  guint64 n_hits;
+  guint64 n_invalidations;     /* keys dropped because they changed */
+  guint64 n_flushes;           /* times the whole cache was dropped */
+};
+
+typedef struct _GConfDatabaseSyncJob GConfDatabaseSyncJob;
+
+/* Called once the changes made before gconf_database_flush() are
+ * on disk, or failed to be written.
+ */
+typedef void (* GConfDatabaseFlushFunc) (GConfDatabase *db,
+                                         const GError  *error,
+                                         gpointer       user_data);
 
 struct _GConfDatabase
 {
@@ -56,8 +95,26 @@ struct _GConfDatabase
   /* Information about clients that want notification. */
   GHashTable     *notifications;
   GHashTable     *listening_clients;
+
+  /* Sends the notifications queued for NotifyMany clients */
+  guint           notify_flush_id;
+
+  /* Queries queued to or running in the worker pool */
+  guint           n_queries;
+
+  /* For GetStatistics: calls and latencies by method name, and how
+   * many changes were delivered to listeners in how many messages.
+   */
+  GHashTable     *method_stats;
+  guint64         n_notifications;
+  guint64         n_notify_messages;
 #endif
 
+  /* Held for reading by worker threads answering queries, and for
+   * writing by the main loop while it handles anything else.
+   */
+  GRWLock lock;
+
   GConfListeners* listeners;
   GConfSources* sources;
 
@@ -65,6 +122,32 @@ struct _GConfDatabase
   guint sync_idle;
   guint sync_timeout;
 
+  /* When the pending sync_timeout fires, and how much has been
+   * changed since the last sync (0 means clean).
+   */
+  gint64 sync_deadline;
+  gint64 dirty_since;
+  gsize  dirty_bytes;
+
+  /* A background sync in flight; sync_again if another was
+   * requested meanwhile. Flush callbacks wait for the next sync.
+   */
+  GConfDatabaseSyncJob *sync_job;
+  gboolean sync_again;
+  GSList *flush_waiters;
+
+  GConfDatabaseSyncStats sync_stats;
+
+  /* Fully resolved query results, by key, each a list of
+   * ResolvedValue for the locale lists and modes asked for; and for
+   * each schema key, the set of keys whose defaults came from it.
+   */
+  GHashTable *value_cache;
+  GHashTable *value_cache_dependents;
+  GConfDatabaseValueCacheStats value_cache_stats;
+  GMutex value_cache_lock;
+  guint value_cache_generation;
+
   gchar *persistent_name;
 };
 
@@ -132,6 +215,23 @@ void gconf_database_recursive_unset (GConfDatabase      *db,
                                      GConfUnsetFlags     flags,
                                      GError            **err);
 
+#ifdef HAVE_DBUS
+typedef struct _GConfDatabaseCommitError GConfDatabaseCommitError;
+
+/* A change from a commit that couldn't be made */
+struct _GConfDatabaseCommitError
+{
+  gchar  *key;
+  GError *error;
+};
+
+gboolean gconf_database_commit_changes     (GConfDatabase *db,
+                                            GSList        *entries,
+                                            const gchar   *locale,
+                                            GSList       **errors);
+void     gconf_database_commit_errors_free (GSList        *errors);
+#endif
+
 
 gboolean gconf_database_dir_exists  (GConfDatabase  *db,
                                      const gchar    *dir,
@@ -156,11 +256,23 @@ void     gconf_database_sync             (GConfDatabase  *db,
                                           GError    **err);
 gboolean gconf_database_synchronous_sync (GConfDatabase  *db,
                                           GError    **err);
+void     gconf_database_flush            (GConfDatabase  *db,
+                                          GConfDatabaseFlushFunc func,
+                                          gpointer        user_data);
 void     gconf_database_clear_cache      (GConfDatabase  *db,
                                           GError    **err);
+
+void     gconf_database_get_sync_policy  (guint          *coalesce_msec,
+                                          guint          *max_dirty_age,
+                                          gsize          *max_dirty_bytes);
+guint    gconf_database_get_worker_threads (void);
 void     gconf_database_clear_cache_for_sources (GConfDatabase  *db,
 						 GConfSources   *sources,
 						 GError        **err);
+/* Another database changed @key in @sources, which we may share */
+void     gconf_database_forget_key_for_sources (GConfDatabase  *db,
+						GConfSources   *sources,
+						const gchar    *key);
 
 GConfLocaleList* gconfd_locale_cache_lookup (const gchar *locale);
 
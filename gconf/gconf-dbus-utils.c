@@ -23,6 +23,10 @@
  *   boolean is_writable;
  * };
  *
+ * In an array of entries the value can't be a struct, since its
+ * signature depends on the type. With GCONF_DBUS_WIRE_TEXT it is the
+ * string from gconf_value_encode (), empty for no value; with
+ * GCONF_DBUS_WIRE_TYPED it is a variant holding the value struct.
  */
 
 /* Pair:
@@ -78,21 +82,31 @@
  *   boolean gettext_domain_set;
  *   string  gettext_domain;
 
- *   string  default_value;
+ *   <string, variant> default_value;
  * };
  *
+ * The default value is encoded with gconf_value_encode () for
+ * GCONF_DBUS_WIRE_TEXT, or is a variant holding the value struct for
+ * GCONF_DBUS_WIRE_TYPED.
  */
 
-static void         utils_append_value_helper_fundamental (DBusMessageIter   *iter,
-							   const GConfValue  *value);
-static void         utils_append_value_helper_pair        (DBusMessageIter   *main_iter,
-							   const GConfValue  *value);
-static void         utils_append_value_helper_list        (DBusMessageIter   *main_iter,
-							   const GConfValue  *value);
-static void         utils_append_schema                   (DBusMessageIter   *main_iter,
-							   const GConfSchema *schema);
-static void         utils_append_value                    (DBusMessageIter   *main_iter,
-							   const GConfValue  *value);
+static void         utils_append_value_helper_fundamental (DBusMessageIter     *iter,
+							   const GConfValue    *value,
+							   GConfDBusWireFormat  format);
+static void         utils_append_value_helper_pair        (DBusMessageIter     *main_iter,
+							   const GConfValue    *value,
+							   GConfDBusWireFormat  format);
+static void         utils_append_value_helper_list        (DBusMessageIter     *main_iter,
+							   const GConfValue    *value,
+							   GConfDBusWireFormat  format);
+static void         utils_append_schema                   (DBusMessageIter     *main_iter,
+							   const GConfSchema   *schema,
+							   GConfDBusWireFormat  format);
+static void         utils_append_value                    (DBusMessageIter     *main_iter,
+							   const GConfValue    *value,
+							   GConfDBusWireFormat  format);
+static void         utils_append_value_variant            (DBusMessageIter     *iter,
+							   const GConfValue    *value);
 
 static GConfValue * utils_get_value_helper_fundamental    (DBusMessageIter   *iter,
 							   GConfValueType     value_type);
@@ -144,6 +158,134 @@ utils_get_optional_string (DBusMessageIter *iter)
 }
 
 
+/*
+ * Signatures
+ */
+
+/* Long enough for any value struct: the worst case is a pair of two
+ * schemas, about 40 characters.
+ */
+#define VALUE_SIGNATURE_MAX 64
+
+static gchar *
+utils_write_schema_signature (gchar               *sig,
+			      GConfDBusWireFormat  format)
+{
+  sig = g_stpcpy (sig,
+		  DBUS_STRUCT_BEGIN_CHAR_AS_STRING
+		  DBUS_TYPE_INT32_AS_STRING
+		  DBUS_TYPE_INT32_AS_STRING
+		  DBUS_TYPE_INT32_AS_STRING
+		  DBUS_TYPE_INT32_AS_STRING
+		  DBUS_TYPE_BOOLEAN_AS_STRING
+		  DBUS_TYPE_STRING_AS_STRING
+		  DBUS_TYPE_BOOLEAN_AS_STRING
+		  DBUS_TYPE_STRING_AS_STRING
+		  DBUS_TYPE_BOOLEAN_AS_STRING
+		  DBUS_TYPE_STRING_AS_STRING
+		  DBUS_TYPE_BOOLEAN_AS_STRING
+		  DBUS_TYPE_STRING_AS_STRING);
+
+  if (format == GCONF_DBUS_WIRE_TEXT)
+    sig = g_stpcpy (sig, DBUS_TYPE_STRING_AS_STRING);
+  else
+    sig = g_stpcpy (sig, DBUS_TYPE_VARIANT_AS_STRING);
+
+  return g_stpcpy (sig, DBUS_STRUCT_END_CHAR_AS_STRING);
+}
+
+/* Writes the signature of an int/string/float/bool/schema and returns
+ * the end of it.
+ */
+static gchar *
+utils_write_fundamental_signature (gchar               *sig,
+				   GConfValueType       type,
+				   GConfDBusWireFormat  format)
+{
+  switch (type)
+    {
+    case GCONF_VALUE_INT:
+      return g_stpcpy (sig, DBUS_TYPE_INT32_AS_STRING);
+
+    case GCONF_VALUE_STRING:
+      return g_stpcpy (sig, DBUS_TYPE_STRING_AS_STRING);
+
+    case GCONF_VALUE_FLOAT:
+      return g_stpcpy (sig, DBUS_TYPE_DOUBLE_AS_STRING);
+
+    case GCONF_VALUE_BOOL:
+      return g_stpcpy (sig, DBUS_TYPE_BOOLEAN_AS_STRING);
+
+    case GCONF_VALUE_SCHEMA:
+      return utils_write_schema_signature (sig, format);
+
+    default:
+      g_assert_not_reached ();
+      return sig;
+    }
+}
+
+/* Writes the signature of the struct utils_append_value () would
+ * write for @value.
+ */
+static gchar *
+utils_write_value_signature (gchar               *sig,
+			     const GConfValue    *value,
+			     GConfDBusWireFormat  format)
+{
+  GConfValue *car, *cdr;
+
+  sig = g_stpcpy (sig,
+		  DBUS_STRUCT_BEGIN_CHAR_AS_STRING
+		  DBUS_TYPE_INT32_AS_STRING);
+
+  if (value == NULL)
+    return g_stpcpy (sig, DBUS_STRUCT_END_CHAR_AS_STRING);
+
+  switch (value->type)
+    {
+    case GCONF_VALUE_INT:
+    case GCONF_VALUE_STRING:
+    case GCONF_VALUE_FLOAT:
+    case GCONF_VALUE_BOOL:
+    case GCONF_VALUE_SCHEMA:
+      sig = utils_write_fundamental_signature (sig, value->type, format);
+      break;
+
+    case GCONF_VALUE_LIST:
+      sig = g_stpcpy (sig,
+		      DBUS_STRUCT_BEGIN_CHAR_AS_STRING
+		      DBUS_TYPE_INT32_AS_STRING
+		      DBUS_TYPE_ARRAY_AS_STRING);
+      sig = utils_write_fundamental_signature (sig,
+					       gconf_value_get_list_type (value),
+					       format);
+      sig = g_stpcpy (sig, DBUS_STRUCT_END_CHAR_AS_STRING);
+      break;
+
+    case GCONF_VALUE_PAIR:
+      car = gconf_value_get_car (value);
+      cdr = gconf_value_get_cdr (value);
+
+      sig = g_stpcpy (sig,
+		      DBUS_STRUCT_BEGIN_CHAR_AS_STRING
+		      DBUS_TYPE_INT32_AS_STRING
+		      DBUS_TYPE_INT32_AS_STRING);
+      if (car)
+	sig = utils_write_fundamental_signature (sig, car->type, format);
+      if (cdr)
+	sig = utils_write_fundamental_signature (sig, cdr->type, format);
+      sig = g_stpcpy (sig, DBUS_STRUCT_END_CHAR_AS_STRING);
+      break;
+
+    default:
+      g_assert_not_reached ();
+    }
+
+  return g_stpcpy (sig, DBUS_STRUCT_END_CHAR_AS_STRING);
+}
+
+
 /*
  * Setters
  */
@@ -152,8 +294,9 @@ utils_get_optional_string (DBusMessageIter *iter)
 /* Helper for utils_append_value, writes a int/string/float/bool/schema.
  */
 static void
-utils_append_value_helper_fundamental (DBusMessageIter  *iter,
-				       const GConfValue *value)
+utils_append_value_helper_fundamental (DBusMessageIter     *iter,
+				       const GConfValue    *value,
+				       GConfDBusWireFormat  format)
 {
   gint32       i;
   gboolean     b;
@@ -185,7 +328,7 @@ utils_append_value_helper_fundamental (DBusMessageIter  *iter,
       break;
 
     case GCONF_VALUE_SCHEMA:
-      utils_append_schema (iter, gconf_value_get_schema (value));
+      utils_append_schema (iter, gconf_value_get_schema (value), format);
       break;
 
     default:
@@ -197,8 +340,9 @@ utils_append_value_helper_fundamental (DBusMessageIter  *iter,
  * two values and two fundamental values (type, value, type value).
  */
 static void
-utils_append_value_helper_pair (DBusMessageIter  *main_iter,
-				const GConfValue *value)
+utils_append_value_helper_pair (DBusMessageIter     *main_iter,
+				const GConfValue    *value,
+				GConfDBusWireFormat  format)
 {
   DBusMessageIter  struct_iter;
   GConfValue      *car, *cdr;
@@ -231,10 +375,10 @@ utils_append_value_helper_pair (DBusMessageIter  *main_iter,
 
   /* The values. */
   if (car)
-    utils_append_value_helper_fundamental (&struct_iter, car);
+    utils_append_value_helper_fundamental (&struct_iter, car, format);
 
   if (cdr)
-    utils_append_value_helper_fundamental (&struct_iter, cdr);
+    utils_append_value_helper_fundamental (&struct_iter, cdr, format);
 
   dbus_message_iter_close_container (main_iter, &struct_iter);
 }
@@ -243,13 +387,14 @@ utils_append_value_helper_pair (DBusMessageIter  *main_iter,
  * list type and an array with the values directly in it.
  */
 static void
-utils_append_value_helper_list (DBusMessageIter  *main_iter,
-				const GConfValue *value)
+utils_append_value_helper_list (DBusMessageIter     *main_iter,
+				const GConfValue    *value,
+				GConfDBusWireFormat  format)
 {
   DBusMessageIter  struct_iter;
   DBusMessageIter  array_iter;
   GConfValueType   list_type;
-  const gchar     *array_type;
+  gchar            array_type[VALUE_SIGNATURE_MAX];
   GSList          *list;
   
   d(g_print ("Append value (list)\n"));
@@ -265,33 +410,8 @@ utils_append_value_helper_list (DBusMessageIter  *main_iter,
   list_type = gconf_value_get_list_type (value);
   dbus_message_iter_append_basic (&struct_iter, DBUS_TYPE_INT32, &list_type);
 
-  /* And the value. */
-  switch (list_type)
-    {
-    case GCONF_VALUE_INT:
-      array_type = DBUS_TYPE_INT32_AS_STRING;
-      break;
-      
-    case GCONF_VALUE_STRING:
-      array_type = DBUS_TYPE_STRING_AS_STRING;
-      break;
-      
-    case GCONF_VALUE_FLOAT:
-      array_type = DBUS_TYPE_DOUBLE_AS_STRING;
-      break;
-      
-    case GCONF_VALUE_BOOL:
-      array_type = DBUS_TYPE_BOOLEAN_AS_STRING;
-      break;
-      
-    case GCONF_VALUE_SCHEMA:
-      array_type = DBUS_TYPE_STRUCT_AS_STRING;
-      break;
-
-    default:
-      array_type = NULL;
-      g_assert_not_reached ();
-    }
+  /* And the values, in an array of the list type. */
+  utils_write_fundamental_signature (array_type, list_type, format);
   
   dbus_message_iter_open_container (&struct_iter,
 				    DBUS_TYPE_ARRAY,
@@ -364,7 +484,7 @@ utils_append_value_helper_list (DBusMessageIter  *main_iter,
 	  GConfSchema *schema;
 
 	  schema = gconf_value_get_schema (list->data);
-	  utils_append_schema (&array_iter, schema);
+	  utils_append_schema (&array_iter, schema, format);
 	  
 	  list = list->next;
 	}
@@ -380,8 +500,9 @@ utils_append_value_helper_list (DBusMessageIter  *main_iter,
 
 /* Writes a schema, which is a struct. */
 static void
-utils_append_schema (DBusMessageIter   *main_iter,
-		     const GConfSchema *schema)
+utils_append_schema (DBusMessageIter     *main_iter,
+		     const GConfSchema   *schema,
+		     GConfDBusWireFormat  format)
 {
   DBusMessageIter  struct_iter;
   gint32           i;
@@ -419,8 +540,9 @@ utils_append_schema (DBusMessageIter   *main_iter,
 
   default_value = gconf_schema_get_default_value (schema);
 
-  /* We don't need to do this, but it's much simpler */
-  if (default_value)
+  if (format >= GCONF_DBUS_WIRE_TYPED)
+    utils_append_value_variant (&struct_iter, default_value);
+  else if (default_value)
     {
       gchar *encoded;
       
@@ -441,8 +563,9 @@ utils_append_schema (DBusMessageIter   *main_iter,
 }
 
 static void
-utils_append_value (DBusMessageIter  *main_iter,
-		    const GConfValue *value)
+utils_append_value (DBusMessageIter     *main_iter,
+		    const GConfValue    *value,
+		    GConfDBusWireFormat  format)
 {
   DBusMessageIter struct_iter;
   gint32          type;
@@ -467,15 +590,15 @@ utils_append_value (DBusMessageIter  *main_iter,
     case GCONF_VALUE_FLOAT:
     case GCONF_VALUE_BOOL:
     case GCONF_VALUE_SCHEMA:
-      utils_append_value_helper_fundamental (&struct_iter, value);
+      utils_append_value_helper_fundamental (&struct_iter, value, format);
       break;
       
     case GCONF_VALUE_LIST:
-      utils_append_value_helper_list (&struct_iter, value);
+      utils_append_value_helper_list (&struct_iter, value, format);
       break;
 
     case GCONF_VALUE_PAIR:
-      utils_append_value_helper_pair (&struct_iter, value);
+      utils_append_value_helper_pair (&struct_iter, value, format);
       break;
 
     case GCONF_VALUE_INVALID:
@@ -488,14 +611,38 @@ utils_append_value (DBusMessageIter  *main_iter,
   dbus_message_iter_close_container (main_iter, &struct_iter);
 }
 
+/* Writes a value struct inside a variant, for the places where the
+ * signature has to be the same whatever the type of the value.
+ */
+static void
+utils_append_value_variant (DBusMessageIter  *iter,
+			    const GConfValue *value)
+{
+  DBusMessageIter variant_iter;
+  gchar           sig[VALUE_SIGNATURE_MAX];
+
+  utils_write_value_signature (sig, value, GCONF_DBUS_WIRE_TYPED);
+
+  dbus_message_iter_open_container (iter,
+				    DBUS_TYPE_VARIANT,
+				    sig,
+				    &variant_iter);
+
+  utils_append_value (&variant_iter, value, GCONF_DBUS_WIRE_TYPED);
+
+  if (!dbus_message_iter_close_container (iter, &variant_iter))
+    g_error ("Out of memory");
+}
+
 /* Writes an entry, which is a struct. */
 static void
-utils_append_entry_values (DBusMessageIter  *main_iter,
-			   const gchar      *key,
-			   const GConfValue *value,
-			   gboolean          is_default,
-			   gboolean          is_writable,
-			   const gchar      *schema_name)   
+utils_append_entry_values (DBusMessageIter     *main_iter,
+			   const gchar         *key,
+			   const GConfValue    *value,
+			   gboolean             is_default,
+			   gboolean             is_writable,
+			   const gchar         *schema_name,
+			   GConfDBusWireFormat  format)
 {
   DBusMessageIter struct_iter;
 
@@ -508,7 +655,7 @@ utils_append_entry_values (DBusMessageIter  *main_iter,
 
   dbus_message_iter_append_basic (&struct_iter, DBUS_TYPE_STRING, &key);
 
-  utils_append_value (&struct_iter, value);
+  utils_append_value (&struct_iter, value, format);
 
   utils_append_optional_string (&struct_iter, schema_name);
 
@@ -519,14 +666,17 @@ utils_append_entry_values (DBusMessageIter  *main_iter,
   dbus_message_iter_close_container (main_iter, &struct_iter);
 }
 
-/* Writes an entry, which is a struct. */
+/* Writes an entry as an element of an entry array, see the comment
+ * at the top.
+ */
 static void
-utils_append_entry_values_stringified (DBusMessageIter  *main_iter,
-				       const gchar      *key,
-				       const GConfValue *value,
-				       gboolean          is_default,
-				       gboolean          is_writable,
-				       const gchar      *schema_name)   
+utils_append_array_entry_values (DBusMessageIter     *main_iter,
+				 const gchar         *key,
+				 const GConfValue    *value,
+				 gboolean             is_default,
+				 gboolean             is_writable,
+				 const gchar         *schema_name,
+				 GConfDBusWireFormat  format)
 {
   DBusMessageIter  struct_iter;
   gchar           *value_str;
@@ -540,15 +690,20 @@ utils_append_entry_values_stringified (DBusMessageIter  *main_iter,
 
   dbus_message_iter_append_basic (&struct_iter, DBUS_TYPE_STRING, &key);
 
-  value_str = NULL;
-  if (value)
-    value_str = gconf_value_encode ((GConfValue *) value);
+  if (format >= GCONF_DBUS_WIRE_TYPED)
+    utils_append_value_variant (&struct_iter, value);
+  else
+    {
+      value_str = NULL;
+      if (value)
+	value_str = gconf_value_encode ((GConfValue *) value);
 
-  if (!value_str)
-    value_str = g_strdup ("");
+      if (!value_str)
+	value_str = g_strdup ("");
 
-  dbus_message_iter_append_basic (&struct_iter, DBUS_TYPE_STRING, &value_str);
-  g_free (value_str);
+      dbus_message_iter_append_basic (&struct_iter, DBUS_TYPE_STRING, &value_str);
+      g_free (value_str);
+    }
 
   utils_append_optional_string (&struct_iter, schema_name);
 
@@ -615,15 +770,17 @@ gconf_dbus_utils_get_entry_values (DBusMessageIter  *main_iter,
   return TRUE;
 }
 
+/* Reads an element of an entry array in either format. */
 static gboolean
-utils_get_entry_values_stringified (DBusMessageIter  *main_iter,
-				    gchar           **key_p,
-				    GConfValue      **value_p,
-				    gboolean         *is_default_p,
-				    gboolean         *is_writable_p,
-				    gchar           **schema_name_p)
+utils_get_array_entry_values (DBusMessageIter  *main_iter,
+			      gchar           **key_p,
+			      GConfValue      **value_p,
+			      gboolean         *is_default_p,
+			      gboolean         *is_writable_p,
+			      gchar           **schema_name_p)
 {
   DBusMessageIter  struct_iter;
+  DBusMessageIter  variant_iter;
   gchar           *key;
   gchar           *value_str;
   GConfValue      *value;
@@ -637,11 +794,19 @@ utils_get_entry_values_stringified (DBusMessageIter  *main_iter,
   d(g_print ("Getting entry %s\n", key));
     
   dbus_message_iter_next (&struct_iter);
-  dbus_message_iter_get_basic (&struct_iter, &value_str);
-  if (value_str[0] != '\0')
-    value = gconf_value_decode (value_str);
+  if (dbus_message_iter_get_arg_type (&struct_iter) == DBUS_TYPE_VARIANT)
+    {
+      dbus_message_iter_recurse (&struct_iter, &variant_iter);
+      value = utils_get_value (&variant_iter);
+    }
   else
-    value = NULL;
+    {
+      dbus_message_iter_get_basic (&struct_iter, &value_str);
+      if (value_str[0] != '\0')
+	value = gconf_value_decode (value_str);
+      else
+	value = NULL;
+    }
 
   dbus_message_iter_next (&struct_iter);
   schema_name = (gchar *) utils_get_optional_string (&struct_iter);
@@ -657,7 +822,7 @@ utils_get_entry_values_stringified (DBusMessageIter  *main_iter,
 
   if (value_p)
     *value_p = value;
-  else
+  else if (value)
     gconf_value_free (value);
 
   if (schema_name_p)
@@ -751,18 +916,18 @@ utils_get_value_helper_pair (DBusMessageIter *iter)
   dbus_message_iter_next (&struct_iter);
   dbus_message_iter_get_basic (&struct_iter, &cdr_type);
 
-  /* Get the values. */
-  dbus_message_iter_next (&struct_iter);
-  if (car_type == GCONF_VALUE_SCHEMA) 
-    car_value = utils_get_schema_value (&struct_iter);
-  else if (car_type != GCONF_VALUE_INVALID)
-    car_value = utils_get_value_helper_fundamental (&struct_iter, car_type);
+  /* Get the values; a missing half isn't written at all. */
+  if (car_type != GCONF_VALUE_INVALID)
+    {
+      dbus_message_iter_next (&struct_iter);
+      car_value = utils_get_value_helper_fundamental (&struct_iter, car_type);
+    }
 
-  dbus_message_iter_next (&struct_iter);
-  if (cdr_type == GCONF_VALUE_SCHEMA) 
-    cdr_value = utils_get_schema_value (&struct_iter);
-  else if (cdr_type != GCONF_VALUE_INVALID)
-    cdr_value = utils_get_value_helper_fundamental (&struct_iter, cdr_type);
+  if (cdr_type != GCONF_VALUE_INVALID)
+    {
+      dbus_message_iter_next (&struct_iter);
+      cdr_value = utils_get_value_helper_fundamental (&struct_iter, cdr_type);
+    }
 
   if (car_value)
     gconf_value_set_car_nocopy (value, car_value);
@@ -939,6 +1104,7 @@ static GConfSchema *
 utils_get_schema (DBusMessageIter *main_iter)
 {
   DBusMessageIter  struct_iter;
+  DBusMessageIter  variant_iter;
   gint32           type, list_type, car_type, cdr_type;
   const gchar     *locale, *short_desc, *long_desc, *owner;
   const gchar     *encoded;
@@ -972,7 +1138,18 @@ utils_get_schema (DBusMessageIter *main_iter)
   owner = utils_get_optional_string (&struct_iter);
 
   dbus_message_iter_next (&struct_iter);
-  dbus_message_iter_get_basic (&struct_iter, &encoded);
+  if (dbus_message_iter_get_arg_type (&struct_iter) == DBUS_TYPE_VARIANT)
+    {
+      dbus_message_iter_recurse (&struct_iter, &variant_iter);
+      default_value = utils_get_value (&variant_iter);
+    }
+  else
+    {
+      dbus_message_iter_get_basic (&struct_iter, &encoded);
+      default_value = NULL;
+      if (*encoded != '\0')
+	default_value = gconf_value_decode (encoded);
+    }
 
   schema = gconf_schema_new ();
   
@@ -993,12 +1170,8 @@ utils_get_schema (DBusMessageIter *main_iter)
   if (owner)
     gconf_schema_set_owner (schema, owner);
 
-  if (*encoded != '\0')
-    {
-      default_value = gconf_value_decode (encoded);
-      if (default_value)
-	gconf_schema_set_default_value_nocopy (schema, default_value);
-    }
+  if (default_value)
+    gconf_schema_set_default_value_nocopy (schema, default_value);
 
   return schema;
 }
@@ -1023,10 +1196,11 @@ utils_get_schema_value (DBusMessageIter *iter)
  */
 
 void
-gconf_dbus_utils_append_value (DBusMessageIter  *iter,
-			       const GConfValue *value)
+gconf_dbus_utils_append_value (DBusMessageIter     *iter,
+			       const GConfValue    *value,
+			       GConfDBusWireFormat  format)
 {
-  utils_append_value (iter, value);
+  utils_append_value (iter, value, format);
 }
 
 GConfValue *
@@ -1036,57 +1210,76 @@ gconf_dbus_utils_get_value (DBusMessageIter  *iter)
 }
 
 void
-gconf_dbus_utils_append_entry_values (DBusMessageIter  *iter,
-				      const gchar      *key,
-				      const GConfValue *value,
-				      gboolean          is_default,
-				      gboolean          is_writable,
-				      const gchar      *schema_name)
+gconf_dbus_utils_append_entry_values (DBusMessageIter     *iter,
+				      const gchar         *key,
+				      const GConfValue    *value,
+				      gboolean             is_default,
+				      gboolean             is_writable,
+				      const gchar         *schema_name,
+				      GConfDBusWireFormat  format)
 {
   utils_append_entry_values (iter,
 			     key,
 			     value,
 			     is_default,
 			     is_writable,
-			     schema_name);
+			     schema_name,
+			     format);
 }
 
 /* Append the list of entries as an array. */
 void
-gconf_dbus_utils_append_entries (DBusMessageIter *iter,
-				 GSList          *entries)
+gconf_dbus_utils_append_entries (DBusMessageIter     *iter,
+				 GSList              *entries,
+				 GConfDBusWireFormat  format)
 {
   DBusMessageIter array_iter;
   GSList *l;
+  const gchar *sig;
+
+  if (format >= GCONF_DBUS_WIRE_TYPED)
+    sig = DBUS_STRUCT_BEGIN_CHAR_AS_STRING
+      DBUS_TYPE_STRING_AS_STRING
+      DBUS_TYPE_VARIANT_AS_STRING
+      DBUS_TYPE_BOOLEAN_AS_STRING
+      DBUS_TYPE_STRING_AS_STRING
+      DBUS_TYPE_BOOLEAN_AS_STRING
+      DBUS_TYPE_BOOLEAN_AS_STRING
+      DBUS_STRUCT_END_CHAR_AS_STRING;
+  else
+    sig = DBUS_STRUCT_BEGIN_CHAR_AS_STRING
+      DBUS_TYPE_STRING_AS_STRING
+      DBUS_TYPE_STRING_AS_STRING
+      DBUS_TYPE_BOOLEAN_AS_STRING
+      DBUS_TYPE_STRING_AS_STRING
+      DBUS_TYPE_BOOLEAN_AS_STRING
+      DBUS_TYPE_BOOLEAN_AS_STRING
+      DBUS_STRUCT_END_CHAR_AS_STRING;
 
   dbus_message_iter_open_container (iter,
 				    DBUS_TYPE_ARRAY,
-				    DBUS_STRUCT_BEGIN_CHAR_AS_STRING
-				    DBUS_TYPE_STRING_AS_STRING
-				    DBUS_TYPE_STRING_AS_STRING
-				    DBUS_TYPE_BOOLEAN_AS_STRING
-				    DBUS_TYPE_STRING_AS_STRING
-				    DBUS_TYPE_BOOLEAN_AS_STRING
-				    DBUS_TYPE_BOOLEAN_AS_STRING
-				    DBUS_STRUCT_END_CHAR_AS_STRING,
+				    sig,
 				    &array_iter);
 
   for (l = entries; l; l = l->next)
     {
       GConfEntry *entry = l->data;
 
-      utils_append_entry_values_stringified (&array_iter,
-					     entry->key,
-					     gconf_entry_get_value (entry),
-					     gconf_entry_get_is_default (entry),
-					     gconf_entry_get_is_writable (entry),
-					     gconf_entry_get_schema_name (entry));
+      utils_append_array_entry_values (&array_iter,
+				       entry->key,
+				       gconf_entry_get_value (entry),
+				       gconf_entry_get_is_default (entry),
+				       gconf_entry_get_is_writable (entry),
+				       gconf_entry_get_schema_name (entry),
+				       format);
     }
 
   dbus_message_iter_close_container (iter, &array_iter);
 }
 
-/* Get a list of entries from an array. */
+/* Get a list of entries from an array. Keys are relative to @dir, or
+ * taken as they are when @dir is NULL.
+ */
 GSList *
 gconf_dbus_utils_get_entries (DBusMessageIter *iter, const gchar *dir)
 {
@@ -1107,15 +1300,18 @@ gconf_dbus_utils_get_entries (DBusMessageIter *iter, const gchar *dir)
       gchar      *schema_name;
       GConfEntry *entry;
 
-      if (!utils_get_entry_values_stringified (&array_iter,
-					       &key,
-					       &value,
-					       &is_default,
-					       &is_writable,
-					       &schema_name))
+      if (!utils_get_array_entry_values (&array_iter,
+					 &key,
+					 &value,
+					 &is_default,
+					 &is_writable,
+					 &schema_name))
 	break;
 
-      entry = gconf_entry_new_nocopy (gconf_concat_dir_and_key (dir, key), value);
+      if (dir)
+	entry = gconf_entry_new_nocopy (gconf_concat_dir_and_key (dir, key), value);
+      else
+	entry = gconf_entry_new_nocopy (g_strdup (key), value);
 
       gconf_entry_set_is_default (entry, is_default);
       gconf_entry_set_is_writable (entry, is_writable);
@@ -40,19 +40,26 @@
 #define GCONF_DBUS_DATABASE_LOOKUP          "Lookup"
 #define GCONF_DBUS_DATABASE_LOOKUP_EXTENDED "LookupExtended" 
 #define GCONF_DBUS_DATABASE_LOOKUP_DEFAULT  "LookupDefault" 
+#define GCONF_DBUS_DATABASE_LOOKUP_MANY     "LookupMany"
 #define GCONF_DBUS_DATABASE_SET             "Set"
 #define GCONF_DBUS_DATABASE_UNSET           "UnSet"
 #define GCONF_DBUS_DATABASE_RECURSIVE_UNSET "RecursiveUnset"
 #define GCONF_DBUS_DATABASE_DIR_EXISTS      "DirExists"
 #define GCONF_DBUS_DATABASE_GET_ALL_ENTRIES "AllEntries"
 #define GCONF_DBUS_DATABASE_GET_ALL_DIRS    "AllDirs"
+#define GCONF_DBUS_DATABASE_GET_SUBTREE     "GetSubtree"
 #define GCONF_DBUS_DATABASE_SET_SCHEMA      "SetSchema"
 #define GCONF_DBUS_DATABASE_SUGGEST_SYNC    "SuggestSync"
+#define GCONF_DBUS_DATABASE_GET_SYNC_STATS  "GetSyncStatistics"
+#define GCONF_DBUS_DATABASE_GET_CACHE_STATS "GetCacheStatistics"
+#define GCONF_DBUS_DATABASE_GET_STATISTICS  "GetStatistics"
+#define GCONF_DBUS_DATABASE_COMMIT_CHANGE_SET "CommitChangeSet"
 
 #define GCONF_DBUS_DATABASE_ADD_NOTIFY      "AddNotify"
 #define GCONF_DBUS_DATABASE_REMOVE_NOTIFY   "RemoveNotify"
  
 #define GCONF_DBUS_LISTENER_NOTIFY          "Notify"
+#define GCONF_DBUS_LISTENER_NOTIFY_MANY     "NotifyMany"
 
 #define GCONF_DBUS_CLIENT_SERVICE           "org.gnome.GConf.ClientService"
 #define GCONF_DBUS_CLIENT_OBJECT            "/org/gnome/GConf/Client"
@@ -74,16 +81,36 @@
 #define GCONF_DBUS_ERROR_OVERRIDDEN           "org.gnome.GConf.Error.Overriden"
 #define GCONF_DBUS_ERROR_LOCK_FAILED          "org.gnome.GConf.Error.LockFailed"
 
-void        gconf_dbus_utils_append_value     (DBusMessageIter   *iter,
-					       const GConfValue  *value);
+/* How values are laid out on the wire. TEXT sends entry arrays and
+ * schema default values through gconf_value_encode (); TYPED uses
+ * D-Bus types all the way down. Clients append the newest format they
+ * understand to GetDatabase and GetDefaultDatabase, and gconfd appends
+ * its own to the reply; a peer that doesn't say only knows TEXT.
+ * Readers accept either format. BATCHED lays values out like TYPED,
+ * and also tells gconfd the client handles NotifyMany. CHANGE_SETS
+ * tells the client gconfd handles CommitChangeSet.
+ */
+typedef enum {
+  GCONF_DBUS_WIRE_TEXT        = 0,
+  GCONF_DBUS_WIRE_TYPED       = 1,
+  GCONF_DBUS_WIRE_BATCHED     = 2,
+  GCONF_DBUS_WIRE_CHANGE_SETS = 3
+} GConfDBusWireFormat;
+
+#define GCONF_DBUS_WIRE_NEWEST GCONF_DBUS_WIRE_CHANGE_SETS
+
+void        gconf_dbus_utils_append_value     (DBusMessageIter     *iter,
+					       const GConfValue    *value,
+					       GConfDBusWireFormat  format);
 GConfValue *gconf_dbus_utils_get_value        (DBusMessageIter   *iter);
 
-void        gconf_dbus_utils_append_entry_values (DBusMessageIter   *iter,
-						 const gchar       *key,
-						 const GConfValue  *value,
-						 gboolean           is_default,
-						 gboolean           is_writable,
-						 const gchar       *schema_name);
+void        gconf_dbus_utils_append_entry_values (DBusMessageIter     *iter,
+						 const gchar         *key,
+						 const GConfValue    *value,
+						 gboolean             is_default,
+						 gboolean             is_writable,
+						 const gchar         *schema_name,
+						 GConfDBusWireFormat  format);
 gboolean    gconf_dbus_utils_get_entry_values   (DBusMessageIter   *iter,
 						 gchar            **key,
 						 GConfValue       **value,
@@ -91,8 +118,9 @@ gboolean    gconf_dbus_utils_get_entry_values   (DBusMessageIter   *iter,
 						 gboolean          *is_writable,
 						 gchar            **schema_name);
 
-void gconf_dbus_utils_append_entries (DBusMessageIter *iter,
-				      GSList          *entries);
+void gconf_dbus_utils_append_entries (DBusMessageIter     *iter,
+				      GSList              *entries,
+				      GConfDBusWireFormat  format);
 
 GSList *gconf_dbus_utils_get_entries (DBusMessageIter *iter, const gchar *dir);
 
@@ -77,6 +77,12 @@ struct _GConfEngine {
   gpointer owner;
   int owner_use_count;
 
+  /* Asynchronous requests in the order they were made; callbacks
+   * run from the front as the requests complete.
+   */
+  GQueue async_ops;
+  guint async_idle;
+
   /* If TRUE, this is a local engine (and therefore
    * has no ctable and no notifications)
    */
@@ -105,6 +111,9 @@ static GHashTable     *engines_by_db = NULL;
 static GHashTable     *engines_by_address = NULL;
 static gboolean        dbus_disconnected = FALSE;
 
+/* Newest value encoding gconfd told us it understands */
+static GConfDBusWireFormat server_wire_format = GCONF_DBUS_WIRE_TEXT;
+
 static gboolean     ensure_dbus_connection      (GError **error);
 static gboolean     ensure_service              (gboolean          start_if_not_found,
 						 GError          **err);
@@ -156,6 +165,9 @@ static DBusHandlerResult
                     handle_notify               (DBusConnection   *connection,
 						 DBusMessage      *message,
 						 GConfEngine      *conf);
+static DBusHandlerResult
+                    handle_notify_many          (DBusConnection   *connection,
+						 DBusMessage      *message);
 
 
 #define CHECK_OWNER_USE(engine) \
@@ -491,6 +503,7 @@ ensure_database (GConfEngine  *conf,
   DBusMessage *message, *reply;
   DBusError error;
   gchar *db;
+  dbus_uint32_t format;
 
   g_return_val_if_fail (!conf->is_local, TRUE);
 
@@ -533,6 +546,12 @@ ensure_database (GConfEngine  *conf,
       g_free (addresses);
     }
 
+  /* Tell gconfd which value encodings we understand */
+  format = GCONF_DBUS_WIRE_NEWEST;
+  dbus_message_append_args (message,
+			    DBUS_TYPE_UINT32, &format,
+			    DBUS_TYPE_INVALID);
+
   dbus_error_init (&error);
   reply = dbus_connection_send_with_reply_and_block (global_conn,
 						     message, -1, &error);
@@ -551,6 +570,18 @@ ensure_database (GConfEngine  *conf,
                              NULL,
                              DBUS_TYPE_STRING, &db,
                              DBUS_TYPE_INVALID);
+      server_wire_format = GCONF_DBUS_WIRE_TEXT;
+    }
+  else if (g_str_equal (dbus_message_get_signature (reply),
+                        DBUS_TYPE_OBJECT_PATH_AS_STRING
+                        DBUS_TYPE_UINT32_AS_STRING))
+    {
+      dbus_message_get_args (reply,
+                             NULL,
+                             DBUS_TYPE_OBJECT_PATH, &db,
+                             DBUS_TYPE_UINT32, &format,
+                             DBUS_TYPE_INVALID);
+      server_wire_format = MIN (format, GCONF_DBUS_WIRE_NEWEST);
     }
   else
     {
@@ -558,6 +589,7 @@ ensure_database (GConfEngine  *conf,
                              NULL,
                              DBUS_TYPE_OBJECT_PATH, &db,
                              DBUS_TYPE_INVALID);
+      server_wire_format = GCONF_DBUS_WIRE_TEXT;
     }
 
   if (db == NULL)
@@ -1313,6 +1345,133 @@ gconf_engine_get_entry (GConfEngine* conf,
 
   return entry;
 }
+
+static GSList*
+get_many_one_by_one (GConfEngine *conf,
+                     GSList      *keys,
+                     const gchar *locale,
+                     gboolean     use_schema_default,
+                     GError     **err)
+{
+  GSList *entries;
+  GSList *tmp;
+
+  entries = NULL;
+  for (tmp = keys; tmp != NULL; tmp = tmp->next)
+    {
+      GConfEntry *entry;
+
+      entry = gconf_engine_get_entry (conf, tmp->data, locale,
+                                      use_schema_default, err);
+      if (entry == NULL)
+        {
+          g_slist_foreach (entries, (GFunc) gconf_entry_free, NULL);
+          g_slist_free (entries);
+          return NULL;
+        }
+
+      entries = g_slist_prepend (entries, entry);
+    }
+
+  return g_slist_reverse (entries);
+}
+
+GSList*
+gconf_engine_get_many (GConfEngine *conf,
+                       GSList      *keys,
+                       const gchar *locale,
+                       gboolean     use_schema_default,
+                       GError     **err)
+{
+  const gchar *db;
+  DBusMessage *message, *reply;
+  DBusMessageIter iter, array_iter;
+  DBusError error;
+  GSList *entries;
+  GSList *tmp;
+
+  g_return_val_if_fail (conf != NULL, NULL);
+  g_return_val_if_fail (err == NULL || *err == NULL, NULL);
+
+  CHECK_OWNER_USE (conf);
+
+  if (keys == NULL)
+    return NULL;
+
+  for (tmp = keys; tmp != NULL; tmp = tmp->next)
+    {
+      if (!gconf_key_check (tmp->data, err))
+        return NULL;
+    }
+
+  if (gconf_engine_is_local (conf))
+    return get_many_one_by_one (conf, keys, locale, use_schema_default, err);
+
+  db = gconf_engine_get_database (conf, TRUE, err);
+
+  if (db == NULL)
+    {
+      g_return_val_if_fail (err == NULL || *err != NULL, NULL);
+      return NULL;
+    }
+
+  message = dbus_message_new_method_call (GCONF_DBUS_SERVICE,
+					  db,
+					  GCONF_DBUS_DATABASE_INTERFACE,
+					  GCONF_DBUS_DATABASE_LOOKUP_MANY);
+
+  locale = locale ? locale : gconf_current_locale ();
+
+  dbus_message_iter_init_append (message, &iter);
+  dbus_message_iter_open_container (&iter, DBUS_TYPE_ARRAY,
+				    DBUS_TYPE_STRING_AS_STRING,
+				    &array_iter);
+  for (tmp = keys; tmp != NULL; tmp = tmp->next)
+    dbus_message_iter_append_basic (&array_iter, DBUS_TYPE_STRING, &tmp->data);
+  dbus_message_iter_close_container (&iter, &array_iter);
+
+  dbus_message_iter_append_basic (&iter, DBUS_TYPE_STRING, &locale);
+  dbus_message_iter_append_basic (&iter, DBUS_TYPE_BOOLEAN, &use_schema_default);
+
+  dbus_error_init (&error);
+  reply = dbus_connection_send_with_reply_and_block (global_conn, message, -1, &error);
+  dbus_message_unref (message);
+
+  if (dbus_error_is_set (&error) &&
+      dbus_error_has_name (&error, DBUS_ERROR_UNKNOWN_METHOD))
+    {
+      /* An older gconfd */
+      dbus_error_free (&error);
+      return get_many_one_by_one (conf, keys, locale, use_schema_default, err);
+    }
+
+  if (gconf_handle_dbus_exception (reply, &error, err))
+    return NULL;
+
+  dbus_message_iter_init (reply, &iter);
+
+  /* The keys come back absolute, so they're relative to "/" */
+  entries = NULL;
+  if (dbus_message_iter_get_arg_type (&iter) == DBUS_TYPE_ARRAY)
+    entries = g_slist_reverse (gconf_dbus_utils_get_entries (&iter, "/"));
+
+  dbus_message_unref (reply);
+
+  if (g_slist_length (entries) != g_slist_length (keys))
+    {
+      g_slist_foreach (entries, (GFunc) gconf_entry_free, NULL);
+      g_slist_free (entries);
+
+      if (err)
+	g_set_error (err, GCONF_ERROR,
+		     GCONF_ERROR_FAILED,
+		     _("Couldn't get values"));
+
+      return NULL;
+    }
+
+  return entries;
+}
      
 GConfValue*  
 gconf_engine_get (GConfEngine* conf, const gchar* key, GError** err)
@@ -1498,7 +1657,7 @@ gconf_engine_set (GConfEngine* conf, const gchar* key,
 			    DBUS_TYPE_INVALID);
 
   dbus_message_iter_init_append (message, &iter);
-  gconf_dbus_utils_append_value (&iter, value);
+  gconf_dbus_utils_append_value (&iter, value, server_wire_format);
 
   dbus_error_init (&error);
   reply = dbus_connection_send_with_reply_and_block (global_conn, message, -1, &error);
@@ -1988,6 +2147,168 @@ gconf_engine_all_dirs(GConfEngine* conf, const gchar* dir, GError** err)
   return subdirs;
 }
 
+static gboolean
+all_entries_dir_by_dir (GConfEngine *conf,
+                        const gchar *dir,
+                        GSList     **entries,
+                        GSList     **subdirs,
+                        GError     **err)
+{
+  GError *error = NULL;
+  GSList *dirs;
+  GSList *tmp;
+
+  *entries = g_slist_concat (gconf_engine_all_entries (conf, dir, &error),
+                             *entries);
+  if (error == NULL)
+    dirs = gconf_engine_all_dirs (conf, dir, &error);
+  else
+    dirs = NULL;
+
+  for (tmp = dirs; tmp != NULL; tmp = tmp->next)
+    {
+      if (error == NULL)
+        all_entries_dir_by_dir (conf, tmp->data, entries, subdirs, &error);
+
+      *subdirs = g_slist_prepend (*subdirs, tmp->data);
+    }
+  g_slist_free (dirs);
+
+  if (error != NULL)
+    {
+      g_propagate_error (err, error);
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+static GSList*
+all_entries_recursive_dir_by_dir (GConfEngine *conf,
+                                  const gchar *dir,
+                                  GSList     **subdirs,
+                                  GError     **err)
+{
+  GSList *entries = NULL;
+  GSList *dirs = NULL;
+
+  if (!all_entries_dir_by_dir (conf, dir, &entries, &dirs, err))
+    {
+      g_slist_foreach (entries, (GFunc) gconf_entry_free, NULL);
+      g_slist_free (entries);
+      g_slist_foreach (dirs, (GFunc) g_free, NULL);
+      g_slist_free (dirs);
+      return NULL;
+    }
+
+  if (subdirs)
+    *subdirs = dirs;
+  else
+    {
+      g_slist_foreach (dirs, (GFunc) g_free, NULL);
+      g_slist_free (dirs);
+    }
+
+  return entries;
+}
+
+GSList*
+gconf_engine_all_entries_recursive (GConfEngine *conf,
+                                    const gchar *dir,
+                                    GSList     **subdirs,
+                                    GError     **err)
+{
+  GSList *entries;
+  GSList *dirs;
+  const gchar *db;
+  const gchar *locale;
+  DBusMessage *message, *reply;
+  DBusError error;
+  DBusMessageIter iter;
+  DBusMessageIter array_iter;
+
+  g_return_val_if_fail (conf != NULL, NULL);
+  g_return_val_if_fail (dir != NULL, NULL);
+  g_return_val_if_fail (err == NULL || *err == NULL, NULL);
+
+  CHECK_OWNER_USE (conf);
+
+  if (subdirs)
+    *subdirs = NULL;
+
+  if (!gconf_key_check (dir, err))
+    return NULL;
+
+  if (gconf_engine_is_local (conf))
+    return all_entries_recursive_dir_by_dir (conf, dir, subdirs, err);
+
+  db = gconf_engine_get_database (conf, TRUE, err);
+
+  if (db == NULL)
+    {
+      g_return_val_if_fail (err == NULL || *err != NULL, NULL);
+      return NULL;
+    }
+
+  message = dbus_message_new_method_call (GCONF_DBUS_SERVICE,
+					  db,
+					  GCONF_DBUS_DATABASE_INTERFACE,
+					  GCONF_DBUS_DATABASE_GET_SUBTREE);
+
+  locale = gconf_current_locale ();
+  dbus_message_append_args (message,
+			    DBUS_TYPE_STRING, &dir,
+			    DBUS_TYPE_STRING, &locale,
+			    DBUS_TYPE_INVALID);
+
+  dbus_error_init (&error);
+  reply = dbus_connection_send_with_reply_and_block (global_conn, message, -1, &error);
+  dbus_message_unref (message);
+
+  if (dbus_error_is_set (&error) &&
+      dbus_error_has_name (&error, DBUS_ERROR_UNKNOWN_METHOD))
+    {
+      /* An older gconfd */
+      dbus_error_free (&error);
+      return all_entries_recursive_dir_by_dir (conf, dir, subdirs, err);
+    }
+
+  if (gconf_handle_dbus_exception (reply, &error, err))
+    return NULL;
+
+  dbus_message_iter_init (reply, &iter);
+
+  /* The subdirs, then the entries, all absolute */
+  dirs = NULL;
+  dbus_message_iter_recurse (&iter, &array_iter);
+  while (dbus_message_iter_get_arg_type (&array_iter) == DBUS_TYPE_STRING)
+    {
+      const gchar *name;
+
+      dbus_message_iter_get_basic (&array_iter, &name);
+      dirs = g_slist_prepend (dirs, g_strdup (name));
+
+      dbus_message_iter_next (&array_iter);
+    }
+
+  entries = NULL;
+  if (dbus_message_iter_next (&iter) &&
+      dbus_message_iter_get_arg_type (&iter) == DBUS_TYPE_ARRAY)
+    entries = gconf_dbus_utils_get_entries (&iter, "/");
+
+  dbus_message_unref (reply);
+
+  if (subdirs)
+    *subdirs = dirs;
+  else
+    {
+      g_slist_foreach (dirs, (GFunc) g_free, NULL);
+      g_slist_free (dirs);
+    }
+
+  return entries;
+}
+
 /* annoyingly, this is REQUIRED for local sources */
 void 
 gconf_engine_suggest_sync(GConfEngine* conf, GError** err)
@@ -2083,6 +2404,12 @@ gconf_clear_cache(GConfEngine* conf, GError** err)
 void 
 gconf_synchronous_sync(GConfEngine* conf, GError** err)
 {
+  const gchar *db;
+  DBusMessage *message;
+  DBusMessage *reply;
+  DBusError error;
+  dbus_bool_t wait = TRUE;
+
   g_return_if_fail(conf != NULL);
   g_return_if_fail(err == NULL || *err == NULL);
 
@@ -2106,93 +2433,823 @@ gconf_synchronous_sync(GConfEngine* conf, GError** err)
       return;
     }
 
-  /* Do nothing for non-local case. */
-}
-
-gboolean
-gconf_engine_dir_exists (GConfEngine *conf, const gchar *dir, GError** err)
-{
-  const gchar *db;
-  dbus_bool_t exists;
-  DBusMessage *message, *reply;
-  DBusError error;
-  
-  g_return_val_if_fail(conf != NULL, FALSE);
-  g_return_val_if_fail(dir != NULL, FALSE);
-  g_return_val_if_fail(err == NULL || *err == NULL, FALSE);
-
-  CHECK_OWNER_USE (conf);
-  
-  if (!gconf_key_check(dir, err))
-    return FALSE;
-  
-  if (gconf_engine_is_local(conf))
-    {
-      return gconf_sources_dir_exists(conf->local_sources,
-                                      dir,
-                                      err);
-    }
+  db = gconf_engine_get_database (conf, TRUE, err);
 
-  g_assert(!gconf_engine_is_local(conf));
-  
-  db = gconf_engine_get_database(conf, TRUE, err);
-  
   if (db == NULL)
     {
-      g_return_val_if_fail(err == NULL || *err != NULL, FALSE);
-
-      return FALSE;
+      g_return_if_fail (err == NULL || *err != NULL);
+      return;
     }
 
+  /* Ask gconfd to reply once everything is written out */
   message = dbus_message_new_method_call (GCONF_DBUS_SERVICE,
 					  db,
 					  GCONF_DBUS_DATABASE_INTERFACE,
-					  GCONF_DBUS_DATABASE_DIR_EXISTS);
-  
+					  GCONF_DBUS_DATABASE_SUGGEST_SYNC);
   dbus_message_append_args (message,
-			    DBUS_TYPE_STRING, &dir,
+			    DBUS_TYPE_BOOLEAN, &wait,
 			    DBUS_TYPE_INVALID);
-  
+
   dbus_error_init (&error);
   reply = dbus_connection_send_with_reply_and_block (global_conn, message, -1, &error);
   dbus_message_unref (message);
- 
-  if (gconf_handle_dbus_exception (reply, &error, err))
-    return FALSE;
 
-  g_return_val_if_fail (err == NULL || *err == NULL, FALSE);
+  if (!gconf_handle_dbus_exception (reply, &error, err))
+    dbus_message_unref (reply);
+}
 
-  exists = FALSE;
-  dbus_message_get_args (reply,
-			 NULL,
-			 DBUS_TYPE_BOOLEAN, &exists,
-			 DBUS_TYPE_INVALID);
+/* A local engine has no resolved-value cache, only the sources' */
+static GSList*
+local_cache_statistics (GConfEngine *conf)
+{
+  GConfSourceMissingStats missing;
+  GSList *stats;
 
-  dbus_message_unref (reply);
+  gconf_sources_get_missing_stats (conf->local_sources, &missing);
 
-  return !!exists;
+  stats = NULL;
+  stats = gconf_statistics_prepend (stats, "missing-lookups",
+                                    missing.n_lookups);
+  stats = gconf_statistics_prepend (stats, "missing-hits",
+                                    missing.n_hits);
+  stats = gconf_statistics_prepend (stats, "missing-invalidations",
+                                    missing.n_invalidations);
+
+  return g_slist_reverse (stats);
 }
 
-void
-gconf_engine_remove_dir (GConfEngine* conf,
-                         const gchar* dir,
-                         GError** err)
+/* Calls one of the database methods that return a{st} */
+static GSList*
+get_statistics (GConfEngine  *conf,
+                const gchar  *method,
+                GError      **err)
 {
-  g_return_if_fail(conf != NULL);
-  g_return_if_fail(dir != NULL);
-  g_return_if_fail(err == NULL || *err == NULL);
+  const gchar *db;
+  DBusMessage *message;
+  DBusMessage *reply;
+  DBusError error;
+  DBusMessageIter iter;
+  DBusMessageIter dict;
+  GSList *stats;
 
-  /* FIXME we have no GConfClient method for doing this */
+  db = gconf_engine_get_database (conf, TRUE, err);
+
+  if (db == NULL)
+    {
+      g_return_val_if_fail (err == NULL || *err != NULL, NULL);
+      return NULL;
+    }
+
+  message = dbus_message_new_method_call (GCONF_DBUS_SERVICE,
+					  db,
+					  GCONF_DBUS_DATABASE_INTERFACE,
+					  method);
+
+  dbus_error_init (&error);
+  reply = dbus_connection_send_with_reply_and_block (global_conn, message, -1, &error);
+  dbus_message_unref (message);
+
+  if (gconf_handle_dbus_exception (reply, &error, err))
+    return NULL;
+
+  stats = NULL;
+  dbus_message_iter_init (reply, &iter);
+  if (dbus_message_iter_get_arg_type (&iter) == DBUS_TYPE_ARRAY)
+    {
+      dbus_message_iter_recurse (&iter, &dict);
+      while (dbus_message_iter_get_arg_type (&dict) == DBUS_TYPE_DICT_ENTRY)
+        {
+          DBusMessageIter entry;
+          const gchar *name;
+          dbus_uint64_t value;
+
+          dbus_message_iter_recurse (&dict, &entry);
+          dbus_message_iter_get_basic (&entry, &name);
+          dbus_message_iter_next (&entry);
+          dbus_message_iter_get_basic (&entry, &value);
+
+          stats = gconf_statistics_prepend (stats, name, value);
+
+          dbus_message_iter_next (&dict);
+        }
+    }
+
+  dbus_message_unref (reply);
+
+  return g_slist_reverse (stats);
+}
+
+GSList*
+gconf_engine_get_cache_statistics (GConfEngine  *conf,
+                                   GError      **err)
+{
+  g_return_val_if_fail (conf != NULL, NULL);
+  g_return_val_if_fail (err == NULL || *err == NULL, NULL);
+
+  if (gconf_engine_is_local (conf))
+    return local_cache_statistics (conf);
+
+  return get_statistics (conf, GCONF_DBUS_DATABASE_GET_CACHE_STATS, err);
+}
+
+GSList*
+gconf_engine_get_statistics (GConfEngine  *conf,
+                             GError      **err)
+{
+  g_return_val_if_fail (conf != NULL, NULL);
+  g_return_val_if_fail (err == NULL || *err == NULL, NULL);
+
+  if (gconf_engine_is_local (conf))
+    return local_cache_statistics (conf);
+
+  return get_statistics (conf, GCONF_DBUS_DATABASE_GET_STATISTICS, err);
+}
+
+gboolean
+gconf_engine_commit_entries (GConfEngine  *conf,
+                             GSList       *entries,
+                             GSList      **committed,
+                             GError      **err)
+{
+  const gchar *db;
+  const gchar *empty;
+  DBusMessage *message;
+  DBusMessage *reply;
+  DBusError error;
+  DBusMessageIter iter;
+  DBusMessageIter array_iter;
+  dbus_bool_t applied;
+  GHashTable *failed;
+  GSList *tmp;
+
+  g_return_val_if_fail (conf != NULL, FALSE);
+  g_return_val_if_fail (committed != NULL, FALSE);
+  g_return_val_if_fail (err == NULL || *err == NULL, FALSE);
+
+  CHECK_OWNER_USE (conf);
+
+  *committed = NULL;
+
+  if (gconf_engine_is_local (conf))
+    return FALSE;
+
+  db = gconf_engine_get_database (conf, TRUE, err);
+
+  if (db == NULL)
+    {
+      g_return_val_if_fail (err == NULL || *err != NULL, TRUE);
+
+      return TRUE;
+    }
+
+  if (server_wire_format < GCONF_DBUS_WIRE_CHANGE_SETS)
+    return FALSE;
+
+  message = dbus_message_new_method_call (GCONF_DBUS_SERVICE,
+					  db,
+					  GCONF_DBUS_DATABASE_INTERFACE,
+					  GCONF_DBUS_DATABASE_COMMIT_CHANGE_SET);
+
+  dbus_message_iter_init_append (message, &iter);
+  gconf_dbus_utils_append_entries (&iter, entries, server_wire_format);
+
+  empty = "";
+  dbus_message_iter_append_basic (&iter, DBUS_TYPE_STRING, &empty);
+
+  dbus_error_init (&error);
+  reply = dbus_connection_send_with_reply_and_block (global_conn, message, -1, &error);
+  dbus_message_unref (message);
+
+  if (gconf_handle_dbus_exception (reply, &error, err))
+    return TRUE;
+
+  if (!dbus_message_has_signature (reply, "ba(sis)"))
+    {
+      if (err)
+        *err = gconf_error_new (GCONF_ERROR_FAILED,
+                                _("Got a malformed reply to a change set commit"));
+      dbus_message_unref (reply);
+      return TRUE;
+    }
+
+  dbus_message_iter_init (reply, &iter);
+  dbus_message_iter_get_basic (&iter, &applied);
+
+  failed = g_hash_table_new (g_str_hash, g_str_equal);
+
+  dbus_message_iter_next (&iter);
+  dbus_message_iter_recurse (&iter, &array_iter);
+  while (dbus_message_iter_get_arg_type (&array_iter) == DBUS_TYPE_STRUCT)
+    {
+      DBusMessageIter struct_iter;
+      const gchar *key;
+      const gchar *str;
+      gint32 code;
+
+      dbus_message_iter_recurse (&array_iter, &struct_iter);
+      dbus_message_iter_get_basic (&struct_iter, &key);
+      dbus_message_iter_next (&struct_iter);
+      dbus_message_iter_get_basic (&struct_iter, &code);
+      dbus_message_iter_next (&struct_iter);
+      dbus_message_iter_get_basic (&struct_iter, &str);
+
+      g_hash_table_insert (failed, (gchar *) key, (gchar *) key);
+
+      /* gconfd's message already names the kind of error */
+      if (err && *err == NULL)
+        *err = g_error_new_literal (GCONF_ERROR, code, str);
+
+      dbus_message_iter_next (&array_iter);
+    }
+
+  if (applied)
+    {
+      for (tmp = entries; tmp != NULL; tmp = tmp->next)
+        {
+          GConfEntry *entry = tmp->data;
+
+          if (g_hash_table_lookup (failed, entry->key) == NULL)
+            *committed = g_slist_prepend (*committed, entry);
+        }
+
+      *committed = g_slist_reverse (*committed);
+    }
+
+  g_hash_table_destroy (failed);
+  dbus_message_unref (reply);
+
+  return TRUE;
+}
+
+gboolean
+gconf_engine_dir_exists (GConfEngine *conf, const gchar *dir, GError** err)
+{
+  const gchar *db;
+  dbus_bool_t exists;
+  DBusMessage *message, *reply;
+  DBusError error;
+  
+  g_return_val_if_fail(conf != NULL, FALSE);
+  g_return_val_if_fail(dir != NULL, FALSE);
+  g_return_val_if_fail(err == NULL || *err == NULL, FALSE);
+
+  CHECK_OWNER_USE (conf);
+  
+  if (!gconf_key_check(dir, err))
+    return FALSE;
+  
+  if (gconf_engine_is_local(conf))
+    {
+      return gconf_sources_dir_exists(conf->local_sources,
+                                      dir,
+                                      err);
+    }
+
+  g_assert(!gconf_engine_is_local(conf));
+  
+  db = gconf_engine_get_database(conf, TRUE, err);
+  
+  if (db == NULL)
+    {
+      g_return_val_if_fail(err == NULL || *err != NULL, FALSE);
+
+      return FALSE;
+    }
+
+  message = dbus_message_new_method_call (GCONF_DBUS_SERVICE,
+					  db,
+					  GCONF_DBUS_DATABASE_INTERFACE,
+					  GCONF_DBUS_DATABASE_DIR_EXISTS);
+  
+  dbus_message_append_args (message,
+			    DBUS_TYPE_STRING, &dir,
+			    DBUS_TYPE_INVALID);
+  
+  dbus_error_init (&error);
+  reply = dbus_connection_send_with_reply_and_block (global_conn, message, -1, &error);
+  dbus_message_unref (message);
+ 
+  if (gconf_handle_dbus_exception (reply, &error, err))
+    return FALSE;
+
+  g_return_val_if_fail (err == NULL || *err == NULL, FALSE);
+
+  exists = FALSE;
+  dbus_message_get_args (reply,
+			 NULL,
+			 DBUS_TYPE_BOOLEAN, &exists,
+			 DBUS_TYPE_INVALID);
+
+  dbus_message_unref (reply);
+
+  return !!exists;
+}
+
+void
+gconf_engine_remove_dir (GConfEngine* conf,
+                         const gchar* dir,
+                         GError** err)
+{
+  g_return_if_fail(conf != NULL);
+  g_return_if_fail(dir != NULL);
+  g_return_if_fail(err == NULL || *err == NULL);
+
+  /* FIXME we have no GConfClient method for doing this */
   /*   CHECK_OWNER_USE (conf); */
   
   if (!gconf_key_check(dir, err))
     return;
 
-  if (gconf_engine_is_local(conf))
+  if (gconf_engine_is_local(conf))
+    {
+      gconf_sources_remove_dir(conf->local_sources, dir, err);
+      return;
+    }
+}
+
+/*
+ * Asynchronous requests
+ */
+
+typedef enum {
+  ASYNC_SET,
+  ASYNC_UNSET,
+  ASYNC_GET_ENTRY,
+  ASYNC_ALL_ENTRIES
+} AsyncKind;
+
+typedef struct {
+  GConfEngine *conf;
+  AsyncKind kind;
+  gchar *key;
+
+  /* Set while waiting for the reply */
+  DBusPendingCall *call;
+  gboolean done;
+
+  GError *error;
+  GConfEntry *entry;
+  GSList *entries;
+
+  GCallback func;
+  gpointer user_data;
+} AsyncOp;
+
+static void async_dispatch (GConfEngine *conf);
+
+static AsyncOp *
+async_op_new (GConfEngine *conf,
+	      AsyncKind    kind,
+	      const gchar *key,
+	      GCallback    func,
+	      gpointer     user_data)
+{
+  AsyncOp *op;
+
+  op = g_new0 (AsyncOp, 1);
+  op->conf = conf;
+  op->kind = kind;
+  op->key = g_strdup (key);
+  op->func = func;
+  op->user_data = user_data;
+
+  gconf_engine_ref (conf);
+  g_queue_push_tail (&conf->async_ops, op);
+
+  return op;
+}
+
+static void
+async_op_free (AsyncOp *op)
+{
+  if (op->error)
+    g_error_free (op->error);
+  if (op->entry)
+    gconf_entry_free (op->entry);
+  g_slist_foreach (op->entries, (GFunc) gconf_entry_free, NULL);
+  g_slist_free (op->entries);
+  g_free (op->key);
+  gconf_engine_unref (op->conf);
+  g_free (op);
+}
+
+static gboolean
+async_dispatch_idle (gpointer data)
+{
+  GConfEngine *conf = data;
+
+  conf->async_idle = 0;
+  async_dispatch (conf);
+  gconf_engine_unref (conf);
+
+  return FALSE;
+}
+
+/* Finishes a request that has no reply to wait for. Its callback
+ * still waits for those of the requests made before it.
+ */
+static void
+async_op_finish (AsyncOp *op,
+		 GError  *error)
+{
+  GConfEngine *conf = op->conf;
+
+  op->error = error;
+  op->done = TRUE;
+
+  if (conf->async_idle == 0)
+    {
+      gconf_engine_ref (conf);
+      conf->async_idle = g_idle_add (async_dispatch_idle, conf);
+    }
+}
+
+static void
+async_op_take_entry (AsyncOp     *op,
+		     DBusMessage *reply)
+{
+  DBusMessageIter iter;
+  GConfValue *val;
+  gboolean is_default;
+  gboolean is_writable;
+  gchar *schema_name;
+
+  op->entry = gconf_entry_new_nocopy (g_strdup (op->key), NULL);
+  gconf_entry_set_is_writable (op->entry, TRUE);
+
+  dbus_message_iter_init (reply, &iter);
+
+  /* If there is no struct (entry) here, there is no value. */
+  if (dbus_message_iter_get_arg_type (&iter) != DBUS_TYPE_STRUCT)
+    return;
+
+  if (!gconf_dbus_utils_get_entry_values (&iter,
+					  NULL,
+					  &val,
+					  &is_default,
+					  &is_writable,
+					  &schema_name))
+    {
+      gconf_entry_free (op->entry);
+      op->entry = NULL;
+      op->error = gconf_error_new (GCONF_ERROR_FAILED, _("Couldn't get value"));
+      return;
+    }
+
+  gconf_entry_set_value_nocopy (op->entry, val);
+  gconf_entry_set_is_default (op->entry, is_default);
+  gconf_entry_set_is_writable (op->entry, is_writable);
+
+  if (schema_name && schema_name[0] == '/')
+    gconf_entry_set_schema_name (op->entry, schema_name);
+
+  g_free (schema_name);
+}
+
+static void
+async_op_reply (DBusPendingCall *call,
+		void            *data)
+{
+  AsyncOp *op = data;
+  DBusMessage *reply;
+  DBusMessageIter iter;
+
+  reply = dbus_pending_call_steal_reply (call);
+  dbus_pending_call_unref (op->call);
+  op->call = NULL;
+  op->done = TRUE;
+
+  if (!gconf_handle_dbus_exception (reply, NULL, &op->error))
+    {
+      switch (op->kind)
+	{
+	case ASYNC_GET_ENTRY:
+	  async_op_take_entry (op, reply);
+	  break;
+	case ASYNC_ALL_ENTRIES:
+	  dbus_message_iter_init (reply, &iter);
+	  op->entries = gconf_dbus_utils_get_entries (&iter, op->key);
+	  break;
+	default:
+	  break;
+	}
+
+      dbus_message_unref (reply);
+    }
+
+  async_dispatch (op->conf);
+}
+
+/* Sends the request without waiting for the reply; other requests
+ * can go out meanwhile.
+ */
+static void
+async_op_send (AsyncOp     *op,
+	       DBusMessage *message)
+{
+  if (global_conn == NULL ||
+      !dbus_connection_send_with_reply (global_conn, message, &op->call, -1) ||
+      op->call == NULL)
+    {
+      op->call = NULL;
+      async_op_finish (op, gconf_error_new (GCONF_ERROR_NO_SERVER,
+					    _("Couldn't send request to the configuration server")));
+      return;
+    }
+
+  dbus_pending_call_set_notify (op->call, async_op_reply, op, NULL);
+}
+
+/* Returns NULL having finished the request with an error if there is
+ * no database to send it to.
+ */
+static const gchar *
+async_op_get_database (AsyncOp *op)
+{
+  const gchar *db;
+  GError *error;
+
+  error = NULL;
+  db = gconf_engine_get_database (op->conf, TRUE, &error);
+
+  if (db == NULL)
+    async_op_finish (op, error);
+
+  return db;
+}
+
+static void
+async_dispatch (GConfEngine *conf)
+{
+  AsyncOp *op;
+
+  /* The last request may hold the last reference */
+  gconf_engine_ref (conf);
+
+  while ((op = g_queue_peek_head (&conf->async_ops)) != NULL && op->done)
+    {
+      g_queue_pop_head (&conf->async_ops);
+
+      if (op->func != NULL)
+	{
+	  switch (op->kind)
+	    {
+	    case ASYNC_SET:
+	    case ASYNC_UNSET:
+	      (* (GConfEngineDoneFunc) op->func) (conf, op->error,
+						  op->user_data);
+	      break;
+	    case ASYNC_GET_ENTRY:
+	      (* (GConfEngineEntryFunc) op->func) (conf, op->entry, op->error,
+						   op->user_data);
+	      break;
+	    case ASYNC_ALL_ENTRIES:
+	      (* (GConfEngineEntriesFunc) op->func) (conf, op->entries,
+						     op->error, op->user_data);
+	      break;
+	    }
+	}
+
+      async_op_free (op);
+    }
+
+  gconf_engine_unref (conf);
+}
+
+void
+gconf_engine_set_async (GConfEngine         *conf,
+			const gchar         *key,
+			const GConfValue    *value,
+			GConfEngineDoneFunc  func,
+			gpointer             user_data)
+{
+  AsyncOp *op;
+  const gchar *db;
+  DBusMessage *message;
+  DBusMessageIter iter;
+  GError *error;
+
+  g_return_if_fail (conf != NULL);
+  g_return_if_fail (key != NULL);
+  g_return_if_fail (value != NULL);
+
+  CHECK_OWNER_USE (conf);
+
+  op = async_op_new (conf, ASYNC_SET, key, G_CALLBACK (func), user_data);
+
+  error = NULL;
+  if (gconf_engine_is_local (conf) ||
+      !gconf_key_check (key, &error) ||
+      !gconf_value_validate (value, &error))
+    {
+      /* Local engines have nothing to wait for */
+      if (error == NULL)
+	gconf_engine_set (conf, key, value, &error);
+
+      async_op_finish (op, error);
+      return;
+    }
+
+  db = async_op_get_database (op);
+  if (db == NULL)
+    return;
+
+  message = dbus_message_new_method_call (GCONF_DBUS_SERVICE,
+					  db,
+					  GCONF_DBUS_DATABASE_INTERFACE,
+					  GCONF_DBUS_DATABASE_SET);
+
+  dbus_message_append_args (message,
+			    DBUS_TYPE_STRING, &key,
+			    DBUS_TYPE_INVALID);
+
+  dbus_message_iter_init_append (message, &iter);
+  gconf_dbus_utils_append_value (&iter, value, server_wire_format);
+
+  async_op_send (op, message);
+  dbus_message_unref (message);
+}
+
+void
+gconf_engine_unset_async (GConfEngine         *conf,
+			  const gchar         *key,
+			  GConfEngineDoneFunc  func,
+			  gpointer             user_data)
+{
+  AsyncOp *op;
+  const gchar *db;
+  const gchar *empty;
+  DBusMessage *message;
+  GError *error;
+
+  g_return_if_fail (conf != NULL);
+  g_return_if_fail (key != NULL);
+
+  CHECK_OWNER_USE (conf);
+
+  op = async_op_new (conf, ASYNC_UNSET, key, G_CALLBACK (func), user_data);
+
+  error = NULL;
+  if (gconf_engine_is_local (conf) || !gconf_key_check (key, &error))
     {
-      gconf_sources_remove_dir(conf->local_sources, dir, err);
+      if (error == NULL)
+	gconf_engine_unset (conf, key, &error);
+
+      async_op_finish (op, error);
+      return;
+    }
+
+  db = async_op_get_database (op);
+  if (db == NULL)
+    return;
+
+  message = dbus_message_new_method_call (GCONF_DBUS_SERVICE,
+					  db,
+					  GCONF_DBUS_DATABASE_INTERFACE,
+					  GCONF_DBUS_DATABASE_UNSET);
+
+  empty = "";
+  dbus_message_append_args (message,
+			    DBUS_TYPE_STRING, &key,
+			    DBUS_TYPE_STRING, &empty,
+			    DBUS_TYPE_INVALID);
+
+  async_op_send (op, message);
+  dbus_message_unref (message);
+}
+
+void
+gconf_engine_get_entry_async (GConfEngine          *conf,
+			      const gchar          *key,
+			      const gchar          *locale,
+			      gboolean              use_schema_default,
+			      GConfEngineEntryFunc  func,
+			      gpointer              user_data)
+{
+  AsyncOp *op;
+  const gchar *db;
+  DBusMessage *message;
+  GError *error;
+
+  g_return_if_fail (conf != NULL);
+  g_return_if_fail (key != NULL);
+
+  CHECK_OWNER_USE (conf);
+
+  op = async_op_new (conf, ASYNC_GET_ENTRY, key, G_CALLBACK (func), user_data);
+
+  error = NULL;
+  if (gconf_engine_is_local (conf) || !gconf_key_check (key, &error))
+    {
+      if (error == NULL)
+	op->entry = gconf_engine_get_entry (conf, key, locale,
+					    use_schema_default, &error);
+
+      async_op_finish (op, error);
+      return;
+    }
+
+  db = async_op_get_database (op);
+  if (db == NULL)
+    return;
+
+  message = dbus_message_new_method_call (GCONF_DBUS_SERVICE,
+					  db,
+					  GCONF_DBUS_DATABASE_INTERFACE,
+					  GCONF_DBUS_DATABASE_LOOKUP_EXTENDED);
+
+  locale = locale ? locale : gconf_current_locale ();
+
+  dbus_message_append_args (message,
+			    DBUS_TYPE_STRING, &key,
+			    DBUS_TYPE_STRING, &locale,
+			    DBUS_TYPE_BOOLEAN, &use_schema_default,
+			    DBUS_TYPE_INVALID);
+
+  async_op_send (op, message);
+  dbus_message_unref (message);
+}
+
+void
+gconf_engine_all_entries_async (GConfEngine            *conf,
+				const gchar            *dir,
+				GConfEngineEntriesFunc  func,
+				gpointer                user_data)
+{
+  AsyncOp *op;
+  const gchar *db;
+  const gchar *locale;
+  DBusMessage *message;
+  GError *error;
+
+  g_return_if_fail (conf != NULL);
+  g_return_if_fail (dir != NULL);
+
+  CHECK_OWNER_USE (conf);
+
+  op = async_op_new (conf, ASYNC_ALL_ENTRIES, dir, G_CALLBACK (func), user_data);
+
+  error = NULL;
+  if (gconf_engine_is_local (conf) || !gconf_key_check (dir, &error))
+    {
+      if (error == NULL)
+	op->entries = gconf_engine_all_entries (conf, dir, &error);
+
+      async_op_finish (op, error);
       return;
     }
+
+  db = async_op_get_database (op);
+  if (db == NULL)
+    return;
+
+  message = dbus_message_new_method_call (GCONF_DBUS_SERVICE,
+					  db,
+					  GCONF_DBUS_DATABASE_INTERFACE,
+					  GCONF_DBUS_DATABASE_GET_ALL_ENTRIES);
+
+  locale = gconf_current_locale ();
+  dbus_message_append_args (message,
+			    DBUS_TYPE_STRING, &dir,
+			    DBUS_TYPE_STRING, &locale,
+			    DBUS_TYPE_INVALID);
+
+  async_op_send (op, message);
+  dbus_message_unref (message);
+}
+
+void
+gconf_engine_complete_pending (GConfEngine *conf)
+{
+  g_return_if_fail (conf != NULL);
+
+  gconf_engine_ref (conf);
+
+  while (!g_queue_is_empty (&conf->async_ops))
+    {
+      AsyncOp *op = g_queue_peek_head (&conf->async_ops);
+
+      /* Blocking runs the reply handler, which dispatches */
+      if (op->call != NULL)
+	{
+	  DBusPendingCall *call;
+
+	  call = dbus_pending_call_ref (op->call);
+	  dbus_pending_call_block (call);
+	  dbus_pending_call_unref (call);
+	}
+      else
+	async_dispatch (conf);
+    }
+
+  if (conf->async_idle != 0)
+    {
+      g_source_remove (conf->async_idle);
+      conf->async_idle = 0;
+      gconf_engine_unref (conf);
+    }
+
+  gconf_engine_unref (conf);
 }
 
 static void
@@ -2270,6 +3327,12 @@ gconf_dbus_message_filter (DBusConnection    *dbus_conn,
     {
       return handle_notify (dbus_conn, message, NULL);
     }
+  else if (dbus_message_is_method_call (message,
+					GCONF_DBUS_CLIENT_INTERFACE,
+					GCONF_DBUS_LISTENER_NOTIFY_MANY))
+    {
+      return handle_notify_many (dbus_conn, message);
+    }
   else if (dbus_message_is_signal (message,
 				   DBUS_INTERFACE_LOCAL,
 				   "Disconnected"))
@@ -2322,6 +3385,7 @@ gconf_dbus_message_filter (DBusConnection    *dbus_conn,
 	  /* GConfd is gone, set the state so we can detect that we're down. */
 	  service_running = FALSE;
 	  needs_reconnect = TRUE;
+	  server_wire_format = GCONF_DBUS_WIRE_TEXT;
   
 	  d(g_print ("*** GConf Service deleted\n"));
 	}
@@ -2476,6 +3540,91 @@ handle_notify (DBusConnection *connection,
   return DBUS_HANDLER_RESULT_HANDLED;
 }
 
+/* A batch of changes: the entries, then (namespace_section, index)
+ * pairs naming the entry each matched section is notified of.
+ */
+static DBusHandlerResult
+handle_notify_many (DBusConnection *connection,
+		    DBusMessage    *message)
+{
+  GConfEngine *conf;
+  DBusMessageIter iter;
+  DBusMessageIter array_iter;
+  DBusMessageIter struct_iter;
+  GPtrArray *entries;
+  GSList *list, *tmp;
+  gboolean match = FALSE;
+  gchar *db;
+
+  if (!dbus_message_iter_init (message, &iter) ||
+      dbus_message_iter_get_arg_type (&iter) != DBUS_TYPE_OBJECT_PATH)
+    return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+
+  dbus_message_iter_get_basic (&iter, &db);
+
+  if (!dbus_message_iter_next (&iter) ||
+      dbus_message_iter_get_arg_type (&iter) != DBUS_TYPE_ARRAY)
+    return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+
+  conf = lookup_engine_by_database (db);
+  if (conf == NULL)
+    return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+
+  /* Keys are sent in full */
+  list = g_slist_reverse (gconf_dbus_utils_get_entries (&iter, "/"));
+
+  entries = g_ptr_array_new ();
+  for (tmp = list; tmp; tmp = tmp->next)
+    g_ptr_array_add (entries, tmp->data);
+  g_slist_free (list);
+
+  if (dbus_message_iter_next (&iter) &&
+      dbus_message_iter_get_arg_type (&iter) == DBUS_TYPE_ARRAY)
+    {
+      dbus_message_iter_recurse (&iter, &array_iter);
+
+      while (dbus_message_iter_get_arg_type (&array_iter) == DBUS_TYPE_STRUCT)
+	{
+	  gchar *namespace_section;
+	  dbus_uint32_t index;
+	  GList *l;
+
+	  dbus_message_iter_recurse (&array_iter, &struct_iter);
+	  dbus_message_iter_get_basic (&struct_iter, &namespace_section);
+	  dbus_message_iter_next (&struct_iter);
+	  dbus_message_iter_get_basic (&struct_iter, &index);
+
+	  dbus_message_iter_next (&array_iter);
+
+	  if (index >= entries->len)
+	    continue;
+
+	  d(g_print ("Got batched notify on %s (%s)\n",
+		     gconf_entry_get_key (g_ptr_array_index (entries, index)),
+		     namespace_section));
+
+	  for (l = gconf_cnxn_lookup_dir (conf, namespace_section); l; l = l->next)
+	    {
+	      GConfCnxn *cnxn = l->data;
+
+	      if (strcmp (cnxn->namespace_section, namespace_section) == 0)
+		{
+		  gconf_cnxn_notify (cnxn, g_ptr_array_index (entries, index));
+		  match = TRUE;
+		}
+	    }
+	}
+    }
+
+  g_ptr_array_foreach (entries, (GFunc) gconf_entry_free, NULL);
+  g_ptr_array_free (entries, TRUE);
+
+  if (!match)
+    return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+
+  return DBUS_HANDLER_RESULT_HANDLED;
+}
+
 
 /*
  * Daemon control
@@ -23,6 +23,7 @@
 #include "gconf-backend.h"
 #include "gconf-schema.h"
 #include "gconf.h"
+#include "gconf-changeset.h"
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -1041,6 +1042,195 @@ gconf_address_list_free (GSList *addresses)
   g_slist_free (addresses);
 }
 
+GSList*
+gconf_statistics_prepend (GSList      *stats,
+                          const gchar *name,
+                          guint64      value)
+{
+  GConfStatistic *stat;
+
+  stat = g_new (GConfStatistic, 1);
+  stat->name = g_strdup (name);
+  stat->value = value;
+
+  return g_slist_prepend (stats, stat);
+}
+
+void
+gconf_statistics_free (GSList *stats)
+{
+  GSList *tmp;
+
+  for (tmp = stats; tmp != NULL; tmp = tmp->next)
+    {
+      GConfStatistic *stat = tmp->data;
+
+      g_free (stat->name);
+      g_free (stat);
+    }
+
+  g_slist_free (stats);
+}
+
+/*
+ * Change sets as entries
+ */
+
+static void
+change_set_entries_foreach (GConfChangeSet *cs,
+                            const gchar    *key,
+                            GConfValue     *value,
+                            gpointer        user_data)
+{
+  GSList **entries = user_data;
+
+  *entries = g_slist_prepend (*entries,
+                              gconf_entry_new_nocopy (g_strdup (key),
+                                                      value ? gconf_value_ref (value) : NULL));
+}
+
+GSList*
+gconf_change_set_get_entries (GConfChangeSet *cs)
+{
+  GSList *entries;
+
+  g_return_val_if_fail (cs != NULL, NULL);
+
+  entries = NULL;
+  gconf_change_set_foreach (cs, change_set_entries_foreach, &entries);
+
+  return entries;
+}
+
+gboolean
+gconf_entries_validate (GSList  *entries,
+                        GError **err)
+{
+  GSList *tmp;
+
+  for (tmp = entries; tmp != NULL; tmp = tmp->next)
+    {
+      GConfEntry *entry = tmp->data;
+
+      if (!gconf_key_check (entry->key, err))
+        return FALSE;
+
+      if (entry->value != NULL && !gconf_value_validate (entry->value, err))
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+/*
+ * Key interning
+ */
+
+typedef struct {
+  guint refcount;
+  gchar str[1];
+} InternedKey;
+
+#define INTERNED_KEY(str) \
+  ((InternedKey*) ((gchar*) (str) - G_STRUCT_OFFSET (InternedKey, str)))
+
+static GMutex intern_lock;
+static GHashTable *intern_table = NULL;
+static GConfKeyInternStats intern_stats;
+/* GCONF_DISABLE_KEY_INTERNING makes every intern a plain copy, to
+ * measure what interning saves
+ */
+static gint intern_disabled = -1;
+
+const gchar*
+gconf_key_intern (const gchar *key)
+{
+  InternedKey *ik;
+
+  if (key == NULL)
+    return NULL;
+
+  g_mutex_lock (&intern_lock);
+
+  if (G_UNLIKELY (intern_disabled < 0))
+    intern_disabled = g_getenv ("GCONF_DISABLE_KEY_INTERNING") != NULL;
+
+  intern_stats.n_interns++;
+
+  if (G_UNLIKELY (intern_disabled))
+    {
+      intern_stats.n_allocs++;
+      g_mutex_unlock (&intern_lock);
+      return g_strdup (key);
+    }
+
+  if (intern_table == NULL)
+    intern_table = g_hash_table_new (g_str_hash, g_str_equal);
+
+  ik = g_hash_table_lookup (intern_table, key);
+  if (ik != NULL)
+    ik->refcount++;
+  else
+    {
+      gsize len = strlen (key);
+
+      ik = g_malloc (G_STRUCT_OFFSET (InternedKey, str) + len + 1);
+      ik->refcount = 1;
+      memcpy (ik->str, key, len + 1);
+      g_hash_table_insert (intern_table, ik->str, ik);
+
+      intern_stats.n_strings++;
+      intern_stats.n_bytes += len + 1;
+      intern_stats.n_allocs++;
+    }
+
+  g_mutex_unlock (&intern_lock);
+
+  return ik->str;
+}
+
+void
+gconf_key_unintern (const gchar *key)
+{
+  InternedKey *ik;
+
+  if (key == NULL)
+    return;
+
+  g_mutex_lock (&intern_lock);
+
+  if (intern_disabled > 0)
+    {
+      g_mutex_unlock (&intern_lock);
+      g_free ((gchar*) key);
+      return;
+    }
+
+  ik = INTERNED_KEY (key);
+  g_assert (ik->refcount > 0);
+
+  ik->refcount--;
+  if (ik->refcount == 0)
+    {
+      g_hash_table_remove (intern_table, ik->str);
+
+      intern_stats.n_strings--;
+      intern_stats.n_bytes -= strlen (ik->str) + 1;
+
+      g_free (ik);
+    }
+
+  g_mutex_unlock (&intern_lock);
+}
+
+void
+gconf_key_intern_get_stats (GConfKeyInternStats *stats)
+{
+  g_mutex_lock (&intern_lock);
+  *stats = intern_stats;
+  g_mutex_unlock (&intern_lock);
+}
+
 /* This should also support concatting filesystem dirs and keys, 
    or dir and subdir.
 */
@@ -1361,6 +1551,49 @@ gconf_value_pair_from_primitive_pair(GConfValueType car_type,
 }
 
 
+/* The primitive held by a list element; strings and schemas are
+ * taken from @elem if @steal, copied otherwise
+ */
+static gpointer
+primitive_list_element (GConfValue* elem, GConfValueType list_type,
+                        gboolean steal)
+{
+  g_assert(elem != NULL);
+  g_assert(elem->type == list_type);
+
+  switch (list_type)
+    {
+    case GCONF_VALUE_INT:
+      return GINT_TO_POINTER(gconf_value_get_int(elem));
+
+    case GCONF_VALUE_BOOL:
+      return GINT_TO_POINTER(gconf_value_get_bool(elem));
+
+    case GCONF_VALUE_FLOAT:
+      {
+        gdouble* d = g_new(gdouble, 1);
+        *d = gconf_value_get_float(elem);
+        return d;
+      }
+
+    case GCONF_VALUE_STRING:
+      if (steal)
+        return gconf_value_steal_string (elem);
+      return g_strdup (gconf_value_get_string (elem));
+
+    case GCONF_VALUE_SCHEMA:
+      if (steal)
+        return gconf_value_steal_schema (elem);
+      return gconf_value_get_schema (elem) ?
+        gconf_schema_copy (gconf_value_get_schema (elem)) : NULL;
+
+    default:
+      g_assert_not_reached();
+      return NULL;
+    }
+}
+
+
 GSList*
 gconf_value_list_to_primitive_list_destructive(GConfValue* val,
                                                GConfValueType list_type,
@@ -1396,62 +1629,37 @@ gconf_value_list_to_primitive_list_destructive(GConfValue* val,
     }
 
   g_assert(gconf_value_get_list_type(val) == list_type);
-      
-  retval = gconf_value_steal_list (val);
-      
-  gconf_value_free (val);
-  val = NULL;
-      
-  {
-    /* map (typeChange, retval) */
-    GSList* tmp;
 
-    tmp = retval;
+  if (gconf_value_owns_list (val))
+    {
+      GSList* tmp;
 
-    while (tmp != NULL)
-      {
-        GConfValue* elem = tmp->data;
+      /* map (typeChange, retval), reusing the list nodes */
+      retval = gconf_value_steal_list (val);
 
-        g_assert(elem != NULL);
-        g_assert(elem->type == list_type);
-            
-        switch (list_type)
-          {
-          case GCONF_VALUE_INT:
-            tmp->data = GINT_TO_POINTER(gconf_value_get_int(elem));
-            break;
-
-          case GCONF_VALUE_BOOL:
-            tmp->data = GINT_TO_POINTER(gconf_value_get_bool(elem));
-            break;
-                
-          case GCONF_VALUE_FLOAT:
-            {
-              gdouble* d = g_new(gdouble, 1);
-              *d = gconf_value_get_float(elem);
-              tmp->data = d;
-            }
-            break;
+      for (tmp = retval; tmp != NULL; tmp = g_slist_next (tmp))
+        {
+          GConfValue* elem = tmp->data;
 
-          case GCONF_VALUE_STRING:
-            tmp->data = gconf_value_steal_string (elem);
-            break;
+          tmp->data = primitive_list_element (elem, list_type, TRUE);
+          gconf_value_free (elem);
+        }
+    }
+  else
+    {
+      GSList* tmp;
 
-          case GCONF_VALUE_SCHEMA:
-            tmp->data = gconf_value_steal_schema (elem);
-            break;
-                
-          default:
-            g_assert_not_reached();
-            break;
-          }
+      /* Shared or packed elements are read where they are; stealing
+       * the list would copy every one of them first
+       */
+      retval = NULL;
+      for (tmp = gconf_value_get_list (val); tmp != NULL; tmp = g_slist_next (tmp))
+        retval = g_slist_prepend (retval,
+                                  primitive_list_element (tmp->data, list_type, FALSE));
+      retval = g_slist_reverse (retval);
+    }
 
-        /* Clean up the value */
-        gconf_value_free(elem);
-            
-        tmp = g_slist_next(tmp);
-      }
-  } /* list conversion block */
+  gconf_value_free (val);
       
   return retval;
 }
@@ -36,6 +36,7 @@
 #include "gconf-value.h"
 #include "gconf-engine.h"
 #include "gconf-sources.h"
+#include "gconf-changeset.h"
 
 #ifdef HAVE_CORBA
 #include "GConfX.h"
@@ -264,6 +265,64 @@ gboolean gconf_engine_recursive_unset (GConfEngine      *engine,
                                        GConfUnsetFlags   flags,
                                        GError          **err);
 
+/* A named counter reported by gconfd */
+typedef struct {
+  gchar   *name;
+  guint64  value;
+} GConfStatistic;
+
+GSList* gconf_statistics_prepend (GSList      *stats,
+                                  const gchar *name,
+                                  guint64      value);
+void    gconf_statistics_free    (GSList      *stats);
+
+GSList* gconf_engine_get_cache_statistics (GConfEngine  *conf,
+                                           GError      **err);
+/* Everything gconfd counts for the engine's database: listeners,
+ * notifications, caches, syncs and per-method call latencies.
+ */
+GSList* gconf_engine_get_statistics       (GConfEngine  *conf,
+                                           GError      **err);
+
+/* The changes in @cs as a list of entries for
+ * gconf_engine_commit_entries(), with no value for the keys @cs
+ * unsets. The values are shared with @cs; free the entries with
+ * gconf_entry_free().
+ */
+GSList* gconf_change_set_get_entries (GConfChangeSet *cs);
+
+/* Checks every key and value in @entries, so that a commit made one
+ * key at a time can refuse the whole set before changing any of it.
+ */
+gboolean gconf_entries_validate (GSList  *entries,
+                                 GError **err);
+
+/* Makes the changes in @entries, unsetting the keys whose entry has
+ * no value, in one request to gconfd. The entries that were committed
+ * are returned in @committed. Returns FALSE, without touching
+ * anything, when @conf can't do that and the keys have to be changed
+ * one by one.
+ */
+gboolean gconf_engine_commit_entries (GConfEngine  *conf,
+                                      GSList       *entries,
+                                      GSList      **committed,
+                                      GError      **err);
+
+/* Process-wide table of key and path strings. Equal strings share
+ * one refcounted copy; every gconf_key_intern() is matched by a
+ * gconf_key_unintern().
+ */
+typedef struct {
+  guint   n_strings;   /* distinct strings held */
+  gsize   n_bytes;     /* their length, including the nul */
+  guint64 n_interns;   /* calls to gconf_key_intern() */
+  guint64 n_allocs;    /* of which had to copy the string */
+} GConfKeyInternStats;
+
+const gchar* gconf_key_intern           (const gchar         *key);
+void         gconf_key_unintern         (const gchar         *key);
+void         gconf_key_intern_get_stats (GConfKeyInternStats *stats);
+
 #ifdef HAVE_CORBA
 gboolean gconf_CORBA_Object_equal (gconstpointer a,
                                    gconstpointer b);
@@ -275,6 +334,14 @@ GConfValue* gconf_schema_steal_default_value (GConfSchema *schema);
 void gconf_value_set_string_nocopy (GConfValue *value,
                                     char       *str);
 
+/* TRUE if @value is a list whose elements it alone owns, so that
+ * stealing them costs no copies
+ */
+gboolean gconf_value_owns_list (const GConfValue *value);
+
+/* Values allocated in this process so far, for benchmarks */
+guint64 gconf_value_get_n_allocs (void);
+
 void _gconf_init_i18n (void);
 
 gboolean gconf_use_local_locks (void);
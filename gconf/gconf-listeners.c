@@ -20,6 +20,7 @@
 #include <config.h>
 #include "gconf-listeners.h"
 #include "gconf.h"
+#include "gconf-internals.h"
 
 #include <string.h>
 #include <unistd.h>
@@ -69,18 +70,30 @@ struct _LTable {
   
   /* Connection array indexes to be recycled */
   GSList* removed_indices;
+
+  /* Reused to collect the listeners for each notification,
+   * unless a callback notifies again while it's in use
+   */
+  GPtrArray* to_notify;
+  guint notifying : 1;
 };
 
 typedef struct _LTableEntry LTableEntry;
 
 struct _LTableEntry {
-  gchar* name; /* The name of this "directory" */
+  gchar* name; /* The name of this "directory", the tail of full_name */
   GList* listeners; /* Each listener listening *exactly* here. You probably 
                         want to notify all listeners *below* this node as well. 
                      */
-  gchar *full_name; /* fully-qualified name */
+  gchar *full_name; /* fully-qualified name, interned */
+  GHashTable *children; /* child GNode by name, NULL if no children */
 };
 
+/* Keys are copied here to be split in place; longer ones are
+ * copied to the heap
+ */
+#define KEY_BUFFER_SIZE 256
+
 static LTable* ltable_new(void);
 static void    ltable_insert(LTable* ltable,
                              const gchar* where,
@@ -109,8 +122,9 @@ static void    ltable_remove_if  (LTable* ltable,
 static void    ltable_spew(LTable* ltable);
 #endif
 
-static LTableEntry* ltable_entry_new(gchar **pathv,
-				     int     end);
+static LTableEntry* ltable_entry_new(const gchar *name,
+				     const gchar *full_name,
+				     gsize        full_len);
 static void         ltable_entry_destroy(LTableEntry* entry);
 
 static Listener* listener_new   (guint      cnxn_id,
@@ -279,6 +293,8 @@ ltable_new(void)
   lt->removed_indices = NULL;
 
   lt->next_cnxn = 1; /* 0 is invalid */
+
+  lt->to_notify = g_ptr_array_new ();
   
   return lt;
 }
@@ -327,93 +343,108 @@ ltable_next_cnxn(LTable* lt)
     }
 }
 
+static GNode*
+ltable_find_child (GNode       *node,
+                   const gchar *name)
+{
+  LTableEntry *lte = node->data;
+
+  if (lte->children == NULL)
+    return NULL;
+
+  return g_hash_table_lookup (lte->children, name);
+}
+
+static GNode*
+ltable_add_child (GNode       *node,
+                  const gchar *name,
+                  const gchar *full_name,
+                  gsize        full_len)
+{
+  LTableEntry *lte = node->data;
+  LTableEntry *ne;
+  GNode *across;
+  GNode *child;
+
+  ne = ltable_entry_new (name, full_name, full_len);
+
+  /* Keep the children sorted */
+  across = node->children;
+  while (across != NULL &&
+         strcmp (((LTableEntry*) across->data)->name, name) < 0)
+    across = g_node_next_sibling (across);
+
+  if (across != NULL)
+    child = g_node_insert_data_before (node, across, ne);
+  else
+    child = g_node_append_data (node, ne);
+
+  if (lte->children == NULL)
+    lte->children = g_hash_table_new (g_str_hash, g_str_equal);
+
+  g_hash_table_insert (lte->children, ne->name, child);
+
+  return child;
+}
+
 static void
 ltable_insert(LTable* lt, const gchar* where, Listener* l)
 {
-  gchar** dirnames;
-  guint i;
+  gchar buf[KEY_BUFFER_SIZE];
+  gchar *path;
+  gchar *name;
+  gsize len;
   GNode* cur;
-  GNode* found = NULL;
   LTableEntry* lte;
-  const gchar* noroot_where = where + 1;
 
   g_return_if_fail(gconf_valid_key(where, NULL));
   
   if (lt->tree == NULL)
     {
-      lte = ltable_entry_new(NULL, 0);
+      lte = ltable_entry_new(NULL, NULL, 0);
       
       lt->tree = g_node_new(lte);
 
       lte = NULL; /* paranoia */
     }
-  
-  /* Add to the tree */
-  dirnames = g_strsplit(noroot_where, "/", -1);
-  
-  cur = lt->tree;
-  i = 0;
-  while (dirnames[i])
-    {
-      LTableEntry* ne;
-      GNode* across;
-
-      /* Find this dirname on this level, or add it. */
-      g_assert (cur != NULL);        
-
-      found = NULL;
-
-      across = cur->children;
-
-      while (across != NULL)
-        {
-          int cmp;
 
-          lte = across->data;
+  len = strlen (where);
+  path = len < sizeof (buf) ? memcpy (buf, where, len + 1) : g_strdup (where);
 
-          cmp = strcmp(lte->name, dirnames[i]);
+  /* Add to the tree, splitting the path in place; nothing
+   * is left for "/" itself
+   */
+  cur = lt->tree;
+  name = path + 1;
+  while (*name != '\0')
+    {
+      gchar *slash;
+      GNode* found;
 
-          if (cmp == 0)
-            {
-              found = across;
-              break;
-            }
-          else if (cmp > 0)
-            {
-              /* Past it */
-              break;
-            }
-          else 
-            {
-              across = g_node_next_sibling(across);
-            }
-        }
+      slash = strchr (name, '/');
+      if (slash != NULL)
+        *slash = '\0';
 
+      found = ltable_find_child (cur, name);
       if (found == NULL)
-        {
-          ne = ltable_entry_new(dirnames, i);
-              
-          if (across != NULL) /* Across is at the one past */
-            found = g_node_insert_data_before(cur, across, ne);
-          else                /* Never went past, append - could speed this up by saving last visited */
-            found = g_node_append_data(cur, ne);
-        }
-
-      g_assert(found != NULL);
+        found = ltable_add_child (cur, name, where,
+                                  (slash ? slash : name + strlen (name)) - path);
 
       cur = found;
 
-      ++i;
+      if (slash == NULL)
+        break;
+
+      name = slash + 1;
     }
 
-  /* cur is still the root node ("/") if where was "/" since nothing
-     was returned from g_strsplit */
+  if (path != buf)
+    g_free (path);
+
   lte = cur->data;
 
   lte->listeners = g_list_prepend(lte->listeners, l);
 
-  g_strfreev(dirnames);
-
   /* Add tree node to the flat table */
   g_ptr_array_set_size(lt->listeners, MAX(CNXN_ID_INDEX(lt->next_cnxn), CNXN_ID_INDEX(l->cnxn)));
   g_ptr_array_index(lt->listeners, CNXN_ID_INDEX(l->cnxn)) = cur;
@@ -511,6 +542,17 @@ ltable_remove(LTable* lt, guint cnxn)
           {
             if (cur == lt->tree)
               lt->tree = NULL;
+            else
+              {
+                LTableEntry *parent_lte = parent->data;
+
+                g_hash_table_remove (parent_lte->children, lte->name);
+                if (g_hash_table_size (parent_lte->children) == 0)
+                  {
+                    g_hash_table_destroy (parent_lte->children);
+                    parent_lte->children = NULL;
+                  }
+              }
               
             ltable_entry_destroy(lte);
             g_node_destroy(cur);
@@ -565,6 +607,7 @@ ltable_destroy(LTable* ltable)
     }
       
   g_ptr_array_free(ltable->listeners, TRUE);
+  g_ptr_array_free(ltable->to_notify, TRUE);
 
   g_slist_free(ltable->removed_indices);
   
@@ -572,24 +615,17 @@ ltable_destroy(LTable* ltable)
 }
 
 static void
-notify_listener_list(GConfListeners* listeners,
-                     GList* list,
-                     const gchar* key,
-                     GConfListenersCallback callback,
-                     gpointer user_data)
+add_listener_list (GPtrArray *to_notify,
+                   GList     *list)
 {
-  GList* tmp;
+  GList *tmp;
 
-  tmp = list;
-  while (tmp != NULL)
+  for (tmp = list; tmp != NULL; tmp = tmp->next)
     {
-      Listener* l = tmp->data;
-
-      /* don't notify listeners that were removed during the notify */
-      if (!l->removed)
-        (*callback)(listeners, key, l->cnxn, l->listener_data, user_data);
+      Listener *l = tmp->data;
 
-      tmp = g_list_next(tmp);
+      listener_ref (l);
+      g_ptr_array_add (to_notify, l);
     }
 }
 
@@ -597,69 +633,84 @@ static void
 ltable_notify(LTable* lt, const gchar* key,
               GConfListenersCallback callback, gpointer user_data)
 {
-  gchar** dirs;
-  guint i;
-  const gchar* noroot_key;
+  gchar buf[KEY_BUFFER_SIZE];
+  gchar *path;
+  gchar *name;
+  gsize len;
   GNode* cur;
-  GList *to_notify;
+  GPtrArray *to_notify;
+  gboolean nested;
+  guint i;
   
-  noroot_key = key + 1;
-
   g_return_if_fail(*key == '/');
   g_return_if_fail(gconf_valid_key(key, NULL));
 
   if (lt->tree == NULL)
     return; /* no one to notify */
 
-  /* we build a list "to_notify" to be safe against tree
-   * modifications during the notification.
+  /* we collect the listeners to notify first, to be safe against
+   * tree modifications during the notification.
    */
+  nested = lt->notifying;
+  if (nested)
+    to_notify = g_ptr_array_new ();
+  else
+    to_notify = lt->to_notify;
+
+  lt->notifying = TRUE;
   
   /* Notify "/" listeners */
-  to_notify = g_list_copy (((LTableEntry*)lt->tree->data)->listeners);  
+  add_listener_list (to_notify, ((LTableEntry*)lt->tree->data)->listeners);
 
-  dirs = g_strsplit (noroot_key, "/", -1);
+  len = strlen (key);
+  path = len < sizeof (buf) ? memcpy (buf, key, len + 1) : g_strdup (key);
 
   cur = lt->tree;
-  i = 0;
-  while (dirs[i] && cur)
+  name = path + 1;
+  while (*name != '\0')
     {
-      GNode* child = cur->children;
+      gchar *slash;
 
-      while (child != NULL)
-        {
-          LTableEntry* lte = child->data;
-
-          if (strcmp(lte->name, dirs[i]) == 0)
-            {
-              GList *copy = g_list_copy (lte->listeners);
-              to_notify = g_list_concat (to_notify, copy);
+      slash = strchr (name, '/');
+      if (slash != NULL)
+        *slash = '\0';
 
-              break;
-            }
+      cur = ltable_find_child (cur, name);
+      if (cur == NULL) /* end of the line */
+        break;
 
-          child = g_node_next_sibling(child);
-        }
+      add_listener_list (to_notify, ((LTableEntry*) cur->data)->listeners);
 
-      if (child != NULL) /* we found a child, scan below it */
-        cur = child;
-      else               /* end of the line */
-        cur = NULL;
+      if (slash == NULL)
+        break;
 
-      ++i;
+      name = slash + 1;
     }
-  
-  g_strfreev(dirs);
 
-  g_list_foreach (to_notify, (GFunc) listener_ref, NULL);
-  
-  notify_listener_list ((GConfListeners*)lt,
-                        to_notify, key,
-                        callback, user_data);
+  if (path != buf)
+    g_free (path);
+
+  for (i = 0; i < to_notify->len; i++)
+    {
+      Listener* l = g_ptr_array_index (to_notify, i);
+
+      /* don't notify listeners that were removed during the notify */
+      if (!l->removed)
+        (*callback)((GConfListeners*)lt, key, l->cnxn, l->listener_data, user_data);
+    }
 
-  g_list_foreach (to_notify, (GFunc) listener_unref, NULL);
+  for (i = 0; i < to_notify->len; i++)
+    listener_unref (g_ptr_array_index (to_notify, i));
 
-  g_list_free (to_notify);
+  if (nested)
+    {
+      g_ptr_array_free (to_notify, TRUE);
+    }
+  else
+    {
+      g_ptr_array_set_size (to_notify, 0);
+      lt->notifying = FALSE;
+    }
 }
 
 struct NodeTraverseData
@@ -828,35 +879,33 @@ ltable_remove_if  (LTable                 *ltable,
 }
 
 static LTableEntry* 
-ltable_entry_new(gchar **pathv,
-		 int     end)
+ltable_entry_new(const gchar *name,
+		 const gchar *full_name,
+		 gsize        full_len)
 {
   LTableEntry* lte;
 
   lte = g_new0(LTableEntry, 1);
 
-  if (pathv != NULL)
+  if (name != NULL)
     {
-      GString* full_name;
-      guint i;
-
-      lte->name = g_strdup(pathv[end]);
-
-      full_name = g_string_new("/");
-      i = 0;
-      while (i <= end)
-	{
-	  g_string_append(full_name, pathv[i]);
-	  if (i != end)
-	    g_string_append_c(full_name, '/');
-	  i++;
-	}
-      lte->full_name = g_string_free(full_name, FALSE);
+      gchar buf[KEY_BUFFER_SIZE];
+      gchar *prefix;
+
+      prefix = full_len < sizeof (buf) ? buf : g_malloc (full_len + 1);
+      memcpy (prefix, full_name, full_len);
+      prefix[full_len] = '\0';
+
+      lte->full_name = (gchar*) gconf_key_intern (prefix);
+      lte->name = lte->full_name + full_len - strlen (name);
+
+      if (prefix != buf)
+        g_free (prefix);
     }
   else
     {
-      lte->name = g_strdup("/");
-      lte->full_name = g_strdup("/");
+      lte->full_name = (gchar*) gconf_key_intern ("/");
+      lte->name = lte->full_name;
     }
   
   return lte;
@@ -866,8 +915,9 @@ static void
 ltable_entry_destroy(LTableEntry* lte)
 {
   g_return_if_fail(lte->listeners == NULL); /* should destroy all listeners first. */
-  g_free(lte->name);
-  g_free(lte->full_name);
+  if (lte->children)
+    g_hash_table_destroy(lte->children);
+  gconf_key_unintern (lte->full_name);
   g_free(lte);
 }
 
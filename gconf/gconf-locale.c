@@ -35,7 +35,7 @@ typedef struct _GConfLocaleListPrivate GConfLocaleListPrivate;
 
 struct _GConfLocaleListPrivate {
   gchar** list;
-  guint refcount;
+  gint refcount;     /* atomic, lists are shared between threads */
 };
 
 typedef struct _Entry Entry;
@@ -134,7 +134,7 @@ gconf_locale_list_ref (GConfLocaleList* list)
 
   priv = (GConfLocaleListPrivate*) list;
 
-  priv->refcount += 1;
+  g_atomic_int_inc (&priv->refcount);
 }
 
 void
@@ -144,11 +144,9 @@ gconf_locale_list_unref (GConfLocaleList* list)
 
   priv = (GConfLocaleListPrivate*) list;
 
-  g_return_if_fail(priv->refcount > 0);
+  g_return_if_fail(g_atomic_int_get (&priv->refcount) > 0);
 
-  priv->refcount -= 1;
-
-  if (priv->refcount == 0)
+  if (g_atomic_int_dec_and_test (&priv->refcount))
     {
       g_strfreev(priv->list);
       g_free(list);
@@ -83,6 +83,9 @@ gconf_source_free (GConfSource* source)
   backend = source->backend;
   address = source->address;
 
+  if (source->missing)
+    g_hash_table_destroy (source->missing);
+
   (*source->backend->vtable.destroy_source)(source);
   
   /* Remove ref held by the source. */
@@ -90,23 +93,195 @@ gconf_source_free (GConfSource* source)
   g_free(address);
 }
 
-#define SOURCE_READABLE(source, key, err)                  \
-     ( ((source)->flags & GCONF_SOURCE_ALL_READABLE) ||    \
-       ((source)->backend->vtable.readable != NULL &&     \
-        (*(source)->backend->vtable.readable)((source), (key), (err))) )
+/* Backends that aren't thread-safe provide lock and unlock, which
+ * are held around every call into them and around the source's own
+ * caches, so gconfd's worker threads can share sources. They nest.
+ */
+static void
+source_lock (GConfSource *source)
+{
+  if (source->backend->vtable.lock != NULL)
+    (*source->backend->vtable.lock) (source, NULL);
+}
+
+static void
+source_unlock (GConfSource *source)
+{
+  if (source->backend->vtable.unlock != NULL)
+    (*source->backend->vtable.unlock) (source, NULL);
+}
+
+/*
+ * Negative cache: which keys a source is known not to have, so that
+ * probing for keys that are set nowhere doesn't make every source in
+ * the stack load a directory. Anything that writes to a source, or
+ * makes it reread its storage, drops what it knew.
+ */
+
+#define MISSING_VALUE  (1 << 0)   /* no value for the key */
+#define MISSING_SCHEMA (1 << 1)   /* no schema name for it either */
+
+/* Past this many keys we start over rather than grow further */
+#define MISSING_MAX_KEYS 4096
+
+static gboolean
+source_is_missing (GConfSource *source,
+                   const gchar *key,
+                   guint        what)
+{
+  guint known;
+
+  source_lock (source);
+
+  source->missing_stats.n_lookups++;
+
+  known = 0;
+  if (source->missing != NULL)
+    known = GPOINTER_TO_UINT (g_hash_table_lookup (source->missing, key));
+
+  if ((known & what) == what)
+    source->missing_stats.n_hits++;
+
+  source_unlock (source);
+
+  return (known & what) == what;
+}
+
+static void
+source_remember_missing (GConfSource *source,
+                         const gchar *key,
+                         guint        what)
+{
+  guint known;
+
+  source_lock (source);
+
+  if (source->missing == NULL)
+    source->missing = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                             (GDestroyNotify) gconf_key_unintern,
+                                             NULL);
+  else if (g_hash_table_size (source->missing) >= MISSING_MAX_KEYS)
+    g_hash_table_remove_all (source->missing);
+
+  known = GPOINTER_TO_UINT (g_hash_table_lookup (source->missing, key));
+  g_hash_table_replace (source->missing, (gchar *) gconf_key_intern (key),
+                        GUINT_TO_POINTER (known | what));
+
+  source_unlock (source);
+}
+
+static void
+source_forget_all_missing (GConfSource *source)
+{
+  source_lock (source);
+
+  if (source->missing != NULL && g_hash_table_size (source->missing) > 0)
+    {
+      g_hash_table_remove_all (source->missing);
+      source->missing_stats.n_invalidations++;
+    }
+
+  source_unlock (source);
+}
+
+void
+gconf_source_forget_missing (GConfSource *source,
+                             const gchar *location)
+{
+  GHashTableIter iter;
+  gpointer key;
+
+  g_return_if_fail (source != NULL);
+  g_return_if_fail (location != NULL);
+
+  source_lock (source);
+
+  if (source->missing != NULL)
+    {
+      g_hash_table_iter_init (&iter, source->missing);
+      while (g_hash_table_iter_next (&iter, &key, NULL))
+        {
+          if (strcmp (key, location) == 0 ||
+              gconf_key_is_below (location, key))
+            {
+              g_hash_table_iter_remove (&iter);
+              source->missing_stats.n_invalidations++;
+            }
+        }
+    }
+
+  source_unlock (source);
+}
+
+/* The cheap case of the above, for a single key we just wrote */
+static void
+source_forget_missing_key (GConfSource *source,
+                           const gchar *key)
+{
+  source_lock (source);
+
+  if (source->missing != NULL &&
+      g_hash_table_remove (source->missing, key))
+    source->missing_stats.n_invalidations++;
+
+  source_unlock (source);
+}
+
+/* Takes the default out of a schema value and frees the rest. The
+ * default is copied instead when someone else holds the value.
+ */
+static GConfValue*
+schema_value_take_default (GConfValue *val)
+{
+  GConfSchema *schema;
+  GConfValue *retval;
+
+  schema = gconf_value_steal_schema (val);
+  gconf_value_free (val);
+
+  if (schema == NULL)
+    return NULL;
+
+  retval = gconf_schema_steal_default_value (schema);
+  gconf_schema_free (schema);
+
+  return retval;
+}
+
+static gboolean
+source_is_readable (GConfSource *source, const gchar *key, GError **err)
+{
+  gboolean readable;
+
+  if ((source->flags & GCONF_SOURCE_ALL_READABLE) != 0)
+    return TRUE;
+  else if (source->backend->vtable.readable == NULL)
+    return FALSE;
+
+  source_lock (source);
+  readable = (*source->backend->vtable.readable)(source, key, err);
+  source_unlock (source);
+
+  return readable;
+}
 
 static gboolean
 source_is_writable(GConfSource* source, const gchar* key, GError** err)
 {
+  gboolean writable;
+
   if ((source->flags & GCONF_SOURCE_NEVER_WRITEABLE) != 0)
     return FALSE;
   else if ((source->flags & GCONF_SOURCE_ALL_WRITEABLE) != 0)
     return TRUE;
-  else if ((source->backend->vtable.writable != NULL) &&
-           (*source->backend->vtable.writable)(source, key, err))
-    return TRUE;
-  else
+  else if (source->backend->vtable.writable == NULL)
     return FALSE;
+
+  source_lock (source);
+  writable = (*source->backend->vtable.writable)(source, key, err);
+  source_unlock (source);
+
+  return writable;
 }
 
 static GConfValue*
@@ -122,10 +297,17 @@ gconf_source_query_value      (GConfSource* source,
   
   /* note that key validity is unchecked */
 
-  if ( SOURCE_READABLE(source, key, err) )
+  if ( source_is_readable(source, key, err) )
     {
+      GConfValue *retval;
+
       g_return_val_if_fail(err == NULL || *err == NULL, NULL);
-      return (*source->backend->vtable.query_value)(source, key, locales, schema_name, err);
+
+      source_lock (source);
+      retval = (*source->backend->vtable.query_value)(source, key, locales, schema_name, err);
+      source_unlock (source);
+
+      return retval;
     }
   else
     return NULL;
@@ -142,10 +324,17 @@ gconf_source_query_metainfo      (GConfSource* source,
   
   /* note that key validity is unchecked */
 
-  if ( SOURCE_READABLE(source, key, err) )
+  if ( source_is_readable(source, key, err) )
     {
+      GConfMetaInfo *retval;
+
       g_return_val_if_fail(err == NULL || *err == NULL, NULL);
-      return (*source->backend->vtable.query_metainfo)(source, key, err);
+
+      source_lock (source);
+      retval = (*source->backend->vtable.query_metainfo)(source, key, err);
+      source_unlock (source);
+
+      return retval;
     }
   else
     return NULL;
@@ -169,7 +358,10 @@ gconf_source_set_value        (GConfSource* source,
   if ( source_is_writable(source, key, err) )
     {
       g_return_val_if_fail(err == NULL || *err == NULL, FALSE);
+      source_forget_missing_key (source, key);
+      source_lock (source);
       (*source->backend->vtable.set_value)(source, key, value, err);
+      source_unlock (source);
       return TRUE;
     }
   else
@@ -190,7 +382,10 @@ gconf_source_unset_value      (GConfSource* source,
     {
       g_return_val_if_fail(err == NULL || *err == NULL, FALSE);
 
+      source_forget_missing_key (source, key);
+      source_lock (source);
       (*source->backend->vtable.unset_value)(source, key, locale, err);
+      source_unlock (source);
       return TRUE;
     }
   else
@@ -207,10 +402,17 @@ gconf_source_all_entries         (GConfSource* source,
   g_return_val_if_fail(dir != NULL, NULL);
   g_return_val_if_fail(err == NULL || *err == NULL, NULL);
   
-  if ( SOURCE_READABLE(source, dir, err) )
+  if ( source_is_readable(source, dir, err) )
     {
+      GSList *retval;
+
       g_return_val_if_fail(err == NULL || *err == NULL, NULL);
-      return (*source->backend->vtable.all_entries)(source, dir, locales, err);
+
+      source_lock (source);
+      retval = (*source->backend->vtable.all_entries)(source, dir, locales, err);
+      source_unlock (source);
+
+      return retval;
     }
   else
     return NULL;
@@ -225,10 +427,17 @@ gconf_source_all_dirs          (GConfSource* source,
   g_return_val_if_fail(dir != NULL, NULL);  
   g_return_val_if_fail(err == NULL || *err == NULL, NULL);
   
-  if ( SOURCE_READABLE(source, dir, err) )
+  if ( source_is_readable(source, dir, err) )
     {
+      GSList *retval;
+
       g_return_val_if_fail(err == NULL || *err == NULL, NULL);
-      return (*source->backend->vtable.all_subdirs)(source, dir, err);
+
+      source_lock (source);
+      retval = (*source->backend->vtable.all_subdirs)(source, dir, err);
+      source_unlock (source);
+
+      return retval;
     }
   else
     return NULL;
@@ -243,10 +452,17 @@ gconf_source_dir_exists        (GConfSource* source,
   g_return_val_if_fail(dir != NULL, FALSE);
   g_return_val_if_fail(err == NULL || *err == NULL, FALSE);
   
-  if ( SOURCE_READABLE(source, dir, err) )
+  if ( source_is_readable(source, dir, err) )
     {
+      gboolean retval;
+
       g_return_val_if_fail(err == NULL || *err == NULL, FALSE);
-      return (*source->backend->vtable.dir_exists)(source, dir, err);
+
+      source_lock (source);
+      retval = (*source->backend->vtable.dir_exists)(source, dir, err);
+      source_unlock (source);
+
+      return retval;
     }
   else
     return FALSE;
@@ -264,7 +480,9 @@ gconf_source_remove_dir        (GConfSource* source,
   if ( source_is_writable(source, dir, err) )
     {
       g_return_if_fail(err == NULL || *err == NULL);
+      source_lock (source);
       (*source->backend->vtable.remove_dir)(source, dir, err);
+      source_unlock (source);
     }
 }
 
@@ -281,7 +499,10 @@ gconf_source_set_schema        (GConfSource* source,
   if ( source_is_writable(source, key, err) )
     {
       g_return_val_if_fail(err == NULL || *err == NULL, FALSE);
+      source_forget_missing_key (source, key);
+      source_lock (source);
       (*source->backend->vtable.set_schema)(source, key, schema_key, err);
+      source_unlock (source);
       return TRUE;
     }
   else
@@ -291,7 +512,13 @@ gconf_source_set_schema        (GConfSource* source,
 static gboolean
 gconf_source_sync_all         (GConfSource* source, GError** err)
 {
-  return (*source->backend->vtable.sync_all)(source, err);
+  gboolean retval;
+
+  source_lock (source);
+  retval = (*source->backend->vtable.sync_all)(source, err);
+  source_unlock (source);
+
+  return retval;
 }
 
 static void
@@ -303,7 +530,9 @@ gconf_source_set_notify_func (GConfSource           *source,
 
   if (source->backend->vtable.set_notify_func)
     {
+      source_lock (source);
       (*source->backend->vtable.set_notify_func) (source, notify_func, user_data);
+      source_unlock (source);
     }
 }
 
@@ -317,7 +546,9 @@ gconf_source_add_listener (GConfSource *source,
 
   if (source->backend->vtable.add_listener)
     {
+      source_lock (source);
       (*source->backend->vtable.add_listener) (source, id, namespace_section);
+      source_unlock (source);
     }
 }
 
@@ -330,7 +561,9 @@ gconf_source_remove_listener (GConfSource *source,
 
   if (source->backend->vtable.remove_listener)
     {
+      source_lock (source);
       (*source->backend->vtable.remove_listener) (source, id);
+      source_unlock (source);
     }
 }
 
@@ -475,8 +708,14 @@ gconf_sources_clear_cache        (GConfSources  *sources)
     {
       GConfSource* source = tmp->data;
 
+      source_forget_all_missing (source);
+
       if (source->backend->vtable.clear_cache)
-        (*source->backend->vtable.clear_cache)(source);
+        {
+          source_lock (source);
+          (*source->backend->vtable.clear_cache)(source);
+          source_unlock (source);
+        }
       
       tmp = g_list_next(tmp);
     }
@@ -509,8 +748,14 @@ gconf_sources_clear_cache_for_sources (GConfSources  *sources,
 	  if (source->backend == affected_source->backend &&
 	      strcmp (source_resource, get_address_resource (affected_source->address)) == 0)
 	    {
+	      source_forget_all_missing (source);
+
 	      if (source->backend->vtable.clear_cache)
-		(*source->backend->vtable.clear_cache)(source);
+		{
+		  source_lock (source);
+		  (*source->backend->vtable.clear_cache)(source);
+		  source_unlock (source);
+		}
 	    }
 
 	  tmp2 = g_list_next(tmp2);
@@ -520,6 +765,33 @@ gconf_sources_clear_cache_for_sources (GConfSources  *sources,
     }
 }
 
+void
+gconf_sources_forget_missing_for_sources (GConfSources  *sources,
+					  GConfSources  *affected,
+					  const gchar   *location)
+{
+  GList* tmp;
+
+  for (tmp = sources->sources; tmp != NULL; tmp = tmp->next)
+    {
+      GConfSource* source = tmp->data;
+      const char *source_resource = get_address_resource (source->address);
+      GList* tmp2;
+
+      if (source->missing == NULL)
+        continue;
+
+      for (tmp2 = affected->sources; tmp2 != NULL; tmp2 = tmp2->next)
+	{
+	  GConfSource* affected_source = tmp2->data;
+
+	  if (source->backend == affected_source->backend &&
+	      strcmp (source_resource, get_address_resource (affected_source->address)) == 0)
+	    gconf_source_forget_missing (source, location);
+	}
+    }
+}
+
 GConfValue*   
 gconf_sources_query_value (GConfSources* sources, 
                            const gchar* key,
@@ -583,12 +855,25 @@ gconf_sources_query_value (GConfSources* sources,
           if (value_is_writable &&
               source_is_writable (source, key, NULL)) /* ignore errors */
             *value_is_writable = TRUE;
-          
-          val = gconf_source_query_value (source, key, locales,
-                                          schema_name_retloc, &error);
 
+          /* If we still want a schema name, the source must be
+           * known to lack that as well before we skip it
+           */
+          if (!source_is_missing (source, key,
+                                  schema_name_retloc ?
+                                  MISSING_VALUE | MISSING_SCHEMA : MISSING_VALUE))
+            {
+              val = gconf_source_query_value (source, key, locales,
+                                              schema_name_retloc, &error);
+
+              if (val == NULL && error == NULL)
+                source_remember_missing (source, key,
+                                         schema_name_retloc && schema_name == NULL ?
+                                         MISSING_VALUE | MISSING_SCHEMA : MISSING_VALUE);
+            }
         }
-      else if (schema_name_retloc != NULL)
+      else if (schema_name_retloc != NULL &&
+               !source_is_missing (source, key, MISSING_SCHEMA))
         {
           GConfMetaInfo *mi;
           
@@ -600,6 +885,9 @@ gconf_sources_query_value (GConfSources* sources,
               mi->schema = NULL;
               gconf_meta_info_free (mi);
             }
+
+          if (*schema_name_retloc == NULL && error == NULL)
+            source_remember_missing (source, key, MISSING_SCHEMA);
         }
           
       if (error != NULL)
@@ -693,9 +981,7 @@ gconf_sources_query_value (GConfSources* sources,
         {
           GConfValue* retval;
 
-          retval = gconf_schema_steal_default_value (gconf_value_get_schema (val));          
-
-          gconf_value_free (val);
+          retval = schema_value_take_default (val);
 
           if (schema_namep)
             *schema_namep = schema_name;
@@ -1234,7 +1520,8 @@ hash_lookup_defaults_func(gpointer key, gpointer value, gpointer user_data)
             {
               GConfValue* defval;
 
-              defval = gconf_schema_steal_default_value (gconf_value_get_schema(val));
+              defval = schema_value_take_default (val);
+              val = NULL;
 
               gconf_entry_set_value_nocopy (entry, defval);
               gconf_entry_set_is_default (entry, TRUE);
@@ -1291,6 +1578,8 @@ gconf_sources_all_entries   (GConfSources* sources,
                                  doing hash lookups on first source
                               */
   struct DefaultsLookupData dld = { NULL, NULL };
+  GString *full;
+  gsize prefix_len;
   
   dld.sources = sources;
   dld.locales = locales;
@@ -1301,6 +1590,12 @@ gconf_sources_all_entries   (GConfSources* sources,
 
   hash = g_hash_table_new(g_str_hash, g_str_equal);
 
+  /* Each entry's full key is built in here, after the dir */
+  full = g_string_new (dir);
+  if (full->str[full->len - 1] != '/')
+    g_string_append_c (full, '/');
+  prefix_len = full->len;
+
   tmp = sources->sources;
 
   while (tmp != NULL)
@@ -1320,6 +1615,7 @@ gconf_sources_all_entries   (GConfSources* sources,
           g_hash_table_foreach(hash, hash_destroy_entries_func, NULL);
           
           g_hash_table_destroy(hash);
+          g_string_free (full, TRUE);
           
           if (err)
             {
@@ -1342,7 +1638,6 @@ gconf_sources_all_entries   (GConfSources* sources,
         {
           GConfEntry* pair = iter->data;
           GConfEntry* previous;
-          gchar *full;
           
           if (first_pass)
             previous = NULL; /* Can't possibly be there. */
@@ -1364,15 +1659,14 @@ gconf_sources_all_entries   (GConfSources* sources,
                    * entry->key is relative not absolute on the
                    * gconfd side
                    */
-                  full = gconf_concat_dir_and_key (dir, previous->key);
+                  g_string_truncate (full, prefix_len);
+                  g_string_append (full, previous->key);
 
                   gconf_entry_set_is_writable (previous,
                                                key_is_writable (sources,
                                                                 src,
-                                                                full,
+                                                                full->str,
                                                                 NULL));
-
-                  g_free (full);
                 }
               
               if (gconf_entry_get_schema_name (previous) != NULL)
@@ -1399,15 +1693,14 @@ gconf_sources_all_entries   (GConfSources* sources,
                * entry->key is relative not absolute on the
                * gconfd side
                */
-              full = gconf_concat_dir_and_key (dir, pair->key);
+              g_string_truncate (full, prefix_len);
+              g_string_append (full, pair->key);
 
               gconf_entry_set_is_writable (pair,
                                            key_is_writable (sources,
                                                             src,
-                                                            full,
+                                                            full->str,
                                                             NULL));
-              
-              g_free (full);
             }
 
           iter = g_slist_next(iter);
@@ -1428,6 +1721,7 @@ gconf_sources_all_entries   (GConfSources* sources,
   g_hash_table_foreach(hash, hash_listify_func, &flattened);
 
   g_hash_table_destroy(hash);
+  g_string_free (full, TRUE);
   
   return flattened;
 }
@@ -1578,6 +1872,143 @@ gconf_sources_sync_all    (GConfSources* sources, GError** err)
   return !failed;
 }
 
+typedef struct
+{
+  GConfSource *source;
+  gpointer     job;
+} SourceSyncJob;
+
+struct _GConfSourcesSync
+{
+  GSList *jobs;
+};
+
+GConfSourcesSync*
+gconf_sources_prepare_sync (GConfSources *sources,
+                            GError      **err)
+{
+  GConfSourcesSync *sync;
+  GList *tmp;
+  GSList *jobs;
+  GError *all_errors;
+
+  jobs = NULL;
+  all_errors = NULL;
+
+  for (tmp = sources->sources; tmp != NULL; tmp = tmp->next)
+    {
+      GConfSource *src = tmp->data;
+
+      if (src->backend->vtable.prepare_sync != NULL)
+        {
+          gpointer job;
+
+          source_lock (src);
+          job = (*src->backend->vtable.prepare_sync) (src);
+          source_unlock (src);
+          if (job != NULL)
+            {
+              SourceSyncJob *sjob;
+
+              sjob = g_new (SourceSyncJob, 1);
+              sjob->source = src;
+              sjob->job = job;
+
+              jobs = g_slist_prepend (jobs, sjob);
+            }
+        }
+      else
+        {
+          GError *error = NULL;
+
+          if (!gconf_source_sync_all (src, &error))
+            {
+              g_assert (error != NULL);
+
+              if (err)
+                {
+                  GError *composed;
+
+                  composed = gconf_compose_errors (all_errors, error);
+                  if (all_errors)
+                    g_error_free (all_errors);
+                  all_errors = composed;
+                }
+
+              g_error_free (error);
+            }
+        }
+    }
+
+  if (err)
+    *err = all_errors;
+
+  if (jobs == NULL)
+    return NULL;
+
+  sync = g_new (GConfSourcesSync, 1);
+  sync->jobs = g_slist_reverse (jobs);
+
+  return sync;
+}
+
+gboolean
+gconf_sources_run_sync (GConfSourcesSync *sync,
+                        GError          **err)
+{
+  GSList *tmp;
+  gboolean failed = FALSE;
+  GError *all_errors = NULL;
+
+  for (tmp = sync->jobs; tmp != NULL; tmp = tmp->next)
+    {
+      SourceSyncJob *sjob = tmp->data;
+      GError *error = NULL;
+
+      if (!(*sjob->source->backend->vtable.run_sync_job) (sjob->job, &error))
+        {
+          failed = TRUE;
+          g_assert (error != NULL);
+
+          if (err)
+            {
+              GError *composed;
+
+              composed = gconf_compose_errors (all_errors, error);
+              if (all_errors)
+                g_error_free (all_errors);
+              all_errors = composed;
+            }
+
+          g_error_free (error);
+        }
+    }
+
+  if (err)
+    *err = all_errors;
+
+  return !failed;
+}
+
+void
+gconf_sources_finish_sync (GConfSourcesSync *sync)
+{
+  GSList *tmp;
+
+  for (tmp = sync->jobs; tmp != NULL; tmp = tmp->next)
+    {
+      SourceSyncJob *sjob = tmp->data;
+
+      source_lock (sjob->source);
+      (*sjob->source->backend->vtable.finish_sync) (sjob->source, sjob->job);
+      source_unlock (sjob->source);
+      g_free (sjob);
+    }
+
+  g_slist_free (sync->jobs);
+  g_free (sync);
+}
+
 GConfMetaInfo*
 gconf_sources_query_metainfo (GConfSources* sources,
                               const gchar* key,
@@ -1688,8 +2119,6 @@ gconf_sources_query_default_value(GConfSources* sources,
   
   if (val != NULL)
     {
-      GConfSchema* schema;
-
       if (val->type != GCONF_VALUE_SCHEMA)
         {
           gconf_log(GCL_WARNING,
@@ -1704,20 +2133,7 @@ gconf_sources_query_default_value(GConfSources* sources,
 
       gconf_meta_info_free(mi);
 
-      schema = gconf_value_steal_schema (val);
-      gconf_value_free (val);
-      
-      if (schema != NULL)
-        {
-          GConfValue* retval;
-
-          retval = gconf_schema_steal_default_value (schema);
-
-          gconf_schema_free (schema);
-          
-          return retval;
-        }
-      return NULL;
+      return schema_value_take_default (val);
     }
   else
     {
@@ -1854,3 +2270,26 @@ gconf_sources_is_affected (GConfSources *sources,
   
   return TRUE;
 }
+
+void
+gconf_sources_get_missing_stats (GConfSources            *sources,
+                                 GConfSourceMissingStats *stats)
+{
+  GList *tmp;
+
+  g_return_if_fail (sources != NULL);
+  g_return_if_fail (stats != NULL);
+
+  memset (stats, 0, sizeof (GConfSourceMissingStats));
+
+  for (tmp = sources->sources; tmp != NULL; tmp = tmp->next)
+    {
+      GConfSource *source = tmp->data;
+
+      source_lock (source);
+      stats->n_lookups += source->missing_stats.n_lookups;
+      stats->n_hits += source->missing_stats.n_hits;
+      stats->n_invalidations += source->missing_stats.n_invalidations;
+      source_unlock (source);
+    }
+}
@@ -34,10 +34,23 @@ typedef struct _GConfBackend GConfBackend;
 
 typedef struct _GConfSource GConfSource;
 
+typedef struct _GConfSourceMissingStats GConfSourceMissingStats;
+
+/* How often the negative cache spared a backend lookup */
+struct _GConfSourceMissingStats {
+  guint64 n_lookups;      /* value lookups in the source */
+  guint64 n_hits;         /* answered "not here" from the cache */
+  guint64 n_invalidations; /* keys or whole caches dropped by changes */
+};
+
 struct _GConfSource {
   guint flags;
   gchar* address;
   GConfBackend* backend;
+  /* Keys this source is known not to have, maintained by
+   * gconf-sources.c; backends should leave it alone. */
+  GHashTable* missing;
+  GConfSourceMissingStats missing_stats;
 };
 
 typedef enum {
@@ -60,6 +73,11 @@ GConfSource*  gconf_resolve_address         (const gchar* address,
 
 void          gconf_source_free          (GConfSource* source);
 
+/* For backends that notice changes behind our back: forgets that
+ * @location, or anything below it, was missing from @source. */
+void          gconf_source_forget_missing (GConfSource *source,
+                                           const gchar *location);
+
 /* This is the actual thing we want to talk to, the stack of sources */
 typedef struct _GConfSources GConfSources;
 
@@ -84,6 +102,9 @@ void          gconf_sources_free               (GConfSources  *sources);
 void          gconf_sources_clear_cache        (GConfSources  *sources);
 void          gconf_sources_clear_cache_for_sources (GConfSources  *sources,
 						     GConfSources  *affected);
+void          gconf_sources_forget_missing_for_sources (GConfSources  *sources,
+							GConfSources  *affected,
+							const gchar   *location);
 GConfValue*   gconf_sources_query_value        (GConfSources  *sources,
                                                 const gchar   *key,
                                                 const gchar  **locales,
@@ -128,6 +149,19 @@ void          gconf_sources_set_schema         (GConfSources  *sources,
 gboolean      gconf_sources_sync_all           (GConfSources  *sources,
                                                 GError   **err);
 
+/* sync_all split so that the writing can be done in another
+ * thread. Prepare returns NULL if the sync is already complete,
+ * either because nothing needed saving or because no backend
+ * can sync in the background; errors from that go in @err.
+ */
+typedef struct _GConfSourcesSync GConfSourcesSync;
+
+GConfSourcesSync* gconf_sources_prepare_sync   (GConfSources     *sources,
+                                                GError          **err);
+gboolean          gconf_sources_run_sync       (GConfSourcesSync *sync,
+                                                GError          **err);
+void              gconf_sources_finish_sync    (GConfSourcesSync *sync);
+
 
 GConfMetaInfo*gconf_sources_query_metainfo     (GConfSources* sources,
                                                 const gchar* key,
@@ -152,4 +186,8 @@ gboolean      gconf_sources_is_affected        (GConfSources *sources,
 						GConfSource  *modified_src,
 						const char   *key);
 
+/* Sums the negative cache counters of every source in the stack */
+void          gconf_sources_get_missing_stats  (GConfSources            *sources,
+						GConfSourceMissingStats *stats);
+
 #endif
@@ -26,17 +26,26 @@
 #include <string.h>
 #include <stdlib.h>
 
+typedef struct _ValueArray ValueArray;
+
 typedef struct {
   GConfValueType type;
+  guint flags;
+  gint refcount;
   union {
     gchar* string_data;
+    /* Strings that fit are kept here instead of on the heap */
+    gchar string_inline[2 * sizeof (gpointer)];
     gint int_data;
     gboolean bool_data;
     gdouble float_data;
     GConfSchema* schema_data;
     struct {
       GConfValueType type;
-      GSList* list;
+      union {
+        GSList* list;         /* owned values, unless LIST_PACKED */
+        ValueArray* array;    /* shared, if LIST_PACKED */
+      } u;
     } list_data;
     struct {
       GConfValue* car;
@@ -47,6 +56,165 @@ typedef struct {
 
 #define REAL_VALUE(x) ((GConfRealValue*)(x))
 
+enum {
+  VALUE_STRING_INLINE = 1 << 0, /* string is in d.string_inline */
+  VALUE_LIST_PACKED   = 1 << 1, /* list is in a ValueArray */
+  VALUE_PACKED        = 1 << 2  /* lives in some ValueArray, read-only */
+};
+
+/* Values are only shared through gconf_value_ref(), and a shared value
+ * must not change under its other holders
+ */
+static gboolean
+value_is_readonly (GConfRealValue *real)
+{
+  return (real->flags & VALUE_PACKED) != 0 ||
+    g_atomic_int_get (&real->refcount) > 1;
+}
+
+/* Number of values and packed arrays allocated so far; not exact
+ * if several threads allocate at once
+ */
+static guint64 value_allocs = 0;
+
+/* A list's elements packed into one block, shared between copies of
+ * the list and never changed once built: this header, a value and
+ * a GSList node per element, then the text of long strings.
+ */
+struct _ValueArray {
+  gint    refcount;
+  guint   n_values;
+  GSList *list;
+};
+
+#define VALUE_ARRAY_HEADER_SIZE \
+  ((sizeof (ValueArray) + sizeof (gdouble) - 1) & ~(sizeof (gdouble) - 1))
+
+static const gchar*
+value_string (const GConfRealValue *real)
+{
+  if (real->flags & VALUE_STRING_INLINE)
+    return real->d.string_inline;
+  else
+    return real->d.string_data;
+}
+
+static ValueArray*
+value_array_new (GSList *list)
+{
+  ValueArray *array;
+  GConfRealValue *values;
+  GSList *nodes;
+  GSList *tmp;
+  gchar *text;
+  gsize text_len;
+  guint n, i;
+
+  n = 0;
+  text_len = 0;
+  for (tmp = list; tmp != NULL; tmp = tmp->next)
+    {
+      GConfRealValue *real = tmp->data;
+
+      if (real->type == GCONF_VALUE_STRING && value_string (real) != NULL)
+        {
+          gsize len = strlen (value_string (real));
+
+          if (len >= sizeof (real->d.string_inline))
+            text_len += len + 1;
+        }
+      ++n;
+    }
+
+  array = g_malloc (VALUE_ARRAY_HEADER_SIZE +
+                    n * (sizeof (GConfRealValue) + sizeof (GSList)) +
+                    text_len);
+  array->refcount = 1;
+  array->n_values = n;
+  value_allocs++;
+
+  values = (GConfRealValue*) ((gchar*) array + VALUE_ARRAY_HEADER_SIZE);
+  nodes = (GSList*) (values + n);
+  text = (gchar*) (nodes + n);
+
+  for (tmp = list, i = 0; tmp != NULL; tmp = tmp->next, i++)
+    {
+      GConfRealValue *src = tmp->data;
+      GConfRealValue *dest = &values[i];
+
+      dest->type = src->type;
+      dest->flags = VALUE_PACKED;
+      dest->refcount = 1;
+
+      switch (src->type)
+        {
+        case GCONF_VALUE_STRING:
+          if (value_string (src) == NULL)
+            dest->d.string_data = NULL;
+          else
+            {
+              const gchar *str = value_string (src);
+              gsize len = strlen (str);
+
+              if (len < sizeof (dest->d.string_inline))
+                {
+                  memcpy (dest->d.string_inline, str, len + 1);
+                  dest->flags |= VALUE_STRING_INLINE;
+                }
+              else
+                {
+                  memcpy (text, str, len + 1);
+                  dest->d.string_data = text;
+                  text += len + 1;
+                }
+            }
+          break;
+        case GCONF_VALUE_SCHEMA:
+          dest->d.schema_data = src->d.schema_data ?
+            gconf_schema_copy (src->d.schema_data) : NULL;
+          break;
+        default:
+          /* Lists only hold primitives and schemas */
+          dest->d = src->d;
+          break;
+        }
+
+      nodes[i].data = dest;
+      nodes[i].next = i + 1 < n ? &nodes[i + 1] : NULL;
+    }
+
+  array->list = n > 0 ? nodes : NULL;
+
+  return array;
+}
+
+static ValueArray*
+value_array_ref (ValueArray *array)
+{
+  g_atomic_int_inc (&array->refcount);
+
+  return array;
+}
+
+static void
+value_array_unref (ValueArray *array)
+{
+  GSList *tmp;
+
+  if (!g_atomic_int_dec_and_test (&array->refcount))
+    return;
+
+  for (tmp = array->list; tmp != NULL; tmp = tmp->next)
+    {
+      GConfRealValue *real = tmp->data;
+
+      if (real->type == GCONF_VALUE_SCHEMA && real->d.schema_data != NULL)
+        gconf_schema_free (real->d.schema_data);
+    }
+
+  g_free (array);
+}
+
 static void
 set_string(gchar** dest, const gchar* src)
 {
@@ -75,6 +243,8 @@ gconf_value_new(GConfValueType type)
   value = (GConfValue*) g_slice_new0 (GConfRealValue);
 
   value->type = type;
+  REAL_VALUE (value)->refcount = 1;
+  value_allocs++;
 
   /* the g_new0() is important: sets list type to invalid, NULLs all
    * pointers
@@ -742,7 +912,13 @@ gconf_value_copy (const GConfValue* src)
       dest->d = real->d;
       break;
     case GCONF_VALUE_STRING:
-      set_string(&dest->d.string_data, real->d.string_data);
+      if (real->flags & VALUE_STRING_INLINE)
+        {
+          dest->d = real->d;
+          dest->flags |= VALUE_STRING_INLINE;
+        }
+      else
+        dest->d.string_data = g_strdup (real->d.string_data);
       break;
     case GCONF_VALUE_SCHEMA:
       if (real->d.schema_data)
@@ -752,14 +928,20 @@ gconf_value_copy (const GConfValue* src)
       break;
       
     case GCONF_VALUE_LIST:
-      {
-        GSList* copy;
-
-        copy = copy_value_list(real->d.list_data.list);
-
-        dest->d.list_data.list = copy;
-        dest->d.list_data.type = real->d.list_data.type;
-      }
+      /* Copies share one packed array; the first copy of a list
+       * built up value by value makes it
+       */
+      dest->d.list_data.type = real->d.list_data.type;
+      if (real->flags & VALUE_LIST_PACKED)
+        {
+          dest->d.list_data.u.array = value_array_ref (real->d.list_data.u.array);
+          dest->flags |= VALUE_LIST_PACKED;
+        }
+      else if (real->d.list_data.u.list != NULL)
+        {
+          dest->d.list_data.u.array = value_array_new (real->d.list_data.u.list);
+          dest->flags |= VALUE_LIST_PACKED;
+        }
       break;
       
     case GCONF_VALUE_PAIR:
@@ -793,8 +975,16 @@ gconf_value_free_list(GConfValue* value)
   g_return_if_fail(value->type == GCONF_VALUE_LIST);
 
   real = REAL_VALUE (value);
+
+  if (real->flags & VALUE_LIST_PACKED)
+    {
+      value_array_unref (real->d.list_data.u.array);
+      real->flags &= ~VALUE_LIST_PACKED;
+      real->d.list_data.u.list = NULL;
+      return;
+    }
   
-  tmp = real->d.list_data.list;
+  tmp = real->d.list_data.u.list;
 
   while (tmp != NULL)
     {
@@ -802,9 +992,9 @@ gconf_value_free_list(GConfValue* value)
       
       tmp = g_slist_next(tmp);
     }
-  g_slist_free(real->d.list_data.list);
+  g_slist_free(real->d.list_data.u.list);
 
-  real->d.list_data.list = NULL;
+  real->d.list_data.u.list = NULL;
 }
 
 void 
@@ -815,11 +1005,18 @@ gconf_value_free(GConfValue* value)
   g_return_if_fail(value != NULL);
 
   real = REAL_VALUE (value);
+
+  /* Owned by the list it came from */
+  g_return_if_fail (!(real->flags & VALUE_PACKED));
+
+  if (!g_atomic_int_dec_and_test (&real->refcount))
+    return;
   
   switch (real->type)
     {
     case GCONF_VALUE_STRING:
-      g_free(real->d.string_data);
+      if (!(real->flags & VALUE_STRING_INLINE))
+        g_free(real->d.string_data);
       break;
     case GCONF_VALUE_SCHEMA:
       if (real->d.schema_data != NULL)
@@ -842,13 +1039,62 @@ gconf_value_free(GConfValue* value)
   g_slice_free(GConfRealValue, real);
 }
 
+/**
+ * gconf_value_ref:
+ * @value: a #GConfValue.
+ *
+ * Takes a reference on @value, so it can be held without copying it.
+ * A value with more than one reference must not be changed; take a
+ * copy with gconf_value_copy() for that. The elements of a list
+ * value can't be referenced on their own, so for those a copy is
+ * returned instead.
+ *
+ * Return value: @value or a copy of it, to be released with
+ * gconf_value_unref() or gconf_value_free().
+ */
+GConfValue*
+gconf_value_ref (GConfValue *value)
+{
+  GConfRealValue *real;
+
+  g_return_val_if_fail (value != NULL, NULL);
+
+  real = REAL_VALUE (value);
+
+  if (real->flags & VALUE_PACKED)
+    return gconf_value_copy (value);
+
+  g_atomic_int_inc (&real->refcount);
+
+  return value;
+}
+
+/**
+ * gconf_value_unref:
+ * @value: a #GConfValue.
+ *
+ * Drops a reference on @value, freeing it when the last one goes.
+ * The same as gconf_value_free().
+ */
+void
+gconf_value_unref (GConfValue *value)
+{
+  gconf_value_free (value);
+}
+
+guint64
+gconf_value_get_n_allocs (void)
+{
+  return value_allocs;
+}
+
 const char*
 gconf_value_get_string (const GConfValue *value)
 {
   g_return_val_if_fail (value != NULL, NULL);
   g_return_val_if_fail (value->type == GCONF_VALUE_STRING, NULL);
   
-  return REAL_VALUE (value)->d.string_data;
+  return value_string (REAL_VALUE (value));
 }
 
 char*
@@ -862,7 +1108,16 @@ gconf_value_steal_string (GConfValue *value)
 
   real = REAL_VALUE (value);
 
-  string = real->d.string_data;
+  if (value_is_readonly (real))
+    return g_strdup (value_string (real));
+
+  if (real->flags & VALUE_STRING_INLINE)
+    {
+      string = g_strdup (real->d.string_inline);
+      real->flags &= ~VALUE_STRING_INLINE;
+    }
+  else
+    string = real->d.string_data;
   real->d.string_data = NULL;
 
   return string;
@@ -910,10 +1165,17 @@ gconf_value_get_list_type (const GConfValue *value)
 GSList*
 gconf_value_get_list (const GConfValue *value)
 {
+  GConfRealValue *real;
+
   g_return_val_if_fail (value != NULL, NULL);
   g_return_val_if_fail (value->type == GCONF_VALUE_LIST, NULL);
 
-  return REAL_VALUE (value)->d.list_data.list;
+  real = REAL_VALUE (value);
+
+  if (real->flags & VALUE_LIST_PACKED)
+    return real->d.list_data.u.array->list;
+  else
+    return real->d.list_data.u.list;
 }
 
 GSList*
@@ -927,11 +1189,38 @@ gconf_value_steal_list (GConfValue *value)
 
   real = REAL_VALUE (value);
 
-  list = real->d.list_data.list;
-  real->d.list_data.list = NULL;
+  if (value_is_readonly (real))
+    return copy_value_list (gconf_value_get_list (value));
+
+  if (real->flags & VALUE_LIST_PACKED)
+    {
+      /* The caller gets to own and change the values, so
+       * they can't be the shared ones
+       */
+      list = copy_value_list (real->d.list_data.u.array->list);
+      value_array_unref (real->d.list_data.u.array);
+      real->flags &= ~VALUE_LIST_PACKED;
+    }
+  else
+    list = real->d.list_data.u.list;
+
+  real->d.list_data.u.list = NULL;
   return list;
 }
 
+gboolean
+gconf_value_owns_list (const GConfValue *value)
+{
+  GConfRealValue *real;
+
+  g_return_val_if_fail (value != NULL, FALSE);
+  g_return_val_if_fail (value->type == GCONF_VALUE_LIST, FALSE);
+
+  real = REAL_VALUE (value);
+
+  return !value_is_readonly (real) && !(real->flags & VALUE_LIST_PACKED);
+}
+
 GConfValue*
 gconf_value_get_car (const GConfValue *value)
 {
@@ -980,6 +1269,9 @@ gconf_value_steal_schema (GConfValue *value)
 
   real = REAL_VALUE (value);
 
+  if (value_is_readonly (real))
+    return real->d.schema_data ? gconf_schema_copy (real->d.schema_data) : NULL;
+
   schema = real->d.schema_data;
   real->d.schema_data = NULL;
 
@@ -991,6 +1283,7 @@ gconf_value_set_int(GConfValue* value, gint the_int)
 {
   g_return_if_fail(value != NULL);
   g_return_if_fail(value->type == GCONF_VALUE_INT);
+  g_return_if_fail(!value_is_readonly (REAL_VALUE (value)));
 
   REAL_VALUE (value)->d.int_data = the_int;
 }
@@ -998,8 +1291,26 @@ gconf_value_set_int(GConfValue* value, gint the_int)
 void        
 gconf_value_set_string(GConfValue* value, const gchar* the_str)
 {  
-  gconf_value_set_string_nocopy (value,
-                                 g_strdup (the_str));
+  GConfRealValue *real;
+
+  g_return_if_fail(value != NULL);
+  g_return_if_fail(value->type == GCONF_VALUE_STRING);
+
+  real = REAL_VALUE (value);
+
+  /* Skip the heap copy if it's going inline anyway */
+  if (the_str != NULL && strlen (the_str) < sizeof (real->d.string_inline))
+    {
+      g_return_if_fail (!value_is_readonly (real));
+
+      if (!(real->flags & VALUE_STRING_INLINE))
+        g_free (real->d.string_data);
+
+      strcpy (real->d.string_inline, the_str);
+      real->flags |= VALUE_STRING_INLINE;
+    }
+  else
+    gconf_value_set_string_nocopy (value, g_strdup (the_str));
 }
 
 void
@@ -1013,8 +1324,22 @@ gconf_value_set_string_nocopy (GConfValue *value,
 
   real = REAL_VALUE (value);
 
-  g_free (real->d.string_data);
-  real->d.string_data = str;
+  g_return_if_fail (!value_is_readonly (real));
+
+  if (!(real->flags & VALUE_STRING_INLINE))
+    g_free (real->d.string_data);
+
+  if (str != NULL && strlen (str) < sizeof (real->d.string_inline))
+    {
+      strcpy (real->d.string_inline, str);
+      real->flags |= VALUE_STRING_INLINE;
+      g_free (str);
+    }
+  else
+    {
+      real->d.string_data = str;
+      real->flags &= ~VALUE_STRING_INLINE;
+    }
 }
 
 void        
@@ -1022,6 +1347,7 @@ gconf_value_set_float(GConfValue* value, gdouble the_float)
 {
   g_return_if_fail(value != NULL);
   g_return_if_fail(value->type == GCONF_VALUE_FLOAT);
+  g_return_if_fail(!value_is_readonly (REAL_VALUE (value)));
 
   REAL_VALUE (value)->d.float_data = the_float;
 }
@@ -1031,6 +1357,7 @@ gconf_value_set_bool(GConfValue* value, gboolean the_bool)
 {
   g_return_if_fail(value != NULL);
   g_return_if_fail(value->type == GCONF_VALUE_BOOL);
+  g_return_if_fail(!value_is_readonly (REAL_VALUE (value)));
 
   REAL_VALUE (value)->d.bool_data = the_bool;
 }
@@ -1044,6 +1371,8 @@ gconf_value_set_schema(GConfValue* value, const GConfSchema* sc)
   g_return_if_fail(value->type == GCONF_VALUE_SCHEMA);
 
   real = REAL_VALUE (value);
+
+  g_return_if_fail (!value_is_readonly (real));
   
   if (real->d.schema_data != NULL)
     gconf_schema_free (real->d.schema_data);
@@ -1061,6 +1390,8 @@ gconf_value_set_schema_nocopy(GConfValue* value, GConfSchema* sc)
   g_return_if_fail(sc != NULL);
 
   real = REAL_VALUE (value);
+
+  g_return_if_fail (!value_is_readonly (real));
   
   if (real->d.schema_data != NULL)
     gconf_schema_free (real->d.schema_data);
@@ -1083,6 +1414,8 @@ gconf_value_set_car_nocopy(GConfValue* value, GConfValue* car)
   g_return_if_fail(value->type == GCONF_VALUE_PAIR);
 
   real = REAL_VALUE (value);
+
+  g_return_if_fail (!value_is_readonly (real));
   
   if (real->d.pair_data.car != NULL)
     gconf_value_free (real->d.pair_data.car);
@@ -1105,6 +1438,8 @@ gconf_value_set_cdr_nocopy(GConfValue* value, GConfValue* cdr)
   g_return_if_fail(value->type == GCONF_VALUE_PAIR);
 
   real = REAL_VALUE (value);
+
+  g_return_if_fail (!value_is_readonly (real));
   
   if (real->d.pair_data.cdr != NULL)
     gconf_value_free (real->d.pair_data.cdr);
@@ -1124,12 +1459,14 @@ gconf_value_set_list_type (GConfValue    *value,
   g_return_if_fail(type != GCONF_VALUE_PAIR);
 
   real = REAL_VALUE (value);
+
+  g_return_if_fail (!value_is_readonly (real));
   
   /* If the list is non-NULL either we already have the right
    * type, or we shouldn't be changing it without deleting
    * the list first.
    */
-  g_return_if_fail (real->d.list_data.list == NULL);
+  g_return_if_fail (gconf_value_get_list (value) == NULL);
 
   real->d.list_data.type = type;
 }
@@ -1144,13 +1481,14 @@ gconf_value_set_list_nocopy (GConfValue* value,
   g_return_if_fail (value->type == GCONF_VALUE_LIST);
 
   real = REAL_VALUE (value);
+
+  g_return_if_fail (!value_is_readonly (real));
   
   g_return_if_fail (real->d.list_data.type != GCONF_VALUE_INVALID);
   
-  if (real->d.list_data.list)
-    gconf_value_free_list (value);
+  gconf_value_free_list (value);
 
-  real->d.list_data.list = list;
+  real->d.list_data.u.list = list;
 }
 
 void
@@ -1164,15 +1502,20 @@ gconf_value_set_list       (GConfValue* value,
 
   real = REAL_VALUE (value);
 
+  g_return_if_fail (!value_is_readonly (real));
+
   g_return_if_fail (real->d.list_data.type != GCONF_VALUE_INVALID);
   g_return_if_fail ((list == NULL) ||
                     ((list->data != NULL) &&
                      (((GConfValue*)list->data)->type == real->d.list_data.type)));
   
-  if (real->d.list_data.list)
-    gconf_value_free_list (value);
+  gconf_value_free_list (value);
 
-  real->d.list_data.list = copy_value_list (list);
+  if (list != NULL)
+    {
+      real->d.list_data.u.array = value_array_new (list);
+      real->flags |= VALUE_LIST_PACKED;
+    }
 }
 
 
@@ -1698,8 +2041,8 @@ gconf_value_validate (const GConfValue *value,
   switch (value->type)
     {
     case GCONF_VALUE_STRING:
-      if (real->d.string_data &&
-          !g_utf8_validate (real->d.string_data, -1, NULL))
+      if (value_string (real) &&
+          !g_utf8_validate (value_string (real), -1, NULL))
         {
           g_set_error (err, GCONF_ERROR,
                        GCONF_ERROR_FAILED,
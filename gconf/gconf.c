@@ -1185,6 +1185,52 @@ gconf_engine_get_entry(GConfEngine* conf,
 
   return entry;
 }
+
+static GSList*
+get_many_one_by_one (GConfEngine *conf,
+                     GSList      *keys,
+                     const gchar *locale,
+                     gboolean     use_schema_default,
+                     GError     **err)
+{
+  GSList *entries;
+  GSList *tmp;
+
+  entries = NULL;
+  for (tmp = keys; tmp != NULL; tmp = tmp->next)
+    {
+      GConfEntry *entry;
+
+      entry = gconf_engine_get_entry (conf, tmp->data, locale,
+                                      use_schema_default, err);
+      if (entry == NULL)
+        {
+          g_slist_foreach (entries, (GFunc) gconf_entry_free, NULL);
+          g_slist_free (entries);
+          return NULL;
+        }
+
+      entries = g_slist_prepend (entries, entry);
+    }
+
+  return g_slist_reverse (entries);
+}
+
+GSList*
+gconf_engine_get_many (GConfEngine *conf,
+                       GSList      *keys,
+                       const gchar *locale,
+                       gboolean     use_schema_default,
+                       GError     **err)
+{
+  g_return_val_if_fail (conf != NULL, NULL);
+  g_return_val_if_fail (err == NULL || *err == NULL, NULL);
+
+  CHECK_OWNER_USE (conf);
+
+  /* The ConfigDatabase interface has no usable batch lookup */
+  return get_many_one_by_one (conf, keys, locale, use_schema_default, err);
+}
      
 GConfValue*  
 gconf_engine_get (GConfEngine* conf, const gchar* key, GError** err)
@@ -1941,6 +1987,108 @@ gconf_engine_all_dirs(GConfEngine* conf, const gchar* dir, GError** err)
   return subdirs;
 }
 
+static gboolean
+all_entries_dir_by_dir (GConfEngine *conf,
+                        const gchar *dir,
+                        GSList     **entries,
+                        GSList     **subdirs,
+                        GError     **err)
+{
+  GError *error = NULL;
+  GSList *dirs;
+  GSList *tmp;
+
+  *entries = g_slist_concat (gconf_engine_all_entries (conf, dir, &error),
+                             *entries);
+  if (error == NULL)
+    dirs = gconf_engine_all_dirs (conf, dir, &error);
+  else
+    dirs = NULL;
+
+  for (tmp = dirs; tmp != NULL; tmp = tmp->next)
+    {
+      if (error == NULL)
+        all_entries_dir_by_dir (conf, tmp->data, entries, subdirs, &error);
+
+      *subdirs = g_slist_prepend (*subdirs, tmp->data);
+    }
+  g_slist_free (dirs);
+
+  if (error != NULL)
+    {
+      g_propagate_error (err, error);
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+static GSList*
+all_entries_recursive_dir_by_dir (GConfEngine *conf,
+                                  const gchar *dir,
+                                  GSList     **subdirs,
+                                  GError     **err)
+{
+  GSList *entries = NULL;
+  GSList *dirs = NULL;
+
+  if (!all_entries_dir_by_dir (conf, dir, &entries, &dirs, err))
+    {
+      g_slist_foreach (entries, (GFunc) gconf_entry_free, NULL);
+      g_slist_free (entries);
+      g_slist_foreach (dirs, (GFunc) g_free, NULL);
+      g_slist_free (dirs);
+      return NULL;
+    }
+
+  if (subdirs)
+    *subdirs = dirs;
+  else
+    {
+      g_slist_foreach (dirs, (GFunc) g_free, NULL);
+      g_slist_free (dirs);
+    }
+
+  return entries;
+}
+
+/**
+ * gconf_engine_all_entries_recursive:
+ * @conf: a #GConfEngine.
+ * @dir: directory to list.
+ * @subdirs: (out) (element-type utf8) (transfer full) (allow-none): return location for the directories below @dir.
+ * @err: the return location for an allocated #GError, or <symbol>NULL</symbol> to ignore errors.
+ *
+ * Lists every entry in @dir and in all the directories below it, and
+ * optionally those directories, in a single request to the
+ * configuration server where it supports that. Keys and directory
+ * names are absolute. Free the lists as for gconf_engine_all_entries()
+ * and gconf_engine_all_dirs().
+ *
+ * Return value: (element-type GConfEntry) (transfer full): List of #GConfEntry.
+ */
+GSList*
+gconf_engine_all_entries_recursive (GConfEngine *conf,
+                                    const gchar *dir,
+                                    GSList     **subdirs,
+                                    GError     **err)
+{
+  g_return_val_if_fail (conf != NULL, NULL);
+  g_return_val_if_fail (dir != NULL, NULL);
+  g_return_val_if_fail (err == NULL || *err == NULL, NULL);
+
+  CHECK_OWNER_USE (conf);
+
+  if (subdirs)
+    *subdirs = NULL;
+
+  if (!gconf_key_check (dir, err))
+    return NULL;
+
+  /* The ConfigDatabase interface has no subtree listing */
+  return all_entries_recursive_dir_by_dir (conf, dir, subdirs, err);
+}
+
 /* annoyingly, this is REQUIRED for local sources */
 void 
 gconf_engine_suggest_sync(GConfEngine* conf, GError** err)
@@ -2123,6 +2271,68 @@ gconf_synchronous_sync(GConfEngine* conf, GError** err)
     ; /* nothing additional */
 }
 
+/* A local engine has no resolved-value cache, only the sources' */
+static GSList*
+local_cache_statistics (GConfEngine *conf)
+{
+  GConfSourceMissingStats missing;
+  GSList *stats;
+
+  gconf_sources_get_missing_stats (conf->local_sources, &missing);
+
+  stats = NULL;
+  stats = gconf_statistics_prepend (stats, "missing-lookups",
+                                    missing.n_lookups);
+  stats = gconf_statistics_prepend (stats, "missing-hits",
+                                    missing.n_hits);
+  stats = gconf_statistics_prepend (stats, "missing-invalidations",
+                                    missing.n_invalidations);
+
+  return g_slist_reverse (stats);
+}
+
+GSList*
+gconf_engine_get_cache_statistics (GConfEngine  *conf,
+                                   GError      **err)
+{
+  g_return_val_if_fail (conf != NULL, NULL);
+  g_return_val_if_fail (err == NULL || *err == NULL, NULL);
+
+  if (gconf_engine_is_local (conf))
+    return local_cache_statistics (conf);
+
+  gconf_set_error (err, GCONF_ERROR_FAILED,
+                   _("This server does not report cache statistics"));
+
+  return NULL;
+}
+
+GSList*
+gconf_engine_get_statistics (GConfEngine  *conf,
+                             GError      **err)
+{
+  g_return_val_if_fail (conf != NULL, NULL);
+  g_return_val_if_fail (err == NULL || *err == NULL, NULL);
+
+  if (gconf_engine_is_local (conf))
+    return local_cache_statistics (conf);
+
+  gconf_set_error (err, GCONF_ERROR_FAILED,
+                   _("This server does not report statistics"));
+
+  return NULL;
+}
+
+gboolean
+gconf_engine_commit_entries (GConfEngine  *conf,
+                             GSList       *entries,
+                             GSList      **committed,
+                             GError      **err)
+{
+  /* The CORBA server has no way to take several changes at once */
+  return FALSE;
+}
+
 gboolean
 gconf_engine_dir_exists(GConfEngine *conf, const gchar *dir, GError** err)
 {
@@ -2260,6 +2470,98 @@ gconf_engine_key_is_writable  (GConfEngine *conf,
   return is_writable;
 }
 
+/*
+ * Asynchronous requests
+ */
+
+/* The ConfigDatabase interface is only used synchronously, so these
+ * complete, and run their callbacks, before returning.
+ */
+
+void
+gconf_engine_set_async (GConfEngine         *conf,
+                        const gchar         *key,
+                        const GConfValue    *value,
+                        GConfEngineDoneFunc  func,
+                        gpointer             user_data)
+{
+  GError *error = NULL;
+
+  gconf_engine_set (conf, key, value, &error);
+
+  if (func)
+    (* func) (conf, error, user_data);
+
+  if (error)
+    g_error_free (error);
+}
+
+void
+gconf_engine_unset_async (GConfEngine         *conf,
+                          const gchar         *key,
+                          GConfEngineDoneFunc  func,
+                          gpointer             user_data)
+{
+  GError *error = NULL;
+
+  gconf_engine_unset (conf, key, &error);
+
+  if (func)
+    (* func) (conf, error, user_data);
+
+  if (error)
+    g_error_free (error);
+}
+
+void
+gconf_engine_get_entry_async (GConfEngine          *conf,
+                              const gchar          *key,
+                              const gchar          *locale,
+                              gboolean              use_schema_default,
+                              GConfEngineEntryFunc  func,
+                              gpointer              user_data)
+{
+  GError *error = NULL;
+  GConfEntry *entry;
+
+  entry = gconf_engine_get_entry (conf, key, locale, use_schema_default,
+                                  &error);
+
+  if (func)
+    (* func) (conf, entry, error, user_data);
+
+  if (entry)
+    gconf_entry_free (entry);
+  if (error)
+    g_error_free (error);
+}
+
+void
+gconf_engine_all_entries_async (GConfEngine            *conf,
+                                const gchar            *dir,
+                                GConfEngineEntriesFunc  func,
+                                gpointer                user_data)
+{
+  GError *error = NULL;
+  GSList *entries;
+
+  entries = gconf_engine_all_entries (conf, dir, &error);
+
+  if (func)
+    (* func) (conf, entries, error, user_data);
+
+  g_slist_foreach (entries, (GFunc) gconf_entry_free, NULL);
+  g_slist_free (entries);
+  if (error)
+    g_error_free (error);
+}
+
+void
+gconf_engine_complete_pending (GConfEngine *conf)
+{
+  g_return_if_fail (conf != NULL);
+}
+
 /*
  * Connection maintenance
  */
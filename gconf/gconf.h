@@ -63,6 +63,14 @@ GConfEntry* gconf_engine_get_entry                (GConfEngine  *conf,
                                                    gboolean      use_schema_default,
                                                    GError  **err);
 
+/* Returns a list of GConfEntry, one for each key in the same order,
+   fetched in a single request to the server where possible. */
+GSList*     gconf_engine_get_many                 (GConfEngine  *conf,
+                                                   GSList       *keys,
+                                                   const gchar  *locale,
+                                                   gboolean      use_schema_default,
+                                                   GError  **err);
+
 
 /* Locale only matters if you are expecting to get a schema, or if you
    don't know what you are expecting and it might be a schema. Note
@@ -102,6 +110,12 @@ GSList*  gconf_engine_all_entries      (GConfEngine  *conf,
 GSList*  gconf_engine_all_dirs         (GConfEngine  *conf,
                                         const gchar  *dir,
                                         GError  **err);
+/* Every entry at or below dir, and optionally every dir below it,
+   fetched in a single request to the server where possible. */
+GSList*  gconf_engine_all_entries_recursive (GConfEngine  *conf,
+                                             const gchar  *dir,
+                                             GSList      **subdirs,
+                                             GError  **err);
 void     gconf_engine_suggest_sync     (GConfEngine  *conf,
                                         GError  **err);
 gboolean gconf_engine_dir_exists       (GConfEngine  *conf,
@@ -115,6 +129,43 @@ gboolean gconf_engine_key_is_writable  (GConfEngine *conf,
                                         const gchar *key,
                                         GError     **err);
 
+/* Requests that don't wait for the server. Callbacks run in the order
+   the requests were made, from the main loop or from
+   gconf_engine_complete_pending (); what they are passed belongs to
+   GConf and is freed when they return. */
+typedef void (*GConfEngineDoneFunc)    (GConfEngine  *conf,
+                                        const GError *error,
+                                        gpointer      user_data);
+typedef void (*GConfEngineEntryFunc)   (GConfEngine  *conf,
+                                        GConfEntry   *entry,
+                                        const GError *error,
+                                        gpointer      user_data);
+typedef void (*GConfEngineEntriesFunc) (GConfEngine  *conf,
+                                        GSList       *entries,
+                                        const GError *error,
+                                        gpointer      user_data);
+
+void     gconf_engine_set_async         (GConfEngine            *conf,
+                                         const gchar            *key,
+                                         const GConfValue       *value,
+                                         GConfEngineDoneFunc     func,
+                                         gpointer                user_data);
+void     gconf_engine_unset_async       (GConfEngine            *conf,
+                                         const gchar            *key,
+                                         GConfEngineDoneFunc     func,
+                                         gpointer                user_data);
+void     gconf_engine_get_entry_async   (GConfEngine            *conf,
+                                         const gchar            *key,
+                                         const gchar            *locale,
+                                         gboolean                use_schema_default,
+                                         GConfEngineEntryFunc    func,
+                                         gpointer                user_data);
+void     gconf_engine_all_entries_async (GConfEngine            *conf,
+                                         const gchar            *dir,
+                                         GConfEngineEntriesFunc  func,
+                                         gpointer                user_data);
+void     gconf_engine_complete_pending  (GConfEngine            *conf);
+
 /* if you pass non-NULL for why_invalid, it gives a user-readable
    explanation of the problem in g_malloc()'d memory
 */
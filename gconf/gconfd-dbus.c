@@ -31,6 +31,12 @@ static DBusConnection *bus_conn;
 static const char *server_path = "/org/gnome/GConf/Server";
 static gint nr_of_connections = 0;
 
+/* Newest wire format each client told us it understands, by unique
+ * bus name. Clients that never said are sent GCONF_DBUS_WIRE_TEXT.
+ */
+static GHashTable *client_wire_formats = NULL;
+static GMutex      client_wire_formats_lock;   /* read by worker threads */
+
 static void              server_unregistered_func (DBusConnection *connection,
 						   void           *user_data);
 static DBusHandlerResult server_message_func      (DBusConnection  *connection,
@@ -101,6 +107,55 @@ server_message_func (DBusConnection *connection,
   return DBUS_HANDLER_RESULT_HANDLED;
 }
 
+static gchar *
+get_rule_for_client (const gchar *service)
+{
+  return g_strdup_printf ("type='signal',member='NameOwnerChanged',arg0='%s'",
+			  service);
+}
+
+static void
+set_client_wire_format (const gchar         *service,
+			GConfDBusWireFormat  format)
+{
+  gchar    *rule;
+  gboolean  known;
+
+  g_mutex_lock (&client_wire_formats_lock);
+
+  if (client_wire_formats == NULL)
+    client_wire_formats = g_hash_table_new_full (g_str_hash, g_str_equal,
+						 g_free, NULL);
+
+  known = g_hash_table_lookup_extended (client_wire_formats, service,
+					NULL, NULL);
+
+  if (format == GCONF_DBUS_WIRE_TEXT)
+    {
+      if (known)
+	g_hash_table_remove (client_wire_formats, service);
+    }
+  else
+    g_hash_table_insert (client_wire_formats,
+			 g_strdup (service), GUINT_TO_POINTER (format));
+
+  g_mutex_unlock (&client_wire_formats_lock);
+
+  /* Only a client's first format, or going back to text, changes
+   * whether we watch it
+   */
+  if (known == (format != GCONF_DBUS_WIRE_TEXT))
+    return;
+
+  /* Watch the client so we can forget it when it goes away */
+  rule = get_rule_for_client (service);
+  if (format == GCONF_DBUS_WIRE_TEXT)
+    dbus_bus_remove_match (bus_conn, rule, NULL);
+  else
+    dbus_bus_add_match (bus_conn, rule, NULL);
+  g_free (rule);
+}
+
 static DBusHandlerResult
 server_filter_func (DBusConnection  *connection,
 		    DBusMessage     *message,
@@ -112,10 +167,44 @@ server_filter_func (DBusConnection  *connection,
 	  /* Exit cleanly. */
 	  gconfd_main_quit ();
   }
+  else if (dbus_message_is_signal (message,
+				   DBUS_INTERFACE_DBUS,
+				   "NameOwnerChanged")) {
+    const gchar *service, *old_owner, *new_owner;
+
+    if (dbus_message_get_args (message, NULL,
+			       DBUS_TYPE_STRING, &service,
+			       DBUS_TYPE_STRING, &old_owner,
+			       DBUS_TYPE_STRING, &new_owner,
+			       DBUS_TYPE_INVALID) &&
+	new_owner[0] == '\0')
+      set_client_wire_format (service, GCONF_DBUS_WIRE_TEXT);
+  }
   
   return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
 }
 
+/* Clients that know more than GCONF_DBUS_WIRE_TEXT append the newest
+ * format they understand as the last argument.
+ */
+static GConfDBusWireFormat
+get_requested_wire_format (DBusMessage *message)
+{
+  DBusMessageIter iter;
+  dbus_uint32_t   format = GCONF_DBUS_WIRE_TEXT;
+
+  if (!dbus_message_iter_init (message, &iter))
+    return GCONF_DBUS_WIRE_TEXT;
+
+  while (dbus_message_iter_has_next (&iter))
+    dbus_message_iter_next (&iter);
+
+  if (dbus_message_iter_get_arg_type (&iter) == DBUS_TYPE_UINT32)
+    dbus_message_iter_get_basic (&iter, &format);
+
+  return MIN (format, GCONF_DBUS_WIRE_NEWEST);
+}
+
 static void
 server_real_handle_get_db (DBusConnection *connection,
 			   DBusMessage    *message,
@@ -125,10 +214,14 @@ server_real_handle_get_db (DBusConnection *connection,
   DBusMessage   *reply;
   GError        *gerror = NULL;
   const gchar   *str;
+  dbus_uint32_t  format;
  
   if (gconfd_dbus_check_in_shutdown (connection, message))
     return;
 
+  set_client_wire_format (dbus_message_get_sender (message),
+			  get_requested_wire_format (message));
+
   db = gconfd_obtain_database (addresses, &gerror);
 
   if (gconfd_dbus_set_exception (connection, message, &gerror))
@@ -139,8 +232,10 @@ server_real_handle_get_db (DBusConnection *connection,
       g_error ("No memory");
 
   str = gconf_database_dbus_get_path (db);
+  format = GCONF_DBUS_WIRE_NEWEST;
   dbus_message_append_args (reply,
 			    DBUS_TYPE_OBJECT_PATH, &str,
+			    DBUS_TYPE_UINT32, &format,
 			    DBUS_TYPE_INVALID);
   
   if (!dbus_connection_send (connection, reply, NULL)) 
@@ -202,6 +297,10 @@ gconfd_dbus_init (void)
 
   dbus_error_init (&error);
 
+  /* Worker threads send replies on the connection too */
+  if (gconf_database_get_worker_threads () > 0)
+    dbus_threads_init_default ();
+
   bus_conn = dbus_bus_get (DBUS_BUS_SESSION, &error);
 
   if (!bus_conn) 
@@ -384,6 +483,34 @@ gconfd_dbus_check_in_shutdown (DBusConnection *connection,
     return FALSE;
 }
 
+/* The format to use for values sent to @service */
+GConfDBusWireFormat
+gconfd_dbus_get_client_wire_format (const char *service)
+{
+  GConfDBusWireFormat format;
+
+  if (service == NULL)
+    return GCONF_DBUS_WIRE_TEXT;
+
+  g_mutex_lock (&client_wire_formats_lock);
+
+  format = GCONF_DBUS_WIRE_TEXT;
+  if (client_wire_formats != NULL)
+    format = GPOINTER_TO_UINT (g_hash_table_lookup (client_wire_formats,
+						    service));
+
+  g_mutex_unlock (&client_wire_formats_lock);
+
+  return format;
+}
+
+/* The format to use in the reply to @message */
+GConfDBusWireFormat
+gconfd_dbus_get_wire_format (DBusMessage *message)
+{
+  return gconfd_dbus_get_client_wire_format (dbus_message_get_sender (message));
+}
+
 DBusConnection *
 gconfd_dbus_get_connection (void)
 {
@@ -21,6 +21,7 @@
 #define GCONF_GCONFD_DBUS_H
 
 #include <dbus/dbus.h>
+#include "gconf-dbus-utils.h"
 
 gboolean gconfd_dbus_init                     (void);
 gboolean gconfd_dbus_check_in_shutdown        (DBusConnection   *connection,
@@ -39,6 +40,9 @@ gboolean gconfd_dbus_check_in_shutdown        (DBusConnection *connection,
 					       DBusMessage    *message);
 DBusConnection *gconfd_dbus_get_connection    (void);
 
+GConfDBusWireFormat gconfd_dbus_get_wire_format        (DBusMessage *message);
+GConfDBusWireFormat gconfd_dbus_get_client_wire_format (const char  *service);
+
 void gconfd_emit_db_gone (const char *object_path);
 
 #endif
@@ -1435,6 +1435,9 @@ gconfd_notify_other_listeners (GConfDatabase *modified_db,
 	{
 	  GList *tmp2;
 
+	  /* Our sources may share storage with the modified ones */
+	  gconf_database_forget_key_for_sources (db, modified_sources, key);
+
 	  tmp2 = modified_sources->sources;
 	  while (tmp2)
 	    {
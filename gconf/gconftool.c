@@ -60,6 +60,8 @@ static char* value_cdr_type = NULL;
 static int shutdown_gconfd = FALSE;
 static int ping_gconfd = FALSE;
 static int spawn_gconfd = FALSE;
+static int cache_stats_mode = FALSE;
+static int stats_mode = FALSE;
 static char* short_desc = NULL;
 static char* long_desc = NULL;
 static char* owner = NULL;
@@ -286,6 +288,24 @@ static const GOptionEntry server_entries[] = {
     N_("Launch the configuration server (gconfd). (Normally happens automatically when needed.)"),
     NULL
   },
+  {
+    "cache-stats",
+    '\0',
+    0,
+    G_OPTION_ARG_NONE,
+    &cache_stats_mode,
+    N_("Print the configuration server's cache statistics"),
+    NULL
+  },
+  {
+    "stats",
+    '\0',
+    0,
+    G_OPTION_ARG_NONE,
+    &stats_mode,
+    N_("Print the configuration server's statistics and request latencies"),
+    NULL
+  },
   {
     NULL
   }
@@ -562,6 +582,8 @@ static int do_get_schema_name (GConfEngine *conf, const gchar **args);
 static int do_associate_schema (GConfEngine *conf, const gchar **args);
 static int do_dissociate_schema (GConfEngine *conf, const gchar **args);
 static int do_get_default_source (const gchar **args);
+static int do_cache_stats (GConfEngine *conf);
+static int do_stats (GConfEngine *conf);
 
 int 
 main (int argc, char** argv)
@@ -844,6 +866,32 @@ main (int argc, char** argv)
       return 1;
     }
 
+  if (cache_stats_mode && (shutdown_gconfd || set_mode || get_mode || unset_mode ||
+                           all_subdirs_mode || all_entries_mode || recursive_list || search_key || search_key_regex ||
+                           get_type_mode || get_list_size_mode || get_list_element_mode ||
+                           spawn_gconfd || dir_exists || schema_file ||
+                           makefile_install_mode || makefile_uninstall_mode ||
+                           break_key_mode || break_dir_mode || short_docs_mode ||
+                           long_docs_mode || schema_name_mode || stats_mode))
+    {
+      g_printerr (_("%s option must be used by itself.\n"),
+		      "--cache-stats");
+      return 1;
+    }
+
+  if (stats_mode && (shutdown_gconfd || set_mode || get_mode || unset_mode ||
+                     all_subdirs_mode || all_entries_mode || recursive_list || search_key || search_key_regex ||
+                     get_type_mode || get_list_size_mode || get_list_element_mode ||
+                     spawn_gconfd || dir_exists || schema_file ||
+                     makefile_install_mode || makefile_uninstall_mode ||
+                     break_key_mode || break_dir_mode || short_docs_mode ||
+                     long_docs_mode || schema_name_mode))
+    {
+      g_printerr (_("%s option must be used by itself.\n"),
+		      "--stats");
+      return 1;
+    }
+
   /* FIXME not checking that --recursive-unset, --dump or --load are used alone */
   
   if (use_local_source && config_source == NULL)
@@ -1022,6 +1070,24 @@ main (int argc, char** argv)
       return retval;
     }
 
+  if (cache_stats_mode)
+    {
+      gint retval = do_cache_stats (conf);
+
+      gconf_engine_unref (conf);
+
+      return retval;
+    }
+
+  if (stats_mode)
+    {
+      gint retval = do_stats (conf);
+
+      gconf_engine_unref (conf);
+
+      return retval;
+    }
+
   if (spawn_gconfd)
     {
       do_spawn_daemon(conf);
@@ -4355,3 +4421,184 @@ do_get_default_source (const gchar** args)
 
   return 0;
 }
+
+static int
+do_cache_stats (GConfEngine *conf)
+{
+  GError *err = NULL;
+  GSList *stats;
+  GSList *tmp;
+
+  stats = gconf_engine_get_cache_statistics (conf, &err);
+
+  if (err != NULL)
+    {
+      g_printerr (_("Failed to get cache statistics: %s\n"), err->message);
+      g_error_free (err);
+      return 1;
+    }
+
+  for (tmp = stats; tmp != NULL; tmp = tmp->next)
+    {
+      GConfStatistic *stat = tmp->data;
+
+      g_print ("%s: %" G_GUINT64_FORMAT "\n", stat->name, stat->value);
+    }
+
+  gconf_statistics_free (stats);
+
+  return 0;
+}
+
+/* The latency buckets gconfd reports for each method, in order */
+static const struct {
+  const char *name;
+  const char *heading;
+} latency_columns[] = {
+  { "under-10us",  "<10us" },
+  { "under-100us", "<100us" },
+  { "under-1ms",   "<1ms" },
+  { "under-10ms",  "<10ms" },
+  { "under-100ms", "<100ms" },
+  { "under-1s",    "<1s" },
+  { "over-1s",     ">=1s" }
+};
+
+typedef struct {
+  gchar   *method;
+  guint64  calls;
+  guint64  time;
+  guint64  max_time;
+  guint64  buckets[G_N_ELEMENTS (latency_columns)];
+} MethodRow;
+
+static gint
+method_row_compare (gconstpointer a,
+                    gconstpointer b)
+{
+  return strcmp (((const MethodRow *) a)->method,
+                 ((const MethodRow *) b)->method);
+}
+
+/* Files a method-<Method>-<field> counter in its row; returns FALSE
+ * for anything else.
+ */
+static gboolean
+add_method_stat (GHashTable     *rows,
+                 GConfStatistic *stat)
+{
+  const gchar *method;
+  const gchar *field;
+  MethodRow *row;
+  gchar *name;
+  guint i;
+
+  if (!g_str_has_prefix (stat->name, "method-"))
+    return FALSE;
+
+  method = stat->name + strlen ("method-");
+  field = strchr (method, '-');
+  if (field == NULL)
+    return FALSE;
+
+  name = g_strndup (method, field - method);
+  field++;
+
+  row = g_hash_table_lookup (rows, name);
+  if (row == NULL)
+    {
+      row = g_new0 (MethodRow, 1);
+      row->method = name;
+      g_hash_table_insert (rows, name, row);
+    }
+  else
+    g_free (name);
+
+  if (strcmp (field, "calls") == 0)
+    row->calls = stat->value;
+  else if (strcmp (field, "time") == 0)
+    row->time = stat->value;
+  else if (strcmp (field, "max-time") == 0)
+    row->max_time = stat->value;
+  else
+    {
+      for (i = 0; i < G_N_ELEMENTS (latency_columns); i++)
+        {
+          if (strcmp (field, latency_columns[i].name) == 0)
+            row->buckets[i] = stat->value;
+        }
+    }
+
+  return TRUE;
+}
+
+static void
+method_row_free (MethodRow *row)
+{
+  g_free (row->method);
+  g_free (row);
+}
+
+static int
+do_stats (GConfEngine *conf)
+{
+  GError *err = NULL;
+  GSList *stats;
+  GSList *tmp;
+  GList *rows;
+  GList *l;
+  GHashTable *methods;
+  guint i;
+
+  stats = gconf_engine_get_statistics (conf, &err);
+
+  if (err != NULL)
+    {
+      g_printerr (_("Failed to get statistics: %s\n"), err->message);
+      g_error_free (err);
+      return 1;
+    }
+
+  methods = g_hash_table_new (g_str_hash, g_str_equal);
+
+  for (tmp = stats; tmp != NULL; tmp = tmp->next)
+    {
+      GConfStatistic *stat = tmp->data;
+
+      if (!add_method_stat (methods, stat))
+        g_print ("%s: %" G_GUINT64_FORMAT "\n", stat->name, stat->value);
+    }
+
+  gconf_statistics_free (stats);
+
+  rows = g_list_sort (g_hash_table_get_values (methods), method_row_compare);
+  g_hash_table_destroy (methods);
+
+  if (rows != NULL)
+    {
+      g_print ("\n%-20s %10s %10s %10s", _("Method"), _("Calls"),
+               _("Avg (us)"), _("Max (us)"));
+      for (i = 0; i < G_N_ELEMENTS (latency_columns); i++)
+        g_print (" %8s", latency_columns[i].heading);
+      g_print ("\n");
+    }
+
+  for (l = rows; l != NULL; l = l->next)
+    {
+      MethodRow *row = l->data;
+
+      g_print ("%-20s %10" G_GUINT64_FORMAT " %10" G_GUINT64_FORMAT
+               " %10" G_GUINT64_FORMAT,
+               row->method, row->calls,
+               row->calls > 0 ? row->time / row->calls : 0,
+               row->max_time);
+      for (i = 0; i < G_N_ELEMENTS (latency_columns); i++)
+        g_print (" %8" G_GUINT64_FORMAT, row->buckets[i]);
+      g_print ("\n");
+
+      method_row_free (row);
+    }
+  g_list_free (rows);
+
+  return 0;
+}
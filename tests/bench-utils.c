@@ -0,0 +1,113 @@
+/* GConf
+ * Copyright (C) 2002 Red Hat Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include "bench-utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+void
+exit_if_error (GError *error)
+{
+  if (error != NULL)
+    {
+      g_printerr ("Error: %s\n", error->message);
+      g_error_free (error);
+      exit (1);
+    }
+}
+
+pid_t
+fork_or_die (void)
+{
+  pid_t pid;
+
+  pid = fork ();
+  if (pid < 0)
+    {
+      g_printerr ("Couldn't fork\n");
+      exit (1);
+    }
+
+  return pid;
+}
+
+gboolean
+read_all (int    fd,
+          void  *buf,
+          gsize  len)
+{
+  char *p = buf;
+
+  while (len > 0)
+    {
+      ssize_t n;
+
+      n = read (fd, p, len);
+      if (n <= 0)
+        return FALSE;
+
+      p += n;
+      len -= n;
+    }
+
+  return TRUE;
+}
+
+gboolean
+write_all (int         fd,
+           const void *buf,
+           gsize       len)
+{
+  const char *p = buf;
+
+  while (len > 0)
+    {
+      ssize_t n;
+
+      n = write (fd, p, len);
+      if (n <= 0)
+        return FALSE;
+
+      p += n;
+      len -= n;
+    }
+
+  return TRUE;
+}
+
+gsize
+current_rss_kb (void)
+{
+  char *contents;
+  unsigned long size, resident;
+  gsize retval;
+
+  /* Only where there's a /proc to ask */
+  if (!g_file_get_contents ("/proc/self/statm", &contents, NULL, NULL))
+    return 0;
+
+  retval = 0;
+  if (sscanf (contents, "%lu %lu", &size, &resident) == 2)
+    retval = resident * (sysconf (_SC_PAGESIZE) / 1024);
+
+  g_free (contents);
+
+  return retval;
+}
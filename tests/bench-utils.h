@@ -0,0 +1,48 @@
+/* GConf
+ * Copyright (C) 2002 Red Hat Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/* Helpers shared by the bench* programs */
+
+#ifndef GCONF_BENCH_UTILS_H
+#define GCONF_BENCH_UTILS_H
+
+#include <glib.h>
+#include <sys/types.h>
+
+G_BEGIN_DECLS
+
+/* Prints and frees @error and exits, if there is one */
+void     exit_if_error  (GError *error);
+
+pid_t    fork_or_die    (void);
+
+/* Read or write all of @buf, FALSE if the pipe breaks first */
+gboolean read_all       (int         fd,
+                         void       *buf,
+                         gsize       len);
+gboolean write_all      (int         fd,
+                         const void *buf,
+                         gsize       len);
+
+/* Resident set size of this process, or 0 where it can't be read */
+gsize    current_rss_kb (void);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,745 @@
+/* GConf
+ * Copyright (C) 2002 Red Hat Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/* Client-side benchmarks; these talk to the running gconfd and
+ * leave their keys under /bench.
+ */
+
+#include <gconf/gconf-client.h>
+#include "bench-utils.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <locale.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+/*
+ * An application starting up: fetching a few dozen unrelated keys
+ * that aren't in any preloaded dir, one at a time or all at once
+ */
+
+#define N_STARTUP_RUNS 20
+
+static GSList*
+make_startup_keys (GConfClient *client,
+                   int          n_keys)
+{
+  GSList *keys;
+  int i;
+
+  keys = NULL;
+  for (i = 0; i < n_keys; i++)
+    {
+      GError *error;
+      char *key;
+
+      key = g_strdup_printf ("/bench/startup/section%d/key%d", i % 5, i);
+
+      error = NULL;
+      gconf_client_set_int (client, key, i, &error);
+      exit_if_error (error);
+
+      keys = g_slist_prepend (keys, key);
+    }
+
+  return g_slist_reverse (keys);
+}
+
+static void
+bench_startup (GConfClient *client)
+{
+  static const int sizes[] = { 10, 50, 200 };
+  int s;
+
+  g_print ("%8s %16s %16s %10s\n",
+           "keys", "one by one (ms)", "get_many (ms)", "speedup");
+
+  for (s = 0; s < (int) G_N_ELEMENTS (sizes); s++)
+    {
+      GSList *keys;
+      GSList *tmp;
+      GTimer *timer;
+      double single;
+      double many;
+      int run;
+
+      keys = make_startup_keys (client, sizes[s]);
+
+      timer = g_timer_new ();
+      single = G_MAXDOUBLE;
+      many = G_MAXDOUBLE;
+
+      for (run = 0; run < N_STARTUP_RUNS; run++)
+        {
+          GSList *entries;
+          GError *error;
+
+          /* None of the keys are in the client's dirs, so every
+           * lookup goes to gconfd
+           */
+          g_timer_start (timer);
+          for (tmp = keys; tmp != NULL; tmp = tmp->next)
+            {
+              GConfEntry *entry;
+
+              error = NULL;
+              entry = gconf_client_get_entry (client, tmp->data, NULL,
+                                              TRUE, &error);
+              exit_if_error (error);
+
+              gconf_entry_free (entry);
+            }
+          single = MIN (single, g_timer_elapsed (timer, NULL));
+
+          g_timer_start (timer);
+
+          error = NULL;
+          entries = gconf_client_get_many (client, keys, &error);
+          exit_if_error (error);
+
+          many = MIN (many, g_timer_elapsed (timer, NULL));
+
+          if (g_slist_length (entries) != (guint) sizes[s])
+            {
+              g_printerr ("Got %u entries for %d keys\n",
+                          g_slist_length (entries), sizes[s]);
+              exit (1);
+            }
+
+          g_slist_foreach (entries, (GFunc) gconf_entry_free, NULL);
+          g_slist_free (entries);
+        }
+
+      g_print ("%8d %16.2f %16.2f %9.1fx\n",
+               sizes[s], single * 1e3, many * 1e3, single / many);
+
+      g_timer_destroy (timer);
+
+      for (tmp = keys; tmp != NULL; tmp = tmp->next)
+        {
+          gconf_client_unset (client, tmp->data, NULL);
+          g_free (tmp->data);
+        }
+      g_slist_free (keys);
+    }
+}
+
+/*
+ * A long-lived editor: writing and re-reading many keys outside
+ * the client's dirs, with and without a cache budget
+ */
+
+#define N_EDITOR_KEYS 2000
+
+static void
+bench_editor (GConfClient *client)
+{
+  static const gsize budgets[] = { 0, 256 * 1024, 64 * 1024 };
+  int b;
+
+  g_print ("%10s %10s %10s %8s %8s %10s %10s\n",
+           "budget", "entries", "bytes", "hits", "misses", "evictions",
+           "reads (ms)");
+
+  for (b = 0; b < (int) G_N_ELEMENTS (budgets); b++)
+    {
+      GConfClientCacheStats before;
+      GConfClientCacheStats after;
+      GTimer *timer;
+      double elapsed;
+      int i;
+
+      gconf_client_clear_cache (client);
+      gconf_client_set_cache_budget (client, budgets[b]);
+      gconf_client_get_cache_stats (client, &before);
+
+      for (i = 0; i < N_EDITOR_KEYS; i++)
+        {
+          GError *error;
+          char *key;
+
+          key = g_strdup_printf ("/bench/editor/dir%d/key%d", i % 50, i);
+
+          error = NULL;
+          gconf_client_set_string (client, key,
+                                   "a value of about the usual length", &error);
+          exit_if_error (error);
+
+          g_free (key);
+        }
+
+      /* Read the most recent quarter back, as an editor redrawing
+       * the part of the tree in view would
+       */
+      timer = g_timer_new ();
+      for (i = N_EDITOR_KEYS - N_EDITOR_KEYS / 4; i < N_EDITOR_KEYS; i++)
+        {
+          GError *error;
+          char *key;
+          char *value;
+
+          key = g_strdup_printf ("/bench/editor/dir%d/key%d", i % 50, i);
+
+          error = NULL;
+          value = gconf_client_get_string (client, key, &error);
+          exit_if_error (error);
+
+          g_free (value);
+          g_free (key);
+        }
+      elapsed = g_timer_elapsed (timer, NULL);
+      g_timer_destroy (timer);
+
+      gconf_client_get_cache_stats (client, &after);
+
+      g_print ("%10lu %10u %10lu %8lu %8lu %10lu %10.2f\n",
+               (gulong) budgets[b], after.n_entries, (gulong) after.size,
+               after.hits - before.hits, after.misses - before.misses,
+               after.evictions - before.evictions, elapsed * 1e3);
+    }
+
+  gconf_client_recursive_unset (client, "/bench/editor", 0, NULL);
+  gconf_client_set_cache_budget (client, 0);
+}
+
+/*
+ * Notification fan-out: one process changing keys while more and
+ * more others listen, each at a couple of levels above the keys
+ */
+
+#define N_NOTIFY_KEYS 500
+#define NOTIFY_DIR "/bench/notify"
+#define NOTIFY_DONE_KEY NOTIFY_DIR "/done"
+
+typedef struct {
+  GMainLoop *loop;
+  guint32 n_received;
+} NotifyCounter;
+
+static void
+notify_count_func (GConfEngine *conf,
+                   guint        cnxn_id,
+                   GConfEntry  *entry,
+                   gpointer     user_data)
+{
+  NotifyCounter *counter = user_data;
+
+  counter->n_received++;
+
+  if (strcmp (gconf_entry_get_key (entry), NOTIFY_DONE_KEY) == 0)
+    g_main_loop_quit (counter->loop);
+}
+
+static gboolean
+notify_give_up (gpointer data)
+{
+  g_main_loop_quit (data);
+
+  return FALSE;
+}
+
+/* Runs in a child: listens until the done key changes, then
+ * reports how many notifications arrived.
+ */
+static void
+notify_listener (int fd)
+{
+  GConfEngine *conf;
+  NotifyCounter counter;
+  GError *error;
+  char ready;
+
+  conf = gconf_engine_get_default ();
+
+  counter.loop = g_main_loop_new (NULL, FALSE);
+  counter.n_received = 0;
+
+  error = NULL;
+  gconf_engine_notify_add (conf, NOTIFY_DIR, notify_count_func,
+                           &counter, &error);
+  exit_if_error (error);
+  gconf_engine_notify_add (conf, "/bench", notify_count_func,
+                           &counter, &error);
+  exit_if_error (error);
+
+  ready = 1;
+  if (write (fd, &ready, 1) != 1)
+    _exit (1);
+
+  g_timeout_add (60 * 1000, notify_give_up, counter.loop);
+  g_main_loop_run (counter.loop);
+
+  if (write (fd, &counter.n_received, sizeof (counter.n_received)) !=
+      sizeof (counter.n_received))
+    _exit (1);
+
+  _exit (0);
+}
+
+/* Runs in a child too, since the parent mustn't connect before
+ * forking the next round's listeners.
+ */
+static void
+notify_writer (int round)
+{
+  GConfClient *client;
+  int i;
+
+  client = gconf_client_get_default ();
+
+  for (i = 0; i < N_NOTIFY_KEYS; i++)
+    {
+      GError *error;
+      char *key;
+
+      key = g_strdup_printf (NOTIFY_DIR "/key%d", i);
+
+      error = NULL;
+      gconf_client_set_int (client, key, i + round, &error);
+      exit_if_error (error);
+
+      g_free (key);
+    }
+  gconf_client_set_int (client, NOTIFY_DONE_KEY, round, NULL);
+
+  g_object_unref (client);
+
+  _exit (0);
+}
+
+static void
+bench_notify (void)
+{
+  static const int n_listeners[] = { 1, 4, 16, 64 };
+  int l;
+
+  g_print ("%10s %10s %12s %12s %14s\n",
+           "listeners", "changes", "received", "time (ms)",
+           "delivered/s");
+
+  for (l = 0; l < (int) G_N_ELEMENTS (n_listeners); l++)
+    {
+      GTimer *timer;
+      double elapsed;
+      guint64 received;
+      int fds[2];
+      int i;
+
+      if (pipe (fds) != 0)
+        {
+          g_printerr ("Couldn't make a pipe\n");
+          exit (1);
+        }
+
+      /* Fork before connecting, so each listener has its own
+       * connection to the bus
+       */
+      for (i = 0; i < n_listeners[l]; i++)
+        {
+          if (fork_or_die () == 0)
+            {
+              close (fds[0]);
+              notify_listener (fds[1]);
+            }
+        }
+      close (fds[1]);
+
+      for (i = 0; i < n_listeners[l]; i++)
+        {
+          char ready;
+
+          if (!read_all (fds[0], &ready, 1))
+            {
+              g_printerr ("A listener failed to start\n");
+              exit (1);
+            }
+        }
+
+      timer = g_timer_new ();
+
+      if (fork_or_die () == 0)
+        {
+          close (fds[0]);
+          notify_writer (l);
+        }
+
+      received = 0;
+      for (i = 0; i < n_listeners[l]; i++)
+        {
+          guint32 n;
+
+          if (!read_all (fds[0], &n, sizeof (n)))
+            {
+              g_printerr ("A listener died\n");
+              exit (1);
+            }
+          received += n;
+        }
+      elapsed = g_timer_elapsed (timer, NULL);
+      g_timer_destroy (timer);
+
+      close (fds[0]);
+      while (wait (NULL) > 0)
+        ;
+
+      g_print ("%10d %10d %12lu %12.2f %14.0f\n",
+               n_listeners[l], N_NOTIFY_KEYS + 1, (gulong) received,
+               elapsed * 1e3, received / elapsed);
+    }
+}
+
+/*
+ * Lookup throughput with many clients at once; run gconfd with
+ * GCONF_WORKER_THREADS set and unset to compare.
+ */
+
+#define N_CONCURRENT_KEYS 100
+#define N_CONCURRENT_LOOKUPS 2000
+#define CONCURRENT_DIR "/bench/concurrent"
+
+static void
+concurrent_setup (void)
+{
+  GConfEngine *conf;
+  int i;
+
+  conf = gconf_engine_get_default ();
+
+  for (i = 0; i < N_CONCURRENT_KEYS; i++)
+    {
+      GError *error;
+      char *key;
+
+      key = g_strdup_printf (CONCURRENT_DIR "/key%d", i);
+
+      error = NULL;
+      gconf_engine_set_int (conf, key, i, &error);
+      exit_if_error (error);
+
+      g_free (key);
+    }
+
+  gconf_engine_suggest_sync (conf, NULL);
+  gconf_engine_unref (conf);
+
+  _exit (0);
+}
+
+/* Runs in a child: connects, waits for the go, then looks keys up
+ * as fast as the server answers.
+ */
+static void
+concurrent_reader (int ready_fd,
+                   int go_fd,
+                   int seed)
+{
+  GConfEngine *conf;
+  guint32 n_done;
+  char c;
+  int i;
+
+  conf = gconf_engine_get_default ();
+
+  /* Make sure we're connected before the clock starts */
+  gconf_engine_dir_exists (conf, CONCURRENT_DIR, NULL);
+
+  c = 1;
+  if (write (ready_fd, &c, 1) != 1 || !read_all (go_fd, &c, 1))
+    _exit (1);
+
+  n_done = 0;
+  for (i = 0; i < N_CONCURRENT_LOOKUPS; i++)
+    {
+      GConfValue *value;
+      GError *error;
+      char *key;
+
+      key = g_strdup_printf (CONCURRENT_DIR "/key%d",
+                             (i + seed) % N_CONCURRENT_KEYS);
+
+      error = NULL;
+      value = gconf_engine_get (conf, key, &error);
+      exit_if_error (error);
+
+      if (value != NULL)
+        {
+          n_done++;
+          gconf_value_free (value);
+        }
+
+      g_free (key);
+    }
+
+  if (write (ready_fd, &n_done, sizeof (n_done)) != sizeof (n_done))
+    _exit (1);
+
+  _exit (0);
+}
+
+static void
+bench_concurrent (void)
+{
+  static const int n_clients[] = { 1, 2, 4, 8, 16, 32 };
+  int l;
+
+  if (fork_or_die () == 0)
+    concurrent_setup ();
+  while (wait (NULL) > 0)
+    ;
+
+  g_print ("%10s %12s %12s %14s\n",
+           "clients", "lookups", "time (ms)", "lookups/s");
+
+  for (l = 0; l < (int) G_N_ELEMENTS (n_clients); l++)
+    {
+      GTimer *timer;
+      double elapsed;
+      guint64 looked_up;
+      int ready_fds[2];
+      int go_fds[2];
+      char *go;
+      int i;
+
+      if (pipe (ready_fds) != 0 || pipe (go_fds) != 0)
+        {
+          g_printerr ("Couldn't make a pipe\n");
+          exit (1);
+        }
+
+      for (i = 0; i < n_clients[l]; i++)
+        {
+          if (fork_or_die () == 0)
+            {
+              close (ready_fds[0]);
+              close (go_fds[1]);
+              concurrent_reader (ready_fds[1], go_fds[0], i * 7);
+            }
+        }
+      close (ready_fds[1]);
+      close (go_fds[0]);
+
+      for (i = 0; i < n_clients[l]; i++)
+        {
+          char ready;
+
+          if (!read_all (ready_fds[0], &ready, 1))
+            {
+              g_printerr ("A client failed to start\n");
+              exit (1);
+            }
+        }
+
+      timer = g_timer_new ();
+
+      go = g_malloc0 (n_clients[l]);
+      if (write (go_fds[1], go, n_clients[l]) != n_clients[l])
+        {
+          g_printerr ("Couldn't start the clients\n");
+          exit (1);
+        }
+      g_free (go);
+
+      looked_up = 0;
+      for (i = 0; i < n_clients[l]; i++)
+        {
+          guint32 n;
+
+          if (!read_all (ready_fds[0], &n, sizeof (n)))
+            {
+              g_printerr ("A client died\n");
+              exit (1);
+            }
+          looked_up += n;
+        }
+      elapsed = g_timer_elapsed (timer, NULL);
+      g_timer_destroy (timer);
+
+      close (ready_fds[0]);
+      close (go_fds[1]);
+      while (wait (NULL) > 0)
+        ;
+
+      g_print ("%10d %12lu %12.2f %14.0f\n",
+               n_clients[l], (gulong) looked_up,
+               elapsed * 1e3, looked_up / elapsed);
+    }
+}
+
+/*
+ * Writing and reading back many keys, one round trip at a time
+ * against all requests in flight at once
+ */
+
+#define N_PIPELINE_KEYS 500
+
+static void
+pipeline_done_func (GConfEngine  *conf,
+                    const GError *error,
+                    gpointer      user_data)
+{
+  if (error != NULL)
+    {
+      g_printerr ("Error: %s\n", error->message);
+      exit (1);
+    }
+}
+
+static void
+pipeline_entry_func (GConfEngine  *conf,
+                     GConfEntry   *entry,
+                     const GError *error,
+                     gpointer      user_data)
+{
+  pipeline_done_func (conf, error, user_data);
+}
+
+static void
+bench_pipeline (void)
+{
+  GConfEngine *conf;
+  GConfValue *value;
+  char **keys;
+  int pass;
+  int i;
+
+  conf = gconf_engine_get_default ();
+
+  keys = g_new (char*, N_PIPELINE_KEYS);
+  for (i = 0; i < N_PIPELINE_KEYS; i++)
+    keys[i] = g_strdup_printf ("/bench/pipeline/key%d", i);
+
+  value = gconf_value_new (GCONF_VALUE_INT);
+
+  g_print ("%10s %10s %14s %14s\n",
+           "mode", "keys", "set (ms)", "get (ms)");
+
+  for (pass = 0; pass < 2; pass++)
+    {
+      GTimer *timer;
+      double set_time;
+      double get_time;
+
+      timer = g_timer_new ();
+      for (i = 0; i < N_PIPELINE_KEYS; i++)
+        {
+          gconf_value_set_int (value, i + pass);
+
+          if (pass == 0)
+            {
+              GError *error = NULL;
+
+              gconf_engine_set (conf, keys[i], value, &error);
+              exit_if_error (error);
+            }
+          else
+            gconf_engine_set_async (conf, keys[i], value,
+                                    pipeline_done_func, NULL);
+        }
+      gconf_engine_complete_pending (conf);
+      set_time = g_timer_elapsed (timer, NULL);
+
+      g_timer_start (timer);
+      for (i = 0; i < N_PIPELINE_KEYS; i++)
+        {
+          if (pass == 0)
+            {
+              GError *error = NULL;
+              GConfEntry *entry;
+
+              entry = gconf_engine_get_entry (conf, keys[i], NULL, TRUE,
+                                              &error);
+              exit_if_error (error);
+              gconf_entry_free (entry);
+            }
+          else
+            gconf_engine_get_entry_async (conf, keys[i], NULL, TRUE,
+                                          pipeline_entry_func, NULL);
+        }
+      gconf_engine_complete_pending (conf);
+      get_time = g_timer_elapsed (timer, NULL);
+
+      g_timer_destroy (timer);
+
+      g_print ("%10s %10d %14.2f %14.2f\n",
+               pass == 0 ? "blocking" : "async", N_PIPELINE_KEYS,
+               set_time * 1e3, get_time * 1e3);
+    }
+
+  gconf_value_free (value);
+
+  for (i = 0; i < N_PIPELINE_KEYS; i++)
+    gconf_engine_unset (conf, keys[i], NULL);
+  for (i = 0; i < N_PIPELINE_KEYS; i++)
+    g_free (keys[i]);
+  g_free (keys);
+
+  gconf_engine_unref (conf);
+}
+
+int
+main (int argc, char **argv)
+{
+  GConfClient *client;
+  const char *mode;
+
+  setlocale (LC_ALL, "");
+
+  g_type_init ();
+
+  mode = argc > 1 ? argv[1] : "startup";
+
+  /* Listeners need connections of their own */
+  if (strcmp (mode, "notify") == 0)
+    {
+      bench_notify ();
+      return 0;
+    }
+
+  /* Forks its clients, like notify */
+  if (strcmp (mode, "concurrent") == 0)
+    {
+      bench_concurrent ();
+      return 0;
+    }
+
+  /* Uses the engine directly, so it mustn't belong to a client */
+  if (strcmp (mode, "pipeline") == 0)
+    {
+      bench_pipeline ();
+      return 0;
+    }
+
+  client = gconf_client_get_default ();
+
+  if (strcmp (mode, "startup") == 0)
+    bench_startup (client);
+  else if (strcmp (mode, "editor") == 0)
+    bench_editor (client);
+  else
+    {
+      g_printerr ("Usage: %s [startup|editor|notify|pipeline|concurrent]\n", argv[0]);
+      return 1;
+    }
+
+  gconf_client_suggest_sync (client, NULL);
+  g_object_unref (client);
+
+  return 0;
+}
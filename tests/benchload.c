@@ -0,0 +1,798 @@
+/* GConf
+ * Copyright (C) 2002 Red Hat Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/* Load generator for gconfd. Starts a private bus whose gconfd is
+ * the one built here, with only a temporary markup source to write
+ * to, then runs a mix of operations from N client processes at once
+ * and reports throughput and latency percentiles for each N.
+ *
+ * Run with GCONF_BACKEND_DIR pointing at the built backends, e.g.
+ *   benchload --clients=1,8,32 --mix=get:80,set:15,all-entries:5
+ */
+
+#include <gconf/gconf.h>
+#include <gconf/gconf-internals.h>
+#include "bench-utils.h"
+#include <glib/gstdio.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <locale.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define BENCH_DIR "/bench/load"
+#define N_DIRS 10
+
+enum {
+  OP_GET,
+  OP_SET,
+  OP_UNSET,
+  OP_ALL_ENTRIES,
+  OP_NOTIFY,
+  N_OPS
+};
+
+static const char *op_names[N_OPS] = {
+  "get", "set", "unset", "all-entries", "notify"
+};
+
+static char *clients_arg = NULL;
+static char *mix_arg = NULL;
+static int n_ops_per_client = 2000;
+static int n_keys = 200;
+static int worker_threads = -1;
+static char *gconfd_path = NULL;
+
+static GOptionEntry options[] = {
+  { "clients", 'c', 0, G_OPTION_ARG_STRING, &clients_arg,
+    "Comma-separated numbers of concurrent clients (default 1,4,16)", "N,..." },
+  { "mix", 'm', 0, G_OPTION_ARG_STRING, &mix_arg,
+    "Weights of get, set, unset, all-entries and notify (default get:70,set:20,unset:5,all-entries:5)", "OP:WEIGHT,..." },
+  { "ops", 'n', 0, G_OPTION_ARG_INT, &n_ops_per_client,
+    "Operations per client (default 2000)", "N" },
+  { "keys", 'k', 0, G_OPTION_ARG_INT, &n_keys,
+    "Keys to spread the operations over (default 200)", "N" },
+  { "worker-threads", 'w', 0, G_OPTION_ARG_INT, &worker_threads,
+    "Run gconfd with this many worker threads", "N" },
+  { "gconfd", 0, 0, G_OPTION_ARG_FILENAME, &gconfd_path,
+    "gconfd to run (default the one in the build tree)", "PATH" },
+  { NULL }
+};
+
+/* One timed operation, as sent back by a client */
+typedef struct {
+  guint32 op;
+  guint32 usec;
+} Sample;
+
+/* What a client reports before its samples; times are monotonic,
+ * which is the same clock in every process.
+ */
+typedef struct {
+  gint64  start_time;
+  gint64  end_time;
+  guint32 n_samples;
+  guint32 n_errors;
+  guint32 n_notifications;
+} ClientReport;
+
+static gchar*
+key_name (int i)
+{
+  return g_strdup_printf (BENCH_DIR "/dir%d/key%d", i % N_DIRS, i);
+}
+
+static gchar*
+dir_name (int i)
+{
+  return g_strdup_printf (BENCH_DIR "/dir%d", i % N_DIRS);
+}
+
+/* Parses "op:weight,..." into @weights; FALSE if it doesn't */
+static gboolean
+parse_mix (const char *mix,
+           guint       weights[N_OPS])
+{
+  gchar **parts;
+  gboolean ok;
+  int i;
+
+  memset (weights, 0, sizeof (guint) * N_OPS);
+
+  parts = g_strsplit (mix, ",", -1);
+  ok = TRUE;
+  for (i = 0; ok && parts[i] != NULL; i++)
+    {
+      gchar *colon;
+      gchar *end;
+      int op;
+
+      colon = strchr (parts[i], ':');
+      if (colon == NULL)
+        {
+          ok = FALSE;
+          break;
+        }
+      *colon = '\0';
+
+      for (op = 0; op < N_OPS; op++)
+        {
+          if (strcmp (parts[i], op_names[op]) == 0)
+            break;
+        }
+
+      if (op == N_OPS)
+        {
+          ok = FALSE;
+          break;
+        }
+
+      weights[op] = strtoul (colon + 1, &end, 10);
+      if (*end != '\0')
+        ok = FALSE;
+    }
+  g_strfreev (parts);
+
+  if (ok)
+    {
+      guint total = 0;
+
+      for (i = 0; i < N_OPS; i++)
+        total += weights[i];
+      ok = total > 0;
+    }
+
+  return ok;
+}
+
+/*
+ * The private gconfd
+ */
+
+static gchar *tmp_dir = NULL;
+static GPid bus_pid = 0;
+static pid_t owner_pid = 0;
+
+static void
+write_file_or_die (const gchar *filename,
+                   const gchar *contents)
+{
+  GError *error = NULL;
+
+  g_file_set_contents (filename, contents, -1, &error);
+  exit_if_error (error);
+}
+
+static void
+remove_tree (const gchar *path)
+{
+  GDir *dir;
+  const gchar *name;
+
+  dir = g_dir_open (path, 0, NULL);
+  if (dir != NULL)
+    {
+      while ((name = g_dir_read_name (dir)) != NULL)
+        {
+          gchar *child;
+
+          child = g_build_filename (path, name, NULL);
+          remove_tree (child);
+          g_free (child);
+        }
+      g_dir_close (dir);
+
+      rmdir (path);
+    }
+  else
+    unlink (path);
+}
+
+/* Starts a bus that activates our gconfd, which picks up the source
+ * path in $XDG_CONFIG_HOME/gconf/path ahead of the system ones. The
+ * "xml:" backend is the markup one.
+ */
+static void
+start_private_gconfd (void)
+{
+  GError *error = NULL;
+  gchar *file;
+  gchar *contents;
+  gchar *argv[5];
+  gint out_fd;
+  char address[1024];
+  gsize len;
+
+  tmp_dir = g_build_filename (g_get_tmp_dir (), "benchload-XXXXXX", NULL);
+  if (g_mkdtemp (tmp_dir) == NULL)
+    {
+      g_printerr ("Couldn't make a temporary directory\n");
+      exit (1);
+    }
+
+  file = g_build_filename (tmp_dir, "gconf", NULL);
+  g_mkdir (file, 0700);
+  g_free (file);
+
+  file = g_build_filename (tmp_dir, "services", NULL);
+  g_mkdir (file, 0700);
+  g_free (file);
+
+  file = g_build_filename (tmp_dir, "gconf", "path", NULL);
+  contents = g_strdup_printf ("xml:readwrite:%s/db\n", tmp_dir);
+  write_file_or_die (file, contents);
+  g_free (contents);
+  g_free (file);
+
+  file = g_build_filename (tmp_dir, "services", "org.gnome.GConf.service", NULL);
+  contents = g_strdup_printf ("[D-BUS Service]\n"
+                              "Name=org.gnome.GConf\n"
+                              "Exec=%s\n",
+                              gconfd_path);
+  write_file_or_die (file, contents);
+  g_free (contents);
+  g_free (file);
+
+  file = g_build_filename (tmp_dir, "bus.conf", NULL);
+  contents = g_strdup_printf ("<!DOCTYPE busconfig PUBLIC \"-//freedesktop//DTD D-Bus Bus Configuration 1.0//EN\"\n"
+                              " \"http://www.freedesktop.org/standards/dbus/1.0/busconfig.dtd\">\n"
+                              "<busconfig>\n"
+                              "  <type>session</type>\n"
+                              "  <listen>unix:tmpdir=%s</listen>\n"
+                              "  <servicedir>%s/services</servicedir>\n"
+                              "  <policy context=\"default\">\n"
+                              "    <allow send_destination=\"*\" eavesdrop=\"true\"/>\n"
+                              "    <allow eavesdrop=\"true\"/>\n"
+                              "    <allow own=\"*\"/>\n"
+                              "  </policy>\n"
+                              "</busconfig>\n",
+                              tmp_dir, tmp_dir);
+  write_file_or_die (file, contents);
+  g_free (contents);
+
+  /* The bus, and so gconfd, inherit these */
+  g_setenv ("XDG_CONFIG_HOME", tmp_dir, TRUE);
+  g_setenv ("HOME", tmp_dir, TRUE);
+  g_setenv ("GCONF_TMPDIR", tmp_dir, TRUE);
+  if (worker_threads >= 0)
+    {
+      gchar *str = g_strdup_printf ("%d", worker_threads);
+      g_setenv ("GCONF_WORKER_THREADS", str, TRUE);
+      g_free (str);
+    }
+
+  argv[0] = "dbus-daemon";
+  argv[1] = g_strconcat ("--config-file=", file, NULL);
+  argv[2] = "--nofork";
+  argv[3] = "--print-address=1";
+  argv[4] = NULL;
+
+  g_spawn_async_with_pipes (NULL, argv, NULL,
+                            G_SPAWN_SEARCH_PATH | G_SPAWN_DO_NOT_REAP_CHILD,
+                            NULL, NULL, &bus_pid,
+                            NULL, &out_fd, NULL, &error);
+  exit_if_error (error);
+  g_free (argv[1]);
+  g_free (file);
+
+  /* The address is the first line it prints */
+  len = 0;
+  while (len < sizeof (address) - 1)
+    {
+      if (read (out_fd, &address[len], 1) != 1 || address[len] == '\n')
+        break;
+      len++;
+    }
+  address[len] = '\0';
+  close (out_fd);
+
+  if (len == 0)
+    {
+      g_printerr ("dbus-daemon didn't start\n");
+      exit (1);
+    }
+
+  g_setenv ("DBUS_SESSION_BUS_ADDRESS", address, TRUE);
+}
+
+/* gconfd exits when its bus goes away. Also run at exit, so that
+ * bailing out anywhere doesn't leave them behind; forked clients
+ * exiting mustn't take them down though.
+ */
+static void
+stop_private_gconfd (void)
+{
+  if (getpid () != owner_pid)
+    return;
+
+  if (bus_pid != 0)
+    {
+      kill (bus_pid, SIGTERM);
+      waitpid (bus_pid, NULL, 0);
+      bus_pid = 0;
+    }
+
+  if (tmp_dir != NULL)
+    {
+      remove_tree (tmp_dir);
+      g_free (tmp_dir);
+      tmp_dir = NULL;
+    }
+}
+
+/* In a child, since the parent mustn't connect before forking the
+ * clients; this also starts gconfd.
+ */
+static void
+populate (void)
+{
+  GConfEngine *conf;
+  int i;
+
+  conf = gconf_engine_get_default ();
+
+  for (i = 0; i < n_keys; i++)
+    {
+      GError *error = NULL;
+      gchar *key;
+
+      key = key_name (i);
+      gconf_engine_set_int (conf, key, i, &error);
+      exit_if_error (error);
+      g_free (key);
+    }
+
+  gconf_engine_suggest_sync (conf, NULL);
+  gconf_engine_unref (conf);
+
+  _exit (0);
+}
+
+/*
+ * Clients
+ */
+
+static void
+notify_count_func (GConfEngine *conf,
+                   guint        cnxn_id,
+                   GConfEntry  *entry,
+                   gpointer     user_data)
+{
+  guint32 *n_notifications = user_data;
+
+  (*n_notifications)++;
+}
+
+static void
+ignore_notify_func (GConfEngine *conf,
+                    guint        cnxn_id,
+                    GConfEntry  *entry,
+                    gpointer     user_data)
+{
+}
+
+static gboolean
+run_op (GConfEngine *conf,
+        int          op,
+        GRand       *rand)
+{
+  GError *error = NULL;
+  gchar *name;
+  int i;
+
+  i = g_rand_int_range (rand, 0, n_keys);
+
+  switch (op)
+    {
+    case OP_GET:
+      {
+        GConfValue *value;
+
+        name = key_name (i);
+        value = gconf_engine_get (conf, name, &error);
+        if (value != NULL)
+          gconf_value_free (value);
+      }
+      break;
+
+    case OP_SET:
+      name = key_name (i);
+      gconf_engine_set_int (conf, name, g_rand_int (rand), &error);
+      break;
+
+    case OP_UNSET:
+      name = key_name (i);
+      gconf_engine_unset (conf, name, &error);
+      break;
+
+    case OP_ALL_ENTRIES:
+      {
+        GSList *entries;
+
+        name = dir_name (i);
+        entries = gconf_engine_all_entries (conf, name, &error);
+        g_slist_foreach (entries, (GFunc) gconf_entry_free, NULL);
+        g_slist_free (entries);
+      }
+      break;
+
+    case OP_NOTIFY:
+      {
+        guint cnxn;
+
+        name = dir_name (i);
+        cnxn = gconf_engine_notify_add (conf, name, ignore_notify_func,
+                                        NULL, &error);
+        if (cnxn != 0)
+          gconf_engine_notify_remove (conf, cnxn);
+      }
+      break;
+
+    default:
+      g_assert_not_reached ();
+      name = NULL;
+      break;
+    }
+
+  g_free (name);
+
+  if (error != NULL)
+    {
+      g_error_free (error);
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+/* Runs in a child: connects, waits for the go, runs the mix, then
+ * writes a ClientReport and its samples to @out_fd.
+ */
+static void
+run_client (int          out_fd,
+            int          go_fd,
+            int          seed,
+            const guint  weights[N_OPS])
+{
+  GConfEngine *conf;
+  GRand *rand;
+  ClientReport report;
+  Sample *samples;
+  guint total_weight;
+  char c;
+  int i;
+
+  conf = gconf_engine_get_default ();
+  rand = g_rand_new_with_seed (seed);
+
+  memset (&report, 0, sizeof (report));
+
+  /* With notify in the mix every client listens too, so that sets
+   * have someone to notify
+   */
+  if (weights[OP_NOTIFY] > 0)
+    {
+      GError *error = NULL;
+
+      gconf_engine_notify_add (conf, BENCH_DIR, notify_count_func,
+                               &report.n_notifications, &error);
+      exit_if_error (error);
+    }
+  else
+    gconf_engine_dir_exists (conf, BENCH_DIR, NULL);
+
+  total_weight = 0;
+  for (i = 0; i < N_OPS; i++)
+    total_weight += weights[i];
+
+  samples = g_new (Sample, n_ops_per_client);
+
+  c = 1;
+  if (!write_all (out_fd, &c, 1) || !read_all (go_fd, &c, 1))
+    _exit (1);
+
+  report.start_time = g_get_monotonic_time ();
+
+  for (i = 0; i < n_ops_per_client; i++)
+    {
+      gint64 start;
+      guint pick;
+      int op;
+
+      pick = g_rand_int_range (rand, 0, total_weight);
+      for (op = 0; pick >= weights[op]; op++)
+        pick -= weights[op];
+
+      start = g_get_monotonic_time ();
+      if (!run_op (conf, op, rand))
+        report.n_errors++;
+
+      samples[i].op = op;
+      samples[i].usec = g_get_monotonic_time () - start;
+
+      /* Deliver the notifications that queued up meanwhile */
+      while (g_main_context_iteration (NULL, FALSE))
+        ;
+    }
+
+  report.end_time = g_get_monotonic_time ();
+  report.n_samples = n_ops_per_client;
+
+  if (!write_all (out_fd, &report, sizeof (report)) ||
+      !write_all (out_fd, samples, sizeof (Sample) * n_ops_per_client))
+    _exit (1);
+
+  _exit (0);
+}
+
+/*
+ * Results
+ */
+
+static int
+compare_guint32 (gconstpointer a,
+                 gconstpointer b)
+{
+  guint32 x = *(const guint32 *) a;
+  guint32 y = *(const guint32 *) b;
+
+  return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+static guint32
+percentile (GArray *sorted,
+            double  p)
+{
+  guint i;
+
+  if (sorted->len == 0)
+    return 0;
+
+  i = (guint) (p * (sorted->len - 1) + 0.5);
+
+  return g_array_index (sorted, guint32, i);
+}
+
+static void
+print_row (int          n_clients,
+           const char  *name,
+           GArray      *latencies,
+           double       elapsed)
+{
+  g_array_sort (latencies, compare_guint32);
+
+  g_print ("%8d %12s %10u %12.0f %10u %10u\n",
+           n_clients, name, latencies->len,
+           latencies->len / elapsed,
+           percentile (latencies, 0.50),
+           percentile (latencies, 0.99));
+}
+
+static void
+run_round (int          n_clients,
+           const guint  weights[N_OPS])
+{
+  GArray *all;
+  GArray *by_op[N_OPS];
+  pid_t *pids;
+  int *out_fds;
+  int go_fds[2];
+  gint64 start_time;
+  gint64 end_time;
+  guint64 n_errors;
+  guint64 n_notifications;
+  double elapsed;
+  char *go;
+  int i;
+
+  pids = g_new (pid_t, n_clients);
+  out_fds = g_new (int, n_clients);
+
+  if (pipe (go_fds) != 0)
+    {
+      g_printerr ("Couldn't make a pipe\n");
+      exit (1);
+    }
+
+  /* A pipe each, the samples are too big to share one */
+  for (i = 0; i < n_clients; i++)
+    {
+      int fds[2];
+
+      if (pipe (fds) != 0)
+        {
+          g_printerr ("Couldn't make a pipe\n");
+          exit (1);
+        }
+
+      pids[i] = fork_or_die ();
+      if (pids[i] == 0)
+        {
+          close (fds[0]);
+          close (go_fds[1]);
+          run_client (fds[1], go_fds[0], i + 1, weights);
+        }
+
+      close (fds[1]);
+      out_fds[i] = fds[0];
+    }
+  close (go_fds[0]);
+
+  for (i = 0; i < n_clients; i++)
+    {
+      char ready;
+
+      if (!read_all (out_fds[i], &ready, 1))
+        {
+          g_printerr ("A client failed to start\n");
+          exit (1);
+        }
+    }
+
+  go = g_malloc0 (n_clients);
+  if (!write_all (go_fds[1], go, n_clients))
+    {
+      g_printerr ("Couldn't start the clients\n");
+      exit (1);
+    }
+  g_free (go);
+  close (go_fds[1]);
+
+  all = g_array_new (FALSE, FALSE, sizeof (guint32));
+  for (i = 0; i < N_OPS; i++)
+    by_op[i] = g_array_new (FALSE, FALSE, sizeof (guint32));
+
+  start_time = G_MAXINT64;
+  end_time = 0;
+  n_errors = 0;
+  n_notifications = 0;
+
+  for (i = 0; i < n_clients; i++)
+    {
+      ClientReport report;
+      Sample *samples;
+      guint j;
+
+      if (!read_all (out_fds[i], &report, sizeof (report)))
+        {
+          g_printerr ("A client died\n");
+          exit (1);
+        }
+
+      samples = g_new (Sample, report.n_samples);
+      if (!read_all (out_fds[i], samples, sizeof (Sample) * report.n_samples))
+        {
+          g_printerr ("A client died\n");
+          exit (1);
+        }
+      close (out_fds[i]);
+
+      start_time = MIN (start_time, report.start_time);
+      end_time = MAX (end_time, report.end_time);
+      n_errors += report.n_errors;
+      n_notifications += report.n_notifications;
+
+      for (j = 0; j < report.n_samples; j++)
+        {
+          g_array_append_val (all, samples[j].usec);
+          g_array_append_val (by_op[samples[j].op], samples[j].usec);
+        }
+
+      g_free (samples);
+    }
+  g_free (out_fds);
+
+  /* Not wait(), the bus is our child too */
+  for (i = 0; i < n_clients; i++)
+    waitpid (pids[i], NULL, 0);
+  g_free (pids);
+
+  elapsed = (end_time - start_time) / 1e6;
+  if (elapsed <= 0)
+    elapsed = 1e-6;
+
+  print_row (n_clients, "all", all, elapsed);
+  for (i = 0; i < N_OPS; i++)
+    {
+      if (weights[i] > 0)
+        print_row (n_clients, op_names[i], by_op[i], elapsed);
+      g_array_free (by_op[i], TRUE);
+    }
+  g_array_free (all, TRUE);
+
+  if (n_errors > 0)
+    g_print ("%8d %12s %10lu\n", n_clients, "errors", (gulong) n_errors);
+  if (weights[OP_NOTIFY] > 0)
+    g_print ("%8d %12s %10lu\n", n_clients, "notified", (gulong) n_notifications);
+}
+
+int
+main (int argc, char **argv)
+{
+  GOptionContext *context;
+  GError *error = NULL;
+  guint weights[N_OPS];
+  gchar **counts;
+  pid_t pid;
+  int status;
+  int i;
+
+  setlocale (LC_ALL, "");
+
+  g_type_init ();
+
+  context = g_option_context_new ("- generate load on a private gconfd");
+  g_option_context_add_main_entries (context, options, NULL);
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+      g_printerr ("%s\n", error->message);
+      return 1;
+    }
+  g_option_context_free (context);
+
+  if (!parse_mix (mix_arg ? mix_arg : "get:70,set:20,unset:5,all-entries:5",
+                  weights))
+    {
+      g_printerr ("Bad --mix, expected e.g. get:70,set:20,unset:5,all-entries:5,notify:0\n");
+      return 1;
+    }
+
+  if (n_ops_per_client <= 0 || n_keys <= 0)
+    {
+      g_printerr ("--ops and --keys must be positive\n");
+      return 1;
+    }
+
+  if (gconfd_path == NULL)
+    gconfd_path = g_strdup (GCONFD_PATH);
+
+  owner_pid = getpid ();
+  atexit (stop_private_gconfd);
+
+  start_private_gconfd ();
+
+  pid = fork_or_die ();
+  if (pid == 0)
+    populate ();
+  if (waitpid (pid, &status, 0) != pid ||
+      !WIFEXITED (status) || WEXITSTATUS (status) != 0)
+    {
+      g_printerr ("Couldn't fill the database\n");
+      exit (1);
+    }
+
+  g_print ("%8s %12s %10s %12s %10s %10s\n",
+           "clients", "op", "count", "ops/s", "p50 (us)", "p99 (us)");
+
+  counts = g_strsplit (clients_arg ? clients_arg : "1,4,16", ",", -1);
+  for (i = 0; counts[i] != NULL; i++)
+    {
+      int n_clients = atoi (counts[i]);
+
+      if (n_clients > 0)
+        run_round (n_clients, weights);
+    }
+  g_strfreev (counts);
+
+  stop_private_gconfd ();
+
+  return 0;
+}
@@ -0,0 +1,732 @@
+/* GConf
+ * Copyright (C) 2002 Red Hat Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/* Microbenchmarks for the markup ("xml:") backend. These drive the
+ * backend vtable directly, like testbackend, so no gconfd is needed.
+ * Run with GCONF_BACKEND_DIR pointing at the built backends.
+ */
+
+#include <gconf/gconf-backend.h>
+#include <gconf/gconf-internals.h>
+#include <gconf/gconf.h>
+#include "bench-utils.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <locale.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static char*
+make_temp_root (void)
+{
+  GError *error;
+  char *root;
+
+  error = NULL;
+  root = g_dir_make_tmp ("gconf-bench-XXXXXX", &error);
+  exit_if_error (error);
+
+  return root;
+}
+
+static void
+remove_recursively (const char *path)
+{
+  GDir *dp;
+  const char *dent;
+
+  dp = g_dir_open (path, 0, NULL);
+  if (dp != NULL)
+    {
+      while ((dent = g_dir_read_name (dp)) != NULL)
+        {
+          char *child;
+
+          child = g_build_filename (path, dent, NULL);
+          remove_recursively (child);
+          g_free (child);
+        }
+      g_dir_close (dp);
+
+      g_rmdir (path);
+    }
+  else
+    {
+      g_unlink (path);
+    }
+}
+
+static GConfSource*
+open_source (const char *root,
+             const char *flags)
+{
+  GConfSource *source;
+  GError *error;
+  char *address;
+
+  address = g_strdup_printf ("xml:%s:%s", flags, root);
+
+  error = NULL;
+  source = gconf_resolve_address (address, &error);
+  exit_if_error (error);
+
+  g_free (address);
+
+  return source;
+}
+
+static void
+fill_dir (GConfSource *source,
+          const char  *dir,
+          int          n_entries)
+{
+  GConfValue *value;
+  int i;
+
+  value = gconf_value_new (GCONF_VALUE_INT);
+
+  for (i = 0; i < n_entries; i++)
+    {
+      GError *error;
+      char *key;
+
+      key = g_strdup_printf ("%s/key%d", dir, i);
+      gconf_value_set_int (value, i);
+
+      error = NULL;
+      (* source->backend->vtable.set_value) (source, key, value, &error);
+      exit_if_error (error);
+
+      g_free (key);
+    }
+
+  gconf_value_free (value);
+}
+
+/*
+ * Lookup cost as a single directory grows
+ */
+
+#define N_LOOKUPS 200000
+
+static void
+bench_lookup (void)
+{
+  static const int sizes[] = { 10, 100, 1000, 10000, 100000 };
+  int s;
+
+  g_print ("%10s %14s %14s %14s\n", "entries", "fill (ms)", "lookup (ns)",
+           "allocs/lookup");
+
+  for (s = 0; s < (int) G_N_ELEMENTS (sizes); s++)
+    {
+      GConfSource *source;
+      GTimer *timer;
+      char *root;
+      char **keys;
+      double fill_time;
+      double lookup_time;
+      guint64 allocs;
+      int i;
+
+      root = make_temp_root ();
+      source = open_source (root, "readwrite");
+
+      timer = g_timer_new ();
+      fill_dir (source, "/bench", sizes[s]);
+      fill_time = g_timer_elapsed (timer, NULL);
+
+      keys = g_new (char*, sizes[s]);
+      for (i = 0; i < sizes[s]; i++)
+        keys[i] = g_strdup_printf ("/bench/key%d", g_random_int_range (0, sizes[s]));
+
+      /* Values handed out by reference don't count */
+      allocs = gconf_value_get_n_allocs ();
+
+      g_timer_start (timer);
+      for (i = 0; i < N_LOOKUPS; i++)
+        {
+          GConfValue *value;
+          GError *error;
+
+          error = NULL;
+          value = (* source->backend->vtable.query_value) (source,
+                                                           keys[i % sizes[s]],
+                                                           NULL, NULL,
+                                                           &error);
+          exit_if_error (error);
+
+          if (value == NULL)
+            {
+              g_printerr ("Key %s missing\n", keys[i % sizes[s]]);
+              exit (1);
+            }
+
+          gconf_value_free (value);
+        }
+      lookup_time = g_timer_elapsed (timer, NULL);
+      allocs = gconf_value_get_n_allocs () - allocs;
+
+      g_print ("%10d %14.2f %14.1f %14.2f\n",
+               sizes[s],
+               fill_time * 1e3,
+               lookup_time * 1e9 / N_LOOKUPS,
+               (double) allocs / N_LOOKUPS);
+
+      for (i = 0; i < sizes[s]; i++)
+        g_free (keys[i]);
+      g_free (keys);
+
+      g_timer_destroy (timer);
+
+      gconf_source_free (source);
+
+      remove_recursively (root);
+      g_free (root);
+    }
+}
+
+/*
+ * Loading a merged %gconf-tree.xml from scratch
+ */
+
+#define N_LOAD_RUNS 5
+
+static void
+fill_tree (GConfSource *source,
+           int          n_dirs,
+           int          n_entries)
+{
+  GConfValue *value;
+  int d, i;
+
+  value = gconf_value_new (GCONF_VALUE_STRING);
+
+  for (d = 0; d < n_dirs; d++)
+    {
+      for (i = 0; i < n_entries; i++)
+        {
+          GError *error;
+          char *key;
+          char *str;
+
+          key = g_strdup_printf ("/apps/app%d/section%d/key%d", d, i % 8, i);
+          str = g_strdup_printf ("Value <%d> & \"%d\"", i, d);
+          gconf_value_set_string (value, str);
+
+          error = NULL;
+          (* source->backend->vtable.set_value) (source, key, value, &error);
+          exit_if_error (error);
+
+          g_free (str);
+          g_free (key);
+        }
+    }
+
+  gconf_value_free (value);
+}
+
+static int
+walk_tree (GConfSource *source,
+           const char  *dir)
+{
+  GSList *entries;
+  GSList *subdirs;
+  GSList *tmp;
+  GError *error;
+  int count;
+
+  error = NULL;
+  entries = (* source->backend->vtable.all_entries) (source, dir, NULL, &error);
+  exit_if_error (error);
+
+  count = g_slist_length (entries);
+  g_slist_foreach (entries, (GFunc) gconf_entry_free, NULL);
+  g_slist_free (entries);
+
+  error = NULL;
+  subdirs = (* source->backend->vtable.all_subdirs) (source, dir, &error);
+  exit_if_error (error);
+
+  for (tmp = subdirs; tmp != NULL; tmp = tmp->next)
+    {
+      char *subdir;
+
+      subdir = gconf_concat_dir_and_key (dir, tmp->data);
+      count += walk_tree (source, subdir);
+      g_free (subdir);
+
+      g_free (tmp->data);
+    }
+  g_slist_free (subdirs);
+
+  return count;
+}
+
+static void
+bench_load (void)
+{
+  static const int n_dirs[] = { 10, 100, 100 };
+  static const int n_entries[] = { 100, 100, 1000 };
+  int s;
+
+  g_print ("%10s %12s %14s\n", "entries", "file (KB)", "load (ms)");
+
+  for (s = 0; s < (int) G_N_ELEMENTS (n_dirs); s++)
+    {
+      GConfSource *source;
+      GTimer *timer;
+      GError *error;
+      struct stat statbuf;
+      char *root;
+      char *tree_file;
+      double best;
+      int run;
+
+      root = make_temp_root ();
+
+      source = open_source (root, "readwrite,merged");
+      fill_tree (source, n_dirs[s], n_entries[s]);
+
+      error = NULL;
+      (* source->backend->vtable.sync_all) (source, &error);
+      exit_if_error (error);
+      gconf_source_free (source);
+
+      tree_file = g_build_filename (root, "%gconf-tree.xml", NULL);
+      if (g_stat (tree_file, &statbuf) < 0)
+        {
+          g_printerr ("No merged tree written at %s\n", tree_file);
+          exit (1);
+        }
+
+      timer = g_timer_new ();
+      best = G_MAXDOUBLE;
+
+      for (run = 0; run < N_LOAD_RUNS; run++)
+        {
+          int count;
+
+          g_timer_start (timer);
+
+          source = open_source (root, "readonly");
+          count = walk_tree (source, "/");
+
+          best = MIN (best, g_timer_elapsed (timer, NULL));
+
+          if (count != n_dirs[s] * n_entries[s])
+            {
+              g_printerr ("Loaded %d entries, expected %d\n",
+                          count, n_dirs[s] * n_entries[s]);
+              exit (1);
+            }
+
+          gconf_source_free (source);
+        }
+
+      g_print ("%10d %12lu %14.2f\n",
+               n_dirs[s] * n_entries[s],
+               (unsigned long) statbuf.st_size / 1024,
+               best * 1e3);
+
+      g_timer_destroy (timer);
+      g_free (tree_file);
+
+      remove_recursively (root);
+      g_free (root);
+    }
+}
+
+/*
+ * Rewriting a merged %gconf-tree.xml after a change
+ */
+
+#define N_SAVE_RUNS 5
+
+static void
+bench_save (void)
+{
+  static const int n_dirs[] = { 50, 100 };
+  static const int n_entries[] = { 1000, 500 };
+  int s;
+
+  g_print ("%10s %12s %14s\n", "entries", "file (KB)", "save (ms)");
+
+  for (s = 0; s < (int) G_N_ELEMENTS (n_dirs); s++)
+    {
+      GConfSource *source;
+      GConfValue *value;
+      GTimer *timer;
+      GError *error;
+      struct stat statbuf;
+      char *root;
+      char *tree_file;
+      double best;
+      int run;
+
+      root = make_temp_root ();
+
+      source = open_source (root, "readwrite,merged");
+      fill_tree (source, n_dirs[s], n_entries[s]);
+
+      error = NULL;
+      (* source->backend->vtable.sync_all) (source, &error);
+      exit_if_error (error);
+
+      timer = g_timer_new ();
+      best = G_MAXDOUBLE;
+
+      value = gconf_value_new (GCONF_VALUE_INT);
+
+      for (run = 0; run < N_SAVE_RUNS; run++)
+        {
+          /* One changed key dirties the whole merged file */
+          gconf_value_set_int (value, run);
+
+          error = NULL;
+          (* source->backend->vtable.set_value) (source, "/apps/app0/section0/key0",
+                                                 value, &error);
+          exit_if_error (error);
+
+          g_timer_start (timer);
+
+          error = NULL;
+          (* source->backend->vtable.sync_all) (source, &error);
+          exit_if_error (error);
+
+          best = MIN (best, g_timer_elapsed (timer, NULL));
+        }
+
+      gconf_value_free (value);
+      gconf_source_free (source);
+
+      tree_file = g_build_filename (root, "%gconf-tree.xml", NULL);
+      if (g_stat (tree_file, &statbuf) < 0)
+        {
+          g_printerr ("No merged tree written at %s\n", tree_file);
+          exit (1);
+        }
+
+      g_print ("%10d %12lu %14.2f\n",
+               n_dirs[s] * n_entries[s],
+               (unsigned long) statbuf.st_size / 1024,
+               best * 1e3);
+
+      g_timer_destroy (timer);
+      g_free (tree_file);
+
+      remove_recursively (root);
+      g_free (root);
+    }
+}
+
+/*
+ * Lookup latency while a large merged tree is being synced,
+ * syncing in the main loop versus in the background
+ */
+
+#define N_SYNC_RUNS 5
+
+typedef struct
+{
+  GConfSource *source;
+  gpointer     job;
+  gint         done;
+} SyncThreadData;
+
+static gpointer
+sync_thread_func (SyncThreadData *data)
+{
+  GError *error;
+
+  error = NULL;
+  (* data->source->backend->vtable.run_sync_job) (data->job, &error);
+  exit_if_error (error);
+
+  g_atomic_int_set (&data->done, TRUE);
+
+  return NULL;
+}
+
+static void
+change_key (GConfSource *source,
+            int          run)
+{
+  GConfValue *value;
+  GError *error;
+
+  value = gconf_value_new (GCONF_VALUE_INT);
+  gconf_value_set_int (value, run);
+
+  error = NULL;
+  (* source->backend->vtable.set_value) (source, "/apps/app0/section0/key0",
+                                         value, &error);
+  exit_if_error (error);
+
+  gconf_value_free (value);
+}
+
+static void
+bench_sync (void)
+{
+  static const int n_dirs[] = { 50, 100 };
+  static const int n_entries[] = { 1000, 1000 };
+  int s;
+
+  g_print ("%10s %14s %14s %14s %10s %12s %12s\n",
+           "entries", "blocking (ms)", "prepare (ms)", "write (ms)",
+           "lookups", "avg (us)", "max (us)");
+
+  for (s = 0; s < (int) G_N_ELEMENTS (n_dirs); s++)
+    {
+      GConfSource *source;
+      GTimer *timer;
+      GError *error;
+      char *root;
+      double blocking;
+      double prepare;
+      double write;
+      double lookup_total;
+      double lookup_max;
+      guint n_lookups;
+      int run;
+
+      root = make_temp_root ();
+
+      source = open_source (root, "readwrite,merged");
+      fill_tree (source, n_dirs[s], n_entries[s]);
+
+      error = NULL;
+      (* source->backend->vtable.sync_all) (source, &error);
+      exit_if_error (error);
+
+      if (source->backend->vtable.prepare_sync == NULL)
+        {
+          g_printerr ("Backend can't sync in the background\n");
+          exit (1);
+        }
+
+      timer = g_timer_new ();
+
+      /* A lookup arriving during a sync in the main loop waits
+       * for all of it
+       */
+      blocking = G_MAXDOUBLE;
+      for (run = 0; run < N_SYNC_RUNS; run++)
+        {
+          change_key (source, run);
+
+          g_timer_start (timer);
+
+          error = NULL;
+          (* source->backend->vtable.sync_all) (source, &error);
+          exit_if_error (error);
+
+          blocking = MIN (blocking, g_timer_elapsed (timer, NULL));
+        }
+
+      prepare = G_MAXDOUBLE;
+      write = G_MAXDOUBLE;
+      lookup_total = 0.0;
+      lookup_max = 0.0;
+      n_lookups = 0;
+
+      for (run = 0; run < N_SYNC_RUNS; run++)
+        {
+          SyncThreadData data;
+          GThread *thread;
+          GTimer *lookup_timer;
+          int i;
+
+          change_key (source, run + N_SYNC_RUNS);
+
+          g_timer_start (timer);
+
+          data.source = source;
+          data.job = (* source->backend->vtable.prepare_sync) (source);
+          data.done = FALSE;
+
+          prepare = MIN (prepare, g_timer_elapsed (timer, NULL));
+
+          if (data.job == NULL)
+            {
+              g_printerr ("Nothing to sync after a change\n");
+              exit (1);
+            }
+
+          g_timer_start (timer);
+
+          thread = g_thread_new ("sync", (GThreadFunc) sync_thread_func, &data);
+
+          lookup_timer = g_timer_new ();
+          i = 0;
+          while (!g_atomic_int_get (&data.done))
+            {
+              GConfValue *value;
+              double elapsed;
+              char *key;
+
+              key = g_strdup_printf ("/apps/app%d/section%d/key%d",
+                                     i % n_dirs[s], i % 8, i % n_entries[s]);
+
+              g_timer_start (lookup_timer);
+
+              error = NULL;
+              value = (* source->backend->vtable.query_value) (source, key,
+                                                               NULL, NULL,
+                                                               &error);
+              exit_if_error (error);
+
+              elapsed = g_timer_elapsed (lookup_timer, NULL);
+
+              if (value == NULL)
+                {
+                  g_printerr ("Key %s missing\n", key);
+                  exit (1);
+                }
+
+              gconf_value_free (value);
+              g_free (key);
+
+              lookup_total += elapsed;
+              lookup_max = MAX (lookup_max, elapsed);
+              n_lookups += 1;
+              i += 7;
+            }
+
+          g_thread_join (thread);
+
+          write = MIN (write, g_timer_elapsed (timer, NULL));
+
+          (* source->backend->vtable.finish_sync) (source, data.job);
+
+          g_timer_destroy (lookup_timer);
+        }
+
+      g_print ("%10d %14.2f %14.2f %14.2f %10u %12.2f %12.2f\n",
+               n_dirs[s] * n_entries[s],
+               blocking * 1e3,
+               prepare * 1e3,
+               write * 1e3,
+               n_lookups / N_SYNC_RUNS,
+               n_lookups > 0 ? lookup_total * 1e6 / n_lookups : 0.0,
+               lookup_max * 1e6);
+
+      g_timer_destroy (timer);
+      gconf_source_free (source);
+
+      remove_recursively (root);
+      g_free (root);
+    }
+}
+
+/*
+ * Memory held by a large loaded tree. Run once more with
+ * GCONF_DISABLE_KEY_INTERNING=1 set to compare against plain copies.
+ */
+
+static void
+bench_memory (void)
+{
+  static const int n_dirs[] = { 100, 100, 1000 };
+  static const int n_entries[] = { 100, 1000, 100 };
+  int s;
+
+  g_print ("%10s %10s %10s %12s %12s %12s\n",
+           "entries", "rss (KB)", "strings", "strings (KB)",
+           "interns", "allocs");
+
+  for (s = 0; s < (int) G_N_ELEMENTS (n_dirs); s++)
+    {
+      GConfKeyInternStats before;
+      GConfKeyInternStats after;
+      GConfSource *source;
+      GError *error;
+      char *root;
+      gsize rss;
+      int count;
+
+      root = make_temp_root ();
+
+      source = open_source (root, "readwrite,merged");
+      fill_tree (source, n_dirs[s], n_entries[s]);
+
+      error = NULL;
+      (* source->backend->vtable.sync_all) (source, &error);
+      exit_if_error (error);
+      gconf_source_free (source);
+
+      rss = current_rss_kb ();
+      gconf_key_intern_get_stats (&before);
+
+      source = open_source (root, "readonly");
+      count = walk_tree (source, "/");
+
+      gconf_key_intern_get_stats (&after);
+
+      if (count != n_dirs[s] * n_entries[s])
+        {
+          g_printerr ("Loaded %d entries, expected %d\n",
+                      count, n_dirs[s] * n_entries[s]);
+          exit (1);
+        }
+
+      g_print ("%10d %10ld %10u %12lu %12" G_GUINT64_FORMAT " %12" G_GUINT64_FORMAT "\n",
+               count,
+               (long) current_rss_kb () - (long) rss,
+               after.n_strings - before.n_strings,
+               (unsigned long) (after.n_bytes - before.n_bytes) / 1024,
+               after.n_interns - before.n_interns,
+               after.n_allocs - before.n_allocs);
+
+      gconf_source_free (source);
+
+      remove_recursively (root);
+      g_free (root);
+    }
+}
+
+int
+main (int argc, char **argv)
+{
+  const char *mode;
+
+  setlocale (LC_ALL, "");
+
+  mode = argc > 1 ? argv[1] : "lookup";
+
+  if (strcmp (mode, "lookup") == 0)
+    bench_lookup ();
+  else if (strcmp (mode, "load") == 0)
+    bench_load ();
+  else if (strcmp (mode, "save") == 0)
+    bench_save ();
+  else if (strcmp (mode, "sync") == 0)
+    bench_sync ();
+  else if (strcmp (mode, "memory") == 0)
+    bench_memory ();
+  else
+    {
+      g_printerr ("Usage: %s [lookup|load|save|sync|memory]\n", argv[0]);
+      return 1;
+    }
+
+  return 0;
+}
@@ -0,0 +1,215 @@
+/* GConf
+ * Copyright (C) 2002 Red Hat Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/* Microbenchmarks for GConfValue: building, copying and holding
+ * string lists like MRU lists and keybindings.
+ */
+
+#include <gconf/gconf-value.h>
+#include <gconf/gconf-internals.h>
+#include "bench-utils.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <locale.h>
+
+static const char*
+element_text (int  i,
+              char buf[64],
+              gboolean long_strings)
+{
+  if (long_strings)
+    g_snprintf (buf, 64, "file:///home/user/Documents/report-%d.odt", i);
+  else
+    g_snprintf (buf, 64, "<Ctrl>F%d", i);
+
+  return buf;
+}
+
+/* A list built up value by value, the way the parsers do it */
+static GConfValue*
+make_list (int      n,
+           gboolean long_strings)
+{
+  GConfValue *value;
+  GSList *list;
+  int i;
+
+  list = NULL;
+  for (i = n - 1; i >= 0; i--)
+    {
+      GConfValue *elem;
+      char buf[64];
+
+      elem = gconf_value_new (GCONF_VALUE_STRING);
+      gconf_value_set_string (elem, element_text (i, buf, long_strings));
+      list = g_slist_prepend (list, elem);
+    }
+
+  value = gconf_value_new (GCONF_VALUE_LIST);
+  gconf_value_set_list_type (value, GCONF_VALUE_STRING);
+  gconf_value_set_list_nocopy (value, list);
+
+  return value;
+}
+
+/*
+ * Copy cost: the first copy of a list, and copies of that copy
+ */
+
+#define N_COPY_RUNS 20000
+
+static void
+bench_copy (void)
+{
+  static const int sizes[] = { 1, 10, 100, 1000 };
+  int s;
+  int l;
+
+  g_print ("%10s %8s %14s %14s %14s\n",
+           "elements", "strings", "build (ns)", "copy (ns)",
+           "recopy (ns)");
+
+  for (l = 0; l < 2; l++)
+    {
+      for (s = 0; s < (int) G_N_ELEMENTS (sizes); s++)
+        {
+          GConfValue *value;
+          GConfValue *copy;
+          GTimer *timer;
+          double build_time;
+          double copy_time;
+          double recopy_time;
+          int runs;
+          int i;
+
+          /* Keep the total work roughly the same for each size */
+          runs = MAX (N_COPY_RUNS / sizes[s], 10);
+
+          timer = g_timer_new ();
+          for (i = 0; i < runs; i++)
+            gconf_value_free (make_list (sizes[s], l));
+          build_time = g_timer_elapsed (timer, NULL);
+
+          value = make_list (sizes[s], l);
+
+          g_timer_start (timer);
+          for (i = 0; i < runs; i++)
+            gconf_value_free (gconf_value_copy (value));
+          copy_time = g_timer_elapsed (timer, NULL);
+
+          copy = gconf_value_copy (value);
+
+          g_timer_start (timer);
+          for (i = 0; i < runs; i++)
+            gconf_value_free (gconf_value_copy (copy));
+          recopy_time = g_timer_elapsed (timer, NULL);
+
+          if (gconf_value_compare (value, copy) != 0)
+            {
+              g_printerr ("Copy differs from the original\n");
+              exit (1);
+            }
+
+          g_print ("%10d %8s %14.1f %14.1f %14.1f\n",
+                   sizes[s],
+                   l ? "long" : "short",
+                   build_time * 1e9 / runs,
+                   copy_time * 1e9 / runs,
+                   recopy_time * 1e9 / runs);
+
+          gconf_value_free (copy);
+          gconf_value_free (value);
+          g_timer_destroy (timer);
+        }
+    }
+}
+
+/*
+ * Memory held by many copies of one list, as caches hold them
+ */
+
+#define N_HELD 10000
+
+static void
+bench_memory (void)
+{
+  static const int sizes[] = { 10, 100 };
+  int s;
+  int l;
+
+  g_print ("%10s %8s %10s %14s\n",
+           "elements", "strings", "copies", "rss (KB)");
+
+  for (l = 0; l < 2; l++)
+    {
+      for (s = 0; s < (int) G_N_ELEMENTS (sizes); s++)
+        {
+          GConfValue **held;
+          gsize rss;
+          int i;
+
+          held = g_new (GConfValue*, N_HELD);
+
+          rss = current_rss_kb ();
+
+          /* Separately built lists, so nothing is shared */
+          for (i = 0; i < N_HELD; i++)
+            {
+              GConfValue *value;
+
+              value = make_list (sizes[s], l);
+              held[i] = gconf_value_copy (value);
+              gconf_value_free (value);
+            }
+
+          g_print ("%10d %8s %10d %14ld\n",
+                   sizes[s],
+                   l ? "long" : "short",
+                   N_HELD,
+                   (long) current_rss_kb () - (long) rss);
+
+          for (i = 0; i < N_HELD; i++)
+            gconf_value_free (held[i]);
+          g_free (held);
+        }
+    }
+}
+
+int
+main (int argc, char **argv)
+{
+  const char *mode;
+
+  setlocale (LC_ALL, "");
+
+  mode = argc > 1 ? argv[1] : "copy";
+
+  if (strcmp (mode, "copy") == 0)
+    bench_copy ();
+  else if (strcmp (mode, "memory") == 0)
+    bench_memory ();
+  else
+    {
+      g_printerr ("Usage: %s [copy|memory]\n", argv[0]);
+      return 1;
+    }
+
+  return 0;
+}
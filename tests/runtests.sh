@@ -2,7 +2,7 @@
 
 export GCONFTOOL=`pwd`/../gconf/gconftool
 LOGFILE=runtests.log
-POTENTIAL_TESTS='testdirlist testgconf testlisteners testschemas testpersistence testaddress'
+POTENTIAL_TESTS='testdirlist testgconf testlisteners testschemas testclient testvalue testpersistence testaddress'
 
 for I in $POTENTIAL_TESTS
 do
@@ -1257,10 +1257,190 @@ print_entry (GConfEntry *entry,
   g_free (str);
 }
 
+/*
+ * The sources' cache of keys they lack
+ */
+
+static GConfValue*
+sources_get (GConfSources *sources,
+             const char   *key,
+             gboolean     *is_default)
+{
+  GConfValue *value;
+  GError *error;
+
+  error = NULL;
+  value = gconf_sources_query_value (sources, key, locales, TRUE,
+                                     is_default, NULL, NULL, &error);
+  exit_if_error (error);
+
+  return value;
+}
+
+static void
+sources_set_int (GConfSources *sources,
+                 const char   *key,
+                 int           i)
+{
+  GConfValue *value;
+  GError *error;
+
+  value = gconf_value_new (GCONF_VALUE_INT);
+  gconf_value_set_int (value, i);
+
+  error = NULL;
+  gconf_sources_set_value (sources, key, value, NULL, &error);
+  exit_if_error (error);
+
+  gconf_value_free (value);
+}
+
+static void
+sources_set_schema (GConfSources *sources,
+                    const char   *schema_key,
+                    int           default_value)
+{
+  GConfSchema *schema;
+  GConfValue *value;
+  GError *error;
+
+  schema = gconf_schema_new ();
+  gconf_schema_set_type (schema, GCONF_VALUE_INT);
+  gconf_schema_set_locale (schema, "C");
+  value = gconf_value_new (GCONF_VALUE_INT);
+  gconf_value_set_int (value, default_value);
+  gconf_schema_set_default_value_nocopy (schema, value);
+
+  value = gconf_value_new (GCONF_VALUE_SCHEMA);
+  gconf_value_set_schema_nocopy (value, schema);
+
+  error = NULL;
+  gconf_sources_set_value (sources, schema_key, value, NULL, &error);
+  exit_if_error (error);
+
+  gconf_value_free (value);
+}
+
+/* @key reads back as @expected, or as unset if @expected is -1 */
+static void
+check_sources_int (GConfSources *sources,
+                   const char   *key,
+                   int           expected,
+                   gboolean      expect_default)
+{
+  GConfValue *value;
+  gboolean is_default;
+
+  is_default = FALSE;
+  value = sources_get (sources, key, &is_default);
+
+  if (expected < 0)
+    {
+      check (value == NULL, "`%s' should be unset but has a value", key);
+      return;
+    }
+
+  check (value != NULL && value->type == GCONF_VALUE_INT &&
+         gconf_value_get_int (value) == expected,
+         "`%s' should be %d", key, expected);
+  check (is_default == expect_default,
+         "`%s' %s a schema default", key,
+         is_default ? "is" : "isn't");
+
+  gconf_value_free (value);
+}
+
+/* Each key is looked up while it doesn't exist, so the sources
+ * remember they lack it, and must be found once it does.
+ */
+static void
+check_missing_cache (GConfSources *sources)
+{
+  static const char *key = "/testing/missing/key";
+  static const char *schema_user = "/testing/missing/uses-schema";
+  static const char *late_user = "/testing/missing/uses-late-schema";
+  static const char *schema_key = "/schemas/testing/missing/schema";
+  static const char *late_schema_key = "/schemas/testing/missing/late";
+  static const char *removed_dir = "/testing/missing/removed";
+  static const char *removed_key = "/testing/missing/removed/key";
+  static const char *below_removed_key = "/testing/missing/removed/sub/key";
+  GConfSourceMissingStats before;
+  GConfSourceMissingStats after;
+  GError *error;
+
+  error = NULL;
+  gconf_sources_recursive_unset (sources, "/testing/missing", NULL,
+                                 GCONF_UNSET_INCLUDING_SCHEMA_NAMES,
+                                 NULL, &error);
+  exit_if_error (error);
+  gconf_sources_recursive_unset (sources, "/schemas/testing/missing", NULL,
+                                 0, NULL, &error);
+  exit_if_error (error);
+
+  /* A plain set */
+  check_sources_int (sources, key, -1, FALSE);
+  gconf_sources_get_missing_stats (sources, &before);
+  check_sources_int (sources, key, -1, FALSE);
+  gconf_sources_get_missing_stats (sources, &after);
+  check (after.n_hits > before.n_hits,
+         "a second lookup of `%s' wasn't answered from the cache", key);
+
+  sources_set_int (sources, key, 1);
+  check_sources_int (sources, key, 1, FALSE);
+
+  /* Giving a missing key a schema */
+  sources_set_schema (sources, schema_key, 2);
+  check_sources_int (sources, schema_user, -1, FALSE);
+
+  gconf_sources_set_schema (sources, schema_user, schema_key, &error);
+  exit_if_error (error);
+  check_sources_int (sources, schema_user, 2, TRUE);
+
+  /* Installing a schema that was looked up while missing */
+  gconf_sources_set_schema (sources, late_user, late_schema_key, &error);
+  exit_if_error (error);
+  check_sources_int (sources, late_user, -1, FALSE);
+
+  sources_set_schema (sources, late_schema_key, 3);
+  check_sources_int (sources, late_user, 3, TRUE);
+
+  /* Keys in and below a removed dir */
+  sources_set_int (sources, removed_key, 4);
+  check_sources_int (sources, removed_key, 4, FALSE);
+
+  /* The markup backend asks for the values to be unset instead */
+  gconf_sources_remove_dir (sources, removed_dir, &error);
+  if (error != NULL)
+    {
+      g_error_free (error);
+      error = NULL;
+
+      gconf_sources_recursive_unset (sources, removed_dir, NULL, 0,
+                                     NULL, &error);
+      exit_if_error (error);
+    }
+  check_sources_int (sources, removed_key, -1, FALSE);
+  check_sources_int (sources, below_removed_key, -1, FALSE);
+
+  sources_set_int (sources, removed_key, 5);
+  sources_set_int (sources, below_removed_key, 6);
+  check_sources_int (sources, removed_key, 5, FALSE);
+  check_sources_int (sources, below_removed_key, 6, FALSE);
+
+  gconf_sources_recursive_unset (sources, "/testing/missing", NULL,
+                                 GCONF_UNSET_INCLUDING_SCHEMA_NAMES,
+                                 NULL, &error);
+  exit_if_error (error);
+  gconf_sources_recursive_unset (sources, "/schemas/testing/missing", NULL,
+                                 0, NULL, &error);
+  exit_if_error (error);
+}
+
 static void
 run_all_checks (const char *address)
 {
   GConfSource *source;
+  GConfSources *sources;
   GError *error;
   Stats stats;
     
@@ -1303,8 +1483,17 @@ run_all_checks (const char *address)
   check_bool_storage (source);
 
   sync_and_clear (source);
-  
-  gconf_source_free (source);
+
+  g_print ("\nChecking the cache of missing keys:");
+
+  /* The sources own the source from here on */
+  sources = gconf_sources_new_from_source (source);
+
+  check_missing_cache (sources);
+
+  sync_and_clear (source);
+
+  gconf_sources_free (sources);
 
   g_print ("\n\n");
 }
@@ -287,6 +287,105 @@ check_string_storage(GConfEngine* conf)
   check_unset(conf);
 }
 
+/* Commits @cs, which sets keys[1] next to a change to @bad_key that
+ * can't be made, and checks that nothing at all was
+ */
+static void
+check_bad_commit(GConfEngine* conf, GConfChangeSet* cs, const gchar* bad_key)
+{
+  GError* err = NULL;
+  GConfValue* val;
+  guint size;
+  gboolean result;
+
+  size = gconf_change_set_size(cs);
+
+  result = gconf_engine_commit_change_set(conf, cs, TRUE, &err);
+
+  check(!result, "committing a bad change to `%s' succeeded", bad_key);
+  check(err != NULL, "committing a bad change to `%s' set no error", bad_key);
+  g_error_free(err);
+
+  val = gconf_engine_get(conf, keys[1], NULL);
+  check(val == NULL, "`%s' was committed next to a bad change to `%s'",
+        keys[1], bad_key);
+  if (val)
+    gconf_value_free(val);
+
+  check(gconf_change_set_size(cs) == size &&
+        gconf_change_set_check_value(cs, keys[1], NULL) &&
+        gconf_change_set_check_value(cs, bad_key, NULL),
+        "a failed commit changed the change set");
+}
+
+/* A set and an unset in one commit, next to changes that can't be made */
+static void
+check_mixed_commit(GConfEngine* conf)
+{
+  GError* err = NULL;
+  GConfChangeSet* cs;
+  GConfValue* val;
+  GConfSchema* schema;
+  gchar* gotten;
+  gboolean result;
+
+  cs = gconf_change_set_new();
+
+  gconf_change_set_set_string(cs, keys[0], "first");
+  gconf_change_set_set_string(cs, keys[1], "second");
+
+  result = gconf_engine_commit_change_set(conf, cs, TRUE, &err);
+
+  check(result && err == NULL, "committing two sets failed: %s",
+        err ? err->message : "no error");
+  check(gconf_change_set_size(cs) == 0, "committed sets were left in the change set");
+
+  gconf_change_set_set_string(cs, keys[0], "changed");
+  gconf_change_set_unset(cs, keys[1]);
+
+  result = gconf_engine_commit_change_set(conf, cs, TRUE, &err);
+
+  check(result && err == NULL, "committing a set and an unset failed: %s",
+        err ? err->message : "no error");
+
+  gotten = gconf_engine_get_string(conf, keys[0], NULL);
+  check(gotten != NULL && strcmp(gotten, "changed") == 0,
+        "`changed' was committed to `%s' but `%s' was read back", keys[0],
+        gotten ? gotten : "(none)");
+  g_free(gotten);
+
+  val = gconf_engine_get(conf, keys[1], NULL);
+  check(val == NULL, "`%s' was unset in a commit but still has a value", keys[1]);
+
+  /* A bad key or a bad value fails the whole commit, whether it's
+   * caught here or by gconfd, and leaves the set as it was
+   */
+  gconf_change_set_set_string(cs, keys[1], "valid");
+  gconf_change_set_set_string(cs, "/testing/bad//key", "invalid");
+
+  check_bad_commit(conf, cs, "/testing/bad//key");
+
+  gconf_change_set_remove(cs, "/testing/bad//key");
+
+  /* A valid key with a value that isn't, a list schema without a
+   * list type. Over D-Bus it is gconfd that refuses this one.
+   */
+  schema = gconf_schema_new();
+  gconf_schema_set_type(schema, GCONF_VALUE_LIST);
+  val = gconf_value_new(GCONF_VALUE_SCHEMA);
+  gconf_value_set_schema_nocopy(val, schema);
+  gconf_change_set_set_nocopy(cs, keys[2], val);
+
+  check_bad_commit(conf, cs, keys[2]);
+
+  val = gconf_engine_get(conf, keys[2], NULL);
+  check(val == NULL, "`%s' was set to an invalid schema", keys[2]);
+
+  gconf_change_set_unref(cs);
+
+  check_unset(conf);
+}
+
 int 
 main (int argc, char** argv)
 {
@@ -311,6 +410,10 @@ main (int argc, char** argv)
   
   check_string_storage(conf);
   
+  printf("\nChecking mixed GConfChangeSet commits:");
+
+  check_mixed_commit(conf);
+
   gconf_engine_unref(conf);
 
   printf("\n\n");
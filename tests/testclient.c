@@ -0,0 +1,344 @@
+/* GConf
+ * Copyright (C) 2002 Red Hat Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/* Checks that the GConfClient cache never answers with a value, or
+ * with "unset", that gconfd no longer agrees with. Everything is
+ * kept below /testing/client.
+ */
+
+#include <gconf/gconf-client.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <locale.h>
+#include <gconf/gconf-internals.h>
+
+#define CLIENT_DIR "/testing/client"
+
+static void
+check(gboolean condition, const gchar* fmt, ...)
+{
+  va_list args;
+  gchar* description;
+
+  va_start (args, fmt);
+  description = g_strdup_vprintf(fmt, args);
+  va_end (args);
+
+  if (condition)
+    {
+      printf(".");
+      fflush(stdout);
+    }
+  else
+    {
+      fprintf(stderr, "\n*** FAILED: %s\n", description);
+      exit(1);
+    }
+
+  g_free(description);
+}
+
+static void
+client_set_int(GConfClient* client, const gchar* key, gint val)
+{
+  GError* err = NULL;
+
+  gconf_client_set_int(client, key, val, &err);
+  check(err == NULL, "failed to set `%s': %s", key, err ? err->message : "");
+}
+
+/* Changes @key behind the client's back, as another process would */
+static void
+engine_set_int(GConfClient* client, const gchar* key, gint val)
+{
+  GError* err = NULL;
+
+  gconf_engine_push_owner_usage(client->engine, client);
+  gconf_engine_set_int(client->engine, key, val, &err);
+  gconf_engine_pop_owner_usage(client->engine, client);
+
+  check(err == NULL, "failed to set `%s': %s", key, err ? err->message : "");
+}
+
+static gboolean
+value_is_int(GConfValue* val, gboolean is_set, gint expected)
+{
+  if (!is_set)
+    return val == NULL;
+
+  return val != NULL && val->type == GCONF_VALUE_INT &&
+    gconf_value_get_int(val) == expected;
+}
+
+/* Checks @key reads back as @expected, or as unset if !@is_set, right
+ * away.
+ */
+static void
+check_int(GConfClient* client, const gchar* key, gboolean is_set, gint expected)
+{
+  GConfValue* val;
+
+  val = gconf_client_get(client, key, NULL);
+
+  if (is_set)
+    check(value_is_int(val, TRUE, expected),
+          "`%s' should be %d but isn't", key, expected);
+  else
+    check(val == NULL, "`%s' should be unset but has a value", key);
+
+  if (val)
+    gconf_value_free(val);
+}
+
+/* Like check_int(), but gives notifications a few seconds of main
+ * loop to reach the cache first, for builds that only update it when
+ * gconfd says a key changed.
+ */
+static void
+check_int_soon(GConfClient* client, const gchar* key, gboolean is_set, gint expected)
+{
+  GTimer* timer;
+  GConfValue* val;
+
+  timer = g_timer_new();
+
+  while (TRUE)
+    {
+      val = gconf_client_get(client, key, NULL);
+
+      if (value_is_int(val, is_set, expected) ||
+          g_timer_elapsed(timer, NULL) > 5.0)
+        break;
+
+      if (val)
+        gconf_value_free(val);
+
+      while (g_main_context_iteration(NULL, FALSE))
+        ;
+      g_usleep(10 * 1000);
+    }
+
+  g_timer_destroy(timer);
+
+  if (val)
+    gconf_value_free(val);
+
+  check_int(client, key, is_set, expected);
+}
+
+/* A key that isn't in a fully cached dir is unset without asking
+ * gconfd, until it is set.
+ */
+static void
+check_negative_lookups(GConfClient* client)
+{
+  static const gchar* dir = CLIENT_DIR "/negative";
+  static const gchar* present = CLIENT_DIR "/negative/present";
+  static const gchar* absent = CLIENT_DIR "/negative/absent";
+  GConfClientCacheStats before;
+  GConfClientCacheStats after;
+  GError* err = NULL;
+
+  client_set_int(client, present, 1);
+  gconf_client_unset(client, absent, NULL);
+
+  gconf_client_add_dir(client, dir, GCONF_CLIENT_PRELOAD_ONELEVEL, &err);
+  check(err == NULL, "failed to add `%s': %s", dir, err ? err->message : "");
+
+  gconf_client_get_cache_stats(client, &before);
+  check_int(client, present, TRUE, 1);
+  check_int(client, absent, FALSE, 0);
+  gconf_client_get_cache_stats(client, &after);
+
+  check(after.misses == before.misses,
+        "%lu lookups in a preloaded dir went to gconfd",
+        after.misses - before.misses);
+  check(after.negative_hits == before.negative_hits + 1,
+        "an unset key in a preloaded dir wasn't answered from the cache");
+
+  client_set_int(client, absent, 2);
+  check_int_soon(client, absent, TRUE, 2);
+
+  gconf_client_unset(client, absent, NULL);
+  check_int_soon(client, absent, FALSE, 0);
+
+  gconf_client_remove_dir(client, dir, NULL);
+}
+
+/* A recursive unset empties the cache below the dir, and only there */
+static void
+check_recursive_unset(GConfClient* client)
+{
+  static const gchar* dir = CLIENT_DIR "/tree";
+  static const gchar* tree_keys[] = {
+    CLIENT_DIR "/tree/k0",
+    CLIENT_DIR "/tree/a/k1",
+    CLIENT_DIR "/tree/a/b/k2",
+    CLIENT_DIR "/tree/c/k3",
+    NULL
+  };
+  GError* err = NULL;
+  GSList* entries;
+  gint i;
+
+  for (i = 0; tree_keys[i]; i++)
+    client_set_int(client, tree_keys[i], i);
+
+  gconf_client_add_dir(client, dir, GCONF_CLIENT_PRELOAD_RECURSIVE, &err);
+  check(err == NULL, "failed to add `%s': %s", dir, err ? err->message : "");
+
+  for (i = 0; tree_keys[i]; i++)
+    check_int(client, tree_keys[i], TRUE, i);
+
+  gconf_client_recursive_unset(client, CLIENT_DIR "/tree/a", 0, &err);
+  check(err == NULL, "failed to unset `%s/a': %s", dir,
+        err ? err->message : "");
+
+  check_int_soon(client, tree_keys[1], FALSE, 0);
+  check_int_soon(client, tree_keys[2], FALSE, 0);
+  check_int(client, tree_keys[0], TRUE, 0);
+  check_int(client, tree_keys[3], TRUE, 3);
+
+  entries = gconf_client_all_entries(client, CLIENT_DIR "/tree/a/b", NULL);
+  check(entries == NULL, "%u entries left in an unset dir",
+        g_slist_length(entries));
+
+  /* And a key set again below it is seen */
+  client_set_int(client, tree_keys[2], 20);
+  check_int_soon(client, tree_keys[2], TRUE, 20);
+
+  gconf_client_remove_dir(client, dir, NULL);
+}
+
+/* Once a dir is removed nothing keeps its cached entries current, so
+ * they have to go with it.
+ */
+static void
+check_remove_dir(GConfClient* client)
+{
+  static const gchar* dir = CLIENT_DIR "/removed";
+  static const gchar* key = CLIENT_DIR "/removed/key";
+  static const gchar* absent = CLIENT_DIR "/removed/absent";
+  GError* err = NULL;
+
+  client_set_int(client, key, 1);
+  gconf_client_unset(client, absent, NULL);
+
+  gconf_client_add_dir(client, dir, GCONF_CLIENT_PRELOAD_ONELEVEL, &err);
+  check(err == NULL, "failed to add `%s': %s", dir, err ? err->message : "");
+
+  check_int(client, key, TRUE, 1);
+  check_int(client, absent, FALSE, 0);
+
+  gconf_client_remove_dir(client, dir, NULL);
+
+  engine_set_int(client, key, 2);
+  engine_set_int(client, absent, 3);
+
+  check_int(client, key, TRUE, 2);
+  check_int(client, absent, TRUE, 3);
+}
+
+/* A preload bigger than the cache budget mustn't leave a dir marked
+ * complete after some of its entries were evicted while it was filled.
+ * The dirs aren't added, so their entries are all evictable.
+ */
+static void
+check_preload_over_budget(GConfClient* client)
+{
+  static const GConfClientPreloadType types[] = {
+    GCONF_CLIENT_PRELOAD_ONELEVEL,
+    GCONF_CLIENT_PRELOAD_RECURSIVE
+  };
+  GConfClientCacheStats stats;
+  gchar* keys[2][40];
+  guint t;
+  gint d;
+  gint i;
+
+  for (d = 0; d < 2; d++)
+    for (i = 0; i < (gint) G_N_ELEMENTS (keys[d]); i++)
+      {
+        keys[d][i] = g_strdup_printf(CLIENT_DIR "/budget%s/key%d",
+                                     d ? "/sub" : "", i);
+        client_set_int(client, keys[d][i], d * 100 + i);
+      }
+
+  for (t = 0; t < G_N_ELEMENTS (types); t++)
+    {
+      gconf_client_clear_cache(client);
+      gconf_client_set_cache_budget(client, 1024);
+
+      gconf_client_preload(client, CLIENT_DIR "/budget", types[t], NULL);
+
+      gconf_client_get_cache_stats(client, &stats);
+      check(stats.budget == 0 || stats.size <= stats.budget,
+            "cache holds %lu bytes, over its budget of %lu",
+            (gulong) stats.size, (gulong) stats.budget);
+
+      for (d = 0; d < 2; d++)
+        for (i = 0; i < (gint) G_N_ELEMENTS (keys[d]); i++)
+          check_int(client, keys[d][i], TRUE, d * 100 + i);
+    }
+
+  gconf_client_set_cache_budget(client, 0);
+
+  for (d = 0; d < 2; d++)
+    for (i = 0; i < (gint) G_N_ELEMENTS (keys[d]); i++)
+      g_free(keys[d][i]);
+}
+
+int
+main (int argc, char** argv)
+{
+  GConfClient* client;
+
+  setlocale (LC_ALL, "");
+
+  g_type_init ();
+
+  client = gconf_client_get_default();
+
+  check(client != NULL, "create the default client");
+
+  printf("\nChecking negative lookups in a preloaded dir:");
+
+  check_negative_lookups(client);
+
+  printf("\nChecking recursive unsets of cached dirs:");
+
+  check_recursive_unset(client);
+
+  printf("\nChecking removing a cached dir:");
+
+  check_remove_dir(client);
+
+  printf("\nChecking preloading more than the cache budget:");
+
+  check_preload_over_budget(client);
+
+  gconf_client_recursive_unset(client, CLIENT_DIR, 0, NULL);
+  gconf_client_suggest_sync(client, NULL);
+  g_object_unref(client);
+
+  printf("\n\n");
+
+  return 0;
+}
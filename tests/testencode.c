@@ -17,8 +17,12 @@
  * Boston, MA 02110-1301, USA.
  */
 
+#include <config.h>
 #include <gconf/gconf.h>
 #include <gconf/gconf-internals.h>
+#ifdef HAVE_DBUS
+#include <gconf/gconf-dbus-utils.h>
+#endif
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
@@ -166,16 +170,253 @@ check_quoting(void)
 
 }
 
+#ifdef HAVE_DBUS
+/* One entry of each shape the D-Bus code has to carry, with strings
+ * that need quoting in the text encoding
+ */
+static GSList*
+make_wire_entries(void)
+{
+  GSList* entries = NULL;
+  GSList* list;
+  GConfValue* value;
+  GConfValue* int_list;
+  GConfValue* car;
+  GConfValue* cdr;
+  GConfSchema* schema;
+  guint i;
+
+  value = gconf_value_new(GCONF_VALUE_STRING);
+  gconf_value_set_string(value, quote_success_tests[0]);
+  entries = g_slist_prepend(entries, gconf_entry_new_nocopy(g_strdup("/wire/string"), value));
+
+  value = gconf_value_new(GCONF_VALUE_INT);
+  gconf_value_set_int(value, G_MININT);
+  entries = g_slist_prepend(entries, gconf_entry_new_nocopy(g_strdup("/wire/int"), value));
+
+  value = gconf_value_new(GCONF_VALUE_FLOAT);
+  gconf_value_set_float(value, 3.14159);
+  entries = g_slist_prepend(entries, gconf_entry_new_nocopy(g_strdup("/wire/float"), value));
+
+  value = gconf_value_new(GCONF_VALUE_BOOL);
+  gconf_value_set_bool(value, TRUE);
+  entries = g_slist_prepend(entries, gconf_entry_new_nocopy(g_strdup("/wire/bool"), value));
+
+  list = NULL;
+  for (i = 0; quote_success_tests[i] != NULL; i++)
+    {
+      value = gconf_value_new(GCONF_VALUE_STRING);
+      gconf_value_set_string(value, quote_success_tests[i]);
+      list = g_slist_prepend(list, value);
+    }
+  value = gconf_value_new(GCONF_VALUE_LIST);
+  gconf_value_set_list_type(value, GCONF_VALUE_STRING);
+  gconf_value_set_list_nocopy(value, g_slist_reverse(list));
+  entries = g_slist_prepend(entries, gconf_entry_new_nocopy(g_strdup("/wire/strings"), value));
+
+  list = NULL;
+  for (i = 0; i < n_ints; i++)
+    {
+      value = gconf_value_new(GCONF_VALUE_INT);
+      gconf_value_set_int(value, ints[i]);
+      list = g_slist_prepend(list, value);
+    }
+  value = gconf_value_new(GCONF_VALUE_LIST);
+  gconf_value_set_list_type(value, GCONF_VALUE_INT);
+  gconf_value_set_list_nocopy(value, g_slist_reverse(list));
+  entries = g_slist_prepend(entries, gconf_entry_new_nocopy(g_strdup("/wire/ints"), value));
+  int_list = value;
+
+  value = gconf_value_new(GCONF_VALUE_PAIR);
+  car = gconf_value_new(GCONF_VALUE_INT);
+  gconf_value_set_int(car, 57);
+  gconf_value_set_car_nocopy(value, car);
+  cdr = gconf_value_new(GCONF_VALUE_STRING);
+  gconf_value_set_string(cdr, quote_success_tests[2]);
+  gconf_value_set_cdr_nocopy(value, cdr);
+  entries = g_slist_prepend(entries, gconf_entry_new_nocopy(g_strdup("/wire/pair"), value));
+
+  schema = gconf_schema_new();
+  gconf_schema_set_type(schema, GCONF_VALUE_LIST);
+  gconf_schema_set_list_type(schema, GCONF_VALUE_INT);
+  gconf_schema_set_locale(schema, "C");
+  gconf_schema_set_short_desc(schema, "A list of ints");
+  gconf_schema_set_long_desc(schema, quote_success_tests[1]);
+  gconf_schema_set_owner(schema, "testencode");
+  gconf_schema_set_default_value(schema, int_list);
+  value = gconf_value_new(GCONF_VALUE_SCHEMA);
+  gconf_value_set_schema_nocopy(value, schema);
+  entries = g_slist_prepend(entries, gconf_entry_new_nocopy(g_strdup("/wire/schema"), value));
+
+  entries = g_slist_prepend(entries, gconf_entry_new("/wire/unset", NULL));
+
+  return g_slist_reverse(entries);
+}
+
+static void
+free_entries(GSList* entries)
+{
+  g_slist_foreach(entries, (GFunc) gconf_entry_free, NULL);
+  g_slist_free(entries);
+}
+
+/* Sends the entries through an entry array and a single value the
+ * way gconfd does, and reads them back
+ */
+static GSList*
+wire_round_trip(GSList* entries, GConfDBusWireFormat format)
+{
+  DBusMessage* message;
+  DBusMessageIter iter;
+  GSList* result;
+
+  message = dbus_message_new(DBUS_MESSAGE_TYPE_METHOD_RETURN);
+
+  dbus_message_iter_init_append(message, &iter);
+  gconf_dbus_utils_append_entries(&iter, entries, format);
+
+  dbus_message_iter_init(message, &iter);
+  result = g_slist_reverse(gconf_dbus_utils_get_entries(&iter, "/"));
+
+  dbus_message_unref(message);
+
+  return result;
+}
+
+static void
+check_wire_entry(GConfEntry* sent, GConfEntry* got, GConfDBusWireFormat format)
+{
+  GConfValue* a;
+  GConfValue* b;
+
+  check(strcmp(sent->key, got->key) == 0,
+        "key %s came back as %s (format %d)", sent->key, got->key, format);
+
+  a = gconf_entry_get_value(sent);
+  b = gconf_entry_get_value(got);
+
+  if (a == NULL || b == NULL)
+    {
+      check(a == b, "%s gained or lost its value (format %d)", sent->key, format);
+      return;
+    }
+
+  check(gconf_value_compare(a, b) == 0,
+        "%s changed on the wire (format %d)", sent->key, format);
+
+  if (a->type == GCONF_VALUE_SCHEMA)
+    {
+      a = gconf_schema_get_default_value(gconf_value_get_schema(a));
+      b = gconf_schema_get_default_value(gconf_value_get_schema(b));
+
+      check(a != NULL && b != NULL && gconf_value_compare(a, b) == 0,
+            "%s schema default changed on the wire (format %d)", sent->key, format);
+    }
+}
+
+static void
+check_wire_formats(void)
+{
+  GSList* entries;
+  GConfDBusWireFormat format;
+
+  entries = make_wire_entries();
+
+  for (format = GCONF_DBUS_WIRE_TEXT; format <= GCONF_DBUS_WIRE_NEWEST; format++)
+    {
+      GSList* got;
+      GSList* s;
+      GSList* g;
+
+      got = wire_round_trip(entries, format);
+
+      check(g_slist_length(got) == g_slist_length(entries),
+            "sent %u entries, got %u back (format %d)",
+            g_slist_length(entries), g_slist_length(got), format);
+
+      for (s = entries, g = got; s != NULL; s = s->next, g = g->next)
+        check_wire_entry(s->data, g->data, format);
+
+      free_entries(got);
+    }
+
+  free_entries(entries);
+}
+
+/*
+ * Benchmark, run with --bench: an all_entries reply of a directory
+ * full of lists and schemas, in each wire format
+ */
+
+#define N_WIRE_ROUNDS 2000
+
+static void
+bench_wire_formats(void)
+{
+  static const char* names[] = { "text", "typed", "batched", "change-sets" };
+  GSList* entries;
+  GSList* dir;
+  GConfDBusWireFormat format;
+  int i;
+
+  G_STATIC_ASSERT (G_N_ELEMENTS (names) == GCONF_DBUS_WIRE_NEWEST + 1);
+
+  /* 10 copies of each, about the size of a big applet dir */
+  entries = make_wire_entries();
+  dir = NULL;
+  for (i = 0; i < 10; i++)
+    {
+      GSList* tmp;
+
+      for (tmp = entries; tmp != NULL; tmp = tmp->next)
+        dir = g_slist_prepend(dir, gconf_entry_copy(tmp->data));
+    }
+  free_entries(entries);
+
+  printf("%u entries, %d round trips\n", g_slist_length(dir), N_WIRE_ROUNDS);
+  printf("%8s %12s\n", "format", "usec/reply");
+
+  for (format = GCONF_DBUS_WIRE_TEXT; format <= GCONF_DBUS_WIRE_NEWEST; format++)
+    {
+      GTimer* timer;
+      double elapsed;
+
+      timer = g_timer_new();
+
+      for (i = 0; i < N_WIRE_ROUNDS; i++)
+        free_entries(wire_round_trip(dir, format));
+
+      elapsed = g_timer_elapsed(timer, NULL);
+      g_timer_destroy(timer);
+
+      printf("%8s %12.1f\n", names[format], elapsed * 1e6 / N_WIRE_ROUNDS);
+    }
+
+  free_entries(dir);
+}
+#endif
+
 int 
 main (int argc, char** argv)
 {
-  GConfEngine* conf;
-  GError* err = NULL;
-  
+#ifdef HAVE_DBUS
+  if (argc > 1 && strcmp(argv[1], "--bench") == 0)
+    {
+      bench_wire_formats();
+      return 0;
+    }
+#endif
+
   printf("\nChecking string quoting:");
   
   check_quoting();
 
+#ifdef HAVE_DBUS
+  printf("\nChecking D-Bus value marshalling:");
+
+  check_wire_formats();
+#endif
+
   printf("\n\n");
   
   return 0;
@@ -931,6 +931,419 @@ check_utils (void)
     }  
 }
 
+static void
+check_get_many(GConfEngine* conf)
+{
+  static const gchar* unset_key = "/testing/unset/key";
+  GError* err = NULL;
+  const gchar** keyp;
+  GSList* wanted;
+  GSList* entries;
+  GSList* k;
+  GSList* e;
+  gint i;
+
+  /* Each key is set to its index, and an unset key goes in too */
+  wanted = NULL;
+  i = 0;
+  for (keyp = keys; *keyp; keyp++, i++)
+    {
+      gconf_engine_set_int(conf, *keyp, i, &err);
+      check(err == NULL, "failed to set `%s'", *keyp);
+
+      wanted = g_slist_append(wanted, (gchar*) *keyp);
+    }
+
+  gconf_engine_unset(conf, unset_key, NULL);
+  wanted = g_slist_insert(wanted, (gchar*) unset_key, 3);
+
+  entries = gconf_engine_get_many(conf, wanted, NULL, TRUE, &err);
+
+  check(err == NULL, "error getting many keys: %s", err ? err->message : "");
+  check(g_slist_length(entries) == g_slist_length(wanted),
+        "got %u entries for %u keys",
+        g_slist_length(entries), g_slist_length(wanted));
+
+  i = 0;
+  for (k = wanted, e = entries; k && e; k = k->next, e = e->next)
+    {
+      GConfEntry* entry = e->data;
+      GConfValue* value = gconf_entry_get_value(entry);
+
+      check(strcmp(gconf_entry_get_key(entry), k->data) == 0,
+            "entry for `%s' where `%s' was expected",
+            gconf_entry_get_key(entry), (gchar*) k->data);
+
+      if (k->data == unset_key)
+        {
+          check(value == NULL, "unset key has a value");
+          continue;
+        }
+
+      check(value != NULL && value->type == GCONF_VALUE_INT &&
+            gconf_value_get_int(value) == i,
+            "wrong value for `%s'", (gchar*) k->data);
+      ++i;
+    }
+
+  g_slist_foreach(entries, (GFunc) gconf_entry_free, NULL);
+  g_slist_free(entries);
+
+  /* A bad key fails the whole lookup */
+  wanted = g_slist_append(wanted, "not a key");
+  entries = gconf_engine_get_many(conf, wanted, NULL, TRUE, &err);
+  check(entries == NULL && err != NULL, "bad key didn't cause an error");
+  g_error_free(err);
+
+  g_slist_free(wanted);
+}
+
+static void
+check_all_entries_recursive(GConfEngine* conf)
+{
+  static const gchar* tree_keys[] = {
+    "/testing/subtree/k0",
+    "/testing/subtree/a/k1",
+    "/testing/subtree/a/b/k2",
+    "/testing/subtree/c/d/k3",
+    NULL
+  };
+  static const gchar* tree_dirs[] = {
+    "/testing/subtree/a",
+    "/testing/subtree/a/b",
+    "/testing/subtree/c",
+    "/testing/subtree/c/d",
+    NULL
+  };
+  GError* err = NULL;
+  GSList* entries;
+  GSList* subdirs;
+  GSList* tmp;
+  gint i;
+
+  for (i = 0; tree_keys[i]; i++)
+    {
+      gconf_engine_set_int(conf, tree_keys[i], i, &err);
+      check(err == NULL, "failed to set `%s'", tree_keys[i]);
+    }
+
+  entries = gconf_engine_all_entries_recursive(conf, "/testing/subtree",
+                                               &subdirs, &err);
+  check(err == NULL, "error listing subtree: %s", err ? err->message : "");
+  check(g_slist_length(entries) == G_N_ELEMENTS(tree_keys) - 1,
+        "got %u entries in the subtree", g_slist_length(entries));
+  check(g_slist_length(subdirs) == G_N_ELEMENTS(tree_dirs) - 1,
+        "got %u dirs in the subtree", g_slist_length(subdirs));
+
+  for (i = 0; tree_keys[i]; i++)
+    {
+      GConfValue* value = NULL;
+
+      for (tmp = entries; tmp; tmp = tmp->next)
+        if (strcmp(gconf_entry_get_key(tmp->data), tree_keys[i]) == 0)
+          value = gconf_entry_get_value(tmp->data);
+
+      check(value != NULL && value->type == GCONF_VALUE_INT &&
+            gconf_value_get_int(value) == i,
+            "wrong or missing value for `%s'", tree_keys[i]);
+    }
+
+  for (i = 0; tree_dirs[i]; i++)
+    check(g_slist_find_custom(subdirs, tree_dirs[i], (GCompareFunc) strcmp) != NULL,
+          "dir `%s' missing from the subtree", tree_dirs[i]);
+
+  g_slist_foreach(entries, (GFunc) gconf_entry_free, NULL);
+  g_slist_free(entries);
+  g_slist_foreach(subdirs, (GFunc) g_free, NULL);
+  g_slist_free(subdirs);
+
+  gconf_engine_recursive_unset(conf, "/testing/subtree", 0, NULL);
+}
+
+/* @key reads back as @expected, or as unset if !@is_set */
+static void
+check_cached_int(GConfEngine* conf, const gchar* key, gboolean is_set, gint expected)
+{
+  GError* err = NULL;
+  GConfValue* value;
+
+  value = gconf_engine_get(conf, key, &err);
+  check(err == NULL, "error getting `%s': %s", key, err ? err->message : "");
+
+  if (is_set)
+    check(value != NULL && value->type == GCONF_VALUE_INT &&
+          gconf_value_get_int(value) == expected,
+          "`%s' should be %d", key, expected);
+  else
+    check(value == NULL, "`%s' should be unset but has a value", key);
+
+  if (value)
+    gconf_value_free(value);
+}
+
+/* gconfd keeps the values it resolved; each kind of change has to
+ * drop the ones it affects. Every key is read twice first, so that
+ * the second read comes from the cache.
+ */
+static void
+check_value_cache(GConfEngine* conf)
+{
+  static const gchar* key = "/testing/cache/key";
+  static const gchar* tree_keys[] = {
+    "/testing/cache/tree/k0",
+    "/testing/cache/tree/a/k1",
+    "/testing/cache/tree/a/b/k2",
+    NULL
+  };
+  static const gchar* removed_key = "/testing/cache/removed/key";
+  GError* err = NULL;
+  gint i;
+
+  /* Set and unset */
+  gconf_engine_set_int(conf, key, 1, &err);
+  check(err == NULL, "failed to set `%s'", key);
+  check_cached_int(conf, key, TRUE, 1);
+  check_cached_int(conf, key, TRUE, 1);
+
+  gconf_engine_set_int(conf, key, 2, &err);
+  check(err == NULL, "failed to set `%s'", key);
+  check_cached_int(conf, key, TRUE, 2);
+
+  gconf_engine_unset(conf, key, &err);
+  check(err == NULL, "failed to unset `%s'", key);
+  check_cached_int(conf, key, FALSE, 0);
+  check_cached_int(conf, key, FALSE, 0);
+
+  gconf_engine_set_int(conf, key, 3, &err);
+  check(err == NULL, "failed to set `%s'", key);
+  check_cached_int(conf, key, TRUE, 3);
+
+  /* A recursive unset */
+  for (i = 0; tree_keys[i]; i++)
+    {
+      gconf_engine_set_int(conf, tree_keys[i], i, &err);
+      check(err == NULL, "failed to set `%s'", tree_keys[i]);
+      check_cached_int(conf, tree_keys[i], TRUE, i);
+      check_cached_int(conf, tree_keys[i], TRUE, i);
+    }
+
+  gconf_engine_recursive_unset(conf, "/testing/cache/tree", 0, &err);
+  check(err == NULL, "failed to unset /testing/cache/tree");
+
+  for (i = 0; tree_keys[i]; i++)
+    check_cached_int(conf, tree_keys[i], FALSE, 0);
+
+  /* Removing the dir a key is in, where the backend still can */
+  gconf_engine_set_int(conf, removed_key, 4, &err);
+  check(err == NULL, "failed to set `%s'", removed_key);
+  check_cached_int(conf, removed_key, TRUE, 4);
+  check_cached_int(conf, removed_key, TRUE, 4);
+
+  gconf_engine_remove_dir(conf, "/testing/cache/removed", &err);
+  if (err == NULL)
+    check_cached_int(conf, removed_key, FALSE, 0);
+  else
+    {
+      g_error_free(err);
+      err = NULL;
+    }
+
+  gconf_engine_recursive_unset(conf, "/testing/cache", 0, NULL);
+}
+
+/* Requests made so far, and callbacks run so far */
+static gint async_made = 0;
+static gint async_done = 0;
+
+typedef struct {
+  gint order;
+  gint expected;
+  gboolean expect_error;
+} AsyncCheck;
+
+static AsyncCheck*
+async_check_new(gint expected, gboolean expect_error)
+{
+  AsyncCheck* check_data = g_new(AsyncCheck, 1);
+
+  check_data->order = async_made++;
+  check_data->expected = expected;
+  check_data->expect_error = expect_error;
+
+  return check_data;
+}
+
+static void
+async_done_func(GConfEngine* conf, const GError* error, gpointer user_data)
+{
+  AsyncCheck* check_data = user_data;
+
+  check(check_data->order == async_done,
+        "request %d completed as number %d", check_data->order, async_done);
+  check((error != NULL) == check_data->expect_error,
+        "request %d: %s", check_data->order,
+        error ? error->message : "no error");
+
+  ++async_done;
+  g_free(check_data);
+}
+
+static void
+async_entry_func(GConfEngine* conf, GConfEntry* entry,
+                 const GError* error, gpointer user_data)
+{
+  AsyncCheck* check_data = user_data;
+  GConfValue* value;
+
+  check(check_data->order == async_done,
+        "request %d completed as number %d", check_data->order, async_done);
+  check(error == NULL && entry != NULL, "request %d: %s", check_data->order,
+        error ? error->message : "no entry");
+
+  value = gconf_entry_get_value(entry);
+  check(value != NULL && value->type == GCONF_VALUE_INT &&
+        gconf_value_get_int(value) == check_data->expected,
+        "wrong value for `%s'", gconf_entry_get_key(entry));
+
+  ++async_done;
+  g_free(check_data);
+}
+
+static void
+check_async(GConfEngine* conf)
+{
+  const gchar** keyp;
+  GConfValue* value;
+  gint i;
+
+  value = gconf_value_new(GCONF_VALUE_INT);
+
+  i = 0;
+  for (keyp = keys; *keyp; keyp++, i++)
+    {
+      gconf_value_set_int(value, i * 10);
+      gconf_engine_set_async(conf, *keyp, value, async_done_func,
+                             async_check_new(0, FALSE));
+    }
+
+  /* A bad request fails in its turn, not before the others */
+  gconf_engine_set_async(conf, "not a key", value, async_done_func,
+                         async_check_new(0, TRUE));
+
+  i = 0;
+  for (keyp = keys; *keyp; keyp++, i++)
+    gconf_engine_get_entry_async(conf, *keyp, NULL, TRUE, async_entry_func,
+                                 async_check_new(i * 10, FALSE));
+
+  gconf_value_free(value);
+
+  gconf_engine_complete_pending(conf);
+
+  check(async_done == async_made, "%d of %d requests completed",
+        async_done, async_made);
+}
+
+#ifdef HAVE_DBUS
+#define N_STATS_LOOKUPS 20
+
+static gboolean
+find_statistic(GSList* stats, const gchar* name, guint64* value)
+{
+  GSList* tmp;
+
+  for (tmp = stats; tmp != NULL; tmp = tmp->next)
+    {
+      GConfStatistic* stat = tmp->data;
+
+      if (strcmp(stat->name, name) == 0)
+        {
+          *value = stat->value;
+          return TRUE;
+        }
+    }
+
+  return FALSE;
+}
+
+/* gconfd counts every Lookup it answers, once in the call count and
+ * once in one of the latency buckets
+ */
+static void
+check_statistics(GConfEngine* conf)
+{
+  static const gchar* key = "/testing/stats/key";
+  static const gchar* buckets[] = {
+    "under-10us", "under-100us", "under-1ms", "under-10ms",
+    "under-100ms", "under-1s", "over-1s"
+  };
+  GError* err = NULL;
+  GSList* stats;
+  guint64 calls_before;
+  guint64 calls;
+  guint64 in_buckets;
+  guint64 total_time;
+  guint64 max_time;
+  guint64 value;
+  guint i;
+
+  gconf_engine_set_int(conf, key, 1, &err);
+  check(err == NULL, "failed to set `%s': %s", key, err ? err->message : "");
+
+  stats = gconf_engine_get_statistics(conf, &err);
+  check(err == NULL, "failed to get statistics: %s", err ? err->message : "");
+
+  /* Not there until the method has been called once */
+  calls_before = 0;
+  find_statistic(stats, "method-LookupExtended-calls", &calls_before);
+  gconf_statistics_free(stats);
+
+  for (i = 0; i < N_STATS_LOOKUPS; i++)
+    {
+      GConfValue* val;
+
+      val = gconf_engine_get(conf, key, &err);
+      check(err == NULL && val != NULL, "failed to look up `%s'", key);
+      gconf_value_free(val);
+    }
+
+  stats = gconf_engine_get_statistics(conf, &err);
+  check(err == NULL, "failed to get statistics: %s", err ? err->message : "");
+
+  check(find_statistic(stats, "method-LookupExtended-calls", &calls),
+        "no call count for LookupExtended");
+  check(calls >= calls_before + N_STATS_LOOKUPS,
+        "%" G_GUINT64_FORMAT " lookups were counted instead of %d",
+        calls - calls_before, N_STATS_LOOKUPS);
+
+  in_buckets = 0;
+  for (i = 0; i < G_N_ELEMENTS(buckets); i++)
+    {
+      gchar* name = g_strdup_printf("method-LookupExtended-%s", buckets[i]);
+
+      check(find_statistic(stats, name, &value), "no `%s' statistic", name);
+      in_buckets += value;
+      g_free(name);
+    }
+
+  check(in_buckets == calls,
+        "%" G_GUINT64_FORMAT " LookupExtended calls, but %" G_GUINT64_FORMAT
+        " in the latency buckets", calls, in_buckets);
+
+  check(find_statistic(stats, "method-LookupExtended-time", &total_time) &&
+        find_statistic(stats, "method-LookupExtended-max-time", &max_time) &&
+        max_time <= total_time,
+        "the longest LookupExtended took longer than all of them together");
+
+  check(find_statistic(stats, "listening-clients", &value) &&
+        find_statistic(stats, "listeners", &value),
+        "no listener counts in the statistics");
+
+  gconf_statistics_free(stats);
+
+  gconf_engine_unset(conf, key, NULL);
+}
+#endif
+
 int 
 main (int argc, char** argv)
 {
@@ -981,6 +1394,28 @@ main (int argc, char** argv)
   
   check_bool_storage(conf);
 
+  printf("\nChecking getting many keys at once:");
+
+  check_get_many(conf);
+
+  printf("\nChecking listing a whole subtree:");
+
+  check_all_entries_recursive(conf);
+
+  printf("\nChecking the server's value cache:");
+
+  check_value_cache(conf);
+
+#ifdef HAVE_DBUS
+  printf("\nChecking the server's statistics:");
+
+  check_statistics(conf);
+
+#endif
+  printf("\nChecking asynchronous requests:");
+
+  check_async(conf);
+
   gconf_engine_set_bool(conf, "/foo", TRUE, &err);
 
   gconf_engine_unref(conf);
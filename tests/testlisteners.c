@@ -17,7 +17,11 @@
  * Boston, MA 02110-1301, USA.
  */
 
+#include <config.h>
 #include <gconf/gconf-listeners.h>
+#include <gconf/gconf.h>
+#include <gconf/gconf-changeset.h>
+#include <gconf/gconf-internals.h>
 #include <stdio.h>
 #include <unistd.h>
 #include <math.h>
@@ -530,11 +534,386 @@ check_destroy(void)
         "number of listeners added (%u) doesn't match number destroyed (%u) on GConfListeners destruction", i, destroy_count);
 }
 
+/* Keys longer than the listener table's split buffer, and
+ * notifications made from inside a notification callback
+ */
+struct nested_data {
+  gchar* inner_key;
+  guint outer_count;
+  guint inner_count;
+};
+
+static void
+inner_notify_callback(GConfListeners* listeners,
+                      const gchar* all_above_key,
+                      guint cnxn_id,
+                      gpointer listener_data,
+                      gpointer user_data)
+{
+  struct nested_data* nd = user_data;
+
+  nd->inner_count += 1;
+}
+
+static void
+outer_notify_callback(GConfListeners* listeners,
+                      const gchar* all_above_key,
+                      guint cnxn_id,
+                      gpointer listener_data,
+                      gpointer user_data)
+{
+  struct nested_data* nd = user_data;
+
+  nd->outer_count += 1;
+
+  gconf_listeners_notify(listeners, nd->inner_key,
+                         inner_notify_callback, nd);
+}
+
+static void
+check_long_keys_and_nesting(GConfListeners* listeners)
+{
+  struct nested_data nd;
+  GString* long_key;
+  const gchar* location;
+  guint deep_id;
+  guint top_id;
+  guint i;
+
+  long_key = g_string_new("");
+  for (i = 0; i < 40; i++)
+    g_string_append_printf(long_key, "/component%u", i);
+
+  deep_id = gconf_listeners_add(listeners, long_key->str, NULL, g_free);
+  top_id = gconf_listeners_add(listeners, "/component0", NULL, g_free);
+
+  location = NULL;
+  check(gconf_listeners_get_data(listeners, deep_id, NULL, &location) &&
+        strcmp(location, long_key->str) == 0,
+        "location of a listener with a long key is wrong");
+
+  memset(&nd, 0, sizeof(nd));
+  nd.inner_key = long_key->str;
+
+  /* Both listeners are notified of the long key, and each of
+   * those notifications notifies both again
+   */
+  gconf_listeners_notify(listeners, long_key->str,
+                         outer_notify_callback, &nd);
+
+  check(nd.outer_count == 2,
+        "%u listeners notified of a long key instead of 2", nd.outer_count);
+  check(nd.inner_count == 4,
+        "%u nested notifications instead of 4", nd.inner_count);
+
+  gconf_listeners_remove(listeners, deep_id);
+  gconf_listeners_remove(listeners, top_id);
+
+  g_string_free(long_key, TRUE);
+}
+
+#ifdef HAVE_DBUS
+/*
+ * Against gconfd: what a client is sent when a change set is committed
+ */
+
+#define ENGINE_DIR "/testing/listeners"
+#define N_ENGINE_KEYS 10
+
+struct engine_listener {
+  const gchar* where;
+  guint cnxn;
+  GHashTable* seen;             /* key -> times notified */
+};
+
+static void
+engine_notify_callback(GConfEngine* conf,
+                       guint cnxn_id,
+                       GConfEntry* entry,
+                       gpointer user_data)
+{
+  struct engine_listener* l = user_data;
+  const gchar* key = gconf_entry_get_key(entry);
+  guint count;
+
+  check(cnxn_id == l->cnxn, "listener %u called for connection %u",
+        l->cnxn, cnxn_id);
+
+  count = GPOINTER_TO_UINT(g_hash_table_lookup(l->seen, key));
+  g_hash_table_replace(l->seen, g_strdup(key), GUINT_TO_POINTER(count + 1));
+}
+
+static guint64
+get_statistic(GConfEngine* conf, const gchar* name)
+{
+  GError* err = NULL;
+  GSList* stats;
+  GSList* tmp;
+  guint64 value = 0;
+
+  stats = gconf_engine_get_statistics(conf, &err);
+  check(err == NULL, "failed to get gconfd's statistics: %s",
+        err ? err->message : "");
+
+  for (tmp = stats; tmp != NULL; tmp = tmp->next)
+    {
+      GConfStatistic* stat = tmp->data;
+
+      if (strcmp(stat->name, name) == 0)
+        value = stat->value;
+    }
+
+  gconf_statistics_free(stats);
+
+  return value;
+}
+
+/* Runs the main loop for @seconds, or until each of @listeners has
+ * seen @n_keys keys if @n_keys isn't 0
+ */
+static void
+spin_main_loop(struct engine_listener* listeners, guint n_listeners,
+               guint n_keys, gdouble seconds)
+{
+  GTimer* timer;
+
+  timer = g_timer_new();
+
+  while (g_timer_elapsed(timer, NULL) < seconds)
+    {
+      guint i;
+
+      if (n_keys > 0)
+        {
+          for (i = 0; i < n_listeners; i++)
+            if (g_hash_table_size(listeners[i].seen) < n_keys)
+              break;
+
+          if (i == n_listeners)
+            break;
+        }
+
+      while (g_main_context_iteration(NULL, FALSE))
+        ;
+      g_usleep(10 * 1000);
+    }
+
+  g_timer_destroy(timer);
+}
+
+/* gconfd queues a client's notifications for a short while and sends
+ * them together, so a committed change set reaches the client as one
+ * NotifyMany message. The client listens on the same dir twice and on
+ * dirs above and below it, and still each listener hears of each
+ * change once. Assumes nothing else is listening below /testing while
+ * it runs.
+ */
+static void
+check_engine_notification(void)
+{
+  struct engine_listener listeners[] = {
+    { ENGINE_DIR, 0, NULL },
+    { ENGINE_DIR, 0, NULL },
+    { ENGINE_DIR "/sub", 0, NULL },
+    { "/testing", 0, NULL }
+  };
+  GConfEngine* conf;
+  GConfChangeSet* cs;
+  GError* err = NULL;
+  guint64 messages;
+  gchar* keys[N_ENGINE_KEYS];
+  guint i, k;
+
+  conf = gconf_engine_get_default();
+  check(conf != NULL, "failed to get the default engine");
+
+  gconf_engine_recursive_unset(conf, ENGINE_DIR, 0, NULL);
+
+  for (i = 0; i < G_N_ELEMENTS(listeners); i++)
+    {
+      listeners[i].seen = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                                g_free, NULL);
+      listeners[i].cnxn = gconf_engine_notify_add(conf, listeners[i].where,
+                                                  engine_notify_callback,
+                                                  &listeners[i], &err);
+      check(err == NULL, "failed to listen at `%s': %s", listeners[i].where,
+            err ? err->message : "");
+    }
+
+  /* Let anything still queued from the unset go out first */
+  spin_main_loop(listeners, G_N_ELEMENTS(listeners), 0, 0.5);
+  for (i = 0; i < G_N_ELEMENTS(listeners); i++)
+    g_hash_table_remove_all(listeners[i].seen);
+
+  messages = get_statistic(conf, "notify-messages");
+
+  cs = gconf_change_set_new();
+  for (k = 0; k < N_ENGINE_KEYS; k++)
+    {
+      keys[k] = g_strdup_printf(ENGINE_DIR "/sub/key%u", k);
+      gconf_change_set_set_int(cs, keys[k], k);
+    }
+
+  gconf_engine_commit_change_set(conf, cs, TRUE, &err);
+  check(err == NULL, "failed to commit: %s", err ? err->message : "");
+  gconf_change_set_unref(cs);
+
+  /* Then a little longer, for anything sent twice */
+  spin_main_loop(listeners, G_N_ELEMENTS(listeners), N_ENGINE_KEYS, 5.0);
+  spin_main_loop(listeners, G_N_ELEMENTS(listeners), 0, 0.2);
+
+  for (i = 0; i < G_N_ELEMENTS(listeners); i++)
+    {
+      for (k = 0; k < N_ENGINE_KEYS; k++)
+        {
+          guint count;
+
+          count = GPOINTER_TO_UINT(g_hash_table_lookup(listeners[i].seen,
+                                                       keys[k]));
+          check(count == 1, "listener at `%s' was told of `%s' %u times",
+                listeners[i].where, keys[k], count);
+        }
+
+      check(g_hash_table_size(listeners[i].seen) == N_ENGINE_KEYS,
+            "listener at `%s' was told of keys that didn't change",
+            listeners[i].where);
+    }
+
+  check(get_statistic(conf, "notify-messages") == messages + 1,
+        "a commit of %d keys took %" G_GUINT64_FORMAT " messages to deliver",
+        N_ENGINE_KEYS, get_statistic(conf, "notify-messages") - messages);
+
+  for (i = 0; i < G_N_ELEMENTS(listeners); i++)
+    {
+      gconf_engine_notify_remove(conf, listeners[i].cnxn);
+      g_hash_table_destroy(listeners[i].seen);
+    }
+
+  for (k = 0; k < N_ENGINE_KEYS; k++)
+    g_free(keys[k]);
+
+  gconf_engine_recursive_unset(conf, ENGINE_DIR, 0, NULL);
+  gconf_engine_unref(conf);
+}
+#endif
+
+/*
+ * Benchmark, run with --bench: notification and add/remove cost
+ * with a session's worth of listeners spread over many dirs
+ */
+
+#define N_BENCH_NOTIFIES 200000
+
+static void
+bench_notify_callback(GConfListeners* listeners,
+                      const gchar* all_above_key,
+                      guint cnxn_id,
+                      gpointer listener_data,
+                      gpointer user_data)
+{
+  guint* count = user_data;
+
+  *count += 1;
+}
+
+static void
+bench_listeners(void)
+{
+  static const guint sizes[] = { 1000, 10000, 100000 };
+  guint s;
+
+  printf("%10s %12s %14s %12s %14s\n",
+         "listeners", "add (ns)", "notify (ns)", "notified", "remove (ns)");
+
+  for (s = 0; s < G_N_ELEMENTS(sizes); s++)
+    {
+      GConfListeners* listeners;
+      GTimer* timer;
+      gchar** where;
+      gchar** changed;
+      guint* ids;
+      guint n_notified;
+      double add_time;
+      double notify_time;
+      double remove_time;
+      guint i;
+
+      /* Mostly apps watching their own dir, some watching
+       * single keys, as a desktop session does
+       */
+      where = g_new(gchar*, sizes[s]);
+      for (i = 0; i < sizes[s]; i++)
+        {
+          if (i % 4 == 0)
+            where[i] = g_strdup_printf("/apps/app%u", i % (sizes[s] / 10));
+          else
+            where[i] = g_strdup_printf("/apps/app%u/section%u/key%u",
+                                       i % (sizes[s] / 10), i % 7, i);
+        }
+
+      changed = g_new(gchar*, 1024);
+      for (i = 0; i < 1024; i++)
+        {
+          guint n = g_random_int_range(0, sizes[s]);
+
+          changed[i] = g_strdup_printf("/apps/app%u/section%u/key%u",
+                                       n % (sizes[s] / 10), n % 7, n);
+        }
+
+      ids = g_new(guint, sizes[s]);
+
+      listeners = gconf_listeners_new();
+
+      timer = g_timer_new();
+      for (i = 0; i < sizes[s]; i++)
+        ids[i] = gconf_listeners_add(listeners, where[i], NULL, g_free);
+      add_time = g_timer_elapsed(timer, NULL);
+
+      n_notified = 0;
+      g_timer_start(timer);
+      for (i = 0; i < N_BENCH_NOTIFIES; i++)
+        gconf_listeners_notify(listeners, changed[i % 1024],
+                               bench_notify_callback, &n_notified);
+      notify_time = g_timer_elapsed(timer, NULL);
+
+      g_timer_start(timer);
+      for (i = 0; i < sizes[s]; i++)
+        gconf_listeners_remove(listeners, ids[i]);
+      remove_time = g_timer_elapsed(timer, NULL);
+
+      g_assert(gconf_listeners_count(listeners) == 0);
+
+      printf("%10u %12.1f %14.1f %12.2f %14.1f\n",
+             sizes[s],
+             add_time * 1e9 / sizes[s],
+             notify_time * 1e9 / N_BENCH_NOTIFIES,
+             (double) n_notified / N_BENCH_NOTIFIES,
+             remove_time * 1e9 / sizes[s]);
+
+      gconf_listeners_free(listeners);
+      g_timer_destroy(timer);
+
+      for (i = 0; i < sizes[s]; i++)
+        g_free(where[i]);
+      g_free(where);
+      for (i = 0; i < 1024; i++)
+        g_free(changed[i]);
+      g_free(changed);
+      g_free(ids);
+    }
+}
+
 int 
 main (int argc, char** argv)
 {
   GConfListeners* listeners;
 
+  if (argc > 1 && strcmp(argv[1], "--bench") == 0)
+    {
+      bench_listeners();
+      return 0;
+    }
+
   listeners = gconf_listeners_new();
 
   check_add_remove(listeners);
@@ -551,11 +930,19 @@ main (int argc, char** argv)
   
   check_notification(listeners);
 
+  g_assert(gconf_listeners_count(listeners) == 0);
+
+  check_long_keys_and_nesting(listeners);
+
   g_assert(gconf_listeners_count(listeners) == 0);
   
   gconf_listeners_free(listeners);
 
   check_destroy();
+
+#ifdef HAVE_DBUS
+  check_engine_notification();
+#endif
   
   printf("\n");
   
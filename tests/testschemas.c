@@ -780,6 +780,102 @@ check_schema_use(GConfEngine * conf)
     }
 }
 
+static void
+set_int_schema(GConfEngine* conf, const gchar* schema_key,
+               const gchar* locale, gint default_value)
+{
+  GError* err = NULL;
+  GConfSchema* schema;
+  GConfValue* value;
+
+  schema = gconf_schema_new();
+  gconf_schema_set_type(schema, GCONF_VALUE_INT);
+  gconf_schema_set_locale(schema, locale);
+  gconf_schema_set_owner(schema, "testschemas");
+  value = gconf_value_new(GCONF_VALUE_INT);
+  gconf_value_set_int(value, default_value);
+  gconf_schema_set_default_value_nocopy(schema, value);
+
+  gconf_engine_set_schema(conf, schema_key, schema, &err);
+  check(err == NULL, "failed to set schema `%s' for locale %s: %s",
+        schema_key, locale, err ? err->message : "");
+
+  gconf_schema_free(schema);
+}
+
+/* @key reads back as @expected in @locale, or as unset if !@is_set */
+static void
+check_default(GConfEngine* conf, const gchar* key, const gchar* locale,
+              gboolean is_set, gint expected)
+{
+  GError* err = NULL;
+  GConfValue* value;
+
+  value = gconf_engine_get_with_locale(conf, key, locale, &err);
+  check(err == NULL, "error getting `%s': %s", key, err ? err->message : "");
+
+  if (is_set)
+    check(value != NULL && value->type == GCONF_VALUE_INT &&
+          gconf_value_get_int(value) == expected,
+          "`%s' in locale %s should default to %d", key, locale, expected);
+  else
+    check(value == NULL, "`%s' should have no default", key);
+
+  if (value)
+    gconf_value_free(value);
+}
+
+/* gconfd caches defaults it resolved from a schema; changing the
+ * schema has to drop them, and a different locale mustn't be given
+ * another locale's default. Each value is read twice, so that the
+ * second read comes from the cache.
+ */
+static void
+check_cached_defaults(GConfEngine* conf)
+{
+  static const gchar* key = "/testing/cache/uses-schema";
+  static const gchar* schema_key = "/schemas/testing/cache/schema";
+  GError* err = NULL;
+
+  gconf_engine_unset(conf, schema_key, NULL);
+  gconf_engine_unset(conf, key, NULL);
+
+  gconf_engine_associate_schema(conf, key, schema_key, &err);
+  check(err == NULL, "failed to associate `%s'", key);
+
+  /* Installing the schema */
+  check_default(conf, key, "C", FALSE, 0);
+  check_default(conf, key, "C", FALSE, 0);
+
+  set_int_schema(conf, schema_key, "C", 1);
+  check_default(conf, key, "C", TRUE, 1);
+  check_default(conf, key, "C", TRUE, 1);
+
+  /* Changing it */
+  set_int_schema(conf, schema_key, "C", 2);
+  check_default(conf, key, "C", TRUE, 2);
+  check_default(conf, key, "C", TRUE, 2);
+
+  /* A locale of its own, next to the cached C one */
+  set_int_schema(conf, schema_key, "es", 3);
+  check_default(conf, key, "es", TRUE, 3);
+  check_default(conf, key, "es", TRUE, 3);
+  check_default(conf, key, "C", TRUE, 2);
+  check_default(conf, key, "no", TRUE, 2);
+
+  set_int_schema(conf, schema_key, "es", 4);
+  check_default(conf, key, "es", TRUE, 4);
+  check_default(conf, key, "C", TRUE, 2);
+
+  /* Removing it */
+  gconf_engine_unset(conf, schema_key, &err);
+  check(err == NULL, "failed to unset `%s'", schema_key);
+  check_default(conf, key, "C", FALSE, 0);
+  check_default(conf, key, "es", FALSE, 0);
+
+  gconf_engine_associate_schema(conf, key, NULL, NULL);
+}
+
 int 
 main (int argc, char** argv)
 {
@@ -811,6 +907,10 @@ main (int argc, char** argv)
   printf("\nChecking schema use:");
 
   check_schema_use(conf);
+
+  printf("\nChecking cached schema defaults:");
+
+  check_cached_defaults(conf);
   
   gconf_engine_unref(conf);
 
@@ -0,0 +1,486 @@
+/* GConf
+ * Copyright (C) 2002 Red Hat Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/* Checks GConfValue's storage: strings kept inside the value, and
+ * list elements packed into one block shared between copies. No
+ * gconfd is needed. Criticals are fatal, so touching a packed
+ * element the wrong way fails the test too.
+ */
+
+#include <gconf/gconf-value.h>
+#include <gconf/gconf-schema.h>
+#include <gconf/gconf-internals.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <locale.h>
+
+/* Long enough for the heap, short enough to be inline, and empty */
+static const gchar* strings[] = {
+  "file:///home/user/Documents/report.odt",
+  "<Ctrl>F1",
+  "",
+  "a string that is certainly longer than two pointers",
+  "x",
+  NULL
+};
+
+static void
+check(gboolean condition, const gchar* fmt, ...)
+{
+  va_list args;
+  gchar* description;
+
+  va_start (args, fmt);
+  description = g_strdup_vprintf(fmt, args);
+  va_end (args);
+
+  if (condition)
+    {
+      printf(".");
+      fflush(stdout);
+    }
+  else
+    {
+      fprintf(stderr, "\n*** FAILED: %s\n", description);
+      exit(1);
+    }
+
+  g_free(description);
+}
+
+static GConfValue*
+make_string(const gchar* str)
+{
+  GConfValue* value;
+
+  value = gconf_value_new(GCONF_VALUE_STRING);
+  gconf_value_set_string(value, str);
+
+  return value;
+}
+
+/* A list built value by value, so it isn't packed until copied */
+static GConfValue*
+make_string_list(void)
+{
+  GConfValue* value;
+  GSList* list = NULL;
+  gint i;
+
+  for (i = 0; strings[i] != NULL; i++)
+    list = g_slist_append(list, make_string(strings[i]));
+
+  value = gconf_value_new(GCONF_VALUE_LIST);
+  gconf_value_set_list_type(value, GCONF_VALUE_STRING);
+  gconf_value_set_list_nocopy(value, list);
+
+  return value;
+}
+
+static void
+check_string_list(GConfValue* value, const gchar* what)
+{
+  GSList* tmp;
+  gint i;
+
+  check(value->type == GCONF_VALUE_LIST &&
+        gconf_value_get_list_type(value) == GCONF_VALUE_STRING,
+        "%s isn't a list of strings", what);
+
+  tmp = gconf_value_get_list(value);
+  for (i = 0; strings[i] != NULL; i++, tmp = tmp->next)
+    {
+      check(tmp != NULL, "%s is missing element %d", what, i);
+      check(((GConfValue*) tmp->data)->type == GCONF_VALUE_STRING &&
+            strcmp(gconf_value_get_string(tmp->data), strings[i]) == 0,
+            "element %d of %s isn't `%s'", i, what, strings[i]);
+    }
+
+  check(tmp == NULL, "%s has extra elements", what);
+}
+
+/* Setting a string moves it in and out of the value as its length
+ * changes, and copies keep their own text
+ */
+static void
+check_string_storage(void)
+{
+  GConfValue* value;
+  GConfValue* copy;
+  gint i, j;
+
+  for (i = 0; strings[i] != NULL; i++)
+    for (j = 0; strings[j] != NULL; j++)
+      {
+        value = make_string(strings[i]);
+        copy = gconf_value_copy(value);
+
+        gconf_value_set_string(value, strings[j]);
+        check(strcmp(gconf_value_get_string(value), strings[j]) == 0,
+              "`%s' set to `%s' reads back as `%s'", strings[i], strings[j],
+              gconf_value_get_string(value));
+        check(strcmp(gconf_value_get_string(copy), strings[i]) == 0,
+              "a copy of `%s' changed with the original", strings[i]);
+        check(gconf_value_compare(value, copy) == strcmp(strings[j], strings[i]),
+              "`%s' and `%s' compare the wrong way", strings[j], strings[i]);
+
+        gconf_value_set_string_nocopy(copy, g_strdup(strings[j]));
+        check(gconf_value_compare(value, copy) == 0,
+              "`%s' set with and without a copy differ", strings[j]);
+
+        gconf_value_free(value);
+        gconf_value_free(copy);
+      }
+
+  /* And back to no string at all */
+  value = make_string(strings[1]);
+  gconf_value_set_string(value, NULL);
+  check(gconf_value_get_string(value) == NULL, "a string set to NULL isn't");
+  gconf_value_set_string(value, strings[0]);
+  gconf_value_set_string(value, NULL);
+  check(gconf_value_get_string(value) == NULL, "a string set to NULL isn't");
+  gconf_value_free(value);
+}
+
+static void
+check_steal_string(void)
+{
+  GConfValue* value;
+  GConfValue* list;
+  GConfValue* copy;
+  GSList* tmp;
+  gchar* str;
+  gint i;
+
+  for (i = 0; strings[i] != NULL; i++)
+    {
+      value = make_string(strings[i]);
+      str = gconf_value_steal_string(value);
+
+      check(str != NULL && strcmp(str, strings[i]) == 0,
+            "stole `%s' instead of `%s'", str ? str : "(null)", strings[i]);
+      check(gconf_value_get_string(value) == NULL,
+            "`%s' is still there after being stolen", strings[i]);
+
+      g_free(str);
+      gconf_value_free(value);
+    }
+
+  /* Elements of a packed list belong to the list, so they give copies */
+  list = make_string_list();
+  copy = gconf_value_copy(list);
+
+  for (tmp = gconf_value_get_list(copy), i = 0; tmp != NULL; tmp = tmp->next, i++)
+    {
+      str = gconf_value_steal_string(tmp->data);
+      check(strcmp(str, strings[i]) == 0, "stole `%s' from a packed list", str);
+      g_free(str);
+    }
+
+  check_string_list(copy, "a packed list with its strings stolen");
+
+  gconf_value_free(copy);
+  gconf_value_free(list);
+}
+
+static void
+check_list_copies(void)
+{
+  GConfValue* list;
+  GConfValue* copy;
+  GConfValue* copy2;
+  GConfValue* other;
+  GSList* elems;
+  gchar* str;
+
+  list = make_string_list();
+  check_string_list(list, "a list built by hand");
+
+  /* The first copy packs, copies of that share its block */
+  copy = gconf_value_copy(list);
+  check_string_list(copy, "a copied list");
+  check(gconf_value_compare(list, copy) == 0, "a copied list isn't equal to its original");
+
+  copy2 = gconf_value_copy(copy);
+  check(gconf_value_get_list(copy2) == gconf_value_get_list(copy),
+        "copies of a packed list don't share it");
+  check(gconf_value_compare(copy2, copy) == 0, "copies of a packed list differ");
+
+  /* The original can go first */
+  gconf_value_free(list);
+  check_string_list(copy, "a copy whose original was freed");
+  gconf_value_free(copy);
+  check_string_list(copy2, "a copy whose sources were freed");
+
+  /* Lists differing in one element, or in length */
+  list = make_string_list();
+  other = make_string_list();
+  elems = gconf_value_get_list(other);
+  gconf_value_set_string(elems->next->data, "<Ctrl>F2");
+  copy = gconf_value_copy(other);
+  check(gconf_value_compare(copy2, copy) < 0, "a changed element still compares equal");
+
+  gconf_value_free(copy);
+  gconf_value_set_list(other, g_slist_next(gconf_value_get_list(list)));
+  check(gconf_value_compare(copy2, other) != 0, "a shorter list compares equal");
+
+  /* set_list packs straight away, and copies what it was given */
+  gconf_value_set_list(other, gconf_value_get_list(list));
+  gconf_value_free(list);
+  check_string_list(other, "a list set from another");
+  check(gconf_value_compare(copy2, other) == 0, "a list set from another differs from it");
+
+  str = gconf_value_to_string(copy2);
+  check(strstr(str, strings[0]) != NULL && strstr(str, strings[1]) != NULL,
+        "a packed list prints as `%s'", str);
+  g_free(str);
+
+  gconf_value_free(other);
+  gconf_value_free(copy2);
+}
+
+/* steal_list always hands back values the caller may change and free */
+static void
+check_steal_list(void)
+{
+  GConfValue* list;
+  GConfValue* copy;
+  GConfValue* shared;
+  GSList* stolen;
+  GSList* tmp;
+  gint i;
+
+  /* A list owned value by value gives up its own */
+  list = make_string_list();
+  tmp = gconf_value_get_list(list);
+  stolen = gconf_value_steal_list(list);
+  check(stolen == tmp, "an unpacked list was copied to be stolen");
+  check(gconf_value_get_list(list) == NULL, "a stolen list is still there");
+  gconf_value_free(list);
+
+  /* A packed one gives copies, and lets go of the block */
+  list = gconf_value_new(GCONF_VALUE_LIST);
+  gconf_value_set_list_type(list, GCONF_VALUE_STRING);
+  gconf_value_set_list(list, stolen);
+  copy = gconf_value_copy(list);
+
+  g_slist_foreach(stolen, (GFunc) gconf_value_free, NULL);
+  g_slist_free(stolen);
+
+  stolen = gconf_value_steal_list(list);
+  check(gconf_value_get_list(list) == NULL, "a stolen packed list is still there");
+  check_string_list(copy, "the copy of a stolen packed list");
+
+  for (tmp = stolen, i = 0; tmp != NULL; tmp = tmp->next, i++)
+    {
+      gconf_value_set_string(tmp->data, "changed");
+      gconf_value_free(tmp->data);
+    }
+  g_slist_free(stolen);
+  check(i == (gint) G_N_ELEMENTS(strings) - 1, "stole %d elements", i);
+  check_string_list(copy, "the copy of a changed stolen list");
+
+  /* A shared one stays as it is */
+  shared = gconf_value_ref(copy);
+  stolen = gconf_value_steal_list(shared);
+  check_string_list(copy, "a shared list after a steal");
+  g_slist_foreach(stolen, (GFunc) gconf_value_free, NULL);
+  g_slist_free(stolen);
+  gconf_value_unref(shared);
+
+  check(!gconf_value_owns_list(copy), "a packed list owns its elements");
+  gconf_value_free(list);
+  gconf_value_free(copy);
+
+  list = make_string_list();
+  check(gconf_value_owns_list(list), "an unpacked list doesn't own its elements");
+  gconf_value_free(list);
+}
+
+/* Primitive lists for gconf_client_get_list() and friends, from every
+ * kind of list
+ */
+static void
+check_primitive_lists(void)
+{
+  GConfValue* lists[3];
+  gint l;
+
+  lists[0] = make_string_list();
+  lists[1] = gconf_value_copy(lists[0]);
+  lists[2] = gconf_value_ref(lists[1]);
+
+  for (l = 0; l < (gint) G_N_ELEMENTS(lists); l++)
+    {
+      GError* err = NULL;
+      GSList* primitives;
+      GSList* tmp;
+      gint i;
+
+      primitives = gconf_value_list_to_primitive_list_destructive(lists[l],
+                                                                  GCONF_VALUE_STRING,
+                                                                  &err);
+      check(err == NULL, "converting list %d failed", l);
+
+      for (tmp = primitives, i = 0; strings[i] != NULL; tmp = tmp->next, i++)
+        check(tmp != NULL && strcmp(tmp->data, strings[i]) == 0,
+              "element %d of list %d isn't `%s'", i, l, strings[i]);
+      check(tmp == NULL, "list %d has extra elements", l);
+
+      /* The reference dropped above leaves the copy intact */
+      if (l == 1)
+        check_string_list(lists[2], "a list referenced while converted");
+
+      g_slist_foreach(primitives, (GFunc) g_free, NULL);
+      g_slist_free(primitives);
+    }
+}
+
+static GConfSchema*
+make_schema(const gchar* owner, gint default_value)
+{
+  GConfSchema* schema;
+  GConfValue* value;
+
+  schema = gconf_schema_new();
+  gconf_schema_set_type(schema, GCONF_VALUE_INT);
+  gconf_schema_set_locale(schema, "C");
+  gconf_schema_set_owner(schema, owner);
+  gconf_schema_set_short_desc(schema, owner);
+
+  value = gconf_value_new(GCONF_VALUE_INT);
+  gconf_value_set_int(value, default_value);
+  gconf_schema_set_default_value_nocopy(schema, value);
+
+  return schema;
+}
+
+static void
+check_schema_list(GConfValue* value, gint n, const gchar* what)
+{
+  GSList* tmp;
+  gint i;
+
+  check(gconf_value_get_list_type(value) == GCONF_VALUE_SCHEMA,
+        "%s isn't a list of schemas", what);
+
+  for (tmp = gconf_value_get_list(value), i = 0; tmp != NULL; tmp = tmp->next, i++)
+    {
+      GConfSchema* schema = gconf_value_get_schema(tmp->data);
+      gchar* owner = g_strdup_printf("owner%d", i);
+
+      check(schema != NULL &&
+            strcmp(gconf_schema_get_owner(schema), owner) == 0 &&
+            gconf_value_get_int(gconf_schema_get_default_value(schema)) == i,
+            "schema %d in %s is wrong", i, what);
+      g_free(owner);
+    }
+
+  check(i == n, "%s has %d schemas, not %d", what, i, n);
+}
+
+static void
+check_schema_lists(void)
+{
+  GConfValue* list;
+  GConfValue* copy;
+  GConfValue* packed;
+  GConfSchema* schema;
+  GSList* elems = NULL;
+  GSList* stolen;
+  gint i;
+
+  for (i = 0; i < 3; i++)
+    {
+      GConfValue* elem;
+      gchar* owner = g_strdup_printf("owner%d", i);
+
+      elem = gconf_value_new(GCONF_VALUE_SCHEMA);
+      gconf_value_set_schema_nocopy(elem, make_schema(owner, i));
+      elems = g_slist_append(elems, elem);
+      g_free(owner);
+    }
+
+  list = gconf_value_new(GCONF_VALUE_LIST);
+  gconf_value_set_list_type(list, GCONF_VALUE_SCHEMA);
+  gconf_value_set_list_nocopy(list, elems);
+  check_schema_list(list, 3, "a list of schemas");
+
+  copy = gconf_value_copy(list);
+  gconf_value_free(list);
+  check_schema_list(copy, 3, "a copied list of schemas");
+
+  packed = gconf_value_copy(copy);
+  check(gconf_value_compare(copy, packed) == 0, "copied lists of schemas differ");
+
+  /* A packed element's schema stays with the list */
+  schema = gconf_value_steal_schema(gconf_value_get_list(packed)->data);
+  check(schema != NULL && strcmp(gconf_schema_get_owner(schema), "owner0") == 0,
+        "stole the wrong schema from a packed list");
+  gconf_schema_free(schema);
+  check_schema_list(packed, 3, "a packed list after a steal");
+
+  stolen = gconf_value_steal_list(packed);
+  gconf_value_free(packed);
+  check_schema_list(copy, 3, "a list of schemas after another copy was stolen");
+
+  gconf_schema_set_owner(gconf_value_get_schema(stolen->data), "changed");
+  check_schema_list(copy, 3, "a list of schemas after a stolen copy changed");
+
+  g_slist_foreach(stolen, (GFunc) gconf_value_free, NULL);
+  g_slist_free(stolen);
+  gconf_value_free(copy);
+}
+
+int
+main (int argc, char** argv)
+{
+  setlocale (LC_ALL, "");
+
+  g_log_set_always_fatal (G_LOG_LEVEL_CRITICAL | G_LOG_LEVEL_WARNING);
+
+  printf("\nChecking strings kept in the value:");
+
+  check_string_storage();
+
+  printf("\nChecking stealing strings:");
+
+  check_steal_string();
+
+  printf("\nChecking copying packed lists:");
+
+  check_list_copies();
+
+  printf("\nChecking stealing packed lists:");
+
+  check_steal_list();
+
+  printf("\nChecking primitive lists:");
+
+  check_primitive_lists();
+
+  printf("\nChecking lists of schemas:");
+
+  check_schema_lists();
+
+  printf("\n\n");
+
+  return 0;
+}